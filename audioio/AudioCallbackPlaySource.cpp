@@ -16,11 +16,14 @@
 #include "AudioCallbackPlaySource.h"
 
 #include "AudioGenerator.h"
+#include "MixKernels.h"
 
 #include "data/model/Model.h"
 #include "base/ViewManagerBase.h"
 #include "base/PlayParameterRepository.h"
 #include "base/Preferences.h"
+#include "base/Resampler.h"
+#include "base/ThreadPool.h"
 #include "data/model/DenseTimeValueModel.h"
 #include "data/model/WaveFileModel.h"
 #include "data/model/SparseOneDimensionalModel.h"
@@ -33,11 +36,29 @@ using namespace RubberBand;
 
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
 //#define DEBUG_AUDIO_PLAY_SOURCE 1
 //#define DEBUG_AUDIO_PLAY_SOURCE_PLAYING 1
 
 static const size_t DEFAULT_RING_BUFFER_SIZE = 131071;
+static const size_t COMMAND_QUEUE_SIZE = 1023;
+
+// Models are mixed in pieces of at most this many frames, which must
+// be a multiple of the generator block size, into per-model buffers
+// with a margin either side for the overlap of fades
+static const size_t MIX_BLOCK_SIZE = 16384;
+static const size_t MIX_MARGIN = 64;
+static const size_t MIX_STRIDE = MIX_BLOCK_SIZE + 2 * MIX_MARGIN;
+
+class AudioCallbackPlaySource::MixJob : public ThreadPool::Job
+{
+public:
+    MixJob(AudioCallbackPlaySource *source) : m_source(source) { }
+    virtual void perform(int n) { m_source->mixModelPiece(n); }
+private:
+    AudioCallbackPlaySource *m_source;
+};
 
 AudioCallbackPlaySource::AudioCallbackPlaySource(ViewManagerBase *manager,
                                                  QString clientName) :
@@ -69,6 +90,21 @@ AudioCallbackPlaySource::AudioCallbackPlaySource(ViewManagerBase *manager,
     m_auditioningPluginBypassed(false),
     m_playStartFrame(0),
     m_playStartFramePassed(false),
+    m_deliveredSincePlay(false),
+    m_overloadCount(0),
+    m_underrunCount(0),
+    m_reportedOverloadCount(0),
+    m_commands(COMMAND_QUEUE_SIZE),
+    m_mixBuffer(0),
+    m_mixBufferPtrs(0),
+    m_mixChunkPtrs(0),
+    m_mixChannels(0),
+    m_mixFrames(0),
+    m_mixJob(new MixJob(this)),
+    m_mixPool(0),
+    m_modelMixBuffer(0),
+    m_modelMixModels(0),
+    m_modelMixChannels(0),
     m_timeStretcher(0),
     m_monoStretcher(0),
     m_stretchRatio(1.0),
@@ -82,6 +118,8 @@ AudioCallbackPlaySource::AudioCallbackPlaySource(ViewManagerBase *manager,
 {
     m_viewManager->setAudioPlaySource(this);
 
+    m_audioGenerator->setMaxFrameCount(MIX_BLOCK_SIZE);
+
     connect(m_viewManager, SIGNAL(selectionChanged()),
 	    this, SLOT(selectionChanged()));
     connect(m_viewManager, SIGNAL(playLoopModeChanged()),
@@ -111,6 +149,8 @@ AudioCallbackPlaySource::~AudioCallbackPlaySource()
 	delete m_fillThread;
     }
 
+    delete m_mixJob;
+
     clearModels();
     
     if (m_readBuffers != m_writeBuffers) {
@@ -121,6 +161,11 @@ AudioCallbackPlaySource::~AudioCallbackPlaySource()
 
     delete m_audioGenerator;
 
+    delete[] m_mixBuffer;
+    delete[] m_mixBufferPtrs;
+    delete[] m_mixChunkPtrs;
+    delete[] m_modelMixBuffer;
+
     for (size_t i = 0; i < m_stretcherInputCount; ++i) {
         delete[] m_stretcherInputs[i];
     }
@@ -144,12 +189,14 @@ AudioCallbackPlaySource::addModel(Model *model)
 
     bool canPlay = m_audioGenerator->addModel(model);
 
+    // The fill thread reads the model set and end frame, so these
+    // are changed only under the mutex
     m_mutex.lock();
-
     m_models.insert(model);
     if (model->getEndFrame() > m_lastModelEndFrame) {
 	m_lastModelEndFrame = model->getEndFrame();
     }
+    m_mutex.unlock();
 
     bool buffersChanged = false, srChanged = false;
 
@@ -214,29 +261,34 @@ AudioCallbackPlaySource::addModel(Model *model)
         }
     }
 
-    if (!m_writeBuffers || (m_writeBuffers->size() < getTargetChannelCount())) {
-	clearRingBuffers(true, getTargetChannelCount());
+    // The fill thread picks these up on its next pass, without our
+    // having to wait for it here
+
+    postCommand(Command::AddModel, model);
+
+    // The fill thread changes m_mixChannels when it recreates the
+    // ring buffers, so only read it under the mutex
+    m_mutex.lock();
+    size_t mixChannels = m_mixChannels;
+    m_mutex.unlock();
+
+    if (getTargetChannelCount() > mixChannels) {
+	clearRingBuffers(getTargetChannelCount());
 	buffersChanged = true;
     } else {
-	if (canPlay) clearRingBuffers(true);
+	if (canPlay) clearRingBuffers();
     }
 
     if (buffersChanged || srChanged) {
-	if (m_converter) {
-	    src_delete(m_converter);
-            src_delete(m_crapConverter);
-	    m_converter = 0;
-            m_crapConverter = 0;
-	}
+        postCommand(Command::ResetConverters);
     }
 
+    m_mutex.lock();
     rebuildRangeLists();
-
     m_mutex.unlock();
 
-    m_audioGenerator->setTargetChannelCount(getTargetChannelCount());
-
     if (!m_fillThread) {
+        m_mixPool = ThreadPool::getInstance();
 	m_fillThread = new FillThread(*this);
 	m_fillThread->start();
     }
@@ -261,17 +313,25 @@ AudioCallbackPlaySource::modelChanged(size_t startFrame, size_t endFrame)
 #ifdef DEBUG_AUDIO_PLAY_SOURCE
     std::cerr << "AudioCallbackPlaySource::modelChanged(" << startFrame << "," << endFrame << ")" << std::endl;
 #endif
+    m_mutex.lock();
     if (endFrame > m_lastModelEndFrame) {
         m_lastModelEndFrame = endFrame;
         rebuildRangeLists();
     }
+    m_mutex.unlock();
 }
 
 void
 AudioCallbackPlaySource::removeModel(Model *model)
 {
+    // Unlike adding a model, this has to wait for the fill thread:
+    // the model may be deleted as soon as we return, so it must not
+    // be mid-mix when we do
+
     m_mutex.lock();
 
+    processCommands();
+
 #ifdef DEBUG_AUDIO_PLAY_SOURCE
     std::cout << "AudioCallbackPlaySource::removeModel(" << model << ")" << std::endl;
 #endif
@@ -281,6 +341,14 @@ AudioCallbackPlaySource::removeModel(Model *model)
 
     m_models.erase(model);
 
+    for (std::vector<Model *>::iterator i = m_mixModels.begin();
+         i != m_mixModels.end(); ++i) {
+        if (*i == model) {
+            m_mixModels.erase(i);
+            break;
+        }
+    }
+
     if (m_models.empty()) {
 	if (m_converter) {
 	    src_delete(m_converter);
@@ -320,7 +388,10 @@ AudioCallbackPlaySource::clearModels()
     std::cout << "AudioCallbackPlaySource::clearModels()" << std::endl;
 #endif
 
+    processCommands();
+
     m_models.clear();
+    m_mixModels.clear();
 
     if (m_converter) {
 	src_delete(m_converter);
@@ -341,17 +412,23 @@ AudioCallbackPlaySource::clearModels()
 }    
 
 void
-AudioCallbackPlaySource::clearRingBuffers(bool haveLock, size_t count)
+AudioCallbackPlaySource::clearRingBuffers(size_t count)
 {
-    if (!haveLock) m_mutex.lock();
-
+    m_mutex.lock();
     rebuildRangeLists();
+    m_mutex.unlock();
 
+    postCommand(Command::ClearBuffers, 0, count);
+}
+
+void
+AudioCallbackPlaySource::recreateRingBuffers(size_t count, size_t fill)
+{
     if (count == 0) {
 	if (m_writeBuffers) count = m_writeBuffers->size();
     }
 
-    m_writeBufferFill = getCurrentBufferedFrame();
+    m_writeBufferFill = fill;
 
     if (m_readBuffers != m_writeBuffers) {
 	delete m_writeBuffers;
@@ -363,11 +440,116 @@ AudioCallbackPlaySource::clearRingBuffers(bool haveLock, size_t count)
 	m_writeBuffers->push_back(new RingBuffer<float>(m_ringBufferSize));
     }
 
-//    std::cout << "AudioCallbackPlaySource::clearRingBuffers: Created "
+    allocateMixBuffers(count, m_ringBufferSize);
+
+//    std::cout << "AudioCallbackPlaySource::recreateRingBuffers: Created "
 //	      << count << " write buffers" << std::endl;
+}
+
+void
+AudioCallbackPlaySource::allocateMixBuffers(size_t channels, size_t frames)
+{
+    if (channels <= m_mixChannels && frames <= m_mixFrames) return;
+
+    if (channels < m_mixChannels) channels = m_mixChannels;
+    if (frames < m_mixFrames) frames = m_mixFrames;
+
+    delete[] m_mixBuffer;
+    delete[] m_mixBufferPtrs;
+    delete[] m_mixChunkPtrs;
 
-    if (!haveLock) {
-	m_mutex.unlock();
+    m_mixBuffer = new float[channels * frames * 2];
+    m_mixBufferPtrs = new float *[channels];
+    m_mixChunkPtrs = new float *[channels];
+
+    m_mixChannels = channels;
+    m_mixFrames = frames;
+
+    allocateModelMixBuffers();
+}
+
+void
+AudioCallbackPlaySource::allocateModelMixBuffers()
+{
+    if (!m_mixPool || m_mixPool->getThreadCount() < 2) return;
+
+    size_t models = m_mixModels.size();
+    size_t channels = m_mixChannels;
+
+    if (models <= m_modelMixModels && channels <= m_modelMixChannels) return;
+
+    if (models < m_modelMixModels) models = m_modelMixModels;
+    if (channels < m_modelMixChannels) channels = m_modelMixChannels;
+
+    delete[] m_modelMixBuffer;
+    m_modelMixBuffer = new float[models * channels * MIX_STRIDE];
+
+    m_modelMixModels = models;
+    m_modelMixChannels = channels;
+}
+
+void
+AudioCallbackPlaySource::postCommand(Command::Type type, Model *model,
+                                     size_t count)
+{
+    Command command;
+    command.type = type;
+    command.model = model;
+    command.count = count;
+
+    while (true) {
+
+        m_commandMutex.lock();
+        bool written = (m_commands.write(&command, 1) == 1);
+        m_commandMutex.unlock();
+
+        if (written) break;
+
+        // Queue full: the fill thread must be stuck, so deal with
+        // the backlog ourselves.  The command mutex is released
+        // first, as it must never be held while taking m_mutex
+        std::cerr << "WARNING: AudioCallbackPlaySource::postCommand: "
+                  << "Command queue full, waiting for fill thread" << std::endl;
+        m_mutex.lock();
+        processCommands();
+        m_mutex.unlock();
+    }
+
+    m_condition.wakeAll();
+}
+
+void
+AudioCallbackPlaySource::processCommands()
+{
+    Command command;
+
+    while (m_commands.read(&command, 1) == 1) {
+
+        switch (command.type) {
+
+        case Command::AddModel:
+            if (std::find(m_mixModels.begin(), m_mixModels.end(),
+                          command.model) == m_mixModels.end()) {
+                m_mixModels.push_back(command.model);
+                allocateModelMixBuffers();
+            }
+            break;
+
+        case Command::ClearBuffers:
+            // Take the frame now rather than when the command was
+            // posted, as playback may have moved on since then
+            recreateRingBuffers(command.count, getCurrentBufferedFrame());
+            break;
+
+        case Command::ResetConverters:
+            if (m_converter) {
+                src_delete(m_converter);
+                src_delete(m_crapConverter);
+                m_converter = 0;
+                m_crapConverter = 0;
+            }
+            break;
+        }
     }
 }
 
@@ -440,6 +622,7 @@ AudioCallbackPlaySource::play(size_t startFrame)
     bool changed = !m_playing;
     m_lastRetrievalTimestamp = 0;
     m_lastCurrentFrame = 0;
+    m_deliveredSincePlay = false;
     m_playing = true;
     m_condition.wakeAll();
     if (changed) {
@@ -505,6 +688,22 @@ AudioCallbackPlaySource::preferenceChanged(PropertyContainer::PropertyName n)
 void
 AudioCallbackPlaySource::audioProcessingOverload()
 {
+    m_overloadCount.ref();
+}
+
+int
+AudioCallbackPlaySource::getXrunCount() const
+{
+    return int(m_overloadCount) + int(m_underrunCount);
+}
+
+void
+AudioCallbackPlaySource::checkOverloads()
+{
+    int overloads = m_overloadCount;
+    if (overloads == m_reportedOverloadCount) return;
+    m_reportedOverloadCount = overloads;
+
     std::cerr << "Audio processing overload!" << std::endl;
 
     if (!m_playing) return;
@@ -540,7 +739,10 @@ AudioCallbackPlaySource::setTarget(AudioCallbackPlayTarget *target, size_t size)
                   << m_ringBufferSize << ", calling for more ring buffer"
                   << std::endl;
         m_ringBufferSize = size * 4;
-        if (m_writeBuffers && !m_writeBuffers->empty()) {
+        m_mutex.lock();
+        size_t mixChannels = m_mixChannels;
+        m_mutex.unlock();
+        if (mixChannels > 0) {
             clearRingBuffers();
         }
     }
@@ -685,11 +887,9 @@ AudioCallbackPlaySource::getCurrentFrame(RealTime latency_t)
 
     // Normally the range lists should contain at least one item each
     // -- if playback is unconstrained, that item should report the
-    // entire source audio duration.
-
-    if (m_rangeStarts.empty()) {
-        rebuildRangeLists();
-    }
+    // entire source audio duration.  They are rebuilt under the mutex
+    // whenever the models or selections change, and this may be
+    // called without it, so they are not rebuilt here.
 
     if (m_rangeStarts.empty()) {
         // this code is only used in case of error in rebuildRangeLists
@@ -885,6 +1085,10 @@ AudioCallbackPlaySource::initialiseConverter()
 {
     m_mutex.lock();
 
+    // Any converter reset still waiting in the queue must happen
+    // before, not after, we make the new ones
+    processCommands();
+
     if (m_converter) {
         src_delete(m_converter);
         src_delete(m_crapConverter);
@@ -896,10 +1100,12 @@ AudioCallbackPlaySource::initialiseConverter()
 
 	int err = 0;
 
-	m_converter = src_new(m_resampleQuality == 2 ? SRC_SINC_BEST_QUALITY :
-                              m_resampleQuality == 1 ? SRC_SINC_MEDIUM_QUALITY :
-                              m_resampleQuality == 0 ? SRC_SINC_FASTEST :
-                                                       SRC_SINC_MEDIUM_QUALITY,
+        Resampler::Quality quality =
+            Resampler::getQualityForPreference(m_resampleQuality);
+
+	m_converter = src_new(quality == Resampler::Best ? SRC_SINC_BEST_QUALITY :
+                              quality == Resampler::Fastest ? SRC_SINC_FASTEST :
+                                                              SRC_SINC_MEDIUM_QUALITY,
 			      getTargetChannelCount(), &err);
 
         if (m_converter) {
@@ -1086,6 +1292,16 @@ AudioCallbackPlaySource::getSourceSamples(size_t ucount, float **buffer)
         }
     }
 
+    // Running short once we have started delivering is a dropout;
+    // running short before that just means the fill thread has not
+    // caught up with a new play position yet
+
+    if (count < int(ucount)) {
+        if (m_deliveredSincePlay) m_underrunCount.ref();
+    } else {
+        m_deliveredSincePlay = true;
+    }
+
     if (count == 0) return 0;
 
     RubberBandStretcher *ts = m_timeStretcher;
@@ -1168,6 +1384,11 @@ AudioCallbackPlaySource::getSourceSamples(size_t ucount, float **buffer)
         size_t reqd = lrintf((count - available) / ratio);
         reqd = std::max(reqd, ts->getSamplesRequired());
         if (reqd == 0) reqd = 1;
+
+        // We can't reallocate the stretcher inputs here in the audio
+        // thread, so feed the stretcher in several smaller blocks if
+        // need be -- we just go round this loop again
+        if (reqd > m_stretcherInputSizes[0]) reqd = m_stretcherInputSizes[0];
                 
         size_t got = reqd;
 
@@ -1175,18 +1396,6 @@ AudioCallbackPlaySource::getSourceSamples(size_t ucount, float **buffer)
         std::cerr << "reqd = " <<reqd << ", channels = " << channels << ", ic = " << m_stretcherInputCount << std::endl;
 #endif
 
-        for (size_t c = 0; c < channels; ++c) {
-            if (c >= m_stretcherInputCount) continue;
-            if (reqd > m_stretcherInputSizes[c]) {
-                if (c == 0) {
-                    std::cerr << "WARNING: resizing stretcher input buffer from " << m_stretcherInputSizes[c] << " to " << (reqd * 2) << std::endl;
-                }
-                delete[] m_stretcherInputs[c];
-                m_stretcherInputSizes[c] = reqd * 2;
-                m_stretcherInputs[c] = new float[m_stretcherInputSizes[c]];
-            }
-        }
-
         for (size_t c = 0; c < channels; ++c) {
             if (c >= m_stretcherInputCount) continue;
             RingBuffer<float> *rb = getReadRingBuffer(c);
@@ -1291,11 +1500,22 @@ AudioCallbackPlaySource::applyAuditioningEffect(size_t count, float **buffers)
 bool
 AudioCallbackPlaySource::fillBuffers()
 {
-    static float *tmp = 0;
-    static size_t tmpSize = 0;
+    // The GUI thread may change the source channel count and sample
+    // rate while we are filling (the buffers for the new values
+    // follow through the command queue), so take them just once here
+
+    size_t channels = getTargetChannelCount();
+    if (channels > m_mixChannels) channels = m_mixChannels;
+    if (channels == 0) return false;
+
+    size_t sourceRate = getSourceSampleRate();
+    size_t targetRate = getTargetSampleRate();
+    if (sourceRate == 0 || targetRate == 0) return false;
+
+    m_audioGenerator->setTargetChannelCount(channels);
 
     size_t space = 0;
-    for (size_t c = 0; c < getTargetChannelCount(); ++c) {
+    for (size_t c = 0; c < channels; ++c) {
 	RingBuffer<float> *wb = getWriteRingBuffer(c);
 	if (wb) {
 	    size_t spaceHere = wb->getWriteSpace();
@@ -1310,6 +1530,8 @@ AudioCallbackPlaySource::fillBuffers()
         return false;
     }
 
+    if (space > m_mixFrames) space = m_mixFrames;
+
     size_t f = m_writeBufferFill;
 	
     bool readWriteEqual = (m_readBuffers == m_writeBuffers);
@@ -1325,25 +1547,17 @@ AudioCallbackPlaySource::fillBuffers()
     std::cout << "buffered to " << f << " already" << std::endl;
 #endif
 
-    bool resample = (getSourceSampleRate() != getTargetSampleRate());
+    bool resample = (sourceRate != targetRate);
 
 #ifdef DEBUG_AUDIO_PLAY_SOURCE
-    std::cout << (resample ? "" : "not ") << "resampling (source " << getSourceSampleRate() << ", target " << getTargetSampleRate() << ")" << std::endl;
+    std::cout << (resample ? "" : "not ") << "resampling (source " << sourceRate << ", target " << targetRate << ")" << std::endl;
 #endif
 
-    size_t channels = getTargetChannelCount();
-
     size_t orig = space;
     size_t got = 0;
 
-    static float **bufferPtrs = 0;
-    static size_t bufferPtrCount = 0;
-
-    if (bufferPtrCount < channels) {
-	if (bufferPtrs) delete[] bufferPtrs;
-	bufferPtrs = new float *[channels];
-	bufferPtrCount = channels;
-    }
+    float *tmp = m_mixBuffer;
+    float **bufferPtrs = m_mixBufferPtrs;
 
     size_t generatorBlockSize = m_audioGenerator->getBlockSize();
 
@@ -1357,9 +1571,9 @@ AudioCallbackPlaySource::fillBuffers()
 
     if (resample && m_converter) {
 
-	double ratio =
-	    double(getTargetSampleRate()) / double(getSourceSampleRate());
+	double ratio = double(targetRate) / double(sourceRate);
 	orig = size_t(orig / ratio + 0.1);
+        if (orig > m_mixFrames) orig = m_mixFrames;
 
 	// orig must be a multiple of generatorBlockSize
 	orig = (orig / generatorBlockSize) * generatorBlockSize;
@@ -1377,12 +1591,6 @@ AudioCallbackPlaySource::fillBuffers()
 	// What a faff -- especially as we've already de-interleaved
 	// the audio data from the source file elsewhere before we
 	// even reach this point.
-	
-	if (tmpSize < channels * work * 2) {
-	    delete[] tmp;
-	    tmp = new float[channels * work * 2];
-	    tmpSize = channels * work * 2;
-	}
 
 	float *nonintlv = tmp + channels * work;
 	float *intlv = tmp;
@@ -1398,7 +1606,7 @@ AudioCallbackPlaySource::fillBuffers()
 	    bufferPtrs[c] = nonintlv + c * orig;
 	}
 
-	got = mixModels(f, orig, bufferPtrs); // also modifies f
+	got = mixModels(f, orig, channels, bufferPtrs); // also modifies f
 
 	// and interleave into first half
 	for (size_t c = 0; c < channels; ++c) {
@@ -1467,12 +1675,6 @@ AudioCallbackPlaySource::fillBuffers()
             return false;
         }
 
-	if (tmpSize < channels * space) {
-	    delete[] tmp;
-	    tmp = new float[channels * space];
-	    tmpSize = channels * space;
-	}
-
 	for (size_t c = 0; c < channels; ++c) {
 
 	    bufferPtrs[c] = tmp + c * space;
@@ -1482,7 +1684,7 @@ AudioCallbackPlaySource::fillBuffers()
 	    }
 	}
 
-	size_t got = mixModels(f, space, bufferPtrs); // also modifies f
+	size_t got = mixModels(f, space, channels, bufferPtrs); // also modifies f
 
 	for (size_t c = 0; c < channels; ++c) {
 
@@ -1516,7 +1718,8 @@ AudioCallbackPlaySource::fillBuffers()
 }    
 
 size_t
-AudioCallbackPlaySource::mixModels(size_t &frame, size_t count, float **buffers)
+AudioCallbackPlaySource::mixModels(size_t &frame, size_t count,
+                                   size_t channels, float **buffers)
 {
     size_t processed = 0;
     size_t chunkStart = frame;
@@ -1528,24 +1731,10 @@ AudioCallbackPlaySource::mixModels(size_t &frame, size_t count, float **buffers)
     bool constrained = (m_viewManager->getPlaySelectionMode() &&
 			!m_viewManager->getSelections().empty());
 
-    static float **chunkBufferPtrs = 0;
-    static size_t chunkBufferPtrCount = 0;
-    size_t channels = getTargetChannelCount();
-
 #ifdef DEBUG_AUDIO_PLAY_SOURCE
     std::cout << "Selection playback: start " << frame << ", size " << count <<", channels " << channels << std::endl;
 #endif
 
-    if (chunkBufferPtrCount < channels) {
-	if (chunkBufferPtrs) delete[] chunkBufferPtrs;
-	chunkBufferPtrs = new float *[channels];
-	chunkBufferPtrCount = channels;
-    }
-
-    for (size_t c = 0; c < channels; ++c) {
-	chunkBufferPtrs[c] = buffers[c];
-    }
-
     while (processed < count) {
 	
 	chunkSize = count - processed;
@@ -1628,8 +1817,6 @@ AudioCallbackPlaySource::mixModels(size_t &frame, size_t count, float **buffers)
 	std::cout << "Selection playback: chunk at " << chunkStart << " -> " << nextChunkStart << " (size " << chunkSize << ")" << std::endl;
 #endif
 
-	size_t got = 0;
-
 	if (selectionSize < 100) {
 	    fadeIn = 0;
 	    fadeOut = 0;
@@ -1650,16 +1837,28 @@ AudioCallbackPlaySource::mixModels(size_t &frame, size_t count, float **buffers)
 	    }
 	}
 
-	for (std::set<Model *>::iterator mi = m_models.begin();
-	     mi != m_models.end(); ++mi) {
-	    
-	    got = m_audioGenerator->mixModel(*mi, chunkStart, 
-					     chunkSize, chunkBufferPtrs,
-					     fadeIn, fadeOut);
-	}
+	// Fades apply only at the ends of the chunk.  Avoid leaving a
+	// final piece too short to hold the fade out.
 
-	for (size_t c = 0; c < channels; ++c) {
-	    chunkBufferPtrs[c] += chunkSize;
+	size_t pieceStart = 0;
+
+	while (pieceStart < chunkSize) {
+
+	    size_t pieceSize = chunkSize - pieceStart;
+	    if (pieceSize > MIX_BLOCK_SIZE) {
+		if (pieceSize - MIX_BLOCK_SIZE < MIX_MARGIN) {
+		    pieceSize = MIX_BLOCK_SIZE - m_audioGenerator->getBlockSize();
+		} else {
+		    pieceSize = MIX_BLOCK_SIZE;
+		}
+	    }
+
+	    mixPiece(chunkStart + pieceStart, pieceSize, channels, buffers,
+		     processed + pieceStart, count,
+		     (pieceStart == 0 ? fadeIn : 0),
+		     (pieceStart + pieceSize == chunkSize ? fadeOut : 0));
+
+	    pieceStart += pieceSize;
 	}
 
 	processed += chunkSize;
@@ -1674,6 +1873,79 @@ AudioCallbackPlaySource::mixModels(size_t &frame, size_t count, float **buffers)
     return processed;
 }
 
+void
+AudioCallbackPlaySource::mixPiece(size_t start, size_t frames,
+                                  size_t channels, float **buffers,
+                                  size_t offset, size_t limit,
+                                  size_t fadeIn, size_t fadeOut)
+{
+    size_t models = m_mixModels.size();
+
+    if (models < 2 || models > m_modelMixModels ||
+        channels > m_modelMixChannels ||
+        !m_mixPool || m_mixPool->getThreadCount() < 2) {
+
+        for (size_t c = 0; c < channels; ++c) {
+            m_mixChunkPtrs[c] = buffers[c] + offset;
+        }
+
+        for (size_t i = 0; i < models; ++i) {
+            m_audioGenerator->mixModel(m_mixModels[i], start, frames,
+                                       m_mixChunkPtrs, fadeIn, fadeOut);
+        }
+
+        return;
+    }
+
+    m_mixPiece.start = start;
+    m_mixPiece.frames = frames;
+    m_mixPiece.channels = channels;
+    m_mixPiece.fadeIn = fadeIn;
+    m_mixPiece.fadeOut = fadeOut;
+
+    m_mixPool->run(m_mixJob, int(models));
+
+    // Sum in model order.  The fades of a piece can reach at most
+    // MIX_MARGIN frames beyond it, and never beyond the buffers.
+
+    size_t from = (offset > MIX_MARGIN ? offset - MIX_MARGIN : 0);
+    size_t to = std::min(offset + frames + MIX_MARGIN, limit);
+
+    for (size_t i = 0; i < models; ++i) {
+        for (size_t c = 0; c < channels; ++c) {
+            const float *source = m_modelMixBuffer +
+                (i * m_modelMixChannels + c) * MIX_STRIDE +
+                MIX_MARGIN - (offset - from);
+            MixKernels::addWithGain(source, buffers[c] + from, to - from, 1.f);
+        }
+    }
+}
+
+void
+AudioCallbackPlaySource::mixModelPiece(int index)
+{
+    const MixPiece &piece = m_mixPiece;
+
+    float *base = m_modelMixBuffer + index * m_modelMixChannels * MIX_STRIDE;
+
+    for (size_t i = 0; i < piece.channels * MIX_STRIDE; ++i) {
+        base[i] = 0.f;
+    }
+
+#ifdef __GNUC__
+    float *ptrs[piece.channels];
+#else
+    float **ptrs = (float **)alloca(piece.channels * sizeof(float *));
+#endif
+
+    for (size_t c = 0; c < piece.channels; ++c) {
+        ptrs[c] = base + c * MIX_STRIDE + MIX_MARGIN;
+    }
+
+    m_audioGenerator->mixModel(m_mixModels[index], piece.start, piece.frames,
+                               ptrs, piece.fadeIn, piece.fadeOut);
+}
+
 void
 AudioCallbackPlaySource::unifyRingBuffers()
 {
@@ -1794,6 +2066,9 @@ AudioCallbackPlaySource::FillThread::run()
 	std::cout << "AudioCallbackPlaySourceFillThread: awoken" << std::endl;
 #endif
 
+        s.processCommands();
+        s.checkOverloads();
+
 	work = false;
 
 	if (!s.getSourceSampleRate()) {
@@ -24,6 +24,7 @@
 #include <QObject>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QAtomicInt>
 
 #include "base/Thread.h"
 #include "base/RealTime.h"
@@ -32,6 +33,7 @@
 
 #include <set>
 #include <map>
+#include <vector>
 
 namespace RubberBand {
     class RubberBandStretcher;
@@ -43,6 +45,7 @@ class AudioGenerator;
 class PlayParameters;
 class RealTimePluginInstance;
 class AudioCallbackPlayTarget;
+class ThreadPool;
 
 /**
  * AudioCallbackPlaySource manages audio data supply to callback-based
@@ -239,6 +242,14 @@ public:
 
     QString getClientName() const { return m_clientName; }
 
+    /**
+     * Return the number of dropouts in playback so far: that is, the
+     * number of processing overloads reported by the target plus the
+     * number of times the ring buffers have run dry during playback.
+     * This may safely be called from any thread.
+     */
+    int getXrunCount() const;
+
 signals:
     void modelReplaced();
 
@@ -252,6 +263,11 @@ signals:
     void activity(QString);
 
 public slots:
+    /**
+     * Report a processing overload.  This may safely be called from
+     * the realtime thread: it only counts the overload, and any
+     * action taken as a result happens later in the fill thread.
+     */
     void audioProcessingOverload();
 
 protected slots:
@@ -277,7 +293,8 @@ protected:
 	}
     };
 
-    std::set<Model *>                 m_models;
+    std::set<Model *>                 m_models; // GUI thread only
+    std::vector<Model *>              m_mixModels; // mutex held only
     RingBufferVector                 *m_readBuffers;
     RingBufferVector                 *m_writeBuffers;
     size_t                            m_readBufferFill;
@@ -305,6 +322,10 @@ protected:
     size_t                            m_playStartFrame;
     bool                              m_playStartFramePassed;
     RealTime                          m_playStartedAt;
+    bool                              m_deliveredSincePlay;
+    QAtomicInt                        m_overloadCount;
+    QAtomicInt                        m_underrunCount;
+    int                               m_reportedOverloadCount;
 
     RingBuffer<float> *getWriteRingBuffer(size_t c) {
 	if (m_writeBuffers && c < m_writeBuffers->size()) {
@@ -323,9 +344,50 @@ protected:
 	}
     }
 
-    void clearRingBuffers(bool haveLock = false, size_t count = 0);
+    // Called from the GUI thread: ask the fill thread to replace the
+    // write buffers with count new ones (or as many as there are now,
+    // if count is zero) without waiting for it to do so
+    void clearRingBuffers(size_t count = 0);
+
+    // Mutex held
+    void recreateRingBuffers(size_t count, size_t fill);
     void unifyRingBuffers();
 
+    // Requests made by the GUI thread of whichever thread next holds
+    // the mutex (normally the fill thread).  These are queued rather
+    // than carried out directly, so that the GUI thread does not have
+    // to wait for a fill to finish before it can change the models
+    // or playback parameters.  Commands are written only with
+    // m_commandMutex held, and read only with m_mutex held.  The
+    // command mutex is never held while taking m_mutex.
+    struct Command {
+        enum Type { AddModel, ClearBuffers, ResetConverters };
+        Type type;
+        Model *model;
+        size_t count;
+    };
+    RingBuffer<Command> m_commands;
+    QMutex m_commandMutex;
+    void postCommand(Command::Type type, Model *model = 0, size_t count = 0);
+
+    // Mutex held
+    void processCommands();
+
+    // Called from fill thread, mutex held: react to any processing
+    // overloads since the last call
+    void checkOverloads();
+
+    // Buffers for the fill thread to mix into, allocated along with
+    // the ring buffers so that filling them never has to allocate.
+    // m_mixBuffer has room for two blocks of m_mixFrames samples per
+    // channel (needed when resampling).
+    float  *m_mixBuffer;
+    float **m_mixBufferPtrs;
+    float **m_mixChunkPtrs;
+    size_t  m_mixChannels;
+    size_t  m_mixFrames;
+    void allocateMixBuffers(size_t channels, size_t frames); // mutex held
+
     RubberBand::RubberBandStretcher *m_timeStretcher;
     RubberBand::RubberBandStretcher *m_monoStretcher;
     float m_stretchRatio;
@@ -343,7 +405,45 @@ protected:
     // which will be count or fewer.  Return in the frame argument the
     // new buffered frame position (which may be earlier than the
     // frame argument passed in, in the case of looping).
-    size_t mixModels(size_t &frame, size_t count, float **buffers);
+    size_t mixModels(size_t &frame, size_t count, size_t channels,
+                     float **buffers);
+
+    // Called from mixModels.  Mix frames frames of all models, from
+    // source frame start, into buffers at offset, where the buffers
+    // are limit frames long.  Fades may extend a little either side.
+    void mixPiece(size_t start, size_t frames, size_t channels,
+                  float **buffers, size_t offset, size_t limit,
+                  size_t fadeIn, size_t fadeOut);
+
+    // Called from the shared thread pool during mixPiece: mix the piece
+    // described by m_mixPiece for the model with the given index into
+    // that model's own region of m_modelMixBuffer
+    void mixModelPiece(int index);
+
+    // When there is more than one model and more than one core, each
+    // model is mixed into its own buffer by a thread of the shared
+    // ThreadPool, and the buffers are then summed into the output in
+    // model order, so that the result does not depend on how the work
+    // was scheduled.  m_modelMixBuffer holds m_modelMixModels *
+    // m_modelMixChannels channels of a piece, with a margin either
+    // side for fades.
+    class MixJob;
+    friend class MixJob;
+    MixJob *m_mixJob;
+    ThreadPool *m_mixPool;
+    float  *m_modelMixBuffer;
+    size_t  m_modelMixModels;
+    size_t  m_modelMixChannels;
+    void allocateModelMixBuffers(); // mutex held
+
+    struct MixPiece {
+        size_t start;
+        size_t frames;
+        size_t channels;
+        size_t fadeIn;
+        size_t fadeOut;
+    };
+    MixPiece m_mixPiece;
 
     // Called from getSourceSamples.
     void applyAuditioningEffect(size_t count, float **buffers);
@@ -351,7 +451,7 @@ protected:
     // Ranges of current selections, if play selection is active
     std::vector<RealTime> m_rangeStarts;
     std::vector<RealTime> m_rangeDurations;
-    void rebuildRangeLists();
+    void rebuildRangeLists(); // mutex held
 
     size_t getCurrentFrame(RealTime outputLatency);
 
@@ -14,6 +14,7 @@
 */
 
 #include "AudioGenerator.h"
+#include "MixKernels.h"
 
 #include "base/TempDirectory.h"
 #include "base/PlayParameters.h"
@@ -33,6 +34,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include <QDir>
 #include <QFile>
@@ -45,10 +47,25 @@ AudioGenerator::m_sampleDir = "";
 
 //#define DEBUG_AUDIO_GENERATOR 1
 
+static float
+getChannelGain(float gain, float pan, size_t c)
+{
+    float channelGain = gain;
+    if (pan != 0.0) {
+	if (c == 0) {
+	    if (pan > 0.0) channelGain *= 1.0 - pan;
+	} else {
+	    if (pan < 0.0) channelGain *= pan + 1.0;
+	}
+    }
+    return channelGain;
+}
+
 AudioGenerator::AudioGenerator() :
     m_sourceSampleRate(0),
     m_targetChannelCount(1),
-    m_soloing(false)
+    m_soloing(false),
+    m_maxFrameCount(0)
 {
     initialiseSampleDir();
 
@@ -68,6 +85,11 @@ AudioGenerator::~AudioGenerator()
 #ifdef DEBUG_AUDIO_GENERATOR
     std::cerr << "AudioGenerator::~AudioGenerator" << std::endl;
 #endif
+
+    for (SourceBufferMap::iterator i = m_sourceBuffers.begin();
+         i != m_sourceBuffers.end(); ++i) {
+        freeSourceBuffers(i->second);
+    }
 }
 
 void
@@ -110,15 +132,18 @@ AudioGenerator::initialiseSampleDir()
 bool
 AudioGenerator::addModel(Model *model)
 {
+    DenseTimeValueModel *dtvm = dynamic_cast<DenseTimeValueModel *>(model);
+    if (dtvm) {
+        QWriteLocker locker(&m_lock);
+        allocateSourceBuffers(dtvm, dtvm->getChannelCount());
+    }
+
     if (m_sourceSampleRate == 0) {
 
 	m_sourceSampleRate = model->getSampleRate();
 
     } else {
 
-	DenseTimeValueModel *dtvm =
-	    dynamic_cast<DenseTimeValueModel *>(model);
-
 	if (dtvm) {
 	    m_sourceSampleRate = model->getSampleRate();
 	    return true;
@@ -127,8 +152,9 @@ AudioGenerator::addModel(Model *model)
 
     RealTimePluginInstance *plugin = loadPluginFor(model);
     if (plugin) {
-        QMutexLocker locker(&m_mutex);
+        QWriteLocker locker(&m_lock);
         m_synthMap[model] = plugin;
+        m_noteOffs[model]; // create now, as mixing must not modify the map
         return true;
     }
 
@@ -150,7 +176,7 @@ AudioGenerator::playPluginIdChanged(const Playable *playable, QString)
     
     RealTimePluginInstance *plugin = loadPluginFor(model);
     if (plugin) {
-        QMutexLocker locker(&m_mutex);
+        QWriteLocker locker(&m_lock);
         delete m_synthMap[model];
         m_synthMap[model] = plugin;
     }
@@ -266,34 +292,46 @@ AudioGenerator::loadPlugin(QString pluginId, QString program)
 void
 AudioGenerator::removeModel(Model *model)
 {
+    QWriteLocker locker(&m_lock);
+
+    SourceBufferMap::iterator bi = m_sourceBuffers.find(model);
+    if (bi != m_sourceBuffers.end()) {
+        freeSourceBuffers(bi->second);
+        m_sourceBuffers.erase(bi);
+    }
+
     SparseOneDimensionalModel *sodm =
 	dynamic_cast<SparseOneDimensionalModel *>(model);
-    if (!sodm) return; // nothing to do
-
-    QMutexLocker locker(&m_mutex);
+    if (!sodm) return; // nothing more to do
 
     if (m_synthMap.find(sodm) == m_synthMap.end()) return;
 
     RealTimePluginInstance *instance = m_synthMap[sodm];
     m_synthMap.erase(sodm);
+    m_noteOffs.erase(sodm);
     delete instance;
 }
 
 void
 AudioGenerator::clearModels()
 {
-    QMutexLocker locker(&m_mutex);
+    QWriteLocker locker(&m_lock);
     while (!m_synthMap.empty()) {
 	RealTimePluginInstance *instance = m_synthMap.begin()->second;
 	m_synthMap.erase(m_synthMap.begin());
 	delete instance;
     }
+    m_noteOffs.clear();
+    while (!m_sourceBuffers.empty()) {
+        freeSourceBuffers(m_sourceBuffers.begin()->second);
+        m_sourceBuffers.erase(m_sourceBuffers.begin());
+    }
 }    
 
 void
 AudioGenerator::reset()
 {
-    QMutexLocker locker(&m_mutex);
+    QWriteLocker locker(&m_lock);
     for (PluginMap::iterator i = m_synthMap.begin(); i != m_synthMap.end(); ++i) {
 	if (i->second) {
 	    i->second->silence();
@@ -301,7 +339,9 @@ AudioGenerator::reset()
 	}
     }
 
-    m_noteOffs.clear();
+    for (NoteOffMap::iterator i = m_noteOffs.begin(); i != m_noteOffs.end(); ++i) {
+        i->second.clear();
+    }
 }
 
 void
@@ -311,7 +351,7 @@ AudioGenerator::setTargetChannelCount(size_t targetChannelCount)
 
 //    std::cerr << "AudioGenerator::setTargetChannelCount(" << targetChannelCount << ")" << std::endl;
 
-    QMutexLocker locker(&m_mutex);
+    QWriteLocker locker(&m_lock);
     m_targetChannelCount = targetChannelCount;
 
     for (PluginMap::iterator i = m_synthMap.begin(); i != m_synthMap.end(); ++i) {
@@ -325,10 +365,59 @@ AudioGenerator::getBlockSize() const
     return m_pluginBlockSize;
 }
 
+void
+AudioGenerator::setMaxFrameCount(size_t frameCount)
+{
+    QWriteLocker locker(&m_lock);
+    m_maxFrameCount = frameCount;
+    for (SourceBufferMap::iterator i = m_sourceBuffers.begin();
+         i != m_sourceBuffers.end(); ++i) {
+        allocateSourceBuffers(i->first, i->second.channels);
+    }
+}
+
+void
+AudioGenerator::allocateSourceBuffers(const Model *model, size_t channels)
+{
+    // leave room for the overlap needed by the longest fades
+    size_t frames = m_maxFrameCount;
+    if (frames > 0) frames += m_pluginBlockSize;
+
+    SourceBufferMap::iterator i = m_sourceBuffers.find(model);
+    if (i != m_sourceBuffers.end()) {
+        if (channels <= i->second.channels && frames <= i->second.frames) {
+            return;
+        }
+        freeSourceBuffers(i->second);
+    }
+
+    SourceBuffers sb;
+    sb.buffers = new float *[channels];
+    for (size_t c = 0; c < channels; ++c) {
+        sb.buffers[c] = new float[frames];
+    }
+    sb.channels = channels;
+    sb.frames = frames;
+
+    m_sourceBuffers[model] = sb;
+}
+
+void
+AudioGenerator::freeSourceBuffers(SourceBuffers &sb)
+{
+    for (size_t c = 0; c < sb.channels; ++c) {
+        delete[] sb.buffers[c];
+    }
+    delete[] sb.buffers;
+    sb.buffers = 0;
+    sb.channels = 0;
+    sb.frames = 0;
+}
+
 void
 AudioGenerator::setSoloModelSet(std::set<Model *> s)
 {
-    QMutexLocker locker(&m_mutex);
+    QWriteLocker locker(&m_lock);
 
     m_soloModelSet = s;
     m_soloing = true;
@@ -337,7 +426,7 @@ AudioGenerator::setSoloModelSet(std::set<Model *> s)
 void
 AudioGenerator::clearSoloModelSet()
 {
-    QMutexLocker locker(&m_mutex);
+    QWriteLocker locker(&m_lock);
 
     m_soloModelSet.clear();
     m_soloing = false;
@@ -352,7 +441,7 @@ AudioGenerator::mixModel(Model *model, size_t startFrame, size_t frameCount,
 	return frameCount;
     }
 
-    QMutexLocker locker(&m_mutex);
+    QReadLocker locker(&m_lock);
 
     Playable *playable = model;
     if (!playable || !playable->canPlay()) return frameCount;
@@ -409,29 +498,33 @@ AudioGenerator::mixDenseTimeValueModel(DenseTimeValueModel *dtvm,
 				       float **buffer, float gain, float pan,
 				       size_t fadeIn, size_t fadeOut)
 {
-    static float **channelBuffer = 0;
-    static size_t  channelBufSiz = 0;
-    static size_t  channelBufCount = 0;
-
     size_t totalFrames = frames + fadeIn/2 + fadeOut/2;
 
     size_t modelChannels = dtvm->getChannelCount();
 
-    if (channelBufSiz < totalFrames || channelBufCount < modelChannels) {
+    // Each model has its own source buffers, so that different
+    // models may be mixed concurrently under the read lock
 
-        for (size_t c = 0; c < channelBufCount; ++c) {
-            delete[] channelBuffer[c];
-        }
+    SourceBufferMap::iterator bi = m_sourceBuffers.find(dtvm);
+    if (bi == m_sourceBuffers.end() || bi->second.channels == 0 ||
+        bi->second.frames <= fadeIn/2 + fadeOut/2) {
+        return 0;
+    }
 
-	delete[] channelBuffer;
-        channelBuffer = new float *[modelChannels];
+    float **channelBuffer = bi->second.buffers;
 
-        for (size_t c = 0; c < modelChannels; ++c) {
-            channelBuffer[c] = new float[totalFrames];
-        }
+    // The buffers can only be reallocated with the write lock held,
+    // which can't be taken here on the audio thread.  So if the
+    // caller asks for more than the frame count it gave us, mix only
+    // as much as fits; and if the model has gained channels since it
+    // was added, mix from the ones there is room for.
 
-        channelBufCount = modelChannels;
-	channelBufSiz = totalFrames;
+    if (modelChannels > bi->second.channels) {
+        modelChannels = bi->second.channels;
+    }
+    if (totalFrames > bi->second.frames) {
+        frames = bi->second.frames - fadeIn/2 - fadeOut/2;
+        totalFrames = bi->second.frames;
     }
 
     size_t got = 0;
@@ -460,39 +553,70 @@ AudioGenerator::mixDenseTimeValueModel(DenseTimeValueModel *dtvm,
         got += missing;
     }	    
 
+    // The mix divides into a fade-in section of fadeIn/2 frames, a
+    // section at constant gain, and a fade-out section starting
+    // fadeOut/2 frames before the end of the requested frames and
+    // ending fadeOut/2 frames after it.  Frames beyond those we got
+    // from the model contribute nothing.
+
+    size_t total = frames + fadeOut/2;
+    size_t fadeInEnd = fadeIn/2;
+    size_t fadeOutStart = total;
+    if (fadeOut > 0 && fadeOut/2 <= frames) {
+        fadeOutStart = std::min(frames - fadeOut/2 + 1, total);
+    }
+    size_t available = std::min(total, got);
+
     for (size_t c = 0; c < m_targetChannelCount; ++c) {
 
 	size_t sourceChannel = (c % modelChannels);
 
 //	std::cerr << "mixing channel " << c << " from source channel " << sourceChannel << std::endl;
 
-	float channelGain = gain;
-	if (pan != 0.0) {
-	    if (c == 0) {
-		if (pan > 0.0) channelGain *= 1.0 - pan;
-	    } else {
-		if (pan < 0.0) channelGain *= pan + 1.0;
-	    }
-	}
+	float channelGain = getChannelGain(gain, pan, c);
 
-	for (size_t i = 0; i < fadeIn/2; ++i) {
-	    float *back = buffer[c];
-	    back -= fadeIn/2;
-	    back[i] += (channelGain * channelBuffer[sourceChannel][i] * i) / fadeIn;
-	}
+        const float *source = channelBuffer[sourceChannel];
+        float *target = buffer[c];
 
-	for (size_t i = 0; i < frames + fadeOut/2; ++i) {
-	    float mult = channelGain;
-	    if (i < fadeIn/2) {
-		mult = (mult * i) / fadeIn;
-	    }
-	    if (i > frames - fadeOut/2) {
-		mult = (mult * ((frames + fadeOut/2) - i)) / fadeOut;
-	    }
-            float val = channelBuffer[sourceChannel][i];
-            if (i >= got) val = 0.f;
-	    buffer[c][i] += mult * val;
-	}
+        MixKernels::addWithFadeIn(source, target - fadeInEnd, fadeInEnd,
+                                  channelGain, fadeIn);
+
+        if (fadeInEnd > fadeOutStart) {
+
+            // Fades overlap (very short selection): mix each frame
+            // with both applied
+
+            for (size_t i = 0; i < available; ++i) {
+                float mult = channelGain;
+                if (i < fadeInEnd) {
+                    mult = (mult * i) / fadeIn;
+                }
+                if (i >= fadeOutStart) {
+                    mult = (mult * (total - i)) / fadeOut;
+                }
+                target[i] += mult * source[i];
+            }
+
+            continue;
+        }
+
+        MixKernels::addWithFadeIn(source, target,
+                                  std::min(fadeInEnd, available),
+                                  channelGain, fadeIn);
+
+        if (available > fadeInEnd) {
+            MixKernels::addWithGain(source + fadeInEnd, target + fadeInEnd,
+                                    std::min(fadeOutStart, available) - fadeInEnd,
+                                    channelGain);
+        }
+
+        if (available > fadeOutStart) {
+            MixKernels::addWithFadeOut(source + fadeOutStart,
+                                       target + fadeOutStart,
+                                       available - fadeOutStart,
+                                       channelGain, fadeOut,
+                                       total - fadeOutStart);
+        }
     }
 
     return got;
@@ -505,8 +629,15 @@ AudioGenerator::mixSparseOneDimensionalModel(SparseOneDimensionalModel *sodm,
 					     size_t /* fadeIn */,
 					     size_t /* fadeOut */)
 {
-    RealTimePluginInstance *plugin = m_synthMap[sodm];
-    if (!plugin) return 0;
+    // Look up rather than use operator[], as we may be called
+    // concurrently for other models and must not modify the maps
+
+    PluginMap::iterator pi = m_synthMap.find(sodm);
+    if (pi == m_synthMap.end() || !pi->second) return 0;
+    RealTimePluginInstance *plugin = pi->second;
+
+    NoteOffMap::iterator ni = m_noteOffs.find(sodm);
+    if (ni == m_noteOffs.end()) return 0;
 
     size_t latency = plugin->getLatency();
     size_t blocks = frames / m_pluginBlockSize;
@@ -539,7 +670,7 @@ AudioGenerator::mixSparseOneDimensionalModel(SparseOneDimensionalModel *sodm,
     offEv.data.note.channel = 0;
     offEv.data.note.velocity = 0;
     
-    NoteOffSet &noteOffs = m_noteOffs[sodm];
+    NoteOffSet &noteOffs = ni->second;
 
     for (size_t i = 0; i < blocks; ++i) {
 
@@ -621,19 +752,11 @@ AudioGenerator::mixSparseOneDimensionalModel(SparseOneDimensionalModel *sodm,
 
 	    size_t sourceChannel = (c % plugin->getAudioOutputCount());
 
-	    float channelGain = gain;
-	    if (pan != 0.0) {
-		if (c == 0) {
-		    if (pan > 0.0) channelGain *= 1.0 - pan;
-		} else {
-		    if (pan < 0.0) channelGain *= pan + 1.0;
-		}
-	    }
+	    float channelGain = getChannelGain(gain, pan, c);
 
-	    for (size_t j = 0; j < m_pluginBlockSize; ++j) {
-		buffer[c][i * m_pluginBlockSize + j] +=
-		    channelGain * outs[sourceChannel][j];
-	    }
+	    MixKernels::addWithGain(outs[sourceChannel],
+                                    buffer[c] + i * m_pluginBlockSize,
+                                    m_pluginBlockSize, channelGain);
 	}
     }
 
@@ -649,8 +772,12 @@ AudioGenerator::mixNoteModel(NoteModel *nm,
 			     size_t /* fadeIn */,
 			     size_t /* fadeOut */)
 {
-    RealTimePluginInstance *plugin = m_synthMap[nm];
-    if (!plugin) return 0;
+    PluginMap::iterator pi = m_synthMap.find(nm);
+    if (pi == m_synthMap.end() || !pi->second) return 0;
+    RealTimePluginInstance *plugin = pi->second;
+
+    NoteOffMap::iterator ni = m_noteOffs.find(nm);
+    if (ni == m_noteOffs.end()) return 0;
 
     size_t latency = plugin->getLatency();
     size_t blocks = frames / m_pluginBlockSize;
@@ -686,7 +813,7 @@ AudioGenerator::mixNoteModel(NoteModel *nm,
     offEv.data.note.channel = 0;
     offEv.data.note.velocity = 0;
     
-    NoteOffSet &noteOffs = m_noteOffs[nm];
+    NoteOffSet &noteOffs = ni->second;
 
     for (size_t i = 0; i < blocks; ++i) {
 
@@ -787,19 +914,11 @@ AudioGenerator::mixNoteModel(NoteModel *nm,
 
 	    size_t sourceChannel = (c % plugin->getAudioOutputCount());
 
-	    float channelGain = gain;
-	    if (pan != 0.0) {
-		if (c == 0) {
-		    if (pan > 0.0) channelGain *= 1.0 - pan;
-		} else {
-		    if (pan < 0.0) channelGain *= pan + 1.0;
-		}
-	    }
+	    float channelGain = getChannelGain(gain, pan, c);
 
-	    for (size_t j = 0; j < m_pluginBlockSize; ++j) {
-		buffer[c][i * m_pluginBlockSize + j] += 
-		    channelGain * outs[sourceChannel][j];
-	    }
+	    MixKernels::addWithGain(outs[sourceChannel],
+                                    buffer[c] + i * m_pluginBlockSize,
+                                    m_pluginBlockSize, channelGain);
 	}
     }
 
@@ -24,7 +24,7 @@ class RealTimePluginInstance;
 class Playable;
 
 #include <QObject>
-#include <QMutex>
+#include <QReadWriteLock>
 
 #include <set>
 #include <map>
@@ -74,7 +74,17 @@ public:
     virtual size_t getBlockSize() const;
 
     /**
-     * Mix a single model into an output buffer.
+     * Set the largest frameCount that will be passed to mixModel.
+     * The buffers used for mixing are allocated in advance to suit
+     * this and the channel counts of the models added, so that
+     * mixModel does not normally need to allocate anything.
+     */
+    virtual void setMaxFrameCount(size_t frameCount);
+
+    /**
+     * Mix a single model into an output buffer.  This may be called
+     * from several threads at once, provided each call is for a
+     * different model.
      */
     virtual size_t mixModel(Model *model, size_t startFrame, size_t frameCount,
 			    float **buffer, size_t fadeIn = 0, size_t fadeOut = 0);
@@ -118,9 +128,27 @@ protected:
     typedef std::multiset<NoteOff, NoteOff::Comparator> NoteOffSet;
     typedef std::map<const Model *, NoteOffSet> NoteOffMap;
 
-    QMutex m_mutex;
+    // Source data for mixDenseTimeValueModel, one set per model so
+    // that different models can be mixed at once
+    struct SourceBuffers {
+        float **buffers;
+        size_t channels;
+        size_t frames;
+    };
+    typedef std::map<const Model *, SourceBuffers> SourceBufferMap;
+
+    // Held for reading while mixing, and for writing when changing
+    // any of the maps (not their contents) or other settings
+    QReadWriteLock m_lock;
     PluginMap m_synthMap;
     NoteOffMap m_noteOffs;
+    SourceBufferMap m_sourceBuffers;
+    size_t m_maxFrameCount;
+
+    // Lock held for writing
+    void allocateSourceBuffers(const Model *model, size_t channels);
+    static void freeSourceBuffers(SourceBuffers &buffers);
+
     static QString m_sampleDir;
 
     virtual RealTimePluginInstance *loadPluginFor(const Model *model);
@@ -0,0 +1,214 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "MixKernels.h"
+
+#include "system/System.h"
+#include "system/SIMD.h"
+
+#include <iostream>
+
+//#define DEBUG_MIX_KERNELS 1
+
+
+// Plain implementations
+
+static void
+addWithGainPlain(const float *src, float *dst, size_t n, float gain)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += gain * src[i];
+    }
+}
+
+static void
+addWithRampPlain(const float *src, float *dst, size_t n,
+                 float startGain, float gainStep)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += (startGain + float(i) * gainStep) * src[i];
+    }
+}
+
+
+#ifdef SV_SSE2
+
+static void
+addWithGainSSE2(const float *src, float *dst, size_t n, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 s = _mm_loadu_ps(src + i);
+        __m128 d = _mm_loadu_ps(dst + i);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(g, s)));
+    }
+
+    addWithGainPlain(src + i, dst + i, n - i, gain);
+}
+
+static void
+addWithRampSSE2(const float *src, float *dst, size_t n,
+                float startGain, float gainStep)
+{
+    // The index is kept as a float vector and the gain recalculated
+    // from it each time, rather than accumulated, so that rounding
+    // errors do not build up along the ramp
+
+    const __m128 start = _mm_set1_ps(startGain);
+    const __m128 step = _mm_set1_ps(gainStep);
+    const __m128 four = _mm_set1_ps(4.f);
+    __m128 index = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 g = _mm_add_ps(start, _mm_mul_ps(index, step));
+        __m128 s = _mm_loadu_ps(src + i);
+        __m128 d = _mm_loadu_ps(dst + i);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(g, s)));
+        index = _mm_add_ps(index, four);
+    }
+
+    addWithRampPlain(src + i, dst + i, n - i,
+                     startGain + float(i) * gainStep, gainStep);
+}
+
+#endif // SV_SSE2
+
+
+#ifdef SV_AVX2
+
+static AVX2_FUNCTION void
+addWithGainAVX2(const float *src, float *dst, size_t n, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 s = _mm256_loadu_ps(src + i);
+        __m256 d = _mm256_loadu_ps(dst + i);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(d, _mm256_mul_ps(g, s)));
+    }
+
+    addWithGainPlain(src + i, dst + i, n - i, gain);
+}
+
+static AVX2_FUNCTION void
+addWithRampAVX2(const float *src, float *dst, size_t n,
+                float startGain, float gainStep)
+{
+    const __m256 start = _mm256_set1_ps(startGain);
+    const __m256 step = _mm256_set1_ps(gainStep);
+    const __m256 eight = _mm256_set1_ps(8.f);
+    __m256 index = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 g = _mm256_add_ps(start, _mm256_mul_ps(index, step));
+        __m256 s = _mm256_loadu_ps(src + i);
+        __m256 d = _mm256_loadu_ps(dst + i);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(d, _mm256_mul_ps(g, s)));
+        index = _mm256_add_ps(index, eight);
+    }
+
+    addWithRampPlain(src + i, dst + i, n - i,
+                     startGain + float(i) * gainStep, gainStep);
+}
+
+#endif // SV_AVX2
+
+
+typedef void (*AddWithGainFunction)(const float *, float *, size_t, float);
+typedef void (*AddWithRampFunction)(const float *, float *, size_t,
+                                    float, float);
+
+static AddWithGainFunction
+chooseAddWithGain()
+{
+    AddWithGainFunction f = addWithGainPlain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) f = addWithGainSSE2;
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) f = addWithGainAVX2;
+#endif
+
+#ifdef DEBUG_MIX_KERNELS
+    std::cerr << "MixKernels: using "
+              << (f == addWithGainPlain ? "plain" : "vector")
+              << " implementation" << std::endl;
+#endif
+
+    return f;
+}
+
+static AddWithRampFunction
+chooseAddWithRamp()
+{
+    AddWithRampFunction f = addWithRampPlain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) f = addWithRampSSE2;
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) f = addWithRampAVX2;
+#endif
+
+    return f;
+}
+
+static const AddWithGainFunction addWithGainFunction = chooseAddWithGain();
+static const AddWithRampFunction addWithRampFunction = chooseAddWithRamp();
+
+void
+MixKernels::addWithGain(const float *src, float *dst, size_t n, float gain)
+{
+    addWithGainFunction(src, dst, n, gain);
+}
+
+void
+MixKernels::addWithRamp(const float *src, float *dst, size_t n,
+                        float startGain, float gainStep)
+{
+    addWithRampFunction(src, dst, n, startGain, gainStep);
+}
+
+void
+MixKernels::addWithFadeIn(const float *src, float *dst, size_t n,
+                          float gain, size_t fadeLength, size_t offset)
+{
+    if (fadeLength == 0) {
+        addWithGainFunction(src, dst, n, gain);
+        return;
+    }
+    float step = gain / float(fadeLength);
+    addWithRampFunction(src, dst, n, float(offset) * step, step);
+}
+
+void
+MixKernels::addWithFadeOut(const float *src, float *dst, size_t n,
+                           float gain, size_t fadeLength, size_t remaining)
+{
+    if (fadeLength == 0) {
+        addWithGainFunction(src, dst, n, gain);
+        return;
+    }
+    float step = gain / float(fadeLength);
+    addWithRampFunction(src, dst, n, float(remaining) * step, -step);
+}
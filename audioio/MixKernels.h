@@ -0,0 +1,61 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _MIX_KERNELS_H_
+#define _MIX_KERNELS_H_
+
+#include <stddef.h>
+
+/**
+ * Functions used when mixing sources into a playback buffer.  Each
+ * adds n samples from src, scaled by a gain, into dst.
+ */
+
+class MixKernels
+{
+public:
+    /**
+     * dst[i] += gain * src[i]
+     */
+    static void addWithGain(const float *src, float *dst, size_t n,
+                            float gain);
+
+    /**
+     * dst[i] += (startGain + i * gainStep) * src[i]
+     */
+    static void addWithRamp(const float *src, float *dst, size_t n,
+                            float startGain, float gainStep);
+
+    /**
+     * Mix part of a linear fade in from silence to the given gain
+     * over fadeLength samples, starting offset samples into the fade:
+     * dst[i] += gain * (offset + i) / fadeLength * src[i]
+     */
+    static void addWithFadeIn(const float *src, float *dst, size_t n,
+                              float gain, size_t fadeLength,
+                              size_t offset = 0);
+
+    /**
+     * Mix part of a linear fade out from the given gain to silence
+     * over fadeLength samples, starting remaining samples before the
+     * end of the fade:
+     * dst[i] += gain * (remaining - i) / fadeLength * src[i]
+     */
+    static void addWithFadeOut(const float *src, float *dst, size_t n,
+                               float gain, size_t fadeLength,
+                               size_t remaining);
+};
+
+#endif
@@ -21,6 +21,7 @@ HEADERS += AudioCallbackPlaySource.h \
            AudioPortAudioTarget.h \
            AudioPulseAudioTarget.h \
            AudioTargetFactory.h \
+           MixKernels.h \
            PlaySpeedRangeMapper.h
 SOURCES += AudioCallbackPlaySource.cpp \
            AudioCallbackPlayTarget.cpp \
@@ -30,4 +31,5 @@ SOURCES += AudioCallbackPlaySource.cpp \
            AudioPortAudioTarget.cpp \
            AudioPulseAudioTarget.cpp \
            AudioTargetFactory.cpp \
+           MixKernels.cpp \
            PlaySpeedRangeMapper.cpp
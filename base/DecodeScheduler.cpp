@@ -0,0 +1,106 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "DecodeScheduler.h"
+#include "system/System.h"
+
+#include <QThread>
+#include <QMutexLocker>
+
+#include <iostream>
+
+//#define DEBUG_DECODE_SCHEDULER 1
+
+DecodeScheduler *
+DecodeScheduler::m_instance = new DecodeScheduler;
+
+DecodeScheduler *
+DecodeScheduler::getInstance()
+{
+    return m_instance;
+}
+
+DecodeScheduler::DecodeScheduler() :
+    m_maxDecodes(QThread::idealThreadCount()),
+    m_memoryBudget(0),
+    m_running(0),
+    m_memoryInUse(0)
+{
+    if (m_maxDecodes < 1) m_maxDecodes = 1;
+}
+
+void
+DecodeScheduler::setMaxDecodes(int decodes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxDecodes = (decodes < 1 ? 1 : decodes);
+    m_condition.wakeAll();
+}
+
+void
+DecodeScheduler::setMemoryBudget(size_t bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memoryBudget = bytes;
+    m_condition.wakeAll();
+}
+
+void
+DecodeScheduler::acquire(size_t memory)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_memoryBudget == 0) {
+        // Not known or set yet: find out now, rather than on
+        // construction, as we are constructed statically
+        int available = -1, total = -1;
+        GetRealMemoryMBAvailable(available, total);
+        if (available > 0) {
+            m_memoryBudget = (size_t(available) / 2) * 1024 * 1024;
+        } else {
+            m_memoryBudget = size_t(256) * 1024 * 1024;
+        }
+#ifdef DEBUG_DECODE_SCHEDULER
+        std::cerr << "DecodeScheduler: " << m_maxDecodes << " slots, memory budget "
+                  << m_memoryBudget / (1024 * 1024) << "MB" << std::endl;
+#endif
+    }
+
+    while (m_running > 0 &&
+           (m_running >= m_maxDecodes ||
+            m_memoryInUse + memory > m_memoryBudget)) {
+#ifdef DEBUG_DECODE_SCHEDULER
+        std::cerr << "DecodeScheduler::acquire: waiting (" << m_running
+                  << " running, " << m_memoryInUse << " bytes in use, "
+                  << memory << " requested)" << std::endl;
+#endif
+        m_condition.wait(&m_mutex);
+    }
+
+    ++m_running;
+    m_memoryInUse += memory;
+}
+
+void
+DecodeScheduler::release(size_t memory)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_running > 0) --m_running;
+    if (m_memoryInUse >= memory) m_memoryInUse -= memory;
+    else m_memoryInUse = 0;
+
+    m_condition.wakeAll();
+}
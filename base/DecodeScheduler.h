@@ -0,0 +1,77 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _DECODE_SCHEDULER_H_
+#define _DECODE_SCHEDULER_H_
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <cstddef>
+
+/**
+ * Limits the number of audio file decodes that may run at once, so
+ * that loading many compressed files together makes use of the
+ * available processors without running out of memory.  A decoder
+ * calls acquire() before it starts to produce audio, which blocks
+ * until there is a free slot and enough of the memory budget for the
+ * decode, and release() when it has finished.
+ *
+ * By default the number of slots is the number of processor cores
+ * and the memory budget is half the physical memory available when
+ * the scheduler is first used.  A decode whose memory requirement
+ * exceeds the whole budget is still allowed to run, but only when
+ * nothing else is running.
+ *
+ * This class is thread safe.
+ */
+
+class DecodeScheduler
+{
+public:
+    static DecodeScheduler *getInstance();
+
+    /**
+     * Block until a decode that is expected to hold the given number
+     * of bytes in memory may start, and claim a slot for it.
+     */
+    void acquire(size_t memory);
+
+    /**
+     * Release the slot claimed by a call to acquire() with the same
+     * memory requirement.
+     */
+    void release(size_t memory);
+
+    int getMaxDecodes() const { return m_maxDecodes; }
+    void setMaxDecodes(int decodes);
+
+    size_t getMemoryBudget() const { return m_memoryBudget; }
+    void setMemoryBudget(size_t bytes);
+
+protected:
+    DecodeScheduler();
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    int m_maxDecodes;
+    size_t m_memoryBudget;
+    int m_running;
+    size_t m_memoryInUse;
+
+    static DecodeScheduler *m_instance;
+};
+
+#endif
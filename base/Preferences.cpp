@@ -47,7 +47,10 @@ Preferences::Preferences() :
     m_viewFontSize(10),
     m_backgroundMode(BackgroundFromTheme),
     m_timeToTextMode(TimeToTextMs),
-    m_showSplash(true)
+    m_showSplash(true),
+    m_persistentFFTCache(false),
+    m_persistentFFTCacheSize(2048),
+    m_parallelFeatureExtraction(false)
 {
     QSettings settings;
     settings.beginGroup("Preferences");
@@ -68,6 +71,9 @@ Preferences::Preferences() :
         (settings.value("time-to-text-mode", int(TimeToTextMs)).toInt());
     m_viewFontSize = settings.value("view-font-size", 10).toInt();
     m_showSplash = settings.value("show-splash", true).toBool();
+    m_persistentFFTCache = settings.value("persistent-fft-cache", false).toBool();
+    m_persistentFFTCacheSize = settings.value("persistent-fft-cache-size", 2048).toInt();
+    m_parallelFeatureExtraction = settings.value("parallel-feature-extraction", false).toBool();
     settings.endGroup();
 
     settings.beginGroup("TempDirectory");
@@ -96,6 +102,9 @@ Preferences::getProperties() const
     props.push_back("Time To Text Mode");
     props.push_back("View Font Size");
     props.push_back("Show Splash Screen");
+    props.push_back("Persistent FFT Cache");
+    props.push_back("Persistent FFT Cache Size");
+    props.push_back("Parallel Feature Extraction");
     return props;
 }
 
@@ -141,6 +150,15 @@ Preferences::getPropertyLabel(const PropertyName &name) const
     if (name == "Show Splash Screen") {
         return tr("Show splash screen on startup");
     }
+    if (name == "Persistent FFT Cache") {
+        return tr("Keep spectrogram data between sessions");
+    }
+    if (name == "Persistent FFT Cache Size") {
+        return tr("Maximum size of saved spectrogram data");
+    }
+    if (name == "Parallel Feature Extraction") {
+        return tr("Run per-block analysis plugins on several cores (experimental)");
+    }
     return name;
 }
 
@@ -187,6 +205,15 @@ Preferences::getPropertyType(const PropertyName &name) const
     if (name == "Show Splash Screen") {
         return ToggleProperty;
     }
+    if (name == "Persistent FFT Cache") {
+        return ToggleProperty;
+    }
+    if (name == "Persistent FFT Cache Size") {
+        return RangeProperty;
+    }
+    if (name == "Parallel Feature Extraction") {
+        return ToggleProperty;
+    }
     return InvalidProperty;
 }
 
@@ -259,6 +286,23 @@ Preferences::getPropertyRangeAndValue(const PropertyName &name,
         if (deflt) *deflt = 1;
     }
 
+    if (name == "Persistent FFT Cache") {
+        if (deflt) *deflt = 0;
+        return m_persistentFFTCache ? 1 : 0;
+    }
+
+    if (name == "Persistent FFT Cache Size") {
+        if (min) *min = 64;
+        if (max) *max = 65536;
+        if (deflt) *deflt = 2048;
+        return m_persistentFFTCacheSize;
+    }
+
+    if (name == "Parallel Feature Extraction") {
+        if (deflt) *deflt = 0;
+        return m_parallelFeatureExtraction ? 1 : 0;
+    }
+
     return 0;
 }
 
@@ -363,6 +407,12 @@ Preferences::setProperty(const PropertyName &name, int value)
         setViewFontSize(value);
     } else if (name == "Show Splash Screen") {
         setShowSplash(value ? true : false);
+    } else if (name == "Persistent FFT Cache") {
+        setPersistentFFTCache(value ? true : false);
+    } else if (name == "Persistent FFT Cache Size") {
+        setPersistentFFTCacheSize(value);
+    } else if (name == "Parallel Feature Extraction") {
+        setParallelFeatureExtraction(value ? true : false);
     }
 }
 
@@ -554,3 +604,48 @@ Preferences::setShowSplash(bool show)
     }
 }
         
+
+void
+Preferences::setPersistentFFTCache(bool persistent)
+{
+    if (m_persistentFFTCache != persistent) {
+
+        m_persistentFFTCache = persistent;
+
+        QSettings settings;
+        settings.beginGroup("Preferences");
+        settings.setValue("persistent-fft-cache", persistent);
+        settings.endGroup();
+        emit propertyChanged("Persistent FFT Cache");
+    }
+}
+
+void
+Preferences::setPersistentFFTCacheSize(int mb)
+{
+    if (m_persistentFFTCacheSize != mb) {
+
+        m_persistentFFTCacheSize = mb;
+
+        QSettings settings;
+        settings.beginGroup("Preferences");
+        settings.setValue("persistent-fft-cache-size", mb);
+        settings.endGroup();
+        emit propertyChanged("Persistent FFT Cache Size");
+    }
+}
+
+void
+Preferences::setParallelFeatureExtraction(bool parallel)
+{
+    if (m_parallelFeatureExtraction != parallel) {
+
+        m_parallelFeatureExtraction = parallel;
+
+        QSettings settings;
+        settings.beginGroup("Preferences");
+        settings.setValue("parallel-feature-extraction", parallel);
+        settings.endGroup();
+        emit propertyChanged("Parallel Feature Extraction");
+    }
+}
@@ -88,6 +88,11 @@ public:
 
     bool getShowSplash() const { return m_showSplash; }
 
+    bool getPersistentFFTCache() const { return m_persistentFFTCache; }
+    int getPersistentFFTCacheSize() const { return m_persistentFFTCacheSize; } // MB
+
+    bool getParallelFeatureExtraction() const { return m_parallelFeatureExtraction; }
+
 public slots:
     virtual void setProperty(const PropertyName &, int);
 
@@ -104,6 +109,9 @@ public slots:
     void setTimeToTextMode(TimeToTextMode mode);
     void setViewFontSize(int size);
     void setShowSplash(bool);
+    void setPersistentFFTCache(bool);
+    void setPersistentFFTCacheSize(int mb);
+    void setParallelFeatureExtraction(bool);
 
 private:
     Preferences(); // may throw DirectoryCreationFailed
@@ -124,6 +132,9 @@ private:
     BackgroundMode m_backgroundMode;
     TimeToTextMode m_timeToTextMode;
     bool m_showSplash;
+    bool m_persistentFFTCache;
+    int m_persistentFFTCacheSize;
+    bool m_parallelFeatureExtraction;
 };
 
 #endif
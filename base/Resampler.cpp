@@ -19,18 +19,45 @@
 
 #include "Resampler.h"
 
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include "system/System.h"
+#include "system/SIMD.h"
+
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <vector>
 
 #include <iostream>
 
 #include <samplerate.h>
 
+//#define DEBUG_RESAMPLER 1
+
 class Resampler::D
 {
 public:
-    D(Quality quality, size_t channels, size_t chunkSize);
-    ~D();
+    virtual ~D() { }
+
+    virtual size_t resample(float **in, float **out,
+                            size_t incount, float ratio,
+                            bool final) = 0;
+
+    virtual size_t resampleInterleaved(float *in, float *out,
+                                       size_t incount, float ratio,
+                                       bool final) = 0;
+
+    virtual size_t getMaxOutputCount(size_t incount, float ratio) const = 0;
+
+    virtual void reset() = 0;
+};
+
+class Resampler::SRCImpl : public Resampler::D
+{
+public:
+    SRCImpl(Quality quality, size_t channels, size_t chunkSize);
+    ~SRCImpl();
 
     size_t resample(float **in, float **out,
                     size_t incount, float ratio,
@@ -40,6 +67,8 @@ public:
                                size_t incount, float ratio,
                                bool final);
 
+    size_t getMaxOutputCount(size_t incount, float ratio) const;
+
     void reset();
 
 protected:
@@ -51,7 +80,7 @@ protected:
     size_t m_ioutsize;
 };
 
-Resampler::D::D(Quality quality, size_t channels, size_t chunkSize) :
+Resampler::SRCImpl::SRCImpl(Quality quality, size_t channels, size_t chunkSize) :
     m_src(0),
     m_iin(0),
     m_iout(0),
@@ -76,7 +105,7 @@ Resampler::D::D(Quality quality, size_t channels, size_t chunkSize) :
     }
 }
 
-Resampler::D::~D()
+Resampler::SRCImpl::~SRCImpl()
 {
     src_delete(m_src);
     if (m_iinsize > 0) {
@@ -88,9 +117,9 @@ Resampler::D::~D()
 }
 
 size_t
-Resampler::D::resample(float **in, float **out,
-                       size_t incount, float ratio,
-                       bool final)
+Resampler::SRCImpl::resample(float **in, float **out,
+                             size_t incount, float ratio,
+                             bool final)
 {
     if (m_channels == 1) {
         return resampleInterleaved(*in, *out, incount, ratio, final);
@@ -124,9 +153,9 @@ Resampler::D::resample(float **in, float **out,
 }
 
 size_t
-Resampler::D::resampleInterleaved(float *in, float *out,
-                                  size_t incount, float ratio,
-                                  bool final)
+Resampler::SRCImpl::resampleInterleaved(float *in, float *out,
+                                        size_t incount, float ratio,
+                                        bool final)
 {
     SRC_DATA data;
 
@@ -146,15 +175,572 @@ Resampler::D::resampleInterleaved(float *in, float *out,
     return data.output_frames_gen;
 }
 
+size_t
+Resampler::SRCImpl::getMaxOutputCount(size_t incount, float ratio) const
+{
+    return lrintf(ceilf(incount * ratio));
+}
+
 void
-Resampler::D::reset()
+Resampler::SRCImpl::reset()
 {
     src_reset(m_src);
 }
 
+
+// Dot product of a filter phase with a run of input samples, the
+// inner loop of the polyphase resampler.  The length is always a
+// multiple of 8.
+
+static float
+dotPlain(const float *a, const float *b, size_t n)
+{
+    float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+    for (size_t i = 0; i < n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i+1] * b[i+1];
+        s2 += a[i+2] * b[i+2];
+        s3 += a[i+3] * b[i+3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef SV_SSE2
+
+static float
+dotSSE2(const float *a, const float *b, size_t n)
+{
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+
+    for (size_t i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+    }
+
+    float v[4];
+    _mm_storeu_ps(v, _mm_add_ps(s0, s1));
+    return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+#endif // SV_SSE2
+
+#ifdef SV_AVX2
+
+static AVX2_FUNCTION float
+dotAVX2(const float *a, const float *b, size_t n)
+{
+    __m256 s = _mm256_setzero_ps();
+
+    for (size_t i = 0; i < n; i += 8) {
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                           _mm256_loadu_ps(b + i)));
+    }
+
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s),
+                          _mm256_extractf128_ps(s, 1));
+    float v[4];
+    _mm_storeu_ps(v, h);
+    return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+#endif // SV_AVX2
+
+typedef float (*DotFunction)(const float *, const float *, size_t);
+
+static DotFunction
+chooseDot()
+{
+    DotFunction f = dotPlain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) f = dotSSE2;
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) f = dotAVX2;
+#endif
+
+    return f;
+}
+
+static const DotFunction dotFunction = chooseDot();
+
+
+// The polyphase resampler.  For a conversion of L output samples for
+// every M input samples (with L and M coprime), output sample n lies
+// at input time n * M / L, whose fractional part is one of L values.
+// We calculate a windowed sinc filter for each of these L phases in
+// advance, so that each output sample is a single dot product of one
+// phase with the input around it.
+
+static const size_t MaxPhases = 2048;
+static const size_t MaxFilterSize = 1 << 20; // floats, for all phases
+
+// Input blocks of at least this many frames are resampled with the
+// channels shared between the threads of the ThreadPool
+static const size_t ParallelThreshold = 4096;
+
+class Resampler::PolyphaseImpl : public Resampler::D,
+                                  public ThreadPool::Job
+{
+public:
+    /**
+     * Return a new PolyphaseImpl for the given rates, or 0 if the
+     * ratio between them needs too many phases or too large a
+     * filter.
+     */
+    static PolyphaseImpl *create(Quality quality, size_t channels,
+                                 size_t sourceRate, size_t targetRate,
+                                 size_t chunkSize);
+
+    ~PolyphaseImpl();
+
+    size_t resample(float **in, float **out,
+                    size_t incount, float ratio,
+                    bool final);
+
+    size_t resampleInterleaved(float *in, float *out,
+                               size_t incount, float ratio,
+                               bool final);
+
+    size_t getMaxOutputCount(size_t incount, float ratio) const;
+
+    void reset();
+
+protected:
+    PolyphaseImpl(size_t channels, size_t up, size_t down,
+                  size_t half, double cutoff, double beta,
+                  size_t chunkSize);
+
+    void makeFilter(double cutoff, double beta);
+    void allocateBuffers(size_t frames);
+
+    size_t process(float **in, const float *iin,
+                   float **out, float *iout,
+                   size_t incount, bool final);
+
+    void processChannel(size_t c);
+
+    virtual void perform(int n) { processChannel(n); } // ThreadPool::Job
+
+    size_t m_channels;
+    size_t m_up;         // L
+    size_t m_down;       // M
+    size_t m_downWhole;  // M / L
+    size_t m_downFrac;   // M % L
+    size_t m_half;       // half the filter length, in input samples
+    size_t m_taps;       // filter length for each phase
+    float *m_filter;     // m_up phases of m_taps coefficients
+
+    // Per-channel input history.  The next output sample is centred
+    // between m_base and m_base + 1 in every channel's buffer, at
+    // fractional position m_phase / m_up
+    std::vector<float *> m_buffers;
+    size_t m_bufsiz;
+    size_t m_fill;
+    size_t m_base;
+    size_t m_phase;
+    unsigned long long m_totalIn;
+    unsigned long long m_totalOut;
+    bool m_flushed;
+
+    // Per-channel output, for interleaving
+    std::vector<float *> m_outbufs;
+    size_t m_outbufsiz;
+
+    // Arguments to the current process() call, for processChannel
+    float **m_in;
+    const float *m_iin;
+    float **m_out;
+    size_t m_incount;
+    size_t m_padding;
+    size_t m_outcount;
+    size_t m_drop;
+};
+
+static size_t
+gcd(size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static double
+besselI0(double x)
+{
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    for (int k = 1; k < 100; ++k) {
+        term *= q / (double(k) * double(k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+Resampler::PolyphaseImpl *
+Resampler::PolyphaseImpl::create(Quality quality, size_t channels,
+                                 size_t sourceRate, size_t targetRate,
+                                 size_t chunkSize)
+{
+    if (channels == 0 || sourceRate == 0 || targetRate == 0) return 0;
+
+    size_t g = gcd(sourceRate, targetRate);
+    size_t up = targetRate / g;
+    size_t down = sourceRate / g;
+
+    if (up > MaxPhases) return 0;
+
+    // Filter half-length in zero crossings of the sinc, Kaiser window
+    // parameter, and passband as a proportion of the lower Nyquist
+    // frequency.  The two faster settings are comparable with (and
+    // a little better than) libsamplerate's fastest sinc converter.
+
+    double crossings = 12, beta = 8.0, rolloff = 0.90;
+
+    switch (quality) {
+    case Best:             crossings = 32; beta = 11.0; rolloff = 0.96; break;
+    case FastestTolerable: crossings = 12; beta =  8.0; rolloff = 0.90; break;
+    case Fastest:          crossings =  6; beta =  6.0; rolloff = 0.85; break;
+    }
+
+    // When downsampling, the cutoff is scaled to the new Nyquist
+    // frequency and the filter lengthened to suit
+
+    double scale = 1.0;
+    if (up < down) scale = double(up) / double(down);
+
+    size_t half = size_t(ceil(crossings / scale));
+    half = ((half + 3) / 4) * 4; // so that 2 * half is a multiple of 8
+
+    if (up * half * 2 > MaxFilterSize) return 0;
+
+    return new PolyphaseImpl(channels, up, down, half,
+                             scale * rolloff, beta, chunkSize);
+}
+
+Resampler::PolyphaseImpl::PolyphaseImpl(size_t channels,
+                                        size_t up, size_t down,
+                                        size_t half, double cutoff,
+                                        double beta, size_t chunkSize) :
+    m_channels(channels),
+    m_up(up),
+    m_down(down),
+    m_downWhole(down / up),
+    m_downFrac(down % up),
+    m_half(half),
+    m_taps(half * 2),
+    m_filter(0),
+    m_bufsiz(0),
+    m_fill(0),
+    m_base(0),
+    m_phase(0),
+    m_totalIn(0),
+    m_totalOut(0),
+    m_flushed(false),
+    m_outbufsiz(0),
+    m_in(0),
+    m_iin(0),
+    m_out(0),
+    m_incount(0),
+    m_padding(0),
+    m_outcount(0),
+    m_drop(0)
+{
+    Profiler profiler("Resampler::PolyphaseImpl::PolyphaseImpl", true);
+
+    makeFilter(cutoff, beta);
+
+    for (size_t c = 0; c < m_channels; ++c) {
+        m_buffers.push_back(0);
+        m_outbufs.push_back(0);
+    }
+
+    allocateBuffers(chunkSize > 0 ? chunkSize : 4096);
+    reset();
+
+#ifdef DEBUG_RESAMPLER
+    std::cerr << "Resampler::PolyphaseImpl: " << m_up << "/" << m_down
+              << ", " << m_taps << " taps, cutoff " << cutoff << std::endl;
+#endif
+}
+
+Resampler::PolyphaseImpl::~PolyphaseImpl()
+{
+    for (size_t c = 0; c < m_channels; ++c) {
+        delete[] m_buffers[c];
+        delete[] m_outbufs[c];
+    }
+
+    delete[] m_filter;
+}
+
+void
+Resampler::PolyphaseImpl::makeFilter(double cutoff, double beta)
+{
+    // Phase p, tap k is applied to the input sample whose distance
+    // from the output time is d = (k - half + 1) - p / L samples
+
+    m_filter = new float[m_up * m_taps];
+
+    double i0beta = besselI0(beta);
+
+    for (size_t p = 0; p < m_up; ++p) {
+
+        float *f = m_filter + p * m_taps;
+        double sum = 0.0;
+
+        for (size_t k = 0; k < m_taps; ++k) {
+
+            double d = double(k) - double(m_half) + 1.0 - double(p) / m_up;
+            double x = d / double(m_half);
+
+            double w = 0.0;
+            if (x > -1.0 && x < 1.0) {
+                w = besselI0(beta * sqrt(1.0 - x * x)) / i0beta;
+            }
+
+            double arg = M_PI * cutoff * d;
+            double sinc = (fabs(arg) < 1e-9 ? 1.0 : sin(arg) / arg);
+
+            double h = cutoff * sinc * w;
+            f[k] = float(h);
+            sum += h;
+        }
+
+        // Normalise each phase to unity gain at DC, so that there is
+        // no ripple at the rate of the phase sequence
+        if (sum != 0.0) {
+            for (size_t k = 0; k < m_taps; ++k) {
+                f[k] = float(f[k] / sum);
+            }
+        }
+    }
+}
+
+void
+Resampler::PolyphaseImpl::allocateBuffers(size_t frames)
+{
+    // The history held between calls is always less than the filter
+    // length, and the final call may add half a filter of padding
+
+    size_t bufsiz = frames + m_taps * 2;
+
+    if (bufsiz > m_bufsiz) {
+        for (size_t c = 0; c < m_channels; ++c) {
+            float *b = new float[bufsiz];
+            if (m_buffers[c]) {
+                memcpy(b, m_buffers[c], m_fill * sizeof(float));
+                delete[] m_buffers[c];
+            }
+            m_buffers[c] = b;
+        }
+        m_bufsiz = bufsiz;
+    }
+
+    size_t outbufsiz = getMaxOutputCount(frames, 0.f);
+
+    if (m_channels > 1 && outbufsiz > m_outbufsiz) {
+        for (size_t c = 0; c < m_channels; ++c) {
+            delete[] m_outbufs[c];
+            m_outbufs[c] = new float[outbufsiz];
+        }
+        m_outbufsiz = outbufsiz;
+    }
+}
+
+size_t
+Resampler::PolyphaseImpl::getMaxOutputCount(size_t incount, float) const
+{
+    // Every output needs an input half a filter beyond it, so at most
+    // a filter's worth of input (including the final padding) is
+    // ever held over without having produced output
+
+    unsigned long long in = incount + m_taps + 1;
+    return size_t((in * m_up + m_down - 1) / m_down + 1);
+}
+
+void
+Resampler::PolyphaseImpl::reset()
+{
+    // Start with half a filter of silence before the first input
+    // sample, which is then at m_base with phase 0, so that the
+    // output is aligned with the input and not delayed by the filter
+
+    for (size_t c = 0; c < m_channels; ++c) {
+        memset(m_buffers[c], 0, (m_half - 1) * sizeof(float));
+    }
+
+    m_fill = m_half - 1;
+    m_base = m_half - 1;
+    m_phase = 0;
+    m_totalIn = 0;
+    m_totalOut = 0;
+    m_flushed = false;
+}
+
+size_t
+Resampler::PolyphaseImpl::resample(float **in, float **out,
+                                   size_t incount, float, bool final)
+{
+    return process(in, 0, out, 0, incount, final);
+}
+
+size_t
+Resampler::PolyphaseImpl::resampleInterleaved(float *in, float *out,
+                                              size_t incount, float,
+                                              bool final)
+{
+    if (m_channels == 1) {
+        return process(&in, 0, &out, 0, incount, final);
+    }
+    return process(0, in, 0, out, incount, final);
+}
+
+size_t
+Resampler::PolyphaseImpl::process(float **in, const float *iin,
+                                  float **out, float *iout,
+                                  size_t incount, bool final)
+{
+    allocateBuffers(incount);
+
+    size_t padding = 0;
+    if (final && !m_flushed) {
+        padding = m_half;
+        m_flushed = true;
+    }
+
+    m_totalIn += incount;
+
+    // Work out how many outputs we can make, and where that leaves
+    // us, before we start: the sequence of positions is the same in
+    // every channel.  Output j is at base + (phase + j * M) / L, and
+    // needs input up to half a filter beyond that
+
+    size_t fill = m_fill + incount + padding;
+    size_t outcount = 0;
+
+    if (fill > m_base + m_half) {
+        unsigned long long limit = fill - m_half - m_base; // in whole samples
+        outcount = size_t((limit * m_up - m_phase + m_down - 1) / m_down);
+    }
+
+    if (final) {
+        // Don't run on into the padding beyond the end of the input
+        unsigned long long total = (m_totalIn * m_up + m_down - 1) / m_down;
+        if (m_totalOut + outcount > total) {
+            outcount = (total > m_totalOut ? size_t(total - m_totalOut) : 0);
+        }
+    }
+
+    unsigned long long advance = m_phase + (unsigned long long)outcount * m_down;
+    size_t base = m_base + size_t(advance / m_up);
+    size_t phase = size_t(advance % m_up);
+
+    // Discard the input that no later output will need
+
+    size_t drop = 0;
+    if (base + 1 > m_half) drop = base + 1 - m_half;
+    if (drop > fill) drop = fill;
+
+    m_in = in;
+    m_iin = iin;
+    m_out = (iout ? &m_outbufs[0] : out);
+    m_incount = incount;
+    m_padding = padding;
+    m_outcount = outcount;
+    m_drop = drop;
+
+    if (m_channels > 1 && incount >= ParallelThreshold) {
+        ThreadPool::getInstance()->run(this, int(m_channels));
+    } else {
+        for (size_t c = 0; c < m_channels; ++c) {
+            processChannel(c);
+        }
+    }
+
+    if (iout) {
+        for (size_t i = 0; i < outcount; ++i) {
+            for (size_t c = 0; c < m_channels; ++c) {
+                iout[i * m_channels + c] = m_outbufs[c][i];
+            }
+        }
+    }
+
+    m_fill = fill - drop;
+    m_base = base - drop;
+    m_phase = phase;
+    m_totalOut += outcount;
+
+    return outcount;
+}
+
+void
+Resampler::PolyphaseImpl::processChannel(size_t c)
+{
+    float *buf = m_buffers[c];
+    float *dst = buf + m_fill;
+
+    if (m_in) {
+        memcpy(dst, m_in[c], m_incount * sizeof(float));
+    } else {
+        const float *src = m_iin + c;
+        for (size_t i = 0; i < m_incount; ++i) {
+            dst[i] = src[i * m_channels];
+        }
+    }
+
+    if (m_padding > 0) {
+        memset(dst + m_incount, 0, m_padding * sizeof(float));
+    }
+
+    float *out = m_out[c];
+    const DotFunction dot = dotFunction;
+
+    const float *start = buf + m_base + 1 - m_half;
+    size_t phase = m_phase;
+
+    for (size_t i = 0; i < m_outcount; ++i) {
+        out[i] = dot(start, m_filter + phase * m_taps, m_taps);
+        start += m_downWhole;
+        phase += m_downFrac;
+        if (phase >= m_up) {
+            phase -= m_up;
+            ++start;
+        }
+    }
+
+    size_t fill = m_fill + m_incount + m_padding;
+    if (m_drop > 0) {
+        memmove(buf, buf + m_drop, (fill - m_drop) * sizeof(float));
+    }
+}
+
 Resampler::Resampler(Quality quality, size_t channels, size_t chunkSize)
 {
-    m_d = new D(quality, channels, chunkSize);
+    m_d = new SRCImpl(quality, channels, chunkSize);
+}
+
+Resampler::Resampler(Quality quality, size_t channels,
+                     size_t sourceRate, size_t targetRate,
+                     size_t chunkSize)
+{
+    m_d = PolyphaseImpl::create(quality, channels,
+                                sourceRate, targetRate, chunkSize);
+    if (!m_d) {
+#ifdef DEBUG_RESAMPLER
+        std::cerr << "Resampler: No polyphase filter for " << sourceRate
+                  << " -> " << targetRate << ", using libsamplerate"
+                  << std::endl;
+#endif
+        m_d = new SRCImpl(quality, channels, chunkSize);
+    }
 }
 
 Resampler::~Resampler()
@@ -162,6 +748,16 @@ Resampler::~Resampler()
     delete m_d;
 }
 
+Resampler::Quality
+Resampler::getQualityForPreference(int preference)
+{
+    switch (preference) {
+    case 0: return Fastest;
+    case 2: return Best;
+    default: return FastestTolerable;
+    }
+}
+
 size_t 
 Resampler::resample(float **in, float **out,
                     size_t incount, float ratio,
@@ -178,6 +774,12 @@ Resampler::resampleInterleaved(float *in, float *out,
     return m_d->resampleInterleaved(in, out, incount, ratio, final);
 }
 
+size_t
+Resampler::getMaxOutputCount(size_t incount, float ratio) const
+{
+    return m_d->getMaxOutputCount(incount, ratio);
+}
+
 void
 Resampler::reset()
 {
@@ -28,7 +28,34 @@ class Resampler
 public:
     enum Quality { Best, FastestTolerable, Fastest };
 
+    /**
+     * Return the quality that corresponds to a value of the Resample
+     * Quality preference: 0 for Fastest, 1 for FastestTolerable and
+     * 2 for Best.  Any other value gives FastestTolerable.
+     */
+    static Quality getQualityForPreference(int preference);
+
+    /**
+     * Construct a resampler that accepts any ratio, and may have its
+     * ratio changed from one call to the next.  This uses
+     * libsamplerate.
+     */
     Resampler(Quality quality, size_t channels, size_t chunkSize = 0);
+
+    /**
+     * Construct a resampler for a fixed conversion from sourceRate
+     * to targetRate.  Where the ratio between the rates is simple
+     * enough (as it is between all of the common audio rates), this
+     * uses a polyphase filter whose coefficients are calculated in
+     * advance, with vectorised inner loops, and resamples the
+     * channels of large blocks in parallel.  Otherwise it falls back
+     * to libsamplerate.  The ratio passed to resample() or
+     * resampleInterleaved() must be targetRate / sourceRate.
+     */
+    Resampler(Quality quality, size_t channels,
+              size_t sourceRate, size_t targetRate,
+              size_t chunkSize = 0);
+
     ~Resampler();
 
     size_t resample(float **in, float **out,
@@ -39,10 +66,21 @@ public:
                                size_t incount, float ratio,
                                bool final = false);
 
+    /**
+     * Return the largest number of frames that a call to resample()
+     * or resampleInterleaved() with the given input frame count and
+     * ratio may return, for sizing output buffers.  The final call
+     * may return more frames than the input count alone implies, as
+     * it flushes out any input still held in the filter.
+     */
+    size_t getMaxOutputCount(size_t incount, float ratio) const;
+
     void reset();
 
 protected:
     class D;
+    class SRCImpl;
+    class PolyphaseImpl;
     D *m_d;
 };
 
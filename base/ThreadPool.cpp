@@ -0,0 +1,130 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ThreadPool.h"
+
+ThreadPool *
+ThreadPool::getInstance()
+{
+    // Destroyed, and its workers stopped, on exit
+    static ThreadPool instance;
+    return &instance;
+}
+
+ThreadPool::ThreadPool() :
+    m_exiting(false)
+{
+    int count = QThread::idealThreadCount();
+    if (count > MaxThreads) count = MaxThreads;
+
+    for (int i = 1; i < count; ++i) {
+        Worker *worker = new Worker(this);
+        m_workers.push_back(worker);
+        worker->start();
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    m_mutex.lock();
+    m_exiting = true;
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+}
+
+void
+ThreadPool::run(Job *job, int taskCount)
+{
+    if (taskCount <= 0) return;
+
+    if (m_workers.empty() || taskCount == 1) {
+        for (int i = 0; i < taskCount; ++i) job->perform(i);
+        return;
+    }
+
+    Run run;
+    run.job = job;
+    run.taskCount = taskCount;
+    run.nextTask = 0;
+    run.active = 0;
+
+    m_mutex.lock();
+    m_runs.push_back(&run);
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    work(&run);
+
+    // Withdraw the run so that no worker can start on it from now
+    // on, then wait for those that already have to finish
+
+    m_mutex.lock();
+    m_runs.remove(&run);
+    while (run.active > 0) {
+        m_doneCondition.wait(&m_mutex);
+    }
+    m_mutex.unlock();
+}
+
+void
+ThreadPool::work(Run *run)
+{
+    while (1) {
+        int i = run->nextTask.fetchAndAddOrdered(1);
+        if (i >= run->taskCount) break;
+        run->job->perform(i);
+    }
+}
+
+void
+ThreadPool::Worker::run()
+{
+    m_pool->m_mutex.lock();
+
+    while (!m_pool->m_exiting) {
+
+        Run *run = 0;
+
+        for (std::list<Run *>::iterator i = m_pool->m_runs.begin();
+             i != m_pool->m_runs.end(); ++i) {
+            if (int((*i)->nextTask) < (*i)->taskCount) {
+                run = *i;
+                break;
+            }
+        }
+
+        if (!run) {
+            m_pool->m_condition.wait(&m_pool->m_mutex);
+            continue;
+        }
+
+        ++run->active;
+        m_pool->m_mutex.unlock();
+
+        m_pool->work(run);
+
+        m_pool->m_mutex.lock();
+        if (--run->active == 0) {
+            m_pool->m_doneCondition.wakeAll();
+        }
+    }
+
+    m_pool->m_mutex.unlock();
+}
@@ -0,0 +1,100 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include "Thread.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+#include <vector>
+#include <list>
+
+/**
+ * A process-wide set of worker threads that share out the numbered
+ * tasks of a job between themselves and the thread that submits it.
+ *
+ * Jobs may be submitted from any number of threads at once.  The
+ * submitting thread always works on its own job as well, and takes
+ * whatever tasks no worker has claimed, so a job completes even if
+ * every worker is busy elsewhere.  A task may itself submit a job.
+ */
+class ThreadPool
+{
+public:
+    class Job
+    {
+    public:
+        virtual ~Job() { }
+
+        /**
+         * Carry out task number n of the job.  This may be called
+         * from any of the pool's threads, concurrently with the
+         * other tasks of the same job.
+         */
+        virtual void perform(int n) = 0;
+    };
+
+    static ThreadPool *getInstance();
+
+    /**
+     * Return the largest number of threads that may work on a single
+     * job, including the one that submits it.
+     */
+    int getThreadCount() const { return int(m_workers.size()) + 1; }
+
+    /**
+     * Call job->perform() for every task from 0 to taskCount-1,
+     * sharing the calls between the calling thread and any idle
+     * workers, and return when all of them are done.
+     */
+    void run(Job *job, int taskCount);
+
+protected:
+    ThreadPool();
+    ~ThreadPool();
+
+    struct Run {
+        Job *job;
+        int taskCount;
+        QAtomicInt nextTask;
+        int active; // workers inside work() for this run
+    };
+
+    class Worker : public Thread
+    {
+    public:
+        Worker(ThreadPool *pool) : m_pool(pool) { }
+    protected:
+        virtual void run();
+        ThreadPool *m_pool;
+    };
+
+    void work(Run *run);
+
+    std::vector<Worker *> m_workers;
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QWaitCondition m_doneCondition;
+    std::list<Run *> m_runs; // runs that may still have unclaimed tasks
+    bool m_exiting;
+
+    static const int MaxThreads = 8; // including the submitting thread
+};
+
+#endif
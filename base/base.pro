@@ -18,6 +18,7 @@ HEADERS += AudioLevel.h \
            AudioPlaySource.h \
            Clipboard.h \
            Command.h \
+           DecodeScheduler.h \
            Exceptions.h \
            LogRange.h \
            Pitch.h \
@@ -37,12 +38,12 @@ HEADERS += AudioLevel.h \
            RingBuffer.h \
            Scavenger.h \
            Selection.h \
-           Serialiser.h \
            StorageAdviser.h \
            StringBits.h \
            TempDirectory.h \
            TextMatcher.h \
            Thread.h \
+           ThreadPool.h \
            UnitDatabase.h \
            ViewManagerBase.h \
            Window.h \
@@ -51,6 +52,7 @@ HEADERS += AudioLevel.h \
 SOURCES += AudioLevel.cpp \
            Clipboard.cpp \
            Command.cpp \
+           DecodeScheduler.cpp \
            Exceptions.cpp \
            LogRange.cpp \
            Pitch.cpp \
@@ -66,12 +68,12 @@ SOURCES += AudioLevel.cpp \
            RecentFiles.cpp \
            Resampler.cpp \
            Selection.cpp \
-           Serialiser.cpp \
            StorageAdviser.cpp \
            StringBits.cpp \
            TempDirectory.cpp \
            TextMatcher.cpp \
            Thread.cpp \
+           ThreadPool.cpp \
            UnitDatabase.cpp \
            ViewManagerBase.cpp \
            XmlExportable.cpp
@@ -28,11 +28,14 @@ HEADERS += fft/FFTapi.h \
            fft/FFTDataServer.h \
            fft/FFTFileCacheReader.h \
            fft/FFTFileCacheWriter.h \
+           fft/FFTKernels.h \
            fft/FFTMemoryCache.h \
+           fft/FFTPersistentCache.h \
            fileio/AudioFileReader.h \
            fileio/AudioFileReaderFactory.h \
            fileio/BZipFileDevice.h \
            fileio/CachedFile.h \
+           fileio/ChunkedAudioStore.h \
            fileio/CodedAudioFileReader.h \
            fileio/CSVFileReader.h \
            fileio/CSVFileWriter.h \
@@ -51,6 +54,7 @@ HEADERS += fft/FFTapi.h \
            fileio/PlaylistFileReader.h \
            fileio/QuickTimeFileReader.h \
            fileio/ResamplingWavFileReader.h \
+           fileio/SampleKernels.h \
            fileio/WavFileReader.h \
            fileio/WavFileWriter.h \
            midi/MIDIEvent.h \
@@ -73,7 +77,9 @@ HEADERS += fft/FFTapi.h \
            model/PathModel.h \
            model/PowerOfSqrtTwoZoomConstraint.h \
            model/PowerOfTwoZoomConstraint.h \
+           model/RangeKernels.h \
            model/RangeSummarisableTimeValueModel.h \
+           model/RangeSummariser.h \
            model/RegionModel.h \
            model/SparseModel.h \
            model/SparseOneDimensionalModel.h \
@@ -89,11 +95,14 @@ SOURCES += fft/FFTapi.cpp \
            fft/FFTDataServer.cpp \
            fft/FFTFileCacheReader.cpp \
            fft/FFTFileCacheWriter.cpp \
+           fft/FFTKernels.cpp \
            fft/FFTMemoryCache.cpp \
+           fft/FFTPersistentCache.cpp \
            fileio/AudioFileReader.cpp \
            fileio/AudioFileReaderFactory.cpp \
            fileio/BZipFileDevice.cpp \
            fileio/CachedFile.cpp \
+           fileio/ChunkedAudioStore.cpp \
            fileio/CodedAudioFileReader.cpp \
            fileio/CSVFileReader.cpp \
            fileio/CSVFileWriter.cpp \
@@ -110,6 +119,7 @@ SOURCES += fft/FFTapi.cpp \
            fileio/PlaylistFileReader.cpp \
            fileio/QuickTimeFileReader.cpp \
            fileio/ResamplingWavFileReader.cpp \
+           fileio/SampleKernels.cpp \
            fileio/WavFileReader.cpp \
            fileio/WavFileWriter.cpp \
            midi/MIDIInput.cpp \
@@ -124,7 +134,9 @@ SOURCES += fft/FFTapi.cpp \
            model/ModelDataTableModel.cpp \
            model/PowerOfSqrtTwoZoomConstraint.cpp \
            model/PowerOfTwoZoomConstraint.cpp \
+           model/RangeKernels.cpp \
            model/RangeSummarisableTimeValueModel.cpp \
+           model/RangeSummariser.cpp \
            model/WaveFileModel.cpp \
            model/WritableWaveFileModel.cpp \
            osc/OSCMessage.cpp \
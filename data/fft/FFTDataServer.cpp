@@ -18,6 +18,8 @@
 #include "FFTFileCacheReader.h"
 #include "FFTFileCacheWriter.h"
 #include "FFTMemoryCache.h"
+#include "FFTKernels.h"
+#include "FFTPersistentCache.h"
 
 #include "model/DenseTimeValueModel.h"
 
@@ -30,6 +32,8 @@
 
 #include <QWriteLocker>
 
+#include <algorithm>
+
 //#define DEBUG_FFT_SERVER 1
 //#define DEBUG_FFT_SERVER_FILL 1
 
@@ -224,6 +228,26 @@ FFTDataServer::getFuzzyInstance(const DenseTimeValueModel *model,
                        fillFromColumn);
 }
 
+bool
+FFTDataServer::haveInstance(const DenseTimeValueModel *model,
+                            int channel,
+                            WindowType windowType,
+                            size_t windowSize,
+                            size_t windowIncrement,
+                            size_t fftSize)
+{
+    MutexLocker locker(&m_serverMapMutex, "FFTDataServer::haveInstance::m_serverMapMutex");
+
+    for (int polar = 0; polar < 2; ++polar) {
+        QString n = generateFileBasename(model, channel, windowType,
+                                         windowSize, windowIncrement,
+                                         fftSize, polar != 0);
+        if (m_servers.find(n) != m_servers.end()) return true;
+    }
+
+    return false;
+}
+
 FFTDataServer *
 FFTDataServer::findServer(QString n)
 {    
@@ -503,10 +527,12 @@ FFTDataServer::FFTDataServer(QString fileBaseName,
     m_cacheWidthPower(0),
     m_cacheWidthMask(0),
     m_criteria(criteria),
-    m_fftInput(0),
+    m_buffers(0),
     m_exiting(false),
     m_suspended(true), //!!! or false?
-    m_fillThread(0)
+    m_fillThread(0),
+    m_visibleColumnsGeneration(0),
+    m_accessDirection(MatrixFile::AccessUnknown)
 {
 #ifdef DEBUG_FFT_SERVER
     std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "])::FFTDataServer" << std::endl;
@@ -562,27 +588,30 @@ FFTDataServer::FFTDataServer(QString fileBaseName,
         }
     }
 
+    m_persistent = (FFTPersistentCache::isEnabled() &&
+                    FFTPersistentCache::canPersist(m_model));
+
     for (size_t i = 0; i <= m_width / m_cacheWidth; ++i) {
         m_caches.push_back(0);
     }
 
-    m_fftInput = (fftsample *)
-        fftf_malloc(fftSize * sizeof(fftsample));
+    m_buffers = new FillBuffers(m_fftSize);
 
-    m_fftOutput = (fftf_complex *)
-        fftf_malloc((fftSize/2 + 1) * sizeof(fftf_complex));
+    // No point in having more workers than there are chunks of
+    // columns for them to work on
 
-    m_workbuffer = (float *)
-        fftf_malloc((fftSize+2) * sizeof(float));
+    size_t workers = getFillWorkerCount();
+    size_t chunks = (m_width + FillChunkSize - 1) / FillChunkSize;
+    if (workers > chunks) workers = chunks;
+    if (workers < 1) workers = 1;
 
-    m_fftPlan = fftf_plan_dft_r2c_1d(m_fftSize,
-                                     m_fftInput,
-                                     m_fftOutput,
-                                     FFTW_MEASURE);
+#ifdef DEBUG_FFT_SERVER
+    std::cerr << "FFTDataServer(" << this << "): using " << workers
+              << " fill worker(s)" << std::endl;
+#endif
 
-    if (!m_fftPlan) {
-        std::cerr << "ERROR: fftf_plan_dft_r2c_1d(" << m_windowSize << ") failed!" << std::endl;
-        throw(0);
+    for (size_t i = 0; i < workers; ++i) {
+        m_workerBuffers.push_back(new FillBuffers(m_fftSize));
     }
 
     m_fillThread = new FillThread(*this, fillFromColumn);
@@ -609,9 +638,8 @@ FFTDataServer::~FFTDataServer()
     QWriteLocker wlocker(&m_cacheVectorLock);
 
     for (CacheVector::iterator i = m_caches.begin(); i != m_caches.end(); ++i) {
-        if (*i) {
-            delete *i;
-        }
+        CacheBlock *cb = *i;
+        delete cb;
     }
 
     deleteProcessingData();
@@ -623,13 +651,54 @@ FFTDataServer::deleteProcessingData()
 #ifdef DEBUG_FFT_SERVER
     std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): deleteProcessingData" << std::endl;
 #endif
-    if (m_fftInput) {
-        fftf_destroy_plan(m_fftPlan);
-        fftf_free(m_fftInput);
-        fftf_free(m_fftOutput);
-        fftf_free(m_workbuffer);
+    delete m_buffers;
+    m_buffers = 0;
+
+    for (size_t i = 0; i < m_workerBuffers.size(); ++i) {
+        delete m_workerBuffers[i];
     }
-    m_fftInput = 0;
+    m_workerBuffers.clear();
+}
+
+FFTDataServer::FillBuffers::FillBuffers(size_t fftSize) :
+    input(0),
+    output(0),
+    workbuffer(0),
+    plan(0)
+{
+    input = (fftsample *)
+        fftf_malloc(fftSize * sizeof(fftsample));
+
+    output = (fftf_complex *)
+        fftf_malloc((fftSize/2 + 1) * sizeof(fftf_complex));
+
+    workbuffer = (float *)
+        fftf_malloc((fftSize+2) * sizeof(float));
+
+    plan = fftf_plan_dft_r2c_1d(fftSize, input, output, FFTW_MEASURE);
+
+    if (!plan) {
+        std::cerr << "ERROR: fftf_plan_dft_r2c_1d(" << fftSize << ") failed!" << std::endl;
+        throw(0);
+    }
+}
+
+FFTDataServer::FillBuffers::~FillBuffers()
+{
+    if (plan) fftf_destroy_plan(plan);
+    if (input) fftf_free(input);
+    if (output) fftf_free(output);
+    if (workbuffer) fftf_free(workbuffer);
+}
+
+int
+FFTDataServer::getFillWorkerCount()
+{
+    // Leave one core for the GUI and playback where we can
+    int count = QThread::idealThreadCount() - 1;
+    if (count < 1) count = 1;
+    if (count > MaxFillWorkers) count = MaxFillWorkers;
+    return count;
 }
 
 void
@@ -726,6 +795,16 @@ FFTDataServer::getStorageAdvice(size_t w, size_t h,
         memoryCache = true;
     }
 
+    // If this server's data is going to be kept in the persistent
+    // cache, it has to be written to disc anyway.  File caches are
+    // memory mapped for reading, so this costs little unless memory
+    // is the only sensible option
+
+    if (memoryCache && !(recommendation & StorageAdviser::UseMemory) &&
+        m_persistent) {
+        memoryCache = false;
+    }
+
     compactCache = canCompact &&
         (recommendation & StorageAdviser::ConserveSpace);
 
@@ -747,17 +826,15 @@ FFTDataServer::makeCache(int c)
 
     QMutexLocker locker(&m_cacheCreationMutex);
 
-    m_cacheVectorLock.lockForRead();
-    if (m_caches[c]) {
+    CacheBlock *existing = m_caches[c];
+    if (existing) {
         // someone else must have created the cache between our
         // testing for it and taking the mutex
-        m_cacheVectorLock.unlock();
         return true;
     }
-    m_cacheVectorLock.unlock();
 
-    // Now m_cacheCreationMutex is held, but m_cacheVectorLock is not
-    // -- readers can proceed, but callers to this function will block
+    // Now m_cacheCreationMutex is held -- readers can proceed, but
+    // callers to this function will block
 
     CacheBlock *cb = new CacheBlock;
 
@@ -822,13 +899,37 @@ FFTDataServer::makeCache(int c)
             std::cerr << "ERROR: Failed to construct disc cache for FFT data: "
                       << e.what() << std::endl;
         }
-    }
 
-    m_cacheVectorLock.lockForWrite();
+        if (cb->fileCacheWriter) {
 
-    m_caches[c] = cb;
+            // If the cache file can be memory-mapped, one reader can
+            // be shared by all threads; otherwise each reading thread
+            // makes its own in makeCacheReader
 
-    m_cacheVectorLock.unlock();
+            try {
+                FFTFileCacheReader *reader =
+                    new FFTFileCacheReader(cb->fileCacheWriter);
+                if (reader->isShareable()) {
+                    int direction = m_accessDirection;
+                    if (direction != MatrixFile::AccessUnknown) {
+                        reader->adviseAccess
+                            (MatrixFile::AccessDirection(direction), 0, 0);
+                    }
+                    cb->sharedFileCacheReader = reader;
+                } else {
+                    delete reader;
+                }
+            } catch (std::exception e) {
+                std::cerr << "WARNING: Failed to construct shared disc cache reader for FFT data: "
+                          << e.what() << std::endl;
+            }
+        }
+    }
+
+    // Publish the block only once it is completely constructed, as
+    // readers look it up without locking
+
+    m_caches[c].fetchAndStoreOrdered(cb);
 
     return success;
 }
@@ -843,35 +944,53 @@ FFTDataServer::makeCacheReader(int c)
 #endif
 
     QThread *me = QThread::currentThread();
-    QWriteLocker locker(&m_cacheVectorLock);
-    CacheBlock *cb(m_caches.at(c));
+    CacheBlock *cb = m_caches[c];
     if (!cb || !cb->fileCacheWriter) return false;
 
+    FFTFileCacheReader *reader = 0;
+
     try {
         
-        cb->fileCacheReader[me] = new FFTFileCacheReader(cb->fileCacheWriter);
+        reader = new FFTFileCacheReader(cb->fileCacheWriter);
 
     } catch (std::exception e) {
 
-        delete cb->fileCacheReader[me];
-        cb->fileCacheReader.erase(me);
+        delete reader;
             
         std::cerr << "ERROR: Failed to construct disc cache reader for FFT data: "
                   << e.what() << std::endl;
         return false;
     }
 
+    if (!cb->claimReaderSlot(me, reader)) {
+#ifdef DEBUG_FFT_SERVER
+        std::cerr << "FFTDataServer::makeCacheReader: No free reader slots in cache " << c << ", using overflow map" << std::endl;
+#endif
+        QWriteLocker locker(&m_cacheVectorLock);
+        cb->fileCacheReader[me] = reader;
+    }
+
     // erase a reader that looks like it may no longer going to be
     // used by this thread for a while (leaving alone the current
     // and previous cache readers)
     int deleteCandidate = c - 2;
     if (deleteCandidate < 0) deleteCandidate = c + 2;
-    if (deleteCandidate >= m_caches.size()) {
+    if (deleteCandidate >= int(m_caches.size())) {
+        return true;
+    }
+
+    cb = m_caches[deleteCandidate];
+    if (!cb) return true;
+
+    if (cb->releaseReaderSlot(me)) {
+#ifdef DEBUG_FFT_SERVER
+        std::cerr << "FFTDataServer::makeCacheReader: Deleted probably unpopular reader " << deleteCandidate << " for this thread (as I create reader " << c << ")" << std::endl;
+#endif
         return true;
     }
 
-    cb = m_caches.at(deleteCandidate);
-    if (cb && cb->fileCacheReader.find(me) != cb->fileCacheReader.end()) {
+    QWriteLocker locker(&m_cacheVectorLock);
+    if (cb->fileCacheReader.find(me) != cb->fileCacheReader.end()) {
 #ifdef DEBUG_FFT_SERVER
         std::cerr << "FFTDataServer::makeCacheReader: Deleting probably unpopular reader " << deleteCandidate << " for this thread (as I create reader " << c << ")" << std::endl;
 #endif
@@ -1150,14 +1269,7 @@ FFTDataServer::fillColumn(size_t x)
                   << x << "): model not yet ready" << std::endl;
         return;
     }
-/*
-    if (!m_fftInput) {
-        std::cerr << "WARNING: FFTDataServer::fillColumn(" << x << "): "
-                  << "input has already been completed and discarded?"
-                  << std::endl;
-        return;
-    }
-*/
+
     if (x >= m_width) {
         std::cerr << "WARNING: FFTDataServer::fillColumn(" << x << "): "
                   << "x > width (" << x << " > " << m_width << ")"
@@ -1172,6 +1284,53 @@ FFTDataServer::fillColumn(size_t x)
     FFTCacheWriter *cache = getCacheWriter(x, col);
     if (!cache) return;
 
+    QMutexLocker locker(&m_fftBuffersLock);
+
+    // We may have been called from a function that wanted to obtain a
+    // column using an FFTCacheReader.  Before calling us, it checked
+    // whether the column was available already, and the reader
+    // reported that it wasn't.  Now we test again, with the mutex
+    // held, to avoid a race condition in case another thread has
+    // called fillColumn at the same time.
+    if (cache->haveSetColumnAt(col)) {
+        return;
+    }
+
+    if (!m_buffers) {
+        std::cerr << "WARNING: FFTDataServer::fillColumn(" << x << "): "
+                  << "input has already been completed and discarded?"
+                  << std::endl;
+        return;
+    }
+
+    processColumn(x, col, cache, *m_buffers);
+}
+
+void
+FFTDataServer::fillColumn(size_t x, FillBuffers &buffers)
+{
+    // Called from a fill worker thread, with that worker's own
+    // buffers, so no need for m_fftBuffersLock.  A column may
+    // occasionally be calculated twice if a reader requests it on
+    // demand at the same moment, but the results are identical.
+
+    Profiler profiler("FFTDataServer::fillColumn [worker]", false);
+
+    size_t col;
+    FFTCacheWriter *cache = getCacheWriter(x, col);
+    if (!cache) return;
+
+    if (cache->haveSetColumnAt(col)) {
+        return;
+    }
+
+    processColumn(x, col, cache, buffers);
+}
+
+void
+FFTDataServer::processColumn(size_t x, size_t col, FFTCacheWriter *cache,
+                             FillBuffers &buffers)
+{
     int winsize = m_windowSize;
     int fftsize = m_fftSize;
     int hs = fftsize/2;
@@ -1186,7 +1345,7 @@ FFTDataServer::fillColumn(size_t x)
     endFrame   -= winsize / 2;
 
 #ifdef DEBUG_FFT_SERVER_FILL
-    std::cerr << "FFTDataServer::fillColumn: requesting frames "
+    std::cerr << "FFTDataServer::processColumn: requesting frames "
               << startFrame + pfx << " -> " << endFrame << " ( = "
               << endFrame - (startFrame + pfx) << ") at index "
               << off + pfx << " in buffer of size " << m_fftSize
@@ -1194,37 +1353,22 @@ FFTDataServer::fillColumn(size_t x)
               << " from channel " << m_channel << std::endl;
 #endif
 
-    QMutexLocker locker(&m_fftBuffersLock);
-
-    // We may have been called from a function that wanted to obtain a
-    // column using an FFTCacheReader.  Before calling us, it checked
-    // whether the column was available already, and the reader
-    // reported that it wasn't.  Now we test again, with the mutex
-    // held, to avoid a race condition in case another thread has
-    // called fillColumn at the same time.
-    if (cache->haveSetColumnAt(x & m_cacheWidthMask)) {
-        return;
-    }
-
-    if (!m_fftInput) {
-        std::cerr << "WARNING: FFTDataServer::fillColumn(" << x << "): "
-                  << "input has already been completed and discarded?"
-                  << std::endl;
-        return;
-    }
+    fftsample *input = buffers.input;
+    fftf_complex *output = buffers.output;
+    float *workbuffer = buffers.workbuffer;
 
     for (int i = 0; i < off; ++i) {
-        m_fftInput[i] = 0.0;
+        input[i] = 0.0;
     }
 
     for (int i = 0; i < off; ++i) {
-        m_fftInput[fftsize - i - 1] = 0.0;
+        input[fftsize - i - 1] = 0.0;
     }
 
     if (startFrame < 0) {
 	pfx = -startFrame;
 	for (int i = 0; i < pfx; ++i) {
-	    m_fftInput[off + i] = 0.0;
+	    input[off + i] = 0.0;
 	}
     }
 
@@ -1232,10 +1376,10 @@ FFTDataServer::fillColumn(size_t x)
     if (endFrame > startFrame + pfx) count = endFrame - (startFrame + pfx);
 
     int got = m_model->getData(m_channel, startFrame + pfx,
-                               count, m_fftInput + off + pfx);
+                               count, input + off + pfx);
 
     while (got + pfx < winsize) {
-	m_fftInput[off + got + pfx] = 0.0;
+	input[off + got + pfx] = 0.0;
 	++got;
     }
 
@@ -1243,63 +1387,54 @@ FFTDataServer::fillColumn(size_t x)
 	int channels = m_model->getChannelCount();
 	if (channels > 1) {
 	    for (int i = 0; i < winsize; ++i) {
-		m_fftInput[off + i] /= channels;
+		input[off + i] /= channels;
 	    }
 	}
     }
 
-    m_windower.cut(m_fftInput + off);
+    m_windower.cut(input + off);
 
     for (int i = 0; i < hs; ++i) {
-	fftsample temp = m_fftInput[i];
-	m_fftInput[i] = m_fftInput[i + hs];
-	m_fftInput[i + hs] = temp;
+	fftsample temp = input[i];
+	input[i] = input[i + hs];
+	input[i + hs] = temp;
     }
 
-    fftf_execute(m_fftPlan);
+    fftf_execute(buffers.plan);
 
     float factor = 0.f;
 
     if (cache->getStorageType() == FFTCache::Compact ||
         cache->getStorageType() == FFTCache::Polar) {
 
-        for (int i = 0; i <= hs; ++i) {
-            fftsample real = m_fftOutput[i][0];
-            fftsample imag = m_fftOutput[i][1];
-            float mag = sqrtf(real * real + imag * imag);
-            m_workbuffer[i] = mag;
-            m_workbuffer[i + hs + 1] = atan2f(imag, real);
-            if (mag > factor) factor = mag;
-        }
+        factor = FFTKernels::interleavedToPolar((const float *)output,
+                                                workbuffer,
+                                                workbuffer + hs + 1,
+                                                hs + 1);
 
     } else {
 
         for (int i = 0; i <= hs; ++i) {
-            m_workbuffer[i] = m_fftOutput[i][0];
-            m_workbuffer[i + hs + 1] = m_fftOutput[i][1];
+            workbuffer[i] = output[i][0];
+            workbuffer[i + hs + 1] = output[i][1];
         }
     }
 
-    Profiler subprof("FFTDataServer::fillColumn: set to cache");
+    Profiler subprof("FFTDataServer::processColumn: set to cache");
 
     if (cache->getStorageType() == FFTCache::Compact ||
         cache->getStorageType() == FFTCache::Polar) {
             
         cache->setColumnAt(col,
-                           m_workbuffer,
-                           m_workbuffer + hs + 1,
+                           workbuffer,
+                           workbuffer + hs + 1,
                            factor);
 
     } else {
 
         cache->setColumnAt(col,
-                           m_workbuffer,
-                           m_workbuffer + hs + 1);
-    }
-
-    if (m_suspended) {
-//        std::cerr << "FFTDataServer::fillColumn(" << x << "): calling resume" << std::endl;
-//        resume();
+                           workbuffer,
+                           workbuffer + hs + 1);
     }
 }    
 
@@ -1307,13 +1442,126 @@ void
 FFTDataServer::fillComplete()
 {
     for (int i = 0; i < int(m_caches.size()); ++i) {
-        if (m_caches[i]->memoryCache) {
-            m_caches[i]->memoryCache->allColumnsWritten();
+        CacheBlock *cb = m_caches[i];
+        if (!cb) continue;
+        if (cb->memoryCache) {
+            cb->memoryCache->allColumnsWritten();
         }
-        if (m_caches[i]->fileCacheWriter) {
-            m_caches[i]->fileCacheWriter->allColumnsWritten();
+        if (cb->fileCacheWriter) {
+            cb->fileCacheWriter->allColumnsWritten();
         }
     }
+
+    saveToPersistentCache();
+}
+
+bool
+FFTDataServer::restoreFromPersistentCache()
+{
+    // Called from the fill thread once the model is ready, before
+    // any filling has happened
+
+    if (!m_persistent) return false;
+
+    m_persistentKey = FFTPersistentCache::makeKey
+        (m_model, m_channel, m_windower.getType(),
+         m_windowSize, m_windowIncrement, m_fftSize, m_polar);
+
+    if (m_persistentKey == "") return false;
+
+    FFTPersistentCache::Entry entry;
+    entry.storageType = FFTCache::Compact;
+    entry.width = m_width;
+    entry.height = m_height;
+    entry.blockWidth = m_cacheWidth;
+    entry.blockCount = getCacheBlockCount();
+
+    QString base = QString("%1-restored").arg(m_fileBaseName);
+
+    if (!FFTPersistentCache::retrieve(m_persistentKey, base, entry)) {
+        return false;
+    }
+
+    // We only use the restored data if every block can be read
+    // through a single memory-mapped reader: there is no writer for
+    // these files for per-thread readers to be constructed from
+
+    std::vector<FFTFileCacheReader *> readers;
+    bool ok = true;
+
+    for (size_t c = 0; c < entry.blockCount; ++c) {
+        size_t width = m_cacheWidth;
+        if (c * m_cacheWidth + width > m_width) {
+            width = m_width - c * m_cacheWidth;
+        }
+        try {
+            FFTFileCacheReader *reader = new FFTFileCacheReader
+                (QString("%1-%2").arg(base).arg(c),
+                 entry.storageType, width, m_height);
+            readers.push_back(reader);
+            if (!reader->isShareable()) ok = false;
+        } catch (std::exception e) {
+            std::cerr << "WARNING: FFTDataServer: Failed to open restored "
+                      << "FFT cache: " << e.what() << std::endl;
+            ok = false;
+        }
+        if (!ok) break;
+    }
+
+    if (ok) {
+        QMutexLocker locker(&m_cacheCreationMutex);
+        // If any block has already been created by an on-demand
+        // request, don't mix restored and calculated blocks
+        for (size_t c = 0; c < entry.blockCount; ++c) {
+            CacheBlock *existing = m_caches[c];
+            if (existing) ok = false;
+        }
+        if (ok) {
+            for (size_t c = 0; c < entry.blockCount; ++c) {
+                CacheBlock *cb = new CacheBlock;
+                cb->sharedFileCacheReader = readers[c];
+                m_caches[c].fetchAndStoreOrdered(cb);
+            }
+        }
+    }
+
+    if (!ok) {
+        for (size_t i = 0; i < readers.size(); ++i) delete readers[i];
+        FFTPersistentCache::discard(base, entry.blockCount);
+        return false;
+    }
+
+#ifdef DEBUG_FFT_SERVER
+    std::cerr << "FFTDataServer(" << this << "): restored "
+              << entry.blockCount << " cache block(s) from persistent cache"
+              << std::endl;
+#endif
+
+    return true;
+}
+
+void
+FFTDataServer::saveToPersistentCache()
+{
+    if (m_persistentKey == "") return;
+
+    // Only whole disc caches of a single storage type can be stored
+
+    FFTPersistentCache::Entry entry;
+    entry.width = m_width;
+    entry.height = m_height;
+    entry.blockWidth = m_cacheWidth;
+    entry.blockCount = getCacheBlockCount();
+
+    for (size_t c = 0; c < entry.blockCount; ++c) {
+        CacheBlock *cb = m_caches[c];
+        if (!cb || !cb->fileCacheWriter) return;
+        FFTCache::StorageType type = cb->fileCacheWriter->getStorageType();
+        if (c == 0) entry.storageType = type;
+        else if (type != entry.storageType) return;
+    }
+
+    FFTPersistentCache::store(m_persistentKey, m_fileBaseName, entry);
 }
 
 size_t
@@ -1330,6 +1578,96 @@ FFTDataServer::getFillExtent() const
     else return m_model->getEndFrame();
 }
 
+void
+FFTDataServer::setVisibleColumns(const void *client, size_t x0, size_t x1)
+{
+    if (x1 > m_width) x1 = m_width;
+    if (x0 > x1) x0 = x1;
+
+    MatrixFile::AccessDirection advise = MatrixFile::AccessUnknown;
+
+    {
+        QMutexLocker locker(&m_visibleColumnsMutex);
+
+        VisibleColumnMap::iterator i = m_visibleColumns.find(client);
+        if (i != m_visibleColumns.end() &&
+            i->second.first == x0 && i->second.second == x1) {
+            return;
+        }
+
+#ifdef DEBUG_FFT_SERVER_FILL
+        std::cerr << "FFTDataServer(" << this << ")::setVisibleColumns("
+                  << client << ", " << x0 << ", " << x1 << ")" << std::endl;
+#endif
+
+        if (i != m_visibleColumns.end() && x0 != i->second.first) {
+
+            // A move that overlaps the previous range is a scroll; any
+            // other move is a jump
+
+            size_t p0 = i->second.first, p1 = i->second.second;
+            MatrixFile::AccessDirection direction = MatrixFile::AccessRandom;
+            if (x0 > p0 && x0 < p1) direction = MatrixFile::AccessForward;
+            else if (x0 < p0 && x1 > p0) direction = MatrixFile::AccessBackward;
+
+            ScrollState &state = m_scrollStates[client];
+            if (state.direction == direction) {
+                ++state.moves;
+            } else {
+                state.direction = direction;
+                state.moves = 1;
+            }
+            if (state.moves >= AdviseAfterMoves) advise = direction;
+        }
+
+        m_visibleColumns[client] = ColumnRange(x0, x1);
+        m_visibleColumnsGeneration.fetchAndAddOrdered(1);
+    }
+
+    if (advise != MatrixFile::AccessUnknown) {
+        // Backward scrolling gets no read-ahead from the system, so
+        // ask for a screenful of the columns preceding the view
+        size_t w = x1 - x0;
+        adviseAccess(advise, x0 > w ? x0 - w : 0, x0);
+    }
+}
+
+void
+FFTDataServer::clearVisibleColumns(const void *client)
+{
+    QMutexLocker locker(&m_visibleColumnsMutex);
+
+    m_scrollStates.erase(client);
+
+    if (m_visibleColumns.find(client) == m_visibleColumns.end()) return;
+
+    m_visibleColumns.erase(client);
+    m_visibleColumnsGeneration.fetchAndAddOrdered(1);
+}
+
+void
+FFTDataServer::adviseAccess(MatrixFile::AccessDirection direction,
+                            size_t x0, size_t x1)
+{
+    int previous = m_accessDirection.fetchAndStoreOrdered(direction);
+    if (direction == previous && direction != MatrixFile::AccessBackward) {
+        return;
+    }
+
+    for (size_t c = 0; c < m_caches.size(); ++c) {
+        CacheBlock *cb = m_caches[c];
+        if (!cb || !cb->sharedFileCacheReader) continue;
+        size_t b0 = c << m_cacheWidthPower;
+        size_t b1 = b0 + m_cacheWidth;
+        size_t from = 0, to = 0;
+        if (x0 < b1 && x1 > b0) {
+            from = (x0 > b0 ? x0 - b0 : 0);
+            to = (x1 < b1 ? x1 - b0 : m_cacheWidth);
+        }
+        cb->sharedFileCacheReader->adviseAccess(direction, from, to);
+    }
+}
+
 QString
 FFTDataServer::generateFileBasename() const
 {
@@ -1361,6 +1699,278 @@ FFTDataServer::generateFileBasename(const DenseTimeValueModel *model,
     return buffer;
 }
 
+FFTDataServer::FillThread::FillThread(FFTDataServer &server,
+                                      size_t fillFromFrame) :
+    m_server(server),
+    m_extent(0),
+    m_completion(0),
+    m_fillFrom(fillFromFrame),
+    m_contiguousDone(0),
+    m_columnsDone(0),
+    m_priorityNext(0),
+    m_priorityGeneration(0)
+{
+}
+
+FFTDataServer::FillThread::~FillThread()
+{
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        delete m_queues[i];
+    }
+}
+
+void
+FFTDataServer::FillThread::makeChunks(size_t workers)
+{
+    // Chunks are ordered starting from the one containing the fill
+    // start frame, running up to the end and then wrapping round to
+    // the start; and dealt out in that order to the workers' queues,
+    // so that all of the workers begin near the fill start point.
+
+    size_t start = m_server.m_model->getStartFrame();
+    size_t width = m_server.m_width;
+    size_t firstColumn = 0;
+
+    if (m_fillFrom > start) {
+        firstColumn = (m_fillFrom - start) / m_server.m_windowIncrement;
+        if (firstColumn >= width) firstColumn = 0;
+    }
+    firstColumn = (firstColumn / FillChunkSize) * FillChunkSize;
+
+    m_chunks.clear();
+
+    size_t x = firstColumn;
+    do {
+        Chunk chunk;
+        chunk.from = x;
+        chunk.to = x + FillChunkSize;
+        if (chunk.to > width) chunk.to = width;
+        chunk.order = m_chunks.size();
+        m_chunks.push_back(chunk);
+        x = chunk.to;
+        if (x >= width) x = 0;
+    } while (x != firstColumn);
+
+    m_chunkDone = std::vector<bool>(m_chunks.size(), false);
+    m_chunkTaken = std::vector<bool>(m_chunks.size(), false);
+    m_contiguousDone = 0;
+    m_columnsDone = 0;
+
+    for (size_t i = 0; i < workers; ++i) {
+        m_queues.push_back(new WorkQueue);
+    }
+
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        m_queues[i % workers]->chunks.push_back(m_chunks[i]);
+    }
+}
+
+namespace {
+
+struct ChunkDistanceComparator
+{
+    ChunkDistanceComparator(const std::vector<size_t> &d) : distance(d) { }
+    bool operator()(size_t a, size_t b) const {
+        if (distance[a] != distance[b]) return distance[a] < distance[b];
+        return a < b;
+    }
+    const std::vector<size_t> &distance;
+};
+
+}
+
+void
+FFTDataServer::FillThread::makePriorityOrder()
+{
+    // Called with m_takeMutex held.  Order all chunks by their
+    // distance in columns from the nearest visible range, so that
+    // visible chunks come first and the rest follow outward from
+    // them.  Chunks at the same distance stay in fill order.
+
+    std::vector<ColumnRange> ranges;
+    {
+        QMutexLocker locker(&m_server.m_visibleColumnsMutex);
+        for (VisibleColumnMap::const_iterator i =
+                 m_server.m_visibleColumns.begin();
+             i != m_server.m_visibleColumns.end(); ++i) {
+            if (i->second.second > i->second.first) {
+                ranges.push_back(i->second);
+            }
+        }
+    }
+
+    m_priority.clear();
+    m_priorityNext = 0;
+
+    if (ranges.empty()) return;
+
+    std::vector<size_t> distance(m_chunks.size(), 0);
+
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        const Chunk &chunk = m_chunks[i];
+        size_t nearest = m_server.m_width;
+        for (size_t j = 0; j < ranges.size(); ++j) {
+            size_t d = 0;
+            if (chunk.to <= ranges[j].first) d = ranges[j].first - chunk.to + 1;
+            else if (chunk.from >= ranges[j].second) d = chunk.from - ranges[j].second + 1;
+            if (d < nearest) nearest = d;
+        }
+        distance[i] = nearest;
+        m_priority.push_back(i);
+    }
+
+    std::sort(m_priority.begin(), m_priority.end(),
+              ChunkDistanceComparator(distance));
+}
+
+bool
+FFTDataServer::FillThread::takePriorityChunk(Chunk &chunk)
+{
+    int generation = m_server.m_visibleColumnsGeneration;
+    if (generation == 0) return false; // no visible ranges ever set
+
+    QMutexLocker locker(&m_takeMutex);
+
+    if (generation != m_priorityGeneration) {
+#ifdef DEBUG_FFT_SERVER_FILL
+        std::cerr << "FFTDataServer::FillThread: visible columns changed, "
+                  << "reordering" << std::endl;
+#endif
+        makePriorityOrder();
+        m_priorityGeneration = generation;
+    }
+
+    while (m_priorityNext < m_priority.size()) {
+        size_t order = m_priority[m_priorityNext++];
+        if (m_chunkTaken[order]) continue;
+        m_chunkTaken[order] = true;
+        chunk = m_chunks[order];
+        return true;
+    }
+
+    return false;
+}
+
+bool
+FFTDataServer::FillThread::claimChunk(size_t order)
+{
+    QMutexLocker locker(&m_takeMutex);
+    if (m_chunkTaken[order]) return false;
+    m_chunkTaken[order] = true;
+    return true;
+}
+
+bool
+FFTDataServer::FillThread::takeChunk(int worker, Chunk &chunk)
+{
+    if (takePriorityChunk(chunk)) return true;
+
+    {
+        QMutexLocker locker(&m_queues[worker]->mutex);
+        std::deque<Chunk> &chunks = m_queues[worker]->chunks;
+        while (!chunks.empty()) {
+            chunk = chunks.front();
+            chunks.pop_front();
+            if (claimChunk(chunk.order)) return true;
+        }
+    }
+
+    // Our own queue is empty: steal from another worker.  We take
+    // the chunk that is earliest in fill order (rather than the
+    // conventional work-stealing choice of the victim's least urgent
+    // chunk) so that the area around the fill start point is always
+    // finished first.
+
+    while (true) {
+
+        int victim = -1;
+        size_t victimOrder = 0;
+
+        for (int i = 0; i < int(m_queues.size()); ++i) {
+            if (i == worker) continue;
+            QMutexLocker locker(&m_queues[i]->mutex);
+            std::deque<Chunk> &chunks = m_queues[i]->chunks;
+            if (chunks.empty()) continue;
+            if (victim < 0 || chunks.front().order < victimOrder) {
+                victim = i;
+                victimOrder = chunks.front().order;
+            }
+        }
+
+        if (victim < 0) return false;
+
+        QMutexLocker locker(&m_queues[victim]->mutex);
+        std::deque<Chunk> &chunks = m_queues[victim]->chunks;
+        if (chunks.empty()) continue; // raced with its owner, try again
+
+#ifdef DEBUG_FFT_SERVER_FILL
+        std::cerr << "FFTDataServer::FillThread: worker " << worker
+                  << " stealing chunk " << chunks.front().order
+                  << " from worker " << victim << std::endl;
+#endif
+
+        chunk = chunks.front();
+        chunks.pop_front();
+        if (claimChunk(chunk.order)) return true;
+        // otherwise it was already taken in priority order: try again
+    }
+}
+
+void
+FFTDataServer::FillThread::chunkDone(const Chunk &chunk)
+{
+    QMutexLocker locker(&m_progressMutex);
+
+    m_chunkDone[chunk.order] = true;
+    m_columnsDone += chunk.to - chunk.from;
+
+    while (m_contiguousDone < m_chunks.size() &&
+           m_chunkDone[m_contiguousDone]) {
+        ++m_contiguousDone;
+    }
+
+    // The extent is the end of the run of chunks completed
+    // contiguously from the fill start point.  As with a single
+    // sequential fill, it goes backwards when the fill wraps round
+    // to the start of the model.
+
+    if (m_contiguousDone > 0) {
+        const Chunk &last = m_chunks[m_contiguousDone - 1];
+        size_t start = m_server.m_model->getStartFrame();
+        size_t end = m_server.m_model->getEndFrame();
+        size_t extent = start + last.to * m_server.m_windowIncrement;
+        if (extent > end) extent = end;
+        m_extent = extent;
+    }
+
+    // Don't report 100% until fillComplete has been called
+    size_t completion = (100 * m_columnsDone) / m_server.m_width;
+    if (completion > 99) completion = 99;
+    m_completion = completion;
+}
+
+bool
+FFTDataServer::FillThread::waitWhileSuspended()
+{
+    while (m_server.m_suspended) {
+#ifdef DEBUG_FFT_SERVER
+        std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): suspended, waiting..." << std::endl;
+#endif
+        {
+            MutexLocker locker(&m_server.m_fftBuffersLock,
+                               "FFTDataServer::run::m_fftBuffersLock");
+            if (m_server.m_suspended && !m_server.m_exiting) {
+                m_server.m_condition.wait(&m_server.m_fftBuffersLock, 10000);
+            }
+        }
+#ifdef DEBUG_FFT_SERVER
+        std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): waited" << std::endl;
+#endif
+        if (m_server.m_exiting) return false;
+    }
+    return !m_server.m_exiting;
+}
+
 void
 FFTDataServer::FillThread::run()
 {
@@ -1379,96 +1989,57 @@ FFTDataServer::FillThread::run()
     }
     if (m_server.m_exiting) return;
 
-    size_t start = m_server.m_model->getStartFrame();
-    size_t end = m_server.m_model->getEndFrame();
-    size_t remainingEnd = end;
+    if (m_server.restoreFromPersistentCache()) {
+        m_completion = 100;
+        m_extent = m_server.m_model->getEndFrame();
+        return;
+    }
 
-    int counter = 0;
-    int updateAt = 1;
-    int maxUpdateAt = (end / m_server.m_windowIncrement) / 20;
-    if (maxUpdateAt < 100) maxUpdateAt = 100;
+    size_t workers = m_server.m_workerBuffers.size();
+    if (workers == 0) return; // processing data already discarded
 
-    if (m_fillFrom > start) {
+    makeChunks(workers);
 
-        for (size_t f = m_fillFrom; f < end; f += m_server.m_windowIncrement) {
-	    
-            m_server.fillColumn(int((f - start) / m_server.m_windowIncrement));
+    std::vector<Worker *> threads;
+    for (size_t i = 0; i < workers; ++i) {
+        threads.push_back(new Worker(*this, i));
+        threads[i]->start();
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
 
-            if (m_server.m_exiting) return;
+    if (m_server.m_exiting) return;
+
+    m_server.fillComplete();
+    m_completion = 100;
+    m_extent = m_server.m_model->getEndFrame();
 
-            while (m_server.m_suspended) {
-#ifdef DEBUG_FFT_SERVER
-                std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): suspended, waiting..." << std::endl;
-#endif
-                MutexLocker locker(&m_server.m_fftBuffersLock,
-                                   "FFTDataServer::run::m_fftBuffersLock [1]");
-                if (m_server.m_suspended && !m_server.m_exiting) {
-                    m_server.m_condition.wait(&m_server.m_fftBuffersLock, 10000);
-                }
 #ifdef DEBUG_FFT_SERVER
-                std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): waited" << std::endl;
+    std::cerr << "FFTDataServer::FillThread::run exiting" << std::endl;
 #endif
-                if (m_server.m_exiting) return;
-            }
-
-            if (++counter == updateAt) {
-                m_extent = f;
-                m_completion = size_t(100 * fabsf(float(f - m_fillFrom) /
-                                                  float(end - start)));
-                counter = 0;
-                if (updateAt < maxUpdateAt) {
-                    updateAt *= 2;
-                    if (updateAt > maxUpdateAt) updateAt = maxUpdateAt;
-                }
-            }
-        }
+}
 
-        remainingEnd = m_fillFrom;
-        if (remainingEnd > start) --remainingEnd;
-        else remainingEnd = start;
-    }
+void
+FFTDataServer::FillThread::Worker::run()
+{
+    FFTDataServer &server = m_filler.m_server;
+    FillBuffers &buffers = *server.m_workerBuffers[m_index];
 
-    size_t baseCompletion = m_completion;
+    Chunk chunk;
 
-    for (size_t f = start; f < remainingEnd; f += m_server.m_windowIncrement) {
+    while (m_filler.takeChunk(m_index, chunk)) {
 
-        m_server.fillColumn(int((f - start) / m_server.m_windowIncrement));
+        for (size_t x = chunk.from; x < chunk.to; ++x) {
 
-        if (m_server.m_exiting) return;
+            server.fillColumn(x, buffers);
 
-        while (m_server.m_suspended) {
-#ifdef DEBUG_FFT_SERVER
-            std::cerr << "FFTDataServer(" << this << " [" << (void *)QThread::currentThreadId() << "]): suspended, waiting..." << std::endl;
-#endif
-            {
-                MutexLocker locker(&m_server.m_fftBuffersLock,
-                                   "FFTDataServer::run::m_fftBuffersLock [2]");
-                if (m_server.m_suspended && !m_server.m_exiting) {
-                    m_server.m_condition.wait(&m_server.m_fftBuffersLock, 10000);
-                }
-            }
-            if (m_server.m_exiting) return;
+            if (server.m_exiting) return;
+            if (!m_filler.waitWhileSuspended()) return;
         }
-		    
-        if (++counter == updateAt) {
-            m_extent = f;
-            m_completion = baseCompletion +
-                size_t(100 * fabsf(float(f - start) /
-                                   float(end - start)));
-            counter = 0;
-            if (updateAt < maxUpdateAt) {
-                updateAt *= 2;
-                if (updateAt > maxUpdateAt) updateAt = maxUpdateAt;
-            }
-        }
-    }
-
-    m_server.fillComplete();
-    m_completion = 100;
-    m_extent = end;
 
-#ifdef DEBUG_FFT_SERVER
-    std::cerr << "FFTDataServer::FillThread::run exiting" << std::endl;
-#endif
+        m_filler.chunkDone(chunk);
+    }
 }
 
@@ -29,6 +29,7 @@
 #include <QReadWriteLock>
 #include <QReadLocker>
 #include <QWaitCondition>
+#include <QAtomicPointer>
 #include <QString>
 
 #include <vector>
@@ -62,6 +63,19 @@ public:
                                                StorageAdviser::NoCriteria,
                                            size_t fillFromColumn = 0);
 
+    /**
+     * Return true if a server already exists (whether in use or
+     * released but not yet discarded) for exactly the given model,
+     * channel and FFT parameters, in either polar or cartesian form.
+     * This does not claim the server.
+     */
+    static bool haveInstance(const DenseTimeValueModel *model,
+                             int channel,
+                             WindowType windowType,
+                             size_t windowSize,
+                             size_t windowIncrement,
+                             size_t fftSize);
+
     static void claimInstance(FFTDataServer *);
     static void releaseInstance(FFTDataServer *);
 
@@ -109,6 +123,21 @@ public:
     size_t getFillCompletion() const;
     size_t getFillExtent() const;
 
+    /**
+     * Tell the server that columns x0 to x1-1 are currently visible
+     * to the given client (typically the FFTModel used by a single
+     * view), replacing any range previously set for that client.
+     * While any visible ranges are set, the background fill
+     * calculates the visible columns first and then works outward
+     * from them, rather than proceeding from the fill start point.
+     */
+    void setVisibleColumns(const void *client, size_t x0, size_t x1);
+
+    /**
+     * Remove the visible range set for the given client.
+     */
+    void clearVisibleColumns(const void *client);
+
 private:
     FFTDataServer(QString fileBaseName,
                   const DenseTimeValueModel *model,
@@ -147,71 +176,135 @@ private:
 
     struct CacheBlock {
         FFTMemoryCache *memoryCache;
+
+        // If the file cache could be memory-mapped, a single reader
+        // serves all threads
+        FFTFileCacheReader *sharedFileCacheReader;
+
+        // Otherwise each thread that reads from a file cache needs its own
+        // reader.  The first few threads get a slot in a fixed array,
+        // which can be searched without locking: a slot is claimed
+        // atomically and its reader is only ever used or released by
+        // the thread that claimed it.  Any further threads fall back
+        // to the map, which is guarded by m_cacheVectorLock.
+        struct ReaderSlot {
+            QAtomicPointer<QThread> thread;
+            FFTFileCacheReader *reader;
+        };
+        static const int ReaderSlotCount = 8;
+        ReaderSlot readerSlots[ReaderSlotCount];
         typedef std::map<QThread *, FFTFileCacheReader *> ThreadReaderMap;
         ThreadReaderMap fileCacheReader;
+
         FFTFileCacheWriter *fileCacheWriter;
-        CacheBlock() : memoryCache(0), fileCacheWriter(0) { }
+
+        CacheBlock() :
+            memoryCache(0), sharedFileCacheReader(0), fileCacheWriter(0) {
+            for (int i = 0; i < ReaderSlotCount; ++i) {
+                readerSlots[i].reader = 0;
+            }
+        }
         ~CacheBlock() {
             delete memoryCache; 
+            delete sharedFileCacheReader;
+            for (int i = 0; i < ReaderSlotCount; ++i) {
+                delete readerSlots[i].reader;
+            }
             while (!fileCacheReader.empty()) {
                 delete fileCacheReader.begin()->second;
                 fileCacheReader.erase(fileCacheReader.begin());
             }
             delete fileCacheWriter;
         }
+
+        FFTFileCacheReader *findSlotReader(QThread *me) const {
+            for (int i = 0; i < ReaderSlotCount; ++i) {
+                if (readerSlots[i].thread == me) return readerSlots[i].reader;
+            }
+            return 0;
+        }
+        bool claimReaderSlot(QThread *me, FFTFileCacheReader *reader) {
+            for (int i = 0; i < ReaderSlotCount; ++i) {
+                if (readerSlots[i].thread.testAndSetOrdered(0, me)) {
+                    readerSlots[i].reader = reader;
+                    return true;
+                }
+            }
+            return false;
+        }
+        bool releaseReaderSlot(QThread *me) {
+            for (int i = 0; i < ReaderSlotCount; ++i) {
+                if (readerSlots[i].thread == me) {
+                    delete readerSlots[i].reader;
+                    readerSlots[i].reader = 0;
+                    readerSlots[i].thread.fetchAndStoreOrdered(0);
+                    return true;
+                }
+            }
+            return false;
+        }
     };
 
-    typedef std::vector<CacheBlock *> CacheVector;
+    // The cache vector is sized at construction and never resized.
+    // Each block is published atomically, fully constructed, by
+    // makeCache and not removed until the server is destroyed, so
+    // readers can look blocks up without taking any lock.
+    typedef std::vector<QAtomicPointer<CacheBlock> > CacheVector;
     CacheVector m_caches;
-    QReadWriteLock m_cacheVectorLock; // locks cache lookup, not use
+    QReadWriteLock m_cacheVectorLock; // locks overflow reader maps only
     QMutex m_cacheCreationMutex; // solely to serialise makeCache() calls
 
     FFTCacheReader *getCacheReader(size_t x, size_t &col) {
-        Profiler profiler("FFTDataServer::getCacheReader");
         col = x & m_cacheWidthMask;
         int c = x >> m_cacheWidthPower;
-        m_cacheVectorLock.lockForRead();
-        CacheBlock *cb(m_caches.at(c));
+        CacheBlock *cb = m_caches[c];
         if (cb) {
             if (cb->memoryCache) {
-                m_cacheVectorLock.unlock();
                 return cb->memoryCache;
             }
+            if (cb->sharedFileCacheReader) {
+                return cb->sharedFileCacheReader;
+            }
             if (cb->fileCacheWriter) {
                 QThread *me = QThread::currentThread();
-                CacheBlock::ThreadReaderMap &map = cb->fileCacheReader;
-                if (map.find(me) == map.end()) {
-                    m_cacheVectorLock.unlock();
-                    if (!makeCacheReader(c)) return 0;
-                    return getCacheReader(x, col);
-                }
-                FFTCacheReader *reader = cb->fileCacheReader[me];
-                m_cacheVectorLock.unlock();
-                return reader;
+                FFTCacheReader *reader = cb->findSlotReader(me);
+                if (reader) return reader;
+                return getOverflowCacheReader(x, col);
             }
             // if cb exists but cb->fileCacheWriter doesn't, creation
             // must have failed: don't try again
-            m_cacheVectorLock.unlock();
             return 0;
         }
-        m_cacheVectorLock.unlock();
         if (!makeCache(c)) return 0;
         return getCacheReader(x, col);
     }
+
+    FFTCacheReader *getOverflowCacheReader(size_t x, size_t &col) {
+        int c = x >> m_cacheWidthPower;
+        CacheBlock *cb = m_caches[c];
+        QThread *me = QThread::currentThread();
+        m_cacheVectorLock.lockForRead();
+        CacheBlock::ThreadReaderMap &map = cb->fileCacheReader;
+        CacheBlock::ThreadReaderMap::iterator i = map.find(me);
+        if (i == map.end()) {
+            m_cacheVectorLock.unlock();
+            if (!makeCacheReader(c)) return 0;
+            return getCacheReader(x, col);
+        }
+        FFTCacheReader *reader = i->second;
+        m_cacheVectorLock.unlock();
+        return reader;
+    }
     
     FFTCacheWriter *getCacheWriter(size_t x, size_t &col) {
-        Profiler profiler("FFTDataServer::getCacheWriter");
         col = x & m_cacheWidthMask;
         int c = x >> m_cacheWidthPower;
-        {
-            QReadLocker locker(&m_cacheVectorLock);
-            CacheBlock *cb(m_caches.at(c));
-            if (cb) {
-                if (cb->memoryCache) return cb->memoryCache;
-                if (cb->fileCacheWriter) return cb->fileCacheWriter;
-                // if cb exists, creation must have failed: don't try again
-                return 0;
-            }
+        CacheBlock *cb = m_caches[c];
+        if (cb) {
+            if (cb->memoryCache) return cb->memoryCache;
+            if (cb->fileCacheWriter) return cb->fileCacheWriter;
+            // if cb exists, creation must have failed: don't try again
+            return 0;
         }
         if (!makeCache(c)) return 0;
         return getCacheWriter(x, col);
@@ -219,7 +312,8 @@ private:
 
     bool haveCache(size_t x) {
         int c = x >> m_cacheWidthPower;
-        return (m_caches.at(c) != 0);
+        CacheBlock *cb = m_caches[c];
+        return (cb != 0);
     }
     
     bool makeCache(int c);
@@ -232,37 +326,157 @@ private:
     QMutex m_fftBuffersLock;
     QWaitCondition m_condition;
 
-    fftsample *m_fftInput;
-    fftf_complex *m_fftOutput;
-    float *m_workbuffer;
-    fftf_plan m_fftPlan;
+    /**
+     * Input, output and work buffers plus FFT plan for calculating
+     * one column at a time.  The server has one of these for
+     * on-demand calculation from reader threads (guarded by
+     * m_fftBuffersLock) and one for each fill worker thread (used
+     * without locking).  These must be constructed and destroyed
+     * from the thread that owns the server, because FFT plan
+     * creation and destruction are not thread-safe.
+     */
+    class FillBuffers
+    {
+    public:
+        FillBuffers(size_t fftSize);
+        ~FillBuffers();
 
+        fftsample *input;
+        fftf_complex *output;
+        float *workbuffer;
+        fftf_plan plan;
+
+    private:
+        FillBuffers(const FillBuffers &); // not implemented
+        FillBuffers &operator=(const FillBuffers &); // not implemented
+    };
+
+    FillBuffers *m_buffers;
+    std::vector<FillBuffers *> m_workerBuffers;
+
+    static const int FillChunkSize = 64; // columns
+    static const int MaxFillWorkers = 8;
+    static int getFillWorkerCount();
+
+    /**
+     * The fill thread divides the columns into chunks and distributes
+     * them across a pool of worker threads, each of which has its own
+     * queue of chunks (in order of priority, starting from the
+     * requested fill start point) and its own FFT buffers.  A worker
+     * that runs out of chunks steals the most urgent remaining chunk
+     * from another worker's queue.  While any client has set a
+     * visible range, workers instead take chunks in order of
+     * distance from the visible columns.  The fill thread itself
+     * just waits for the workers and then marks the caches complete.
+     */
     class FillThread : public Thread
     {
     public:
-        FillThread(FFTDataServer &server, size_t fillFromColumn) :
-            m_server(server), m_extent(0), m_completion(0),
-            m_fillFrom(fillFromColumn) { }
+        FillThread(FFTDataServer &server, size_t fillFromFrame);
+        virtual ~FillThread();
 
         size_t getExtent() const { return m_extent; }
         size_t getCompletion() const { return m_completion ? m_completion : 1; }
         virtual void run();
 
     protected:
+        struct Chunk {
+            size_t from;  // first column
+            size_t to;    // one past last column
+            size_t order; // position in fill order
+        };
+
+        struct WorkQueue {
+            QMutex mutex;
+            std::deque<Chunk> chunks;
+        };
+
+        class Worker : public Thread
+        {
+        public:
+            Worker(FillThread &filler, int index) :
+                m_filler(filler), m_index(index) { }
+            virtual void run();
+
+        protected:
+            FillThread &m_filler;
+            int m_index;
+        };
+
+        void makeChunks(size_t workers);
+        bool takeChunk(int worker, Chunk &chunk);
+        bool claimChunk(size_t order);
+        bool takePriorityChunk(Chunk &chunk);
+        void makePriorityOrder();
+        void chunkDone(const Chunk &chunk);
+        bool waitWhileSuspended(); // false if exiting
+
         FFTDataServer &m_server;
         size_t m_extent;
         size_t m_completion;
         size_t m_fillFrom;
+
+        std::vector<WorkQueue *> m_queues;
+        std::vector<Chunk> m_chunks; // in fill order
+        std::vector<bool> m_chunkDone;
+        size_t m_contiguousDone; // count of leading chunks in fill order done
+        size_t m_columnsDone;
+        QMutex m_progressMutex;
+
+        // A chunk may be taken either from a worker queue or, when
+        // there are visible ranges, from the shared priority order,
+        // so each is claimed before it is calculated
+        std::vector<bool> m_chunkTaken; // by order
+        std::vector<size_t> m_priority; // orders, most urgent first
+        size_t m_priorityNext;
+        int m_priorityGeneration;
+        QMutex m_takeMutex;
     };
 
     bool m_exiting;
     bool m_suspended;
     FillThread *m_fillThread;
 
+    typedef std::pair<size_t, size_t> ColumnRange; // [from, to)
+    typedef std::map<const void *, ColumnRange> VisibleColumnMap;
+    VisibleColumnMap m_visibleColumns;
+    QMutex m_visibleColumnsMutex;
+    QAtomicInt m_visibleColumnsGeneration; // incremented on each change
+
+    // Which way each client's visible range has been moving, so that
+    // memory-mapped disc caches can be given read-ahead advice to
+    // match.  The advice covers a whole cache file, so it is changed
+    // only once a client has moved the same way several times running
+    struct ScrollState {
+        MatrixFile::AccessDirection direction;
+        int moves;
+        ScrollState() : direction(MatrixFile::AccessUnknown), moves(0) { }
+    };
+    typedef std::map<const void *, ScrollState> ScrollStateMap;
+    ScrollStateMap m_scrollStates; // guarded by m_visibleColumnsMutex
+    QAtomicInt m_accessDirection; // last advised, for readers made later
+    static const int AdviseAfterMoves = 8;
+
+    void adviseAccess(MatrixFile::AccessDirection direction,
+                      size_t x0, size_t x1);
+
     void deleteProcessingData();
     void fillColumn(size_t x);
+    void fillColumn(size_t x, FillBuffers &buffers);
+    void processColumn(size_t x, size_t col, FFTCacheWriter *cache,
+                       FillBuffers &buffers);
     void fillComplete();
 
+    // Whether this server's data is to be kept in the persistent
+    // cache, and its key there (empty if not in use)
+    bool m_persistent;
+    QString m_persistentKey;
+    size_t getCacheBlockCount() const {
+        return (m_width + m_cacheWidth - 1) / m_cacheWidth;
+    }
+    bool restoreFromPersistentCache();
+    void saveToPersistentCache();
+
     QString generateFileBasename() const;
     static QString generateFileBasename(const DenseTimeValueModel *model,
                                         int channel,
@@ -42,11 +42,31 @@ FFTFileCacheReader::FFTFileCacheReader(FFTFileCacheWriter *writer) :
            MatrixFile::ReadOnly,
            m_storageType == FFTCache::Compact ? sizeof(uint16_t) : sizeof(float),
            writer->getWidth(),
-           writer->getHeight() * 2 + m_factorSize))
+           writer->getHeight() * 2 + m_factorSize)),
+    m_mapped(m_mfc->isMapped())
 {
 //    std::cerr << "FFTFileCacheReader: storage type is " << (storageType == FFTCache::Compact ? "Compact" : storageType == Polar ? "Polar" : "Rectangular") << std::endl;
 }
 
+FFTFileCacheReader::FFTFileCacheReader(QString fileBase,
+                                       FFTCache::StorageType storageType,
+                                       size_t width, size_t height) :
+    m_readbuf(0),
+    m_readbufCol(0),
+    m_readbufWidth(0),
+    m_readbufGood(false),
+    m_storageType(storageType),
+    m_factorSize(m_storageType == FFTCache::Compact ? 2 : 1),
+    m_mfc(new MatrixFile
+          (fileBase,
+           MatrixFile::ReadOnly,
+           m_storageType == FFTCache::Compact ? sizeof(uint16_t) : sizeof(float),
+           width,
+           height * 2 + m_factorSize)),
+    m_mapped(m_mfc->isMapped())
+{
+}
+
 FFTFileCacheReader::~FFTFileCacheReader()
 {
     if (m_readbuf) delete[] m_readbuf;
@@ -214,6 +234,9 @@ FFTFileCacheReader::getMagnitudesAt(size_t x, float *values, size_t minbin, size
 bool
 FFTFileCacheReader::haveSetColumnAt(size_t x) const
 {
+    if (m_mapped) {
+        return m_mfc->haveSetColumnAt(x);
+    }
     if (m_readbuf && m_readbufGood &&
         (m_readbufCol == x || (m_readbufWidth > 1 && m_readbufCol+1 == x))) {
 //        std::cerr << "FFTFileCacheReader::haveSetColumnAt: short-circuiting; we know about this one" << std::endl;
@@ -222,6 +245,17 @@ FFTFileCacheReader::haveSetColumnAt(size_t x) const
     return m_mfc->haveSetColumnAt(x);
 }
 
+void
+FFTFileCacheReader::adviseAccess(MatrixFile::AccessDirection direction,
+                                 size_t x0, size_t x1) const
+{
+    if (!m_mapped) return;
+    m_mfc->adviseAccess(direction);
+    if (direction == MatrixFile::AccessBackward) {
+        m_mfc->adviseWillNeed(x0, x1);
+    }
+}
+
 size_t
 FFTFileCacheReader::getCacheSize(size_t width, size_t height,
                                  FFTCache::StorageType type)
@@ -26,6 +26,16 @@ class FFTFileCacheReader : public FFTCacheReader
 {
 public:
     FFTFileCacheReader(FFTFileCacheWriter *);
+
+    /**
+     * Construct a reader for an existing, already written cache file
+     * with the given base name in the temporary directory, for which
+     * there is no writer (for example one restored from the
+     * persistent cache).
+     */
+    FFTFileCacheReader(QString fileBase, FFTCache::StorageType storageType,
+                       size_t width, size_t height);
+
     ~FFTFileCacheReader();
 
     size_t getWidth() const;
@@ -46,6 +56,22 @@ public:
 
     FFTCache::StorageType getStorageType() const { return m_storageType; }
 
+    /**
+     * Return true if the underlying matrix file is memory-mapped.  A
+     * mapped reader keeps no per-reader buffer state and can be
+     * shared between any number of reading threads.
+     */
+    bool isShareable() const { return m_mapped; }
+
+    /**
+     * Advise that a mapped cache is about to be read in the given
+     * direction, starting with columns x0 to x1-1.  This is intended
+     * to be called when a view's scroll direction changes, not on
+     * every column read.
+     */
+    void adviseAccess(MatrixFile::AccessDirection direction,
+                      size_t x0, size_t x1) const;
+
 protected:
     mutable char *m_readbuf;
     mutable size_t m_readbufCol;
@@ -53,6 +79,9 @@ protected:
     mutable bool m_readbufGood;
 
     float getFromReadBufStandard(size_t x, size_t y) const {
+        if (m_mapped) {
+            return ((const float *)m_mfc->getColumnPointer(x))[y];
+        }
         float v;
         if (m_readbuf &&
             (m_readbufCol == x || (m_readbufWidth > 1 && m_readbufCol+1 == x))) {
@@ -66,6 +95,9 @@ protected:
     }
 
     float getFromReadBufCompactUnsigned(size_t x, size_t y) const {
+        if (m_mapped) {
+            return ((const uint16_t *)m_mfc->getColumnPointer(x))[y];
+        }
         float v;
         if (m_readbuf &&
             (m_readbufCol == x || (m_readbufWidth > 1 && m_readbufCol+1 == x))) {
@@ -79,6 +111,9 @@ protected:
     }
 
     float getFromReadBufCompactSigned(size_t x, size_t y) const {
+        if (m_mapped) {
+            return ((const int16_t *)m_mfc->getColumnPointer(x))[y];
+        }
         float v;
         if (m_readbuf &&
             (m_readbufCol == x || (m_readbufWidth > 1 && m_readbufCol+1 == x))) {
@@ -103,6 +138,13 @@ protected:
                 float f;
                 uint16_t u[2];
             } factor;
+            if (m_mapped) {
+                const uint16_t *column =
+                    (const uint16_t *)m_mfc->getColumnPointer(col);
+                factor.u[0] = column[h - 2];
+                factor.u[1] = column[h - 1];
+                return factor.f;
+            }
             if (!m_readbuf ||
                 !(m_readbufCol == col ||
                   (m_readbufWidth > 1 && m_readbufCol+1 == col))) {
@@ -118,6 +160,7 @@ protected:
     FFTCache::StorageType m_storageType;
     size_t m_factorSize;
     MatrixFile *m_mfc;
+    bool m_mapped;
 };
 
 #endif
@@ -85,6 +85,8 @@ FFTFileCacheWriter::haveSetColumnAt(size_t x) const
 void
 FFTFileCacheWriter::setColumnAt(size_t x, float *mags, float *phases, float factor)
 {
+    QMutexLocker locker(&m_writeMutex);
+
     size_t h = getHeight();
 
     switch (m_storageType) {
@@ -125,6 +127,8 @@ FFTFileCacheWriter::setColumnAt(size_t x, float *mags, float *phases, float fact
 void
 FFTFileCacheWriter::setColumnAt(size_t x, float *real, float *imag)
 {
+    QMutexLocker locker(&m_writeMutex);
+
     size_t h = getHeight();
 
     float factor = 0.0f;
@@ -190,6 +194,7 @@ FFTFileCacheWriter::allColumnsWritten()
 #ifdef DEBUG_FFT_FILE_CACHE_WRITER
     std::cerr << "FFTFileCacheWriter::allColumnsWritten" << std::endl;
 #endif
+    QMutexLocker locker(&m_writeMutex);
     m_mfc->close();
 }
 
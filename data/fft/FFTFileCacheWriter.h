@@ -20,6 +20,8 @@
 #include "FFTCacheWriter.h"
 #include "data/fileio/MatrixFile.h"
 
+#include <QMutex>
+
 class FFTFileCacheWriter : public FFTCacheWriter
 {
 public:
@@ -46,6 +48,7 @@ public:
 
 protected:
     char *m_writebuf;
+    QMutex m_writeMutex; // serialises use of m_writebuf and m_mfc by fill workers
 
     void setNormalizationFactorToWritebuf(float newfactor) {
         size_t h = m_mfc->getHeight();
@@ -0,0 +1,596 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "FFTKernels.h"
+
+#include "system/System.h"
+#include "system/SIMD.h"
+
+#include <cmath>
+#include <cfloat>
+#include <iostream>
+
+//#define DEBUG_FFT_KERNELS 1
+
+static const float piF = float(M_PI);
+static const float phaseQuantiseScale = float(32767.0 / M_PI);
+static const float phaseDequantiseScale = float(M_PI / 32767.0);
+
+
+// Plain implementations
+
+static float
+cartesianToPolarPlain(const float *reals, const float *imags,
+                      float *mags, float *phases, size_t n)
+{
+    float max = 0.f;
+    for (size_t i = 0; i < n; ++i) {
+        float re = reals[i], im = imags[i];
+        float mag = sqrtf(re * re + im * im);
+        phases[i] = atan2f(im, re);
+        mags[i] = mag;
+        if (mag > max) max = mag;
+    }
+    return max;
+}
+
+static float
+interleavedToPolarPlain(const float *complex,
+                        float *mags, float *phases, size_t n)
+{
+    float max = 0.f;
+    for (size_t i = 0; i < n; ++i) {
+        float re = complex[i*2], im = complex[i*2+1];
+        float mag = sqrtf(re * re + im * im);
+        mags[i] = mag;
+        phases[i] = atan2f(im, re);
+        if (mag > max) max = mag;
+    }
+    return max;
+}
+
+static float
+magnitudesPlain(const float *reals, const float *imags,
+                float *mags, size_t n)
+{
+    float max = 0.f;
+    for (size_t i = 0; i < n; ++i) {
+        float mag = sqrtf(reals[i] * reals[i] + imags[i] * imags[i]);
+        mags[i] = mag;
+        if (mag > max) max = mag;
+    }
+    return max;
+}
+
+static void
+quantiseMagnitudesPlain(const float *mags, uint16_t *out,
+                        float scale, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = uint16_t(int(mags[i] * scale));
+    }
+}
+
+static void
+quantisePhasesPlain(const float *phases, uint16_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = uint16_t(int16_t(int(phases[i] * phaseQuantiseScale)));
+    }
+}
+
+static void
+dequantiseMagnitudesPlain(const uint16_t *in, float *out,
+                          float scale, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = float(in[i]) * scale;
+    }
+}
+
+static void
+dequantisePhasesPlain(const uint16_t *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = float(int16_t(in[i])) * phaseDequantiseScale;
+    }
+}
+
+
+#ifdef SV_SSE2
+
+// SSE2 implementations.  The atan2 approximation reduces the ratio of
+// the smaller to the larger absolute component to the range
+// [0,tan(pi/8)] and uses the Cephes atanf polynomial there, then
+// restores the octant and quadrant.
+
+static inline __m128
+selectSSE2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128
+atan2SSE2(__m128 y, __m128 x)
+{
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    const __m128 one = _mm_set1_ps(1.f);
+
+    __m128 ax = _mm_andnot_ps(signMask, x);
+    __m128 ay = _mm_andnot_ps(signMask, y);
+    __m128 mn = _mm_min_ps(ax, ay);
+    __m128 mx = _mm_max_ps(ax, ay);
+    __m128 a = _mm_div_ps(mn, _mm_max_ps(mx, _mm_set1_ps(FLT_MIN)));
+
+    __m128 big = _mm_cmpgt_ps(a, _mm_set1_ps(0.4142135623730950f));
+    __m128 z = selectSSE2(big,
+                          _mm_div_ps(_mm_sub_ps(a, one), _mm_add_ps(a, one)),
+                          a);
+    __m128 r = _mm_and_ps(big, _mm_set1_ps(piF / 4.f));
+
+    __m128 z2 = _mm_mul_ps(z, z);
+    __m128 p = _mm_set1_ps(8.05374449538e-2f);
+    p = _mm_sub_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.38776856032e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z2), _mm_set1_ps(1.99777106478e-1f));
+    p = _mm_sub_ps(_mm_mul_ps(p, z2), _mm_set1_ps(3.33329491539e-1f));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z2), z), z);
+    r = _mm_add_ps(r, p);
+
+    r = selectSSE2(_mm_cmpgt_ps(ay, ax),
+                   _mm_sub_ps(_mm_set1_ps(piF / 2.f), r), r);
+    r = selectSSE2(_mm_cmplt_ps(x, _mm_setzero_ps()),
+                   _mm_sub_ps(_mm_set1_ps(piF), r), r);
+
+    return _mm_or_ps(r, _mm_and_ps(signMask, y));
+}
+
+static inline float
+horizontalMaxSSE2(__m128 v)
+{
+    float f[4];
+    _mm_storeu_ps(f, v);
+    float max = f[0];
+    for (int i = 1; i < 4; ++i) if (f[i] > max) max = f[i];
+    return max;
+}
+
+static float
+cartesianToPolarSSE2(const float *reals, const float *imags,
+                     float *mags, float *phases, size_t n)
+{
+    __m128 vmax = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 re = _mm_loadu_ps(reals + i);
+        __m128 im = _mm_loadu_ps(imags + i);
+        __m128 mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re),
+                                            _mm_mul_ps(im, im)));
+        _mm_storeu_ps(phases + i, atan2SSE2(im, re));
+        _mm_storeu_ps(mags + i, mag);
+        vmax = _mm_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxSSE2(vmax);
+    float tmax = cartesianToPolarPlain(reals + i, imags + i,
+                                       mags + i, phases + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static float
+interleavedToPolarSSE2(const float *complex,
+                       float *mags, float *phases, size_t n)
+{
+    __m128 vmax = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(complex + i*2);
+        __m128 b = _mm_loadu_ps(complex + i*2 + 4);
+        __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re),
+                                            _mm_mul_ps(im, im)));
+        _mm_storeu_ps(mags + i, mag);
+        _mm_storeu_ps(phases + i, atan2SSE2(im, re));
+        vmax = _mm_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxSSE2(vmax);
+    float tmax = interleavedToPolarPlain(complex + i*2,
+                                         mags + i, phases + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static float
+magnitudesSSE2(const float *reals, const float *imags,
+               float *mags, size_t n)
+{
+    __m128 vmax = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 re = _mm_loadu_ps(reals + i);
+        __m128 im = _mm_loadu_ps(imags + i);
+        __m128 mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re),
+                                            _mm_mul_ps(im, im)));
+        _mm_storeu_ps(mags + i, mag);
+        vmax = _mm_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxSSE2(vmax);
+    float tmax = magnitudesPlain(reals + i, imags + i, mags + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static void
+quantiseMagnitudesSSE2(const float *mags, uint16_t *out,
+                       float scale, size_t n)
+{
+    // There is no unsigned 32->16 bit pack in SSE2, so offset into
+    // the signed range, pack with signed saturation and flip the
+    // top bit back again
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128i offset = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(short(0x8000));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(mags + i), vscale));
+        __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(mags + i + 4), vscale));
+        a = _mm_sub_epi32(a, offset);
+        b = _mm_sub_epi32(b, offset);
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(a, b), flip);
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+    quantiseMagnitudesPlain(mags + i, out + i, scale, n - i);
+}
+
+static void
+quantisePhasesSSE2(const float *phases, uint16_t *out, size_t n)
+{
+    const __m128 vscale = _mm_set1_ps(phaseQuantiseScale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(phases + i), vscale));
+        __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(phases + i + 4), vscale));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+    quantisePhasesPlain(phases + i, out + i, n - i);
+}
+
+static void
+dequantiseMagnitudesSSE2(const uint16_t *in, float *out,
+                         float scale, size_t n)
+{
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_unpacklo_epi16(v, zero);
+        __m128i hi = _mm_unpackhi_epi16(v, zero);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+    }
+    dequantiseMagnitudesPlain(in + i, out + i, scale, n - i);
+}
+
+static void
+dequantisePhasesSSE2(const uint16_t *in, float *out, size_t n)
+{
+    const __m128 vscale = _mm_set1_ps(phaseDequantiseScale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        // sign-extend by unpacking into the top halves and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+    }
+    dequantisePhasesPlain(in + i, out + i, n - i);
+}
+
+#endif // SV_SSE2
+
+
+#ifdef SV_AVX2
+
+// AVX2 implementations: as for SSE2 but eight values at a time
+
+static inline AVX2_FUNCTION __m256
+atan2AVX2(__m256 y, __m256 x)
+{
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    __m256 ax = _mm256_andnot_ps(signMask, x);
+    __m256 ay = _mm256_andnot_ps(signMask, y);
+    __m256 mn = _mm256_min_ps(ax, ay);
+    __m256 mx = _mm256_max_ps(ax, ay);
+    __m256 a = _mm256_div_ps(mn, _mm256_max_ps(mx, _mm256_set1_ps(FLT_MIN)));
+
+    __m256 big = _mm256_cmp_ps(a, _mm256_set1_ps(0.4142135623730950f),
+                               _CMP_GT_OQ);
+    __m256 z = _mm256_blendv_ps
+        (a, _mm256_div_ps(_mm256_sub_ps(a, one), _mm256_add_ps(a, one)), big);
+    __m256 r = _mm256_and_ps(big, _mm256_set1_ps(piF / 4.f));
+
+    __m256 z2 = _mm256_mul_ps(z, z);
+    __m256 p = _mm256_set1_ps(8.05374449538e-2f);
+    p = _mm256_sub_ps(_mm256_mul_ps(p, z2), _mm256_set1_ps(1.38776856032e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, z2), _mm256_set1_ps(1.99777106478e-1f));
+    p = _mm256_sub_ps(_mm256_mul_ps(p, z2), _mm256_set1_ps(3.33329491539e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, z2), z), z);
+    r = _mm256_add_ps(r, p);
+
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(piF / 2.f), r),
+                         _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(piF), r),
+                         _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+
+    return _mm256_or_ps(r, _mm256_and_ps(signMask, y));
+}
+
+static inline AVX2_FUNCTION float
+horizontalMaxAVX2(__m256 v)
+{
+    float f[8];
+    _mm256_storeu_ps(f, v);
+    float max = f[0];
+    for (int i = 1; i < 8; ++i) if (f[i] > max) max = f[i];
+    return max;
+}
+
+static AVX2_FUNCTION float
+cartesianToPolarAVX2(const float *reals, const float *imags,
+                     float *mags, float *phases, size_t n)
+{
+    __m256 vmax = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 re = _mm256_loadu_ps(reals + i);
+        __m256 im = _mm256_loadu_ps(imags + i);
+        __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(re, re),
+                                                  _mm256_mul_ps(im, im)));
+        _mm256_storeu_ps(phases + i, atan2AVX2(im, re));
+        _mm256_storeu_ps(mags + i, mag);
+        vmax = _mm256_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxAVX2(vmax);
+    float tmax = cartesianToPolarPlain(reals + i, imags + i,
+                                       mags + i, phases + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static AVX2_FUNCTION float
+interleavedToPolarAVX2(const float *complex,
+                       float *mags, float *phases, size_t n)
+{
+    __m256 vmax = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(complex + i*2);
+        __m256 b = _mm256_loadu_ps(complex + i*2 + 8);
+        // shuffle works within 128-bit lanes, leaving the 64-bit
+        // pairs in the order 0 2 1 3; permute puts them right
+        __m256 re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        re = _mm256_castpd_ps(_mm256_permute4x64_pd
+                              (_mm256_castps_pd(re), _MM_SHUFFLE(3, 1, 2, 0)));
+        im = _mm256_castpd_ps(_mm256_permute4x64_pd
+                              (_mm256_castps_pd(im), _MM_SHUFFLE(3, 1, 2, 0)));
+        __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(re, re),
+                                                  _mm256_mul_ps(im, im)));
+        _mm256_storeu_ps(mags + i, mag);
+        _mm256_storeu_ps(phases + i, atan2AVX2(im, re));
+        vmax = _mm256_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxAVX2(vmax);
+    float tmax = interleavedToPolarPlain(complex + i*2,
+                                         mags + i, phases + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static AVX2_FUNCTION float
+magnitudesAVX2(const float *reals, const float *imags,
+               float *mags, size_t n)
+{
+    __m256 vmax = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 re = _mm256_loadu_ps(reals + i);
+        __m256 im = _mm256_loadu_ps(imags + i);
+        __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(re, re),
+                                                  _mm256_mul_ps(im, im)));
+        _mm256_storeu_ps(mags + i, mag);
+        vmax = _mm256_max_ps(vmax, mag);
+    }
+    float max = horizontalMaxAVX2(vmax);
+    float tmax = magnitudesPlain(reals + i, imags + i, mags + i, n - i);
+    return tmax > max ? tmax : max;
+}
+
+static AVX2_FUNCTION void
+quantiseMagnitudesAVX2(const float *mags, uint16_t *out,
+                       float scale, size_t n)
+{
+    const __m256 vscale = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvttps_epi32
+            (_mm256_mul_ps(_mm256_loadu_ps(mags + i), vscale));
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                          _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+    quantiseMagnitudesPlain(mags + i, out + i, scale, n - i);
+}
+
+static AVX2_FUNCTION void
+quantisePhasesAVX2(const float *phases, uint16_t *out, size_t n)
+{
+    const __m256 vscale = _mm256_set1_ps(phaseQuantiseScale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvttps_epi32
+            (_mm256_mul_ps(_mm256_loadu_ps(phases + i), vscale));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                         _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+    quantisePhasesPlain(phases + i, out + i, n - i);
+}
+
+static AVX2_FUNCTION void
+dequantiseMagnitudesAVX2(const uint16_t *in, float *out,
+                         float scale, size_t n)
+{
+    const __m256 vscale = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32
+            (_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vscale));
+    }
+    dequantiseMagnitudesPlain(in + i, out + i, scale, n - i);
+}
+
+static AVX2_FUNCTION void
+dequantisePhasesAVX2(const uint16_t *in, float *out, size_t n)
+{
+    const __m256 vscale = _mm256_set1_ps(phaseDequantiseScale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32
+            (_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vscale));
+    }
+    dequantisePhasesPlain(in + i, out + i, n - i);
+}
+
+#endif // SV_AVX2
+
+
+struct KernelTable
+{
+    float (*cartesianToPolar)(const float *, const float *,
+                              float *, float *, size_t);
+    float (*interleavedToPolar)(const float *, float *, float *, size_t);
+    float (*magnitudes)(const float *, const float *, float *, size_t);
+    void (*quantiseMagnitudes)(const float *, uint16_t *, float, size_t);
+    void (*quantisePhases)(const float *, uint16_t *, size_t);
+    void (*dequantiseMagnitudes)(const uint16_t *, float *, float, size_t);
+    void (*dequantisePhases)(const uint16_t *, float *, size_t);
+    FFTKernels::Implementation implementation;
+};
+
+static KernelTable
+chooseKernels()
+{
+    KernelTable t;
+
+    t.cartesianToPolar = cartesianToPolarPlain;
+    t.interleavedToPolar = interleavedToPolarPlain;
+    t.magnitudes = magnitudesPlain;
+    t.quantiseMagnitudes = quantiseMagnitudesPlain;
+    t.quantisePhases = quantisePhasesPlain;
+    t.dequantiseMagnitudes = dequantiseMagnitudesPlain;
+    t.dequantisePhases = dequantisePhasesPlain;
+    t.implementation = FFTKernels::Plain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) {
+        t.cartesianToPolar = cartesianToPolarSSE2;
+        t.interleavedToPolar = interleavedToPolarSSE2;
+        t.magnitudes = magnitudesSSE2;
+        t.quantiseMagnitudes = quantiseMagnitudesSSE2;
+        t.quantisePhases = quantisePhasesSSE2;
+        t.dequantiseMagnitudes = dequantiseMagnitudesSSE2;
+        t.dequantisePhases = dequantisePhasesSSE2;
+        t.implementation = FFTKernels::SSE2;
+    }
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) {
+        t.cartesianToPolar = cartesianToPolarAVX2;
+        t.interleavedToPolar = interleavedToPolarAVX2;
+        t.magnitudes = magnitudesAVX2;
+        t.quantiseMagnitudes = quantiseMagnitudesAVX2;
+        t.quantisePhases = quantisePhasesAVX2;
+        t.dequantiseMagnitudes = dequantiseMagnitudesAVX2;
+        t.dequantisePhases = dequantisePhasesAVX2;
+        t.implementation = FFTKernels::AVX2;
+    }
+#endif
+
+#ifdef DEBUG_FFT_KERNELS
+    std::cerr << "FFTKernels: using implementation " << t.implementation
+              << std::endl;
+#endif
+
+    return t;
+}
+
+static const KernelTable kernels = chooseKernels();
+
+float
+FFTKernels::cartesianToPolar(const float *reals, const float *imags,
+                             float *mags, float *phases, size_t n)
+{
+    return kernels.cartesianToPolar(reals, imags, mags, phases, n);
+}
+
+float
+FFTKernels::interleavedToPolar(const float *complex,
+                               float *mags, float *phases, size_t n)
+{
+    return kernels.interleavedToPolar(complex, mags, phases, n);
+}
+
+float
+FFTKernels::magnitudes(const float *reals, const float *imags,
+                       float *mags, size_t n)
+{
+    return kernels.magnitudes(reals, imags, mags, n);
+}
+
+void
+FFTKernels::quantiseMagnitudes(const float *mags, uint16_t *out,
+                               float scale, size_t n)
+{
+    kernels.quantiseMagnitudes(mags, out, scale, n);
+}
+
+void
+FFTKernels::quantisePhases(const float *phases, uint16_t *out, size_t n)
+{
+    kernels.quantisePhases(phases, out, n);
+}
+
+void
+FFTKernels::dequantiseMagnitudes(const uint16_t *in, float *out,
+                                 float scale, size_t n)
+{
+    kernels.dequantiseMagnitudes(in, out, scale, n);
+}
+
+void
+FFTKernels::dequantisePhases(const uint16_t *in, float *out, size_t n)
+{
+    kernels.dequantisePhases(in, out, n);
+}
+
+FFTKernels::Implementation
+FFTKernels::getImplementation()
+{
+    return kernels.implementation;
+}
+
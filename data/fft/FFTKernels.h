@@ -0,0 +1,96 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _FFT_KERNELS_H_
+#define _FFT_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Whole-column conversion functions used when storing FFT output in
+ * the caches and retrieving it again.  Each function has SSE2 and
+ * AVX2 implementations as well as a plain C++ one, and the best one
+ * supported by the processor is selected at runtime.
+ *
+ * The vector implementations of cartesianToPolar use a polynomial
+ * approximation to atan2 that is accurate to within about 1e-6
+ * radians, which is well within the resolution of the compact cache
+ * representation.  All other results match the plain implementation.
+ */
+
+class FFTKernels
+{
+public:
+    /**
+     * Convert n complex values in separate real and imaginary arrays
+     * to magnitude and phase.  The output arrays may be the same as
+     * the input ones.  Return the largest magnitude.
+     */
+    static float cartesianToPolar(const float *reals, const float *imags,
+                                  float *mags, float *phases, size_t n);
+
+    /**
+     * Convert n complex values stored as interleaved real and
+     * imaginary pairs (as returned by the FFT) to separate magnitude
+     * and phase arrays.  Return the largest magnitude.
+     */
+    static float interleavedToPolar(const float *complex,
+                                     float *mags, float *phases, size_t n);
+
+    /**
+     * Calculate the magnitudes of n complex values in separate real
+     * and imaginary arrays.  Return the largest magnitude.
+     */
+    static float magnitudes(const float *reals, const float *imags,
+                            float *mags, size_t n);
+
+    /**
+     * Quantise n magnitudes to 16-bit unsigned values, by multiplying
+     * each by the given scale factor (typically 65535 divided by the
+     * largest magnitude) and truncating.
+     */
+    static void quantiseMagnitudes(const float *mags, uint16_t *out,
+                                   float scale, size_t n);
+
+    /**
+     * Quantise n phases in the range -pi to pi to 16-bit signed
+     * values, stored in unsigned form.
+     */
+    static void quantisePhases(const float *phases, uint16_t *out, size_t n);
+
+    /**
+     * Convert n 16-bit quantised magnitudes back to float, by
+     * multiplying each by the given scale factor (typically the
+     * largest magnitude divided by 65535).
+     */
+    static void dequantiseMagnitudes(const uint16_t *in, float *out,
+                                     float scale, size_t n);
+
+    /**
+     * Convert n 16-bit quantised phases back to floating-point
+     * phases in the range -pi to pi.
+     */
+    static void dequantisePhases(const uint16_t *in, float *out, size_t n);
+
+    enum Implementation { Plain, SSE2, AVX2 };
+
+    /**
+     * Return the implementation in use.
+     */
+    static Implementation getImplementation();
+};
+
+#endif
@@ -18,6 +18,17 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+
+#ifndef __GNUC__
+#include <alloca.h>
+#endif
 
 //#define DEBUG_FFT_MEMORY_CACHE 1
 
@@ -25,6 +36,7 @@ FFTMemoryCache::FFTMemoryCache(FFTCache::StorageType storageType,
                                size_t width, size_t height) :
     m_width(width),
     m_height(height),
+    m_stride(0),
     m_magnitude(0),
     m_phase(0),
     m_fmagnitude(0),
@@ -32,7 +44,10 @@ FFTMemoryCache::FFTMemoryCache(FFTCache::StorageType storageType,
     m_freal(0),
     m_fimag(0),
     m_factor(0),
-    m_storageType(storageType)
+    m_storageType(storageType),
+    m_slab(0),
+    m_slabSize(0),
+    m_slabMapped(false)
 {
 #ifdef DEBUG_FFT_MEMORY_CACHE
     std::cerr << "FFTMemoryCache[" << this << "]::FFTMemoryCache (type "
@@ -48,21 +63,7 @@ FFTMemoryCache::~FFTMemoryCache()
     std::cerr << "FFTMemoryCache[" << this << "]::~FFTMemoryCache" << std::endl;
 #endif
 
-    for (size_t i = 0; i < m_width; ++i) {
-	if (m_magnitude && m_magnitude[i]) free(m_magnitude[i]);
-	if (m_phase && m_phase[i]) free(m_phase[i]);
-	if (m_fmagnitude && m_fmagnitude[i]) free(m_fmagnitude[i]);
-	if (m_fphase && m_fphase[i]) free(m_fphase[i]);
-        if (m_freal && m_freal[i]) free(m_freal[i]);
-        if (m_fimag && m_fimag[i]) free(m_fimag[i]);
-    }
-
-    if (m_magnitude) free(m_magnitude);
-    if (m_phase) free(m_phase);
-    if (m_fmagnitude) free(m_fmagnitude);
-    if (m_fphase) free(m_fphase);
-    if (m_freal) free(m_freal);
-    if (m_fimag) free(m_fimag);
+    freeSlab();
     if (m_factor) free(m_factor);
 }
 
@@ -77,55 +78,104 @@ FFTMemoryCache::initialise()
     std::cerr << "FFTMemoryCache[" << this << "]::initialise(" << width << "x" << height << " = " << width*height << ")" << std::endl;
 #endif
 
+    size_t cellSize = (m_storageType == FFTCache::Compact ?
+                       sizeof(uint16_t) : sizeof(float));
+
+    size_t columnSize = height * cellSize;
+    columnSize = ((columnSize + SlabAlignment - 1) / SlabAlignment) * SlabAlignment;
+    if (columnSize == 0) columnSize = SlabAlignment;
+
+    m_stride = columnSize / cellSize;
+
+    size_t arraySize = columnSize * width;
+    allocateSlab(arraySize * 2);
+
     if (m_storageType == FFTCache::Compact) {
-        initialise(m_magnitude);
-        initialise(m_phase);
+        m_magnitude = (uint16_t *)m_slab;
+        m_phase = (uint16_t *)(m_slab + arraySize);
     } else if (m_storageType == FFTCache::Polar) {
-        initialise(m_fmagnitude);
-        initialise(m_fphase);
+        m_fmagnitude = (float *)m_slab;
+        m_fphase = (float *)(m_slab + arraySize);
     } else {
-        initialise(m_freal);
-        initialise(m_fimag);
+        m_freal = (float *)m_slab;
+        m_fimag = (float *)(m_slab + arraySize);
     }
 
     m_colset.resize(width);
 
     m_factor = (float *)realloc(m_factor, width * sizeof(float));
+    if (!m_factor) throw std::bad_alloc();
 
     m_width = width;
     m_height = height;
 
 #ifdef DEBUG_FFT_MEMORY_CACHE
-    std::cerr << "done, width = " << m_width << " height = " << m_height << std::endl;
+    std::cerr << "done, width = " << m_width << " height = " << m_height
+              << " stride = " << m_stride << " slab size = " << m_slabSize
+              << (m_slabMapped ? " (mapped)" : "") << std::endl;
 #endif
 }
 
 void
-FFTMemoryCache::initialise(uint16_t **&array)
+FFTMemoryCache::allocateSlab(size_t size)
 {
-    array = (uint16_t **)malloc(m_width * sizeof(uint16_t *));
-    if (!array) throw std::bad_alloc();
-    MUNLOCK(array, m_width * sizeof(uint16_t *));
-
-    for (size_t i = 0; i < m_width; ++i) {
-	array[i] = (uint16_t *)malloc(m_height * sizeof(uint16_t));
-	if (!array[i]) throw std::bad_alloc();
-	MUNLOCK(array[i], m_height * sizeof(uint16_t));
+    m_slabSize = size;
+    m_slabMapped = false;
+    m_slab = 0;
+
+#if !defined(_WIN32) && defined(MAP_ANONYMOUS)
+    if (size >= HugePageThreshold) {
+        void *p = ::mmap(0, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            // Only a hint; the kernel may decline, which is harmless
+            ::madvise(p, size, MADV_HUGEPAGE);
+#endif
+            m_slab = (char *)p;
+            m_slabMapped = true;
+        }
+    }
+#endif
+
+    if (!m_slab) {
+#ifdef _WIN32
+        m_slab = (char *)_aligned_malloc(size, SlabAlignment);
+#else
+        void *p = 0;
+        if (posix_memalign(&p, SlabAlignment, size) == 0) {
+            m_slab = (char *)p;
+        }
+#endif
     }
+
+    if (!m_slab) {
+        m_slabSize = 0;
+        throw std::bad_alloc();
+    }
+
+    MUNLOCK(m_slab, m_slabSize);
 }
 
 void
-FFTMemoryCache::initialise(float **&array)
+FFTMemoryCache::freeSlab()
 {
-    array = (float **)malloc(m_width * sizeof(float *));
-    if (!array) throw std::bad_alloc();
-    MUNLOCK(array, m_width * sizeof(float *));
-
-    for (size_t i = 0; i < m_width; ++i) {
-	array[i] = (float *)malloc(m_height * sizeof(float));
-	if (!array[i]) throw std::bad_alloc();
-	MUNLOCK(array[i], m_height * sizeof(float));
+    if (!m_slab) return;
+
+#if !defined(_WIN32) && defined(MAP_ANONYMOUS)
+    if (m_slabMapped) {
+        ::munmap(m_slab, m_slabSize);
+        m_slab = 0;
+        return;
     }
+#endif
+
+#ifdef _WIN32
+    _aligned_free(m_slab);
+#else
+    free(m_slab);
+#endif
+    m_slab = 0;
 }
 
 void
@@ -137,15 +187,24 @@ FFTMemoryCache::setColumnAt(size_t x, float *mags, float *phases, float factor)
 
     if (m_storageType == FFTCache::Rectangular) {
         Profiler subprof("FFTMemoryCache::setColumnAt: polar to cart");
+        float *re = m_freal + x * m_stride;
+        float *im = m_fimag + x * m_stride;
         for (size_t y = 0; y < m_height; ++y) {
-            m_freal[x][y] = mags[y] * cosf(phases[y]);
-            m_fimag[x][y] = mags[y] * sinf(phases[y]);
+            re[y] = mags[y] * cosf(phases[y]);
+            im[y] = mags[y] * sinf(phases[y]);
         }
-    } else {
+    } else if (m_storageType == FFTCache::Polar) {
+        float scale = (factor > 0.f ? 1.f / factor : 0.f);
+        float *mag = m_fmagnitude + x * m_stride;
         for (size_t y = 0; y < m_height; ++y) {
-            setMagnitudeAt(x, y, mags[y]);
-            setPhaseAt(x, y, phases[y]);
+            mag[y] = mags[y] * scale;
         }
+        memcpy(m_fphase + x * m_stride, phases, m_height * sizeof(float));
+    } else {
+        float scale = (factor > 0.f ? 65535.f / factor : 0.f);
+        FFTKernels::quantiseMagnitudes(mags, m_magnitude + x * m_stride,
+                                       scale, m_height);
+        FFTKernels::quantisePhases(phases, m_phase + x * m_stride, m_height);
     }
 
     m_colsetLock.lockForWrite();
@@ -163,25 +222,26 @@ FFTMemoryCache::setColumnAt(size_t x, float *reals, float *imags)
     switch (m_storageType) {
 
     case FFTCache::Rectangular:
-        for (size_t y = 0; y < m_height; ++y) {
-            m_freal[x][y] = reals[y];
-            m_fimag[x][y] = imags[y];
-            float mag = sqrtf(reals[y] * reals[y] + imags[y] * imags[y]);
-            if (mag > max) max = mag;
-        }
+    {
+        memcpy(m_freal + x * m_stride, reals, m_height * sizeof(float));
+        memcpy(m_fimag + x * m_stride, imags, m_height * sizeof(float));
+        // only the largest magnitude is wanted; the scratch space is
+        // on the stack as fill threads may write columns concurrently
+#ifdef __GNUC__
+        float mags[m_height];
+#else
+        float *mags = (float *)alloca(m_height * sizeof(float));
+#endif
+        max = FFTKernels::magnitudes(reals, imags, mags, m_height);
         break;
+    }
 
     case FFTCache::Compact:
     case FFTCache::Polar:
     {
         Profiler subprof("FFTMemoryCache::setColumnAt: cart to polar");
-        for (size_t y = 0; y < m_height; ++y) {
-            float mag = sqrtf(reals[y] * reals[y] + imags[y] * imags[y]);
-            float phase = atan2f(imags[y], reals[y]);
-            reals[y] = mag;
-            imags[y] = phase;
-            if (mag > max) max = mag;
-        }
+        // converts in place, leaving magnitudes in reals and phases in imags
+        max = FFTKernels::cartesianToPolar(reals, imags, reals, imags, m_height);
         break;
     }
     };
@@ -19,6 +19,7 @@
 #include "FFTCacheReader.h"
 #include "FFTCacheWriter.h"
 #include "FFTCacheStorageType.h"
+#include "FFTKernels.h"
 #include "base/ResizeableBitset.h"
 #include "base/Profiler.h"
 
@@ -41,6 +42,10 @@
  * to [0,1] with respect to the column, so the normalization
  * factor should be calculated before all values in a column, and
  * set appropriately.
+ *
+ * Columns are stored contiguously, one after another, in a single
+ * aligned allocation rather than one allocation per column, so that
+ * reading a run of adjacent columns walks through memory in order.
  */
 
 class FFTMemoryCache : public FFTCacheReader, public FFTCacheWriter
@@ -56,8 +61,9 @@ public:
     float getMagnitudeAt(size_t x, size_t y) const {
         if (m_storageType == FFTCache::Rectangular) {
             Profiler profiler("FFTMemoryCache::getMagnitudeAt: cart to polar");
-            return sqrtf(m_freal[x][y] * m_freal[x][y] +
-                         m_fimag[x][y] * m_fimag[x][y]);
+            const float *re = m_freal + x * m_stride;
+            const float *im = m_fimag + x * m_stride;
+            return sqrtf(re[y] * re[y] + im[y] * im[y]);
         } else {
             return getNormalizedMagnitudeAt(x, y) * m_factor[x];
         }
@@ -65,8 +71,8 @@ public:
     
     float getNormalizedMagnitudeAt(size_t x, size_t y) const {
         if (m_storageType == FFTCache::Rectangular) return getMagnitudeAt(x, y) / m_factor[x];
-        else if (m_storageType == FFTCache::Polar) return m_fmagnitude[x][y];
-        else return float(m_magnitude[x][y]) / 65535.0;
+        else if (m_storageType == FFTCache::Polar) return m_fmagnitude[x * m_stride + y];
+        else return float(m_magnitude[x * m_stride + y]) / 65535.0;
     }
     
     float getMaximumMagnitudeAt(size_t x) const {
@@ -76,19 +82,19 @@ public:
     float getPhaseAt(size_t x, size_t y) const {
         if (m_storageType == FFTCache::Rectangular) {
             Profiler profiler("FFTMemoryCache::getValuesAt: cart to polar");
-            return atan2f(m_fimag[x][y], m_freal[x][y]);
+            return atan2f(m_fimag[x * m_stride + y], m_freal[x * m_stride + y]);
         } else if (m_storageType == FFTCache::Polar) {
-            return m_fphase[x][y];
+            return m_fphase[x * m_stride + y];
         } else {
-            int16_t i = (int16_t)m_phase[x][y];
+            int16_t i = (int16_t)m_phase[x * m_stride + y];
             return (float(i) / 32767.0) * M_PI;
         }
     }
     
     void getValuesAt(size_t x, size_t y, float &real, float &imag) const {
         if (m_storageType == FFTCache::Rectangular) {
-            real = m_freal[x][y];
-            imag = m_fimag[x][y];
+            real = m_freal[x * m_stride + y];
+            imag = m_fimag[x * m_stride + y];
         } else {
             Profiler profiler("FFTMemoryCache::getValuesAt: polar to cart");
             float mag = getMagnitudeAt(x, y);
@@ -100,21 +106,34 @@ public:
 
     void getMagnitudesAt(size_t x, float *values, size_t minbin, size_t count, size_t step) const
     {
+        size_t base = x * m_stride + minbin;
+        if (step == 1) {
+            if (m_storageType == FFTCache::Rectangular) {
+                FFTKernels::magnitudes(m_freal + base, m_fimag + base,
+                                       values, count);
+                return;
+            } else if (m_storageType == FFTCache::Compact) {
+                FFTKernels::dequantiseMagnitudes(m_magnitude + base, values,
+                                                 m_factor[x] / 65535.f, count);
+                return;
+            }
+        }
         if (m_storageType == FFTCache::Rectangular) {
+            const float *re = m_freal + base;
+            const float *im = m_fimag + base;
             for (size_t i = 0; i < count; ++i) {
-                size_t y = i * step + minbin;
-                values[i] = sqrtf(m_freal[x][y] * m_freal[x][y] +
-                                  m_fimag[x][y] * m_fimag[x][y]);
+                size_t y = i * step;
+                values[i] = sqrtf(re[y] * re[y] + im[y] * im[y]);
             }
         } else if (m_storageType == FFTCache::Polar) {
+            const float *mag = m_fmagnitude + base;
             for (size_t i = 0; i < count; ++i) {
-                size_t y = i * step + minbin;
-                values[i] = m_fmagnitude[x][y] * m_factor[x];
+                values[i] = mag[i * step] * m_factor[x];
             }
         } else {
+            const uint16_t *mag = m_magnitude + base;
             for (size_t i = 0; i < count; ++i) {
-                size_t y = i * step + minbin;
-                values[i] = (float(m_magnitude[x][y]) * m_factor[x]) / 65535.0;
+                values[i] = (float(mag[i * step]) * m_factor[x]) / 65535.0;
             }
         }
     }
@@ -140,45 +159,40 @@ public:
 private:
     size_t m_width;
     size_t m_height;
-    uint16_t **m_magnitude;
-    uint16_t **m_phase;
-    float **m_fmagnitude;
-    float **m_fphase;
-    float **m_freal;
-    float **m_fimag;
+    size_t m_stride;
+    uint16_t *m_magnitude;
+    uint16_t *m_phase;
+    float *m_fmagnitude;
+    float *m_fphase;
+    float *m_freal;
+    float *m_fimag;
     float *m_factor;
     FFTCache::StorageType m_storageType;
     ResizeableBitset m_colset;
     mutable QReadWriteLock m_colsetLock;
 
+    // All column data lives in a single slab: the first of the two
+    // arrays for the storage type occupies the first half, the second
+    // array the second half.  Columns are m_stride elements apart,
+    // with m_stride rounded up so that every column starts on a
+    // SlabAlignment boundary.
+    char *m_slab;
+    size_t m_slabSize;
+    bool m_slabMapped;
+
+    static const size_t SlabAlignment = 64;
+
+    // Slabs at least this large are allocated with mmap and marked
+    // as candidates for transparent huge pages, where supported
+    static const size_t HugePageThreshold = 8 * 1024 * 1024;
+
     void initialise();
+    void allocateSlab(size_t size);
+    void freeSlab();
 
     void setNormalizationFactor(size_t x, float factor) {
         if (x < m_width) m_factor[x] = factor;
     }
-    
-    void setMagnitudeAt(size_t x, size_t y, float mag) {
-         // norm factor must already be set
-        setNormalizedMagnitudeAt(x, y, mag / m_factor[x]);
-    }
-    
-    void setNormalizedMagnitudeAt(size_t x, size_t y, float norm) {
-        if (x < m_width && y < m_height) {
-            if (m_storageType == FFTCache::Polar) m_fmagnitude[x][y] = norm;
-            else m_magnitude[x][y] = uint16_t(norm * 65535.0);
-        }
-    }
-    
-    void setPhaseAt(size_t x, size_t y, float phase) {
-        // phase in range -pi -> pi
-        if (x < m_width && y < m_height) {
-            if (m_storageType == FFTCache::Polar) m_fphase[x][y] = phase;
-            else m_phase[x][y] = uint16_t(int16_t((phase * 32767) / M_PI));
-        }
-    }
-
-    void initialise(uint16_t **&);
-    void initialise(float **&);
 };
 
 
@@ -0,0 +1,389 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "FFTPersistentCache.h"
+
+#include "model/DenseTimeValueModel.h"
+#include "model/WaveFileModel.h"
+
+#include "base/TempDirectory.h"
+#include "base/Preferences.h"
+#include "base/Exceptions.h"
+#include "base/Profiler.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QByteArray>
+#include <QStringList>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QUrl>
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#include <unistd.h>
+#endif
+
+#include <iostream>
+
+//#define DEBUG_FFT_PERSISTENT_CACHE 1
+
+QMutex
+FFTPersistentCache::m_mutex;
+
+bool
+FFTPersistentCache::isEnabled()
+{
+    return Preferences::getInstance()->getPersistentFFTCache();
+}
+
+bool
+FFTPersistentCache::canPersist(const DenseTimeValueModel *model)
+{
+    const WaveFileModel *wfm = dynamic_cast<const WaveFileModel *>(model);
+    return (wfm && wfm->getLocation() != "");
+}
+
+QString
+FFTPersistentCache::makeKey(const DenseTimeValueModel *model,
+                            int channel,
+                            WindowType windowType,
+                            size_t windowSize,
+                            size_t windowIncrement,
+                            size_t fftSize,
+                            bool polar)
+{
+    Profiler profiler("FFTPersistentCache::makeKey", true);
+
+    if (!model || !model->isOK() || !model->isReady()) return "";
+    if (!canPersist(model)) return "";
+
+    QString location = dynamic_cast<const WaveFileModel *>(model)->getLocation();
+
+    QString path = location;
+    QUrl url(location);
+    if (url.scheme() == "file") path = url.toLocalFile();
+
+    QFileInfo fi(path);
+    bool local = (fi.exists() && fi.isFile());
+
+    size_t start = model->getStartFrame();
+    size_t end = model->getEndFrame();
+    if (end <= start) return "";
+
+    QByteArray params;
+    QDataStream stream(&params, QIODevice::WriteOnly);
+    stream << quint32(FormatVersion)
+           << quint64(model->getSampleRate())
+           << quint64(model->getChannelCount())
+           << qint32(channel)
+           << quint64(start)
+           << quint64(end)
+           << quint32(windowType)
+           << quint64(windowSize)
+           << quint64(windowIncrement)
+           << quint64(fftSize)
+           << quint32(polar ? 1 : 0);
+
+    if (local) {
+        stream << fi.absoluteFilePath()
+               << quint64(fi.size())
+               << quint64(fi.lastModified().toTime_t());
+    } else {
+        stream << location;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(params);
+
+    static const size_t blockSize = 4096;
+    static const size_t blocks = 64;
+
+    size_t frames = end - start;
+    size_t step = 0;
+
+    if (local) {
+        if (frames > blockSize) step = (frames - blockSize) / (blocks - 1);
+    } else {
+        step = blockSize;
+    }
+
+    float *buffer = new float[blockSize];
+
+    for (size_t i = 0; local ? (i < blocks) : (step * i < frames); ++i) {
+        size_t got = model->getData(channel, start + step * i,
+                                    blockSize, buffer);
+        hash.addData((const char *)buffer, got * sizeof(float));
+        if (step == 0) break;
+    }
+
+    delete[] buffer;
+
+    return QString::fromLocal8Bit(hash.result().toHex());
+}
+
+QString
+FFTPersistentCache::getCacheDirectory()
+{
+    QDir dir = TempDirectory::getInstance()->getContainingPath();
+
+    QString cacheDirName("fftcache");
+
+    QFileInfo fi(dir.filePath(cacheDirName));
+
+    if ((fi.exists() && !fi.isDir()) ||
+        (!fi.exists() && !dir.mkdir(cacheDirName))) {
+
+        throw DirectoryCreationFailed(fi.filePath());
+    }
+
+    return fi.filePath();
+}
+
+QString
+FFTPersistentCache::getTempFileName(QString fileBase, size_t block)
+{
+    // must match the naming used by MatrixFile
+    QDir tempDir(TempDirectory::getInstance()->getPath());
+    return tempDir.filePath(QString("%1-%2.mfc").arg(fileBase).arg(block));
+}
+
+bool
+FFTPersistentCache::linkOrCopy(QString from, QString to)
+{
+#ifndef _WIN32
+    if (::link(from.toLocal8Bit().data(), to.toLocal8Bit().data()) == 0) {
+        return true;
+    }
+#endif
+    return QFile::copy(from, to);
+}
+
+bool
+FFTPersistentCache::retrieve(QString key, QString fileBase, Entry &entry)
+{
+    Profiler profiler("FFTPersistentCache::retrieve", true);
+
+    QMutexLocker locker(&m_mutex);
+
+    QDir dir;
+
+    try {
+        dir = QDir(getCacheDirectory());
+    } catch (DirectoryCreationFailed f) {
+        std::cerr << "WARNING: FFTPersistentCache::retrieve: "
+                  << f.what() << std::endl;
+        return false;
+    }
+
+    QString indexName = dir.filePath(key + ".idx");
+    QFile index(indexName);
+    if (!index.open(QIODevice::ReadOnly)) return false;
+
+    quint32 magic = 0, version = 0, sizeOfSizeT = 0, storageType = 0;
+    quint64 width = 0, height = 0, blockWidth = 0, blockCount = 0;
+
+    QDataStream stream(&index);
+    stream >> magic >> version >> sizeOfSizeT >> storageType
+           >> width >> height >> blockWidth >> blockCount;
+    bool good = (stream.status() == QDataStream::Ok);
+    index.close();
+
+    // The cache files contain native size_t headers and native
+    // floats, so an entry written by a different build may not be
+    // readable
+
+    if (!good || magic != Magic || version != FormatVersion ||
+        sizeOfSizeT != sizeof(size_t) || storageType > FFTCache::Polar) {
+        std::cerr << "WARNING: FFTPersistentCache::retrieve: Index for "
+                  << key.toStdString() << " is unreadable or from an "
+                  << "incompatible version, discarding it" << std::endl;
+        removeEntry(dir, key);
+        return false;
+    }
+
+    if (width != entry.width || height != entry.height ||
+        blockWidth != entry.blockWidth || blockCount != entry.blockCount) {
+#ifdef DEBUG_FFT_PERSISTENT_CACHE
+        std::cerr << "FFTPersistentCache::retrieve: Entry " << key.toStdString()
+                  << " has different dimensions from those requested" << std::endl;
+#endif
+        return false;
+    }
+
+    for (size_t c = 0; c < blockCount; ++c) {
+        QString from = dir.filePath(QString("%1-%2.mfc").arg(key).arg(c));
+        if (!linkOrCopy(from, getTempFileName(fileBase, c))) {
+            std::cerr << "WARNING: FFTPersistentCache::retrieve: Failed to "
+                      << "retrieve cache file " << from.toStdString()
+                      << ", discarding entry" << std::endl;
+            discard(fileBase, c);
+            removeEntry(dir, key);
+            return false;
+        }
+    }
+
+    // Update the modification time of the index, which is what we
+    // use to find the least recently used entries
+    ::utime(indexName.toLocal8Bit().data(), 0);
+
+    entry.storageType = FFTCache::StorageType(storageType);
+
+#ifdef DEBUG_FFT_PERSISTENT_CACHE
+    std::cerr << "FFTPersistentCache::retrieve: Retrieved " << key.toStdString()
+              << " as " << fileBase.toStdString() << std::endl;
+#endif
+
+    return true;
+}
+
+bool
+FFTPersistentCache::store(QString key, QString fileBase, const Entry &entry)
+{
+    Profiler profiler("FFTPersistentCache::store", true);
+
+    QMutexLocker locker(&m_mutex);
+
+    QDir dir;
+
+    try {
+        dir = QDir(getCacheDirectory());
+    } catch (DirectoryCreationFailed f) {
+        std::cerr << "WARNING: FFTPersistentCache::store: "
+                  << f.what() << std::endl;
+        return false;
+    }
+
+    removeEntry(dir, key);
+
+    for (size_t c = 0; c < entry.blockCount; ++c) {
+        QString to = dir.filePath(QString("%1-%2.mfc").arg(key).arg(c));
+        if (!linkOrCopy(getTempFileName(fileBase, c), to)) {
+            std::cerr << "WARNING: FFTPersistentCache::store: Failed to "
+                      << "store cache file " << to.toStdString() << std::endl;
+            removeEntry(dir, key);
+            return false;
+        }
+    }
+
+    // Write the index last, and under a temporary name, so that a
+    // partially written entry is never found by retrieve()
+
+    QString tempIndexName = dir.filePath(key + ".tmp");
+    QFile index(tempIndexName);
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        removeEntry(dir, key);
+        return false;
+    }
+
+    QDataStream stream(&index);
+    stream << quint32(Magic)
+           << quint32(FormatVersion)
+           << quint32(sizeof(size_t))
+           << quint32(entry.storageType)
+           << quint64(entry.width)
+           << quint64(entry.height)
+           << quint64(entry.blockWidth)
+           << quint64(entry.blockCount);
+    bool good = (stream.status() == QDataStream::Ok);
+    index.close();
+
+    if (!good || !QFile::rename(tempIndexName, dir.filePath(key + ".idx"))) {
+        QFile::remove(tempIndexName);
+        removeEntry(dir, key);
+        return false;
+    }
+
+#ifdef DEBUG_FFT_PERSISTENT_CACHE
+    std::cerr << "FFTPersistentCache::store: Stored " << fileBase.toStdString()
+              << " as " << key.toStdString() << std::endl;
+#endif
+
+    qint64 limit = Preferences::getInstance()->getPersistentFFTCacheSize();
+    prune(dir, limit * 1024 * 1024);
+
+    return true;
+}
+
+void
+FFTPersistentCache::discard(QString fileBase, size_t blockCount)
+{
+    for (size_t c = 0; c < blockCount; ++c) {
+        QString name = getTempFileName(fileBase, c);
+        if (QFileInfo(name).exists()) QFile::remove(name);
+    }
+}
+
+void
+FFTPersistentCache::removeEntry(QDir &dir, QString key)
+{
+    QFile::remove(dir.filePath(key + ".idx"));
+
+    QStringList files = dir.entryList(QStringList() << (key + "-*.mfc"),
+                                      QDir::Files);
+    for (int i = 0; i < files.size(); ++i) {
+        QFile::remove(dir.filePath(files[i]));
+    }
+}
+
+void
+FFTPersistentCache::prune(QDir &dir, qint64 limit)
+{
+    QFileInfoList files = dir.entryInfoList(QDir::Files);
+
+    qint64 total = 0;
+    for (int i = 0; i < files.size(); ++i) {
+        total += files[i].size();
+    }
+
+#ifdef DEBUG_FFT_PERSISTENT_CACHE
+    std::cerr << "FFTPersistentCache::prune: Total size " << total/1024
+              << "K, limit " << limit/1024 << "K" << std::endl;
+#endif
+
+    if (total <= limit) return;
+
+    // Oldest first
+
+    QFileInfoList indexes = dir.entryInfoList(QStringList() << "*.idx",
+                                              QDir::Files,
+                                              QDir::Time | QDir::Reversed);
+
+    for (int i = 0; i < indexes.size() && total > limit; ++i) {
+
+        QString key = indexes[i].completeBaseName();
+
+        qint64 size = indexes[i].size();
+        QFileInfoList blocks = dir.entryInfoList
+            (QStringList() << (key + "-*.mfc"), QDir::Files);
+        for (int j = 0; j < blocks.size(); ++j) {
+            size += blocks[j].size();
+        }
+
+#ifdef DEBUG_FFT_PERSISTENT_CACHE
+        std::cerr << "FFTPersistentCache::prune: Discarding " << key.toStdString()
+                  << " (" << size/1024 << "K)" << std::endl;
+#endif
+
+        removeEntry(dir, key);
+        total -= size;
+    }
+}
@@ -0,0 +1,136 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _FFT_PERSISTENT_CACHE_H_
+#define _FFT_PERSISTENT_CACHE_H_
+
+#include "FFTCacheStorageType.h"
+#include "base/Window.h"
+
+#include <QString>
+#include <QMutex>
+
+class DenseTimeValueModel;
+class QDir;
+
+/**
+ * A store for completed FFT disc caches that persists between runs
+ * of the program, so that reopening the same audio does not require
+ * the whole short-time Fourier transform to be calculated again.
+ * Use of the store is optional and controlled by the "Persistent FFT
+ * Cache" preference.
+ *
+ * Entries are keyed by a hash of the analysis parameters and the
+ * identity of the audio file: its location, and for a local file its
+ * size, modification time and a sample of its audio (see makeKey).
+ * The same data is therefore found again when the same, unchanged
+ * file is reopened in a later session, but not when identical audio
+ * is loaded from a different file.
+ *
+ * Each entry consists of a versioned index file and the MatrixFile
+ * cache files written by the FFT data server, which are hard-linked
+ * (or copied, where links are unavailable) between the store and the
+ * temporary directory.
+ *
+ * The total size of the store is kept within the limit set in the
+ * preferences by discarding the least recently used entries.
+ *
+ * This class is thread safe.
+ */
+
+class FFTPersistentCache
+{
+public:
+    struct Entry {
+        FFTCache::StorageType storageType;
+        size_t width;      // total number of columns
+        size_t height;     // bins per column
+        size_t blockWidth; // columns per cache file
+        size_t blockCount; // number of cache files
+    };
+
+    /**
+     * Return true if the persistent cache is enabled in the
+     * preferences.
+     */
+    static bool isEnabled();
+
+    /**
+     * Return true if FFT data calculated from the given model could
+     * be kept in the store.  Only models read from audio files can
+     * be: the content of any other model is not stable enough to be
+     * worth keeping, or to identify reliably when it is seen again.
+     */
+    static bool canPersist(const DenseTimeValueModel *model);
+
+    /**
+     * Return the key for FFT data calculated from the given model
+     * and channel with the given parameters.  The model must be
+     * ready, and one for which canPersist returns true.  The key
+     * incorporates a hash of the model's sample rate and extent and
+     * of the location of its audio file.  For a local file it also
+     * includes the file's size and modification time, and blocks of
+     * audio sampled at regular intervals through it, so that a file
+     * that has been edited or replaced gets a new key without our
+     * having to read the whole of it first.  For a remote file, whose
+     * local copy has no useful identity, every sample is hashed.
+     * Return an empty string if no key can be made.
+     */
+    static QString makeKey(const DenseTimeValueModel *model,
+                           int channel,
+                           WindowType windowType,
+                           size_t windowSize,
+                           size_t windowIncrement,
+                           size_t fftSize,
+                           bool polar);
+
+    /**
+     * Look up the entry with the given key and, if it exists and has
+     * the width, height, block width and block count given in entry,
+     * make its cache files available in the temporary directory with
+     * names fileBase-0, fileBase-1 etc, set the storage type in entry
+     * and return true.  Return false if there is no such entry.
+     */
+    static bool retrieve(QString key, QString fileBase, Entry &entry);
+
+    /**
+     * Store the completed cache files fileBase-0, fileBase-1 etc in
+     * the temporary directory as the entry with the given key,
+     * replacing any existing entry, and discard old entries as
+     * necessary to bring the store back within its size limit.
+     */
+    static bool store(QString key, QString fileBase, const Entry &entry);
+
+    /**
+     * Remove any of the files fileBase-0, fileBase-1 etc that remain
+     * in the temporary directory following a retrieve() whose files
+     * are not going to be used after all.
+     */
+    static void discard(QString fileBase, size_t blockCount);
+
+private:
+    static const unsigned int Magic = 0x53564643; // "SVFC"
+    static const unsigned int FormatVersion = 2;
+
+    static QString getCacheDirectory();
+    static QString getTempFileName(QString fileBase, size_t block);
+    static bool linkOrCopy(QString from, QString to);
+    static void removeEntry(QDir &dir, QString key);
+    static void prune(QDir &dir, qint64 limit);
+
+    static QMutex m_mutex;
+};
+
+#endif
@@ -16,7 +16,35 @@
 
 #include "FFTapi.h"
 
-#ifndef HAVE_FFTW3F
+#ifdef HAVE_FFTW3F
+
+#include <QMutex>
+#include <QMutexLocker>
+
+static QMutex plannerMutex;
+
+fftf_plan
+fftf_plan_dft_r2c_1d(int n, float *in, fftf_complex *out, unsigned flags)
+{
+    QMutexLocker locker(&plannerMutex);
+    return fftwf_plan_dft_r2c_1d(n, in, out, flags);
+}
+
+fftf_plan
+fftf_plan_dft_c2r_1d(int n, fftf_complex *in, float *out, unsigned flags)
+{
+    QMutexLocker locker(&plannerMutex);
+    return fftwf_plan_dft_c2r_1d(n, in, out, flags);
+}
+
+void
+fftf_destroy_plan(fftf_plan p)
+{
+    QMutexLocker locker(&plannerMutex);
+    fftwf_destroy_plan(p);
+}
+
+#else
 
 #include <cmath>
 #include <iostream>
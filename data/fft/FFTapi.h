@@ -24,10 +24,17 @@
 #define fftf_malloc fftwf_malloc
 #define fftf_free fftwf_free
 #define fftf_plan fftwf_plan
-#define fftf_plan_dft_r2c_1d fftwf_plan_dft_r2c_1d
-#define fftf_plan_dft_c2r_1d fftwf_plan_dft_c2r_1d
 #define fftf_execute fftwf_execute
-#define fftf_destroy_plan fftwf_destroy_plan
+
+// FFTW's planner is not thread-safe, so plans are made and destroyed
+// through these, which share a single lock.  Executing a plan needs
+// no lock.
+
+fftf_plan fftf_plan_dft_r2c_1d(int n, float *in, fftf_complex *out,
+                               unsigned flags);
+fftf_plan fftf_plan_dft_c2r_1d(int n, fftf_complex *in, float *out,
+                               unsigned flags);
+void fftf_destroy_plan(fftf_plan p);
 
 #else
 
@@ -35,7 +35,7 @@ public:
 
     virtual QString getError() const { return ""; }
 
-    size_t getFrameCount() const { return m_frameCount; }
+    virtual size_t getFrameCount() const { return m_frameCount; }
     size_t getChannelCount() const { return m_channelCount; }
     size_t getSampleRate() const { return m_sampleRate; }
     size_t getNativeRate() const { return m_sampleRate; } // if resampled
@@ -91,6 +91,16 @@ public:
     // file is until it's been completely decoded should implement this
     virtual int getDecodeCompletion() const { return 100; } // %
 
+    /**
+     * Return the number of frames that have been decoded so far and
+     * can be read cheaply.  This is the same as getFrameCount()
+     * except for subclasses that know the length of the file before
+     * decoding it and can decode any region on demand; for those it
+     * is the extent that a reader wanting every frame in turn should
+     * keep within while isUpdating() returns true.
+     */
+    virtual size_t getDecodedFrameCount() const { return getFrameCount(); }
+
     virtual bool isUpdating() const { return false; }
 
 signals:
@@ -101,7 +101,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
                  threading ?
                  ResamplingWavFileReader::ResampleThreaded :
                  ResamplingWavFileReader::ResampleAtOnce,
-                 ResamplingWavFileReader::CacheInTemporaryFile,
+                 ResamplingWavFileReader::CacheInMappedFile,
                  targetRate,
                  reporter);
             if (!reader->isOK()) {
@@ -120,7 +120,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
                  threading ?
                  OggVorbisFileReader::DecodeThreaded :
                  OggVorbisFileReader::DecodeAtOnce,
-                 OggVorbisFileReader::CacheInTemporaryFile,
+                 OggVorbisFileReader::CacheInMappedFile,
                  targetRate,
                  reporter);
             if (!reader->isOK()) {
@@ -140,7 +140,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
                  threading ?
                  MP3FileReader::DecodeThreaded :
                  MP3FileReader::DecodeAtOnce,
-                 MP3FileReader::CacheInTemporaryFile,
+                 MP3FileReader::CacheInMappedFile,
                  targetRate,
                  reporter);
             if (!reader->isOK()) {
@@ -159,7 +159,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
                  threading ?
                  QuickTimeFileReader::DecodeThreaded : 
                  QuickTimeFileReader::DecodeAtOnce,
-                 QuickTimeFileReader::CacheInTemporaryFile,
+                 QuickTimeFileReader::CacheInMappedFile,
                  targetRate,
                  reporter);
             if (!reader->isOK()) {
@@ -192,7 +192,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
                  threading ?
                  ResamplingWavFileReader::ResampleThreaded :
                  ResamplingWavFileReader::ResampleAtOnce,
-                 ResamplingWavFileReader::CacheInTemporaryFile,
+                 ResamplingWavFileReader::CacheInMappedFile,
                  targetRate,
                  reporter);
         }
@@ -211,7 +211,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
              threading ?
              OggVorbisFileReader::DecodeThreaded :
              OggVorbisFileReader::DecodeAtOnce,
-             OggVorbisFileReader::CacheInTemporaryFile,
+             OggVorbisFileReader::CacheInMappedFile,
              targetRate,
              reporter);
 
@@ -230,7 +230,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
              threading ?
              MP3FileReader::DecodeThreaded :
              MP3FileReader::DecodeAtOnce,
-             MP3FileReader::CacheInTemporaryFile,
+             MP3FileReader::CacheInMappedFile,
              targetRate,
              reporter);
 
@@ -248,7 +248,7 @@ AudioFileReaderFactory::create(FileSource source, size_t targetRate, bool thread
              threading ?
              QuickTimeFileReader::DecodeThreaded : 
              QuickTimeFileReader::DecodeAtOnce,
-             QuickTimeFileReader::CacheInTemporaryFile,
+             QuickTimeFileReader::CacheInMappedFile,
              targetRate,
              reporter);
 
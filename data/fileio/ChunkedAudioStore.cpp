@@ -0,0 +1,433 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ChunkedAudioStore.h"
+#include "WavFileReader.h"
+
+#include <QMutexLocker>
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+//#define DEBUG_CHUNKED_AUDIO_STORE 1
+
+ChunkedAudioStore::ChunkedAudioStore(size_t sampleRate, size_t channels,
+                                     QString location, bool compress) :
+    m_location(location),
+    m_compress(compress),
+    m_table(0),
+    m_tableSize(256),
+    m_sealed(0),
+    m_sealedBytes(0),
+    m_backing(0),
+    m_maxResidentBytes(0),
+    m_pagedOut(0),
+    m_epoch(0),
+    m_current(0),
+    m_fill(0),
+    m_updating(true)
+{
+    m_sampleRate = sampleRate;
+    m_channelCount = channels;
+    m_frameCount = 0;
+
+    m_epochReaders[0] = 0;
+    m_epochReaders[1] = 0;
+
+    m_table = new Chunk *[m_tableSize];
+    m_current = new float[ChunkFrames * channels];
+}
+
+ChunkedAudioStore::~ChunkedAudioStore()
+{
+    Chunk **table = m_table;
+    int sealed = m_sealed;
+
+    for (int i = 0; i < sealed; ++i) {
+        char *data = table[i]->data;
+        delete[] data;
+        delete table[i];
+    }
+
+    for (int e = 0; e < 2; ++e) {
+        for (size_t i = 0; i < m_retired[e].size(); ++i) {
+            delete[] m_retired[e][i];
+        }
+    }
+
+    delete[] table;
+
+    for (size_t i = 0; i < m_oldTables.size(); ++i) {
+        delete[] m_oldTables[i];
+    }
+
+    delete[] m_current;
+}
+
+void
+ChunkedAudioStore::setBackingReader(WavFileReader *reader,
+                                    size_t maxResidentBytes)
+{
+    m_backing = reader;
+    m_maxResidentBytes = maxResidentBytes;
+}
+
+void
+ChunkedAudioStore::addFrames(float **samples, size_t count)
+{
+    size_t channels = m_channelCount;
+    size_t done = 0;
+
+    while (done < count) {
+
+        size_t n = ChunkFrames - m_fill;
+        if (n > count - done) n = count - done;
+
+        {
+            QMutexLocker locker(&m_mutex);
+
+            float *dst = m_current + m_fill * channels;
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t c = 0; c < channels; ++c) {
+                    dst[i * channels + c] = samples[c][done + i];
+                }
+            }
+
+            m_fill += n;
+            m_frameCount += n;
+        }
+
+        done += n;
+
+        if (m_fill == ChunkFrames) seal();
+    }
+}
+
+void
+ChunkedAudioStore::finish()
+{
+    // The last partial chunk stays where it is: there is nothing to
+    // gain by sealing it, as it is read under the lock either way
+
+    QMutexLocker locker(&m_mutex);
+    m_updating = false;
+
+#ifdef DEBUG_CHUNKED_AUDIO_STORE
+    std::cerr << "ChunkedAudioStore::finish: " << m_frameCount << " frames, "
+              << getMemoryUsage() << " bytes" << std::endl;
+#endif
+}
+
+void
+ChunkedAudioStore::seal()
+{
+    // Only the writing thread changes m_current, so we can compress
+    // it without holding the lock, while readers continue to read it
+
+    Chunk *chunk = compress(m_current, m_fill);
+
+    int sealed = m_sealed;
+    Chunk **table = m_table;
+
+    if (size_t(sealed) == m_tableSize) {
+        size_t newSize = m_tableSize * 2;
+        Chunk **newTable = new Chunk *[newSize];
+        memcpy(newTable, table, m_tableSize * sizeof(Chunk *));
+        m_oldTables.push_back(table);
+        m_table.fetchAndStoreOrdered(newTable);
+        m_tableSize = newSize;
+        table = newTable;
+    }
+
+    table[sealed] = chunk;
+    m_sealedBytes += ChunkFrames * m_channelCount *
+        SampleKernels::getBytesPerSample(chunk->format);
+
+    // Publish the chunk and empty the current buffer together, so
+    // that a reader holding the lock sees every frame in exactly one
+    // of the two
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_sealed.fetchAndAddOrdered(1);
+        m_fill = 0;
+    }
+
+    if (m_backing && m_sealedBytes > m_maxResidentBytes) pageOut();
+    freeRetired();
+}
+
+void
+ChunkedAudioStore::pageOut()
+{
+    size_t sealed = size_t(int(m_sealed));
+    Chunk **table = m_table;
+
+    while (m_sealedBytes > m_maxResidentBytes && m_pagedOut < sealed) {
+
+        // The file must already contain the whole chunk; it usually
+        // will, as every frame is written there before it reaches us
+
+        size_t end = (m_pagedOut + 1) * ChunkFrames;
+        if (m_backing->getFrameCount() < end) {
+            m_backing->updateFrameCount();
+            if (m_backing->getFrameCount() < end) break;
+        }
+
+        Chunk *chunk = table[m_pagedOut];
+        char *data = chunk->data.fetchAndStoreOrdered(0);
+        m_retired[int(m_epoch) & 1].push_back(data);
+        m_sealedBytes -= ChunkFrames * m_channelCount *
+            SampleKernels::getBytesPerSample(chunk->format);
+        ++m_pagedOut;
+    }
+
+#ifdef DEBUG_CHUNKED_AUDIO_STORE
+    std::cerr << "ChunkedAudioStore::pageOut: " << m_pagedOut
+              << " of " << sealed << " chunks paged out, "
+              << m_sealedBytes << " bytes resident" << std::endl;
+#endif
+}
+
+void
+ChunkedAudioStore::freeRetired()
+{
+    int epoch = m_epoch.fetchAndAddOrdered(0);
+    int current = epoch & 1, previous = 1 - current;
+
+    // Data retired during the previous epoch may still be in use by a
+    // reader registered in it, but by no later reader, as the data
+    // pointers were all cleared before the epoch moved on
+
+    if (m_epochReaders[previous].fetchAndAddOrdered(0) != 0) return;
+
+    for (size_t i = 0; i < m_retired[previous].size(); ++i) {
+        delete[] m_retired[previous][i];
+    }
+    m_retired[previous].clear();
+
+    // Move on, so that the readers that may hold data retired during
+    // this epoch drain away.  The count for the new epoch is known to
+    // be zero, so any reader already registered there has yet to
+    // check the epoch and will retry
+
+    if (!m_retired[current].empty()) {
+        m_epoch.fetchAndStoreOrdered(epoch + 1);
+    }
+}
+
+int
+ChunkedAudioStore::enterRead() const
+{
+    while (true) {
+        int epoch = m_epoch.fetchAndAddOrdered(0);
+        m_epochReaders[epoch & 1].fetchAndAddOrdered(1);
+        if (m_epoch.fetchAndAddOrdered(0) == epoch) return epoch;
+        m_epochReaders[epoch & 1].fetchAndAddOrdered(-1);
+    }
+}
+
+void
+ChunkedAudioStore::leaveRead(int epoch) const
+{
+    m_epochReaders[epoch & 1].fetchAndAddOrdered(-1);
+}
+
+ChunkedAudioStore::Chunk *
+ChunkedAudioStore::compress(const float *frames, size_t count) const
+{
+    size_t n = count * m_channelCount;
+
+    Chunk *chunk = new Chunk;
+    chunk->format = SampleKernels::Float32;
+
+    if (m_compress) {
+
+        // Find the smallest integer format that holds every sample
+        // exactly, using the same scaling as SampleKernels::convert
+
+        bool int16 = true, int24 = true;
+
+        for (size_t i = 0; i < n && int24; ++i) {
+            float s = frames[i] * 8388608.f;
+            if (s < -8388608.f || s > 8388607.f || s != floorf(s)) {
+                int16 = int24 = false;
+            } else if (int16 && (int(s) & 0xff) != 0) {
+                int16 = false;
+            }
+        }
+
+        if (int16) chunk->format = SampleKernels::Int16;
+        else if (int24) chunk->format = SampleKernels::Int24;
+    }
+
+    size_t bps = SampleKernels::getBytesPerSample(chunk->format);
+    char *data = new char[n * bps];
+    chunk->data = data;
+
+    // Integers are stored little-endian whatever the host, as that is
+    // what SampleKernels expects
+
+    unsigned char *dst = (unsigned char *)data;
+
+    switch (chunk->format) {
+
+    case SampleKernels::Int16:
+        for (size_t i = 0; i < n; ++i) {
+            int v = int(frames[i] * 32768.f);
+            dst[i*2]     = (unsigned char)(v & 0xff);
+            dst[i*2 + 1] = (unsigned char)((v >> 8) & 0xff);
+        }
+        break;
+
+    case SampleKernels::Int24:
+        for (size_t i = 0; i < n; ++i) {
+            int v = int(frames[i] * 8388608.f);
+            dst[i*3]     = (unsigned char)(v & 0xff);
+            dst[i*3 + 1] = (unsigned char)((v >> 8) & 0xff);
+            dst[i*3 + 2] = (unsigned char)((v >> 16) & 0xff);
+        }
+        break;
+
+    default:
+        memcpy(dst, frames, n * sizeof(float));
+        break;
+    }
+
+    return chunk;
+}
+
+void
+ChunkedAudioStore::decode(const Chunk *chunk, size_t index, size_t offset,
+                          size_t count, float *dst) const
+{
+    size_t channels = m_channelCount;
+
+    // A plain load is enough: the caller's registration as a reader
+    // is an ordered operation that precedes it
+    const char *data = chunk->data;
+
+    if (!data) {
+        // paged out
+        SampleBlock block;
+        m_backing->getInterleavedFrames(index * ChunkFrames + offset,
+                                        count, block);
+        size_t got = block.size();
+        if (got > count * channels) got = count * channels;
+        if (got > 0) memcpy(dst, &block[0], got * sizeof(float));
+        for (size_t i = got; i < count * channels; ++i) dst[i] = 0.f;
+        return;
+    }
+
+    if (chunk->format == SampleKernels::Float32) {
+        memcpy(dst, (const float *)data + offset * channels,
+               count * channels * sizeof(float));
+        return;
+    }
+
+    size_t bps = SampleKernels::getBytesPerSample(chunk->format);
+    SampleKernels::convert(data + offset * channels * bps,
+                           chunk->format, false, dst, count * channels);
+}
+
+size_t
+ChunkedAudioStore::getFrameCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_frameCount;
+}
+
+bool
+ChunkedAudioStore::isUpdating() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_updating;
+}
+
+size_t
+ChunkedAudioStore::getMemoryUsage() const
+{
+    return m_sealedBytes + ChunkFrames * m_channelCount * sizeof(float);
+}
+
+void
+ChunkedAudioStore::getInterleavedFrames(size_t start, size_t count,
+                                        SampleBlock &results) const
+{
+    results.clear();
+    if (count == 0) return;
+
+    size_t channels = m_channelCount;
+    results.resize(count * channels);
+
+    size_t frame = start;
+    size_t end = start + count;
+
+    // Registering as a reader keeps any chunk data we pick up from
+    // being deleted until we have finished with it
+
+    int epoch = enterRead();
+
+    // Sealed chunks first, without locking.  The table pointer is
+    // read after the count, so it is at least as new as the count.
+
+    int sealed = m_sealed.fetchAndAddOrdered(0);
+    Chunk **table = m_table;
+
+    while (frame < end) {
+        size_t index = frame / ChunkFrames;
+        if (index >= size_t(sealed)) break;
+        size_t offset = frame % ChunkFrames;
+        size_t n = ChunkFrames - offset;
+        if (n > end - frame) n = end - frame;
+        decode(table[index], index, offset, n,
+               &results[(frame - start) * channels]);
+        frame += n;
+    }
+
+    if (frame < end) {
+
+        // The rest is in the current chunk, or beyond the end -- or
+        // in a chunk that has been sealed since we looked
+
+        QMutexLocker locker(&m_mutex);
+
+        sealed = m_sealed;
+        table = m_table;
+
+        while (frame < end) {
+            size_t index = frame / ChunkFrames;
+            size_t offset = frame % ChunkFrames;
+            size_t n = ChunkFrames - offset;
+            if (n > end - frame) n = end - frame;
+            float *dst = &results[(frame - start) * channels];
+            if (index < size_t(sealed)) {
+                decode(table[index], index, offset, n, dst);
+            } else if (index == size_t(sealed) && offset < m_fill) {
+                if (n > m_fill - offset) n = m_fill - offset;
+                memcpy(dst, m_current + offset * channels,
+                       n * channels * sizeof(float));
+            } else {
+                break;
+            }
+            frame += n;
+        }
+    }
+
+    leaveRead(epoch);
+
+    results.resize((frame - start) * channels);
+}
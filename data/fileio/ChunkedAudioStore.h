@@ -0,0 +1,147 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _CHUNKED_AUDIO_STORE_H_
+#define _CHUNKED_AUDIO_STORE_H_
+
+#include "AudioFileReader.h"
+#include "SampleKernels.h"
+
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+#include <vector>
+
+class WavFileReader;
+
+/**
+ * An in-memory audio store that is appended to as audio arrives (for
+ * example while recording) and read through the AudioFileReader
+ * interface, so that a WaveFileModel can display and analyse the
+ * audio as it grows without reading it back from a file.
+ *
+ * Audio is held in chunks of a fixed number of frames.  Once a chunk
+ * is full it is sealed and never changes again, so any number of
+ * threads may read sealed chunks without locking; only reads of the
+ * chunk still being filled take a lock.  If compression is enabled,
+ * a sealed chunk whose samples are all exactly representable as 16
+ * or 24 bit integers (as they are when recording from a 16 or 24 bit
+ * source) is stored as integers, which loses nothing.
+ *
+ * If a backing reader is set, the store holds only a bounded amount
+ * of audio in memory: once the sealed chunks exceed the limit, the
+ * oldest are discarded and read back from the backing reader (which
+ * reads the file the same audio is being written to) instead.
+ *
+ * Only one thread may add frames.
+ */
+
+class ChunkedAudioStore : public AudioFileReader
+{
+public:
+    ChunkedAudioStore(size_t sampleRate, size_t channels,
+                      QString location = "", bool compress = true);
+    virtual ~ChunkedAudioStore();
+
+    /**
+     * Read sealed chunks back from the given reader, rather than
+     * keeping them in memory, once more than maxResidentBytes of
+     * sealed chunks are held.  The reader must be reading the file
+     * that every frame is written to before it is added here, and be
+     * constructed with fileUpdating set; the store updates its frame
+     * count as it needs to.  The store does not take ownership of the
+     * reader, which must outlive it.  Call before adding any frames.
+     */
+    void setBackingReader(WavFileReader *reader, size_t maxResidentBytes);
+
+    /**
+     * Append count frames, given as one buffer per channel.
+     */
+    void addFrames(float **samples, size_t count);
+
+    /**
+     * Indicate that no more frames will be added.
+     */
+    void finish();
+
+    virtual QString getLocation() const { return m_location; }
+
+    virtual size_t getFrameCount() const;
+
+    virtual void getInterleavedFrames(size_t start, size_t count,
+                                      SampleBlock &frames) const;
+
+    virtual bool isUpdating() const;
+
+    /**
+     * Return the number of bytes of sample data held in memory.
+     */
+    size_t getMemoryUsage() const;
+
+protected:
+    struct Chunk {
+        SampleKernels::Format format;
+        QAtomicPointer<char> data; // null once paged out
+    };
+
+    void seal();
+    void pageOut();
+    void freeRetired();
+    Chunk *compress(const float *frames, size_t count) const;
+    void decode(const Chunk *chunk, size_t index, size_t offset,
+                size_t count, float *dst) const;
+
+    QString m_location;
+    bool m_compress;
+
+    // Sealed chunks.  The table is replaced by a larger copy when it
+    // fills; old tables are kept until we are destroyed, in case a
+    // reader is still using one.
+    QAtomicPointer<Chunk *> m_table;
+    size_t m_tableSize;
+    std::vector<Chunk **> m_oldTables;
+    mutable QAtomicInt m_sealed;
+    size_t m_sealedBytes; // resident only
+
+    // Paging.  Chunks below m_pagedOut have had their data discarded.
+    // Discarded data is retired rather than deleted, as a reader may
+    // have picked up a chunk's data pointer just before it was
+    // discarded.  Each reader registers in the current epoch, and
+    // data retired during an epoch is deleted once the epoch has been
+    // moved on and no reader registered in it remains.  Only the
+    // current and previous epochs can have readers, so two counts
+    // and two retired lists, indexed by epoch & 1, are enough.
+    WavFileReader *m_backing;
+    size_t m_maxResidentBytes;
+    size_t m_pagedOut;
+    std::vector<char *> m_retired[2];
+    mutable QAtomicInt m_epoch;
+    mutable QAtomicInt m_epochReaders[2];
+
+    int enterRead() const;
+    void leaveRead(int epoch) const;
+
+    // The chunk being filled, interleaved.  m_mutex protects this,
+    // m_fill, m_frameCount, m_updating, and the sealing of a chunk.
+    float *m_current;
+    size_t m_fill;
+    bool m_updating;
+    mutable QMutex m_mutex;
+
+    static const size_t ChunkFrames = 32768;
+};
+
+#endif
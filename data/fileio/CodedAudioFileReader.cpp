@@ -19,24 +19,43 @@
 #include "base/TempDirectory.h"
 #include "base/Exceptions.h"
 #include "base/Profiler.h"
-#include "base/Serialiser.h"
+#include "base/DecodeScheduler.h"
 #include "base/Resampler.h"
+#include "base/Preferences.h"
 
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
 #include <QDir>
 #include <QMutexLocker>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 CodedAudioFileReader::CodedAudioFileReader(CacheMode cacheMode,
                                            size_t targetRate) :
     m_cacheMode(cacheMode),
     m_initialised(false),
-    m_serialiser(0),
+    m_decodeSlotMemory(0),
+    m_haveDecodeSlot(false),
     m_fileRate(0),
     m_cacheFileWritePtr(0),
     m_cacheFileReader(0),
     m_cacheWriteBuffer(0),
     m_cacheWriteBufferIndex(0),
     m_cacheWriteBufferSize(16384),
+    m_cacheFd(-1),
+    m_cacheMaps(0),
+    m_cacheMapCount(0),
+    m_mappedFrameCount(0),
     m_resampler(0),
     m_resampleBuffer(0)
 {
@@ -50,7 +69,7 @@ CodedAudioFileReader::~CodedAudioFileReader()
 {
     QMutexLocker locker(&m_cacheMutex);
 
-    endSerialised();
+    releaseDecodeSlot();
 
     if (m_cacheFileWritePtr) sf_close(m_cacheFileWritePtr);
 
@@ -59,6 +78,17 @@ CodedAudioFileReader::~CodedAudioFileReader()
     delete m_cacheFileReader;
     delete[] m_cacheWriteBuffer;
 
+#ifndef _WIN32
+    for (size_t i = 0; i < m_cacheMapCount; ++i) {
+        if (!m_cacheMaps[i]) continue;
+        if (::munmap(m_cacheMaps[i], MappedCacheChunkSize) < 0) {
+            ::perror("CodedAudioFileReader::~CodedAudioFileReader: munmap failed");
+        }
+    }
+    delete[] m_cacheMaps;
+    if (m_cacheFd >= 0) ::close(m_cacheFd);
+#endif
+
     if (m_cacheFileName != "") {
         if (!QFile(m_cacheFileName).remove()) {
             std::cerr << "WARNING: CodedAudioFileReader::~CodedAudioFileReader: Failed to delete cache file \"" << m_cacheFileName.toStdString() << "\"" << std::endl;
@@ -70,21 +100,43 @@ CodedAudioFileReader::~CodedAudioFileReader()
 }
 
 void
-CodedAudioFileReader::startSerialised(QString id)
+CodedAudioFileReader::waitForDecodeSlot(size_t inputSize,
+                                        size_t expectedFrames)
 {
-//    std::cerr << "CodedAudioFileReader::startSerialised(" << id.toStdString() << ")" << std::endl;
+    if (m_haveDecodeSlot) return;
+
+    // A rough guess at what we will hold in memory: our write and
+    // resample buffers, plus (if caching in memory) the decoded
+    // audio.  That is exact if we know how many frames to expect;
+    // otherwise we assume compressed input, which typically decodes
+    // to a little over ten times its size when stored as floats
+    
+    size_t memory = m_cacheWriteBufferSize * m_channelCount * sizeof(float) * 3;
+    if (m_cacheMode == CacheInMemory) {
+        if (expectedFrames > 0) {
+            memory += expectedFrames * m_channelCount * sizeof(float);
+        } else {
+            memory += inputSize * 16;
+        }
+    }
+
+//    std::cerr << "CodedAudioFileReader(" << this << ")::waitForDecodeSlot: input size " << inputSize << ", expected frames " << expectedFrames << ", memory estimate " << memory << std::endl;
 
-    delete m_serialiser;
-    m_serialiser = new Serialiser(id);
+    DecodeScheduler::getInstance()->acquire(memory);
+
+    m_decodeSlotMemory = memory;
+    m_haveDecodeSlot = true;
 }
 
 void
-CodedAudioFileReader::endSerialised()
+CodedAudioFileReader::releaseDecodeSlot()
 {
-//    std::cerr << "CodedAudioFileReader(" << this << ")::endSerialised: id = " << (m_serialiser ? m_serialiser->getId().toStdString() : "(none)") << std::endl;
+    if (!m_haveDecodeSlot) return;
+
+    DecodeScheduler::getInstance()->release(m_decodeSlotMemory);
 
-    delete m_serialiser;
-    m_serialiser = 0;
+    m_decodeSlotMemory = 0;
+    m_haveDecodeSlot = false;
 }
 
 void
@@ -104,17 +156,29 @@ CodedAudioFileReader::initialiseDecodeCache()
     }
     if (m_fileRate != m_sampleRate) {
         std::cerr << "CodedAudioFileReader: resampling " << m_fileRate << " -> " <<  m_sampleRate << std::endl;
-        m_resampler = new Resampler(Resampler::FastestTolerable,
+        Resampler::Quality quality = Resampler::getQualityForPreference
+            (Preferences::getInstance()->getResampleQuality());
+        m_resampler = new Resampler(quality,
                                     m_channelCount,
+                                    m_fileRate,
+                                    m_sampleRate,
                                     m_cacheWriteBufferSize);
         float ratio = float(m_sampleRate) / float(m_fileRate);
         m_resampleBuffer = new float
-            [lrintf(ceilf(m_cacheWriteBufferSize * m_channelCount * ratio + 1))];
+            [m_resampler->getMaxOutputCount(m_cacheWriteBufferSize, ratio) *
+             m_channelCount];
     }
 
     m_cacheWriteBuffer = new float[m_cacheWriteBufferSize * m_channelCount];
     m_cacheWriteBufferIndex = 0;
 
+    if (m_cacheMode == CacheInMappedFile) {
+        if (!initialiseMappedCache()) {
+            std::cerr << "CodedAudioFileReader::initialiseDecodeCache: failed to create mapped cache file, falling back to WAV cache file" << std::endl;
+            m_cacheMode = CacheInTemporaryFile;
+        }
+    }
+
     if (m_cacheMode == CacheInTemporaryFile) {
 
         try {
@@ -169,6 +233,115 @@ CodedAudioFileReader::initialiseDecodeCache()
     m_initialised = true;
 }
 
+bool
+CodedAudioFileReader::initialiseMappedCache()
+{
+#ifdef _WIN32
+    return false;
+#else
+    // The whole file ends up mapped, which is only reasonable with a
+    // 64-bit address space
+    if (sizeof(void *) < 8) return false;
+
+    try {
+        QDir dir(TempDirectory::getInstance()->getPath());
+        m_cacheFileName = dir.filePath(QString("decoded_%1.raw")
+                                       .arg((intptr_t)this));
+    } catch (DirectoryCreationFailed f) {
+        std::cerr << "CodedAudioFileReader::initialiseMappedCache: failed to create temporary directory" << std::endl;
+        return false;
+    }
+
+    m_cacheFd = ::open(m_cacheFileName.toLocal8Bit(),
+                       O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (m_cacheFd < 0) {
+        ::perror("CodedAudioFileReader::initialiseMappedCache: open failed");
+        m_cacheFileName = "";
+        return false;
+    }
+
+    // The frame count is published through a QAtomicInt, so that
+    // is the most frames the file can hold.  The table of chunks is
+    // sized for that up front, and never reallocated.
+
+    size_t maxBytes = MappedCacheHeaderSize +
+        size_t(INT_MAX) * m_channelCount * sizeof(float);
+    m_cacheMapCount = maxBytes / MappedCacheChunkSize + 1;
+    m_cacheMaps = new char *[m_cacheMapCount];
+    for (size_t i = 0; i < m_cacheMapCount; ++i) m_cacheMaps[i] = 0;
+
+    if (!mapCacheChunks(MappedCacheHeaderSize)) {
+        delete[] m_cacheMaps;
+        m_cacheMaps = 0;
+        m_cacheMapCount = 0;
+        ::close(m_cacheFd);
+        m_cacheFd = -1;
+        QFile(m_cacheFileName).remove();
+        m_cacheFileName = "";
+        return false;
+    }
+
+    writeMappedCacheHeader();
+    return true;
+#endif
+}
+
+bool
+CodedAudioFileReader::mapCacheChunks(size_t endOffset)
+{
+#ifdef _WIN32
+    return false;
+#else
+    // Map every chunk up to the one containing byte endOffset - 1.
+    // Mapping beyond the end of the file is permitted; we just must
+    // not touch any page that the file does not yet reach
+
+    size_t last = (endOffset - 1) / MappedCacheChunkSize;
+    if (last >= m_cacheMapCount) return false;
+
+    for (size_t i = 0; i <= last; ++i) {
+
+        if (m_cacheMaps[i]) continue;
+
+        void *addr = ::mmap(0, MappedCacheChunkSize, PROT_READ, MAP_SHARED,
+                            m_cacheFd, off_t(i) * MappedCacheChunkSize);
+
+        if (addr == MAP_FAILED) {
+            ::perror("CodedAudioFileReader::mapCacheChunks: mmap failed");
+            return false;
+        }
+
+        m_cacheMaps[i] = (char *)addr;
+    }
+
+    return true;
+#endif
+}
+
+void
+CodedAudioFileReader::writeMappedCacheHeader()
+{
+#ifndef _WIN32
+    // Header: magic, version, channel count, sample rate, frame
+    // count, the last of which is only filled in on completion
+
+    char header[MappedCacheHeaderSize];
+    memset(header, 0, MappedCacheHeaderSize);
+
+    quint32 *h32 = (quint32 *)header;
+    h32[0] = MappedCacheMagic;
+    h32[1] = MappedCacheVersion;
+    h32[2] = quint32(m_channelCount);
+    h32[3] = quint32(m_sampleRate);
+    *(quint64 *)(header + 16) = quint64(m_frameCount);
+
+    if (::pwrite(m_cacheFd, header, MappedCacheHeaderSize, 0) !=
+        ssize_t(MappedCacheHeaderSize)) {
+        ::perror("WARNING: CodedAudioFileReader::writeMappedCacheHeader: write failed");
+    }
+#endif
+}
+
 void
 CodedAudioFileReader::addSamplesToDecodeCache(float **samples, size_t nframes)
 {
@@ -268,7 +441,10 @@ CodedAudioFileReader::finishDecodeCache()
         return;
     }
 
-    if (m_cacheWriteBufferIndex > 0) {
+    // Push even an empty final buffer if we are resampling, to flush
+    // out whatever the resampler is still holding
+
+    if (m_cacheWriteBufferIndex > 0 || m_resampler) {
         pushBuffer(m_cacheWriteBuffer,
                    m_cacheWriteBufferIndex / m_channelCount,
                    true);
@@ -288,6 +464,10 @@ CodedAudioFileReader::finishDecodeCache()
         m_cacheFileWritePtr = 0;
         if (m_cacheFileReader) m_cacheFileReader->updateFrameCount();
     }
+
+    if (m_cacheMode == CacheInMappedFile) {
+        writeMappedCacheHeader();
+    }
 }
 
 void
@@ -322,11 +502,10 @@ CodedAudioFileReader::pushBuffer(float *buffer, size_t sz, bool final)
         if (buffer[i] < -max) buffer[i] = -max;
     }
 
-    m_frameCount += sz;
-
     switch (m_cacheMode) {
 
     case CacheInTemporaryFile:
+        m_frameCount += sz;
         if (sf_writef_float(m_cacheFileWritePtr, buffer, sz) < sz) {
             sf_close(m_cacheFileWritePtr);
             m_cacheFileWritePtr = 0;
@@ -334,7 +513,42 @@ CodedAudioFileReader::pushBuffer(float *buffer, size_t sz, bool final)
         }
         break;
 
+    case CacheInMappedFile:
+    {
+#ifndef _WIN32
+        // Write through the file descriptor rather than the mapping,
+        // so that running out of space is an error rather than a
+        // signal.  The samples are visible through the mapping once
+        // written, and only then do we advance the frame count that
+        // readers check against.
+        size_t bytes = count * sizeof(float);
+        off_t offset = MappedCacheHeaderSize +
+            off_t(m_frameCount) * m_channelCount * sizeof(float);
+        if (m_frameCount + sz > size_t(INT_MAX) ||
+            !mapCacheChunks(size_t(offset) + bytes)) {
+            std::cerr << "WARNING: CodedAudioFileReader::pushBuffer: "
+                      << "Mapped cache file is full" << std::endl;
+            throw InsufficientDiscSpace(TempDirectory::getInstance()->getPath());
+        }
+        const char *data = (const char *)buffer;
+        while (bytes > 0) {
+            ssize_t written = ::pwrite(m_cacheFd, data, bytes, offset);
+            if (written <= 0) {
+                ::perror("CodedAudioFileReader::pushBuffer: write failed");
+                throw InsufficientDiscSpace(TempDirectory::getInstance()->getPath());
+            }
+            data += written;
+            offset += written;
+            bytes -= written;
+        }
+#endif
+        m_frameCount += sz;
+        m_mappedFrameCount.fetchAndStoreOrdered(int(m_frameCount));
+        break;
+    }
+
     case CacheInMemory:
+        m_frameCount += sz;
         m_dataLock.lockForWrite();
         for (size_t s = 0; s < count; ++s) {
             m_data.push_back(buffer[s]);
@@ -345,13 +559,40 @@ CodedAudioFileReader::pushBuffer(float *buffer, size_t sz, bool final)
     }
 }
 
+size_t
+CodedAudioFileReader::getCachedFrameCount() const
+{
+    if (!m_initialised || m_channelCount == 0) return 0;
+
+    switch (m_cacheMode) {
+
+    case CacheInTemporaryFile:
+        if (m_cacheFileReader) return m_cacheFileReader->getFrameCount();
+        return 0;
+
+    case CacheInMemory:
+    {
+        m_dataLock.lockForRead();
+        size_t frames = m_data.size() / m_channelCount;
+        m_dataLock.unlock();
+        return frames;
+    }
+
+    case CacheInMappedFile:
+        if (!m_cacheMaps) return 0;
+        return size_t(m_mappedFrameCount.fetchAndAddOrdered(0));
+    }
+
+    return 0;
+}
+
 void
 CodedAudioFileReader::getInterleavedFrames(size_t start, size_t count,
                                            SampleBlock &frames) const
 {
     // Lock is only required in CacheInMemory mode (the cache file
     // reader is expected to be thread safe and manage its own
-    // locking)
+    // locking, and the mapped file is only ever appended to)
 
     if (!m_initialised) {
         std::cerr << "CodedAudioFileReader::getInterleavedFrames: not initialised" << std::endl;
@@ -382,6 +623,40 @@ CodedAudioFileReader::getInterleavedFrames(size_t start, size_t count,
             ++idx;
         }
         m_dataLock.unlock();
+        break;
+    }
+
+    case CacheInMappedFile:
+    {
+        frames.clear();
+        if (!isOK()) return;
+        if (!m_cacheMaps) return;
+
+        // The ordered load pairs with the store in pushBuffer, so
+        // the samples and chunk mappings below this count are visible
+
+        size_t available = size_t(m_mappedFrameCount.fetchAndAddOrdered(0));
+        if (start >= available) return;
+        if (count > available - start) count = available - start;
+        if (count == 0) return;
+
+        frames.resize(count * m_channelCount);
+
+        char *dst = (char *)&frames[0];
+        size_t offset = MappedCacheHeaderSize +
+            start * m_channelCount * sizeof(float);
+        size_t bytes = count * m_channelCount * sizeof(float);
+
+        while (bytes > 0) {
+            size_t chunk = offset / MappedCacheChunkSize;
+            size_t within = offset % MappedCacheChunkSize;
+            size_t n = std::min(bytes, MappedCacheChunkSize - within);
+            memcpy(dst, m_cacheMaps[chunk] + within, n);
+            dst += n;
+            offset += n;
+            bytes -= n;
+        }
+        break;
     }
     }
 }
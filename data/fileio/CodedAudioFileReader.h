@@ -21,9 +21,9 @@
 #include <sndfile.h>
 #include <QMutex>
 #include <QReadWriteLock>
+#include <QAtomicInt>
 
 class WavFileReader;
-class Serialiser;
 class Resampler;
 
 class CodedAudioFileReader : public AudioFileReader
@@ -33,9 +33,18 @@ class CodedAudioFileReader : public AudioFileReader
 public:
     virtual ~CodedAudioFileReader();
 
+    /**
+     * CacheInTemporaryFile writes the decoded audio to a 16-bit WAV
+     * file in the temporary directory.  CacheInMappedFile writes it
+     * at full float precision to a raw temporary file which is mapped
+     * into memory for reading, so that reads need neither libsndfile
+     * nor any locking; it falls back to CacheInTemporaryFile where the
+     * file cannot be mapped.  CacheInMemory keeps it in memory.
+     */
     enum CacheMode {
         CacheInTemporaryFile,
-        CacheInMemory
+        CacheInMemory,
+        CacheInMappedFile
     };
 
     virtual void getInterleavedFrames(size_t start, size_t count,
@@ -61,19 +70,33 @@ protected:
 
     bool isDecodeCacheInitialised() const { return m_initialised; }
 
-    void startSerialised(QString id);
-    void endSerialised();
+    // The number of frames that getInterleavedFrames can return from
+    // the decode cache now.  This may be fewer than m_frameCount,
+    // which counts frames as they are pushed to the cache.
+    size_t getCachedFrameCount() const;
+
+    // Wait until the decode scheduler allows this decode to go ahead
+    // alongside any others, given the size of the encoded input in
+    // bytes and, if known, the number of frames it will decode to,
+    // and release the slot when done.  See DecodeScheduler.
+    void waitForDecodeSlot(size_t inputSize, size_t expectedFrames = 0);
+    void releaseDecodeSlot();
 
 private:
     void pushBuffer(float *interleaved, size_t sz, bool final);
 
+    bool initialiseMappedCache(); // cache mutex held
+    void writeMappedCacheHeader(); // cache mutex held
+    bool mapCacheChunks(size_t endOffset); // cache mutex held
+
 protected:
     QMutex m_cacheMutex;
     CacheMode m_cacheMode;
     SampleBlock m_data;
     mutable QReadWriteLock m_dataLock;
     bool m_initialised;
-    Serialiser *m_serialiser;
+    size_t m_decodeSlotMemory;
+    bool m_haveDecodeSlot;
     size_t m_fileRate;
 
     QString m_cacheFileName;
@@ -83,6 +106,23 @@ protected:
     size_t m_cacheWriteBufferIndex;
     size_t m_cacheWriteBufferSize; // frames
 
+    // For CacheInMappedFile.  The file has a small header, followed
+    // by the interleaved float samples.  It is mapped in chunks of
+    // MappedCacheChunkSize bytes, each mapped as the file grows into
+    // it and left in place until the reader is destroyed, so that
+    // readers never see a mapping move.  Readers only look at frames
+    // below m_mappedFrameCount, which is stored (ordered) after the
+    // samples are written and their chunks mapped.
+    int m_cacheFd;
+    char **m_cacheMaps; // one per chunk, 0 until mapped
+    size_t m_cacheMapCount;
+    mutable QAtomicInt m_mappedFrameCount;
+
+    static const unsigned int MappedCacheMagic = 0x53564443; // "SVDC"
+    static const unsigned int MappedCacheVersion = 1;
+    static const size_t MappedCacheHeaderSize = 64;
+    static const size_t MappedCacheChunkSize = 64 * 1024 * 1024;
+
     Resampler *m_resampler;
     float *m_resampleBuffer;
 };
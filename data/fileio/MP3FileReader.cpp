@@ -17,6 +17,7 @@
 
 #include "MP3FileReader.h"
 #include "base/ProgressReporter.h"
+#include "base/Profiler.h"
 
 #include "system/System.h"
 
@@ -27,14 +28,22 @@
 #include <iostream>
 
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #ifdef HAVE_ID3TAG
 #include <id3tag.h>
 #endif
 //#define DEBUG_ID3TAG 1
 
 #include <QFileInfo>
+#include <QMutexLocker>
+
+#include <algorithm>
 
 MP3FileReader::MP3FileReader(FileSource source, DecodeMode decodeMode, 
                              CacheMode mode, size_t targetRate,
@@ -52,7 +61,16 @@ MP3FileReader::MP3FileReader(FileSource source, DecodeMode decodeMode,
     m_cancelled = false;
     m_completion = 0;
     m_done = false;
+    m_decodeComplete = 0;
+    m_indexedFrameCount = 0;
+    m_indexedChannels = 0;
+    m_indexedRate = 0;
+    m_indexed = 0;
     m_reporter = reporter;
+    m_filebuffer = 0;
+    m_fileBufferMapped = false;
+    m_samplebuffer = 0;
+    m_samplebuffersize = 0;
 
     struct stat stat;
     if (::stat(m_path.toLocal8Bit().data(), &stat) == -1 || stat.st_size == 0) {
@@ -72,35 +90,52 @@ MP3FileReader::MP3FileReader(FileSource source, DecodeMode decodeMode,
 	return;
     }	
 
-    m_filebuffer = 0;
-    m_samplebuffer = 0;
-    m_samplebuffersize = 0;
+#ifndef _WIN32
+    // Map the file rather than reading it all into memory: libmad
+    // reads through it once from start to end, so the pages can be
+    // brought in as needed and dropped again under memory pressure
 
-    try {
-        m_filebuffer = new unsigned char[m_fileSize];
-    } catch (...) {
-        m_error = QString("Out of memory");
-        ::close(fd);
-	return;
+    void *addr = ::mmap(0, m_fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+#ifdef POSIX_MADV_SEQUENTIAL
+        ::posix_madvise(addr, m_fileSize, POSIX_MADV_SEQUENTIAL);
+#endif
+        m_filebuffer = (unsigned char *)addr;
+        m_fileBufferMapped = true;
+    } else {
+        ::perror("MP3FileReader::MP3FileReader: mmap failed, reading file instead");
     }
-    
-    ssize_t sz = 0;
-    size_t offset = 0;
-    while (offset < m_fileSize) {
-        sz = ::read(fd, m_filebuffer + offset, m_fileSize - offset);
-        if (sz < 0) {
-            m_error = QString("Read error for file %1 (after %2 bytes)")
-                .arg(m_path).arg(offset);
-            delete[] m_filebuffer;
+#endif
+
+    if (!m_filebuffer) {
+
+        try {
+            m_filebuffer = new unsigned char[m_fileSize];
+        } catch (...) {
+            m_error = QString("Out of memory");
             ::close(fd);
             return;
-        } else if (sz == 0) {
-            std::cerr << QString("MP3FileReader::MP3FileReader: Warning: reached EOF after only %1 of %2 bytes")
-                .arg(offset).arg(m_fileSize).toStdString() << std::endl;
-            m_fileSize = offset;
-            break;
         }
-        offset += sz;
+    
+        ssize_t sz = 0;
+        size_t offset = 0;
+        while (offset < m_fileSize) {
+            sz = ::read(fd, m_filebuffer + offset, m_fileSize - offset);
+            if (sz < 0) {
+                m_error = QString("Read error for file %1 (after %2 bytes)")
+                    .arg(m_path).arg(offset);
+                delete[] m_filebuffer;
+                m_filebuffer = 0;
+                ::close(fd);
+                return;
+            } else if (sz == 0) {
+                std::cerr << QString("MP3FileReader::MP3FileReader: Warning: reached EOF after only %1 of %2 bytes")
+                    .arg(offset).arg(m_fileSize).toStdString() << std::endl;
+                m_fileSize = offset;
+                break;
+            }
+            offset += sz;
+        }
     }
 
     ::close(fd);
@@ -119,16 +154,19 @@ MP3FileReader::MP3FileReader(FileSource source, DecodeMode decodeMode,
             m_error = QString("Failed to decode file %1.").arg(m_path);
         }
         
-        delete[] m_filebuffer;
-        m_filebuffer = 0;
+        releaseFileBuffer();
 
         if (isDecodeCacheInitialised()) finishDecodeCache();
-        endSerialised();
+        releaseDecodeSlot();
 
     } else {
 
         if (m_reporter) m_reporter->setProgress(100);
 
+        // Only worth it if the file is mapped, as we have to keep the
+        // whole of it available after the decode thread has finished
+        if (m_fileBufferMapped) buildIndex();
+
         m_decodeThread = new DecodeThread(this);
         m_decodeThread->start();
 
@@ -136,6 +174,15 @@ MP3FileReader::MP3FileReader(FileSource source, DecodeMode decodeMode,
                && !m_done) {
             usleep(10);
         }
+
+        if (isIndexed() &&
+            (m_sampleRate != m_fileRate ||
+             m_indexedRate != m_fileRate ||
+             m_indexedChannels != m_channelCount)) {
+            // We can't reproduce the resampler's output for an
+            // arbitrary region, or the index is inconsistent
+            m_indexed.fetchAndStoreOrdered(0);
+        }
         
         std::cerr << "MP3FileReader ctor: exiting with file rate = " << m_fileRate << std::endl;
     }
@@ -152,6 +199,27 @@ MP3FileReader::~MP3FileReader()
         m_decodeThread->wait();
         delete m_decodeThread;
     }
+
+    releaseFileBuffer();
+}
+
+void
+MP3FileReader::releaseFileBuffer()
+{
+    if (!m_filebuffer) return;
+
+#ifndef _WIN32
+    if (m_fileBufferMapped) {
+        if (::munmap(m_filebuffer, m_fileSize) < 0) {
+            ::perror("MP3FileReader::releaseFileBuffer: munmap failed");
+        }
+        m_filebuffer = 0;
+        return;
+    }
+#endif
+
+    delete[] m_filebuffer;
+    m_filebuffer = 0;
 }
 
 void
@@ -266,8 +334,7 @@ MP3FileReader::DecodeThread::run()
         m_reader->m_error = QString("Failed to decode file %1.").arg(m_reader->m_path);
     }
 
-    delete[] m_reader->m_filebuffer;
-    m_reader->m_filebuffer = 0;
+    if (!m_reader->isIndexed()) m_reader->releaseFileBuffer();
 
     if (m_reader->m_samplebuffer) {
         for (size_t c = 0; c < m_reader->m_channelCount; ++c) {
@@ -280,9 +347,10 @@ MP3FileReader::DecodeThread::run()
     if (m_reader->isDecodeCacheInitialised()) m_reader->finishDecodeCache();
 
     m_reader->m_done = true;
+    m_reader->m_decodeComplete.fetchAndStoreOrdered(1);
     m_reader->m_completion = 100;
 
-    m_reader->endSerialised();
+    m_reader->releaseDecodeSlot();
 } 
 
 bool
@@ -360,10 +428,13 @@ MP3FileReader::accept(struct mad_header const *header,
 
         initialiseDecodeCache();
 
-        if (m_cacheMode == CacheInTemporaryFile) {
-//            std::cerr << "MP3FileReader::accept: channel count " << m_channelCount << ", file rate " << m_fileRate << ", about to start serialised section" << std::endl;
-            startSerialised("MP3FileReader::Decode");
+//        std::cerr << "MP3FileReader::accept: channel count " << m_channelCount << ", file rate " << m_fileRate << ", waiting for decode slot" << std::endl;
+        size_t expected = 0;
+        if (isIndexed()) {
+            expected = size_t((double(m_indexedFrameCount) * m_sampleRate) /
+                              m_fileRate);
         }
+        waitForDecodeSlot(m_fileSize, expected);
     }
     
     if (m_bitrateDenom > 0) {
@@ -422,13 +493,33 @@ MP3FileReader::accept(struct mad_header const *header,
     return MAD_FLOW_CONTINUE;
 }
 
+enum mad_flow
+MP3FileReader::acceptSilence(struct mad_header const *header)
+{
+    struct mad_pcm pcm;
+    pcm.samplerate = header->samplerate;
+    pcm.channels = MAD_NCHANNELS(header);
+    pcm.length = 32 * MAD_NSBSAMPLES(header);
+    memset(pcm.samples, 0, sizeof(pcm.samples));
+    return accept(header, &pcm);
+}
+
 enum mad_flow
 MP3FileReader::error(void *dp,
 		     struct mad_stream *stream,
-		     struct mad_frame *)
+		     struct mad_frame *frame)
 {
     DecoderData *data = (DecoderData *)dp;
 
+    // Errors from MAD_ERROR_BADCRC on are in the data of a frame
+    // whose header was read successfully.  libmad drops the frame, but
+    // buildIndex counts it and decodeRegion fills it with silence,
+    // so do the same here, to keep the decoded length and the
+    // positions of regions decoded on demand in step with the index
+    if (frame && stream->error >= MAD_ERROR_BADCRC) {
+        return data->reader->acceptSilence(&frame->header);
+    }
+
 //    fprintf(stderr, "decoding error 0x%04x (%s) at byte offset %lu\n",
 //	    stream->error, mad_stream_errorstr(stream),
 //	    (unsigned long)(stream->this_frame - data->start));
@@ -436,6 +527,222 @@ MP3FileReader::error(void *dp,
     return MAD_FLOW_CONTINUE;
 }
 
+void
+MP3FileReader::buildIndex()
+{
+    Profiler profiler("MP3FileReader::buildIndex", true);
+
+    unsigned char const *start = m_filebuffer;
+    unsigned long length = m_fileSize;
+
+#ifdef HAVE_ID3TAG
+    // skip the tag in the same way as input() does
+    if (length > ID3_TAG_QUERYSIZE) {
+        int taglen = id3_tag_query(start, ID3_TAG_QUERYSIZE);
+        if (taglen > 0) {
+            start += taglen;
+            length -= taglen;
+        }
+    }
+#endif
+
+    struct mad_stream stream;
+    struct mad_header header;
+
+    mad_stream_init(&stream);
+    mad_header_init(&header);
+    mad_stream_buffer(&stream, start, length);
+
+    size_t total = 0;
+    bool consistent = true;
+
+    while (1) {
+
+        if (mad_header_decode(&header, &stream) == -1) {
+            if (stream.error == MAD_ERROR_BUFLEN) break;
+            if (MAD_RECOVERABLE(stream.error)) continue;
+            break;
+        }
+
+        size_t channels = MAD_NCHANNELS(&header);
+        if (m_frameOffsets.empty()) {
+            m_indexedChannels = channels;
+            m_indexedRate = header.samplerate;
+        } else if (channels != m_indexedChannels ||
+                   header.samplerate != m_indexedRate) {
+            consistent = false;
+            break;
+        }
+
+        m_frameOffsets.push_back(stream.this_frame - m_filebuffer);
+        m_frameStarts.push_back(total);
+        total += 32 * MAD_NSBSAMPLES(&header);
+    }
+
+    mad_header_finish(&header);
+    mad_stream_finish(&stream);
+
+    if (!consistent || m_frameOffsets.empty()) {
+        std::cerr << "MP3FileReader::buildIndex: Unable to index file, "
+                  << "regions will not be decoded on demand" << std::endl;
+        m_frameOffsets.clear();
+        m_frameStarts.clear();
+        return;
+    }
+
+    m_indexedFrameCount = total;
+    m_indexed.fetchAndStoreOrdered(1);
+
+    std::cerr << "MP3FileReader::buildIndex: Indexed " << m_frameOffsets.size()
+              << " frames (" << total << " audio frames)" << std::endl;
+}
+
+size_t
+MP3FileReader::getFrameCount() const
+{
+    if (isIndexed() && !isDecodeComplete()) return m_indexedFrameCount;
+    return m_frameCount;
+}
+
+size_t
+MP3FileReader::getDecodedFrameCount() const
+{
+    return m_frameCount;
+}
+
+void
+MP3FileReader::getInterleavedFrames(size_t start, size_t count,
+                                    SampleBlock &frames) const
+{
+    if (!isIndexed() || isDecodeComplete() ||
+        start + count <= getCachedFrameCount()) {
+        CodedAudioFileReader::getInterleavedFrames(start, count, frames);
+        return;
+    }
+
+    frames.clear();
+    if (start >= m_indexedFrameCount || count == 0) return;
+    if (count > m_indexedFrameCount - start) {
+        count = m_indexedFrameCount - start;
+    }
+
+    QMutexLocker locker(&m_regionMutex);
+
+    RegionList::iterator i = m_regions.begin();
+
+    for ( ; i != m_regions.end(); ++i) {
+        size_t frameCount = i->data.size() / m_channelCount;
+        if (i->start <= start && i->start + frameCount >= start + count) {
+            break;
+        }
+    }
+
+    if (i == m_regions.end()) {
+        m_regions.push_front(Region());
+        decodeRegion(start, count, m_regions.front());
+        while (m_regions.size() > MaxRegions) m_regions.pop_back();
+    } else if (i != m_regions.begin()) {
+        m_regions.splice(m_regions.begin(), m_regions, i);
+    }
+
+    const Region &region = m_regions.front();
+
+    size_t offset = (start - region.start) * m_channelCount;
+    size_t n = count * m_channelCount;
+    if (offset >= region.data.size()) return;
+    if (n > region.data.size() - offset) n = region.data.size() - offset;
+
+    frames.assign(region.data.begin() + offset,
+                  region.data.begin() + offset + n);
+}
+
+void
+MP3FileReader::decodeRegion(size_t start, size_t count, Region &region) const
+{
+    Profiler profiler("MP3FileReader::decodeRegion", true);
+
+    // The frame containing start, and the first frame beyond the
+    // region we want to have decoded
+
+    size_t target = std::upper_bound(m_frameStarts.begin(),
+                                     m_frameStarts.end(), start)
+        - m_frameStarts.begin() - 1;
+
+    size_t end = start + std::max(count, MinRegionFrames);
+    size_t last = std::lower_bound(m_frameStarts.begin(),
+                                   m_frameStarts.end(), end)
+        - m_frameStarts.begin();
+
+    size_t first = (target > PrimingFrames ? target - PrimingFrames : 0);
+
+    region.start = m_frameStarts[target];
+    region.data.clear();
+    region.data.reserve((end - region.start) * m_channelCount);
+
+    struct mad_stream stream;
+    struct mad_frame frame;
+    struct mad_synth synth;
+
+    mad_stream_init(&stream);
+    mad_frame_init(&frame);
+    mad_synth_init(&synth);
+
+    size_t offset = m_frameOffsets[first];
+    mad_stream_buffer(&stream, m_filebuffer + offset, m_fileSize - offset);
+
+    for (size_t f = first; f < last; ++f) {
+
+        // Errors before MAD_ERROR_BADCRC mean that no frame header
+        // was found here.  buildIndex skips these without counting a
+        // frame, so keep looking for frame f rather than filling it
+
+        int rv = 0;
+        do {
+            rv = mad_frame_decode(&frame, &stream);
+        } while (rv == -1 && MAD_RECOVERABLE(stream.error) &&
+                 stream.error < MAD_ERROR_BADCRC);
+
+        if (rv == -1) {
+            if (stream.error == MAD_ERROR_BUFLEN) break;
+            if (!MAD_RECOVERABLE(stream.error)) break;
+            // Expected while priming, as the bit reservoir refers
+            // back to frames we haven't read; otherwise keep the
+            // output aligned with the index
+            if (f >= target) {
+                size_t n = (f + 1 < m_frameStarts.size() ?
+                            m_frameStarts[f + 1] : m_indexedFrameCount)
+                    - m_frameStarts[f];
+                region.data.insert(region.data.end(), n * m_channelCount, 0.f);
+            }
+            continue;
+        }
+
+        mad_synth_frame(&synth, &frame);
+
+        if (f < target) continue;
+
+        const struct mad_pcm &pcm = synth.pcm;
+        int activeChannels = int(sizeof(pcm.samples) / sizeof(pcm.samples[0]));
+
+        for (int i = 0; i < pcm.length; ++i) {
+            for (size_t ch = 0; ch < m_channelCount; ++ch) {
+                mad_fixed_t sample = 0;
+                if (int(ch) < activeChannels && ch < pcm.channels) {
+                    sample = pcm.samples[ch][i];
+                }
+                float fsample = float(sample) / float(MAD_F_ONE);
+                if (fsample >  1.f) fsample =  1.f;
+                if (fsample < -1.f) fsample = -1.f;
+                region.data.push_back(fsample);
+            }
+        }
+    }
+
+    mad_synth_finish(&synth);
+    mad_frame_finish(&frame);
+    mad_stream_finish(&stream);
+}
+
 void
 MP3FileReader::getSupportedExtensions(std::set<QString> &extensions)
 {
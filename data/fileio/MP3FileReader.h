@@ -23,7 +23,11 @@
 #include "base/Thread.h"
 #include <mad.h>
 
+#include <QAtomicInt>
+
 #include <set>
+#include <list>
+#include <vector>
 
 class ProgressReporter;
 
@@ -62,6 +66,18 @@ public:
         return m_decodeThread && m_decodeThread->isRunning();
     }
 
+    /**
+     * While decoding in the background, the length of the file is
+     * known from an index of its frames made by scanning their
+     * headers, and any region not yet decoded is decoded on demand
+     * from the index.  This is only possible when the audio is not
+     * being resampled.
+     */
+    virtual size_t getFrameCount() const;
+    virtual size_t getDecodedFrameCount() const;
+    virtual void getInterleavedFrames(size_t start, size_t count,
+                                      SampleBlock &frames) const;
+
 public slots:
     void cancelled();
 
@@ -78,7 +94,15 @@ protected:
     int m_completion;
     bool m_done;
 
-    unsigned char *m_filebuffer;
+    // Set by the decode thread once the whole file is in the decode
+    // cache, and read from any thread
+    mutable QAtomicInt m_decodeComplete;
+    bool isDecodeComplete() const {
+        return m_decodeComplete.fetchAndAddOrdered(0) != 0;
+    }
+
+    unsigned char *m_filebuffer; // mapped, or on the heap if not
+    bool m_fileBufferMapped;
     float **m_samplebuffer;
     size_t m_samplebuffersize;
 
@@ -94,6 +118,7 @@ protected:
 
     bool decode(void *mm, size_t sz);
     enum mad_flow accept(struct mad_header const *, struct mad_pcm *);
+    enum mad_flow acceptSilence(struct mad_header const *);
 
     static enum mad_flow input(void *, struct mad_stream *);
     static enum mad_flow output(void *, struct mad_header const *, struct mad_pcm *);
@@ -111,6 +136,43 @@ protected:
 
     DecodeThread *m_decodeThread;
 
+    void releaseFileBuffer();
+
+    // Index of MP3 frames, from buildIndex(): the byte offset of
+    // each frame within the file, and the audio frame at which its
+    // output starts
+    std::vector<size_t> m_frameOffsets;
+    std::vector<size_t> m_frameStarts;
+    size_t m_indexedFrameCount;
+    size_t m_indexedChannels;
+    size_t m_indexedRate;
+    mutable QAtomicInt m_indexed;
+    bool isIndexed() const {
+        return m_indexed.fetchAndAddOrdered(0) != 0;
+    }
+
+    // Regions recently decoded on demand, most recent first
+    struct Region {
+        size_t start;
+        SampleBlock data; // interleaved
+    };
+    typedef std::list<Region> RegionList;
+    mutable RegionList m_regions;
+    mutable QMutex m_regionMutex;
+
+    void buildIndex();
+    void decodeRegion(size_t start, size_t count, Region &region) const;
+
+    // Frames decoded and discarded before the first wanted one, so
+    // that the bit reservoir and the synthesis filter overlap are
+    // filled as they would be in a decode from the start
+    static const size_t PrimingFrames = 8;
+
+    // Minimum size of a region decoded on demand, and the number of
+    // regions kept
+    static const size_t MinRegionFrames = 65536;
+    static const size_t MaxRegions = 4;
+
     void loadTags();
     QString loadTag(void *vtag, const char *name);
 };
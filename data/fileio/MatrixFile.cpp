@@ -25,6 +25,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #include <iostream>
 
 #include <cstdio>
@@ -63,7 +67,10 @@ MatrixFile::MatrixFile(QString fileBase, Mode mode,
     m_headerSize(2 * sizeof(size_t)),
     m_setColumns(0),
     m_autoClose(false),
-    m_readyToReadColumn(-1)
+    m_readyToReadColumn(-1),
+    m_mmap(0),
+    m_mmapSize(0),
+    m_accessDirection(AccessUnknown)
 {
     Profiler profiler("MatrixFile::MatrixFile", true);
 
@@ -140,6 +147,8 @@ MatrixFile::MatrixFile(QString fileBase, Mode mode,
                       << m_width << "x" << m_height << std::endl;
             throw FailedToOpenFile(fileName);
         }
+        m_fileName = fileName;
+        map();
     }
 
     m_fileName = fileName;
@@ -157,6 +166,8 @@ MatrixFile::MatrixFile(QString fileBase, Mode mode,
 
 MatrixFile::~MatrixFile()
 {
+    unmap();
+
     if (m_fd >= 0) {
         if (::close(m_fd) < 0) {
             ::perror("MatrixFile::~MatrixFile: close failed");
@@ -244,6 +255,93 @@ MatrixFile::initialise()
     seekTo(0);
 }
 
+void
+MatrixFile::map()
+{
+#ifndef _WIN32
+    assert(m_mode == ReadOnly);
+
+    // The writer has already extended the file to its full size, so
+    // we can map all of it now.  Columns subsequently written through
+    // the writer's file descriptor become visible through the mapping
+    // as they are written.
+
+    size_t size = m_headerSize + (m_width * m_height * m_cellSize) + m_width;
+
+    void *addr = ::mmap(0, size, PROT_READ, MAP_SHARED, m_fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ::perror("WARNING: MatrixFile::map: mmap failed");
+        std::cerr << "WARNING: MatrixFile::map: Failed to map "
+                  << size << " bytes of file \"" << m_fileName.toStdString()
+                  << "\", falling back to reading it" << std::endl;
+        return;
+    }
+
+    m_mmap = (char *)addr;
+    m_mmapSize = size;
+
+#ifdef DEBUG_MATRIX_FILE
+    std::cerr << "MatrixFile[" << m_fd << "]::map: mapped " << size
+              << " bytes at " << addr << std::endl;
+#endif
+#endif
+}
+
+void
+MatrixFile::unmap()
+{
+#ifndef _WIN32
+    if (!m_mmap) return;
+    if (::munmap(m_mmap, m_mmapSize) < 0) {
+        ::perror("MatrixFile::unmap: munmap failed");
+    }
+    m_mmap = 0;
+    m_mmapSize = 0;
+#endif
+}
+
+void
+MatrixFile::adviseAccess(AccessDirection direction) const
+{
+#ifndef _WIN32
+    if (!m_mmap) return;
+
+    int previous = m_accessDirection.fetchAndStoreOrdered(direction);
+    if (direction == previous) return;
+
+    int advice = POSIX_MADV_NORMAL;
+    if (direction == AccessForward) advice = POSIX_MADV_SEQUENTIAL;
+    else if (direction == AccessRandom) advice = POSIX_MADV_RANDOM;
+
+#ifdef DEBUG_MATRIX_FILE
+    std::cerr << "MatrixFile[" << m_fd << "]::adviseAccess: direction changed from "
+              << previous << " to " << direction << std::endl;
+#endif
+
+    ::posix_madvise(m_mmap, m_mmapSize, advice);
+#endif
+}
+
+void
+MatrixFile::adviseWillNeed(size_t x0, size_t x1) const
+{
+#ifndef _WIN32
+    if (!m_mmap) return;
+
+    if (x1 > m_width) x1 = m_width;
+    if (x0 >= x1) return;
+
+    size_t columnSize = m_height * m_cellSize + 1;
+    size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    size_t off = m_headerSize + x0 * columnSize;
+    size_t end = m_headerSize + x1 * columnSize;
+    off -= off % pageSize;
+
+    ::posix_madvise(m_mmap + off, end - off, POSIX_MADV_WILLNEED);
+#endif
+}
+
 void
 MatrixFile::close()
 {
@@ -273,6 +371,15 @@ MatrixFile::getColumnAt(size_t x, void *data)
 
     Profiler profiler("MatrixFile::getColumnAt");
 
+    if (m_mmap) {
+        if (!haveSetColumnAt(x)) {
+            std::cerr << "MatrixFile[" << m_fd << "]::getColumnAt(" << x << "): Column has not been set" << std::endl;
+            return;
+        }
+        memcpy(data, getColumnPointer(x), m_height * m_cellSize);
+        return;
+    }
+
     ssize_t r = -1;
 
     if (m_readyToReadColumn < 0 ||
@@ -309,6 +416,13 @@ MatrixFile::haveSetColumnAt(size_t x) const
         return m_setColumns->get(x);
     }
 
+    if (m_mmap) {
+        if (x >= m_width) return false;
+        const volatile char *set =
+            m_mmap + m_headerSize + x * m_height * m_cellSize + x;
+        return *set != 0;
+    }
+
     if (m_readyToReadColumn >= 0 &&
         size_t(m_readyToReadColumn) == x) return true;
     
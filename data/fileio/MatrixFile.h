@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <QString>
 #include <QMutex>
+#include <QAtomicInt>
 #include <map>
 
 class MatrixFile : public QObject
@@ -55,8 +56,12 @@ public:
      * MatrixFile of WriteOnly type creating the file and then
      * persisting until all readers are complete.
      *
-     * MatrixFile has no built-in cache and is not thread-safe.  Use a
-     * separate MatrixFile in each thread.
+     * A ReadOnly MatrixFile is memory-mapped where the platform
+     * permits.  A mapped MatrixFile can be read from any number of
+     * threads at once, and getColumnPointer provides direct access
+     * to the mapped data without copying.  If the file could not be
+     * mapped, MatrixFile has no built-in cache and is not
+     * thread-safe: use a separate MatrixFile in each thread.
      */
     MatrixFile(QString fileBase, Mode mode, size_t cellSize,
                size_t width, size_t height);
@@ -80,6 +85,44 @@ public:
     void getColumnAt(size_t x, void *data); // may throw FileReadFailed
     void setColumnAt(size_t x, const void *data);
 
+    /**
+     * Return true if this is a ReadOnly MatrixFile whose file has
+     * been memory-mapped.
+     */
+    bool isMapped() const { return m_mmap != 0; }
+
+    /**
+     * Return a pointer to the mapped data for column x, or 0 if the
+     * file is not mapped.  The pointer is valid for the lifetime of
+     * this MatrixFile.  As with getColumnAt, the data is only
+     * meaningful if haveSetColumnAt(x) has returned true.
+     */
+    const void *getColumnPointer(size_t x) const {
+        if (!m_mmap || x >= m_width) return 0;
+        return m_mmap + m_headerSize + x * m_height * m_cellSize + x + 1;
+    }
+
+    enum AccessDirection {
+        AccessUnknown, AccessForward, AccessBackward, AccessRandom
+    };
+
+    /**
+     * Advise the operating system that the mapped file is going to be
+     * read in the given direction (for example as a view scrolls).
+     * The hint covers the whole mapping, so it should be given only
+     * when the direction of access is known to have changed, not for
+     * each column read.  Does nothing if the direction is unchanged
+     * since the last call.
+     */
+    void adviseAccess(AccessDirection direction) const;
+
+    /**
+     * Ask the operating system to read ahead columns x0 to x1-1 of
+     * the mapped file.  There is no backward read-ahead, so this is
+     * useful when reading backward.
+     */
+    void adviseWillNeed(size_t x0, size_t x1) const;
+
 protected:
     int     m_fd;
     Mode    m_mode;
@@ -98,10 +141,18 @@ protected:
     // without seeking (and we know that the column exists)
     mutable int m_readyToReadColumn;
 
+    // In reader: the mapped file, if mapping succeeded
+    char *m_mmap;
+    size_t m_mmapSize;
+
+    mutable QAtomicInt m_accessDirection;
+
     static std::map<QString, int> m_refcount;
     static QMutex m_createMutex;
 
     void initialise();
+    void map();
+    void unmap();
     bool seekTo(size_t x) const;
 };
 
@@ -84,7 +84,7 @@ OggVorbisFileReader::OggVorbisFileReader(FileSource source,
         m_oggz = 0;
 
         if (isDecodeCacheInitialised()) finishDecodeCache();
-        endSerialised();
+        releaseDecodeSlot();
 
     } else {
 
@@ -119,10 +119,8 @@ OggVorbisFileReader::cancelled()
 void
 OggVorbisFileReader::DecodeThread::run()
 {
-    if (m_reader->m_cacheMode == CacheInTemporaryFile) {
-        m_reader->m_completion = 1;
-        m_reader->startSerialised("OggVorbisFileReader::Decode");
-    }
+    m_reader->m_completion = 1;
+    m_reader->waitForDecodeSlot(m_reader->m_fileSize);
 
     while (oggz_read(m_reader->m_oggz, 1024) > 0);
         
@@ -134,7 +132,7 @@ OggVorbisFileReader::DecodeThread::run()
     if (m_reader->isDecodeCacheInitialised()) m_reader->finishDecodeCache();
     m_reader->m_completion = 100;
 
-    m_reader->endSerialised();
+    m_reader->releaseDecodeSlot();
 } 
 
 int
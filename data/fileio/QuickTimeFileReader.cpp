@@ -247,7 +247,7 @@ std::cerr << "QuickTimeFileReader: path is \"" << m_path.toStdString() << "\"" <
         }
         
         finishDecodeCache();
-        endSerialised();
+        releaseDecodeSlot();
 
         m_d->err = MovieAudioExtractionEnd(m_d->extractionSessionRef);
         if (m_d->err) {
@@ -294,10 +294,8 @@ QuickTimeFileReader::cancelled()
 void
 QuickTimeFileReader::DecodeThread::run()
 {
-    if (m_reader->m_cacheMode == CacheInTemporaryFile) {
-        m_reader->m_completion = 1;
-        m_reader->startSerialised("QuickTimeFileReader::Decode");
-    }
+    m_reader->m_completion = 1;
+    m_reader->waitForDecodeSlot(QFileInfo(m_reader->m_path).size());
 
     while (1) {
             
@@ -326,7 +324,7 @@ QuickTimeFileReader::DecodeThread::run()
     }
     
     m_reader->m_completion = 100;
-    m_reader->endSerialised();
+    m_reader->releaseDecodeSlot();
 } 
 
 void
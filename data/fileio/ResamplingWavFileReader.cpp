@@ -80,7 +80,7 @@ ResamplingWavFileReader::ResamplingWavFileReader(FileSource source,
         }
 
         if (isDecodeCacheInitialised()) finishDecodeCache();
-        endSerialised();
+        releaseDecodeSlot();
 
         if (m_reporter) m_reporter->setProgress(100);
 
@@ -116,12 +116,18 @@ ResamplingWavFileReader::cancelled()
 void
 ResamplingWavFileReader::DecodeThread::run()
 {
-    if (m_reader->m_cacheMode == CacheInTemporaryFile) {
-        m_reader->startSerialised("ResamplingWavFileReader::Decode");
-    }
+    // The input is already PCM, so its size says little about how
+    // much audio we will hold; the frame count says exactly
 
     size_t blockSize = 16384;
     size_t total = m_reader->m_original->getFrameCount();
+
+    size_t expected = total;
+    if (m_reader->m_fileRate > 0) {
+        expected = size_t((double(total) * m_reader->m_sampleRate) /
+                          m_reader->m_fileRate);
+    }
+    m_reader->waitForDecodeSlot(QFileInfo(m_reader->m_path).size(), expected);
     
     SampleBlock block;
     
@@ -139,7 +145,7 @@ ResamplingWavFileReader::DecodeThread::run()
     if (m_reader->isDecodeCacheInitialised()) m_reader->finishDecodeCache();
     m_reader->m_completion = 100;
 
-    m_reader->endSerialised();
+    m_reader->releaseDecodeSlot();
 
     delete m_reader->m_original;
     m_reader->m_original = 0;
@@ -0,0 +1,274 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "SampleKernels.h"
+
+#include "system/System.h"
+#include "system/SIMD.h"
+
+#include <iostream>
+#include <cstring>
+
+//#define DEBUG_SAMPLE_KERNELS 1
+
+// The vector implementations read the samples directly, so are only
+// used on little-endian x86 processors
+
+static const float int16Scale = 1.f / 32768.f;
+static const float int24Scale = 1.f / 8388608.f;
+static const float int32Scale = 1.f / 2147483648.f;
+
+
+// Plain implementations.  These assemble each sample from its bytes,
+// so they work whatever the byte order of the processor.
+
+static void
+convertInt16LEPlain(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        short v = short(src[0] | (src[1] << 8));
+        dst[i] = float(v) * int16Scale;
+        src += 2;
+    }
+}
+
+static void
+convertInt16BEPlain(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        short v = short((src[0] << 8) | src[1]);
+        dst[i] = float(v) * int16Scale;
+        src += 2;
+    }
+}
+
+static void
+convertInt24Plain(const unsigned char *src, bool bigEndian,
+                  float *dst, size_t n)
+{
+    // Assemble into the top three bytes of an int, so the sign
+    // comes out right, then scale as for a 32-bit sample
+    int b0 = (bigEndian ? 2 : 0), b2 = (bigEndian ? 0 : 2);
+    for (size_t i = 0; i < n; ++i) {
+        int v = int((unsigned(src[b0]) << 8) |
+                    (unsigned(src[1]) << 16) |
+                    (unsigned(src[b2]) << 24));
+        dst[i] = float(v >> 8) * int24Scale;
+        src += 3;
+    }
+}
+
+static void
+convertInt32LEPlain(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        int v = int(unsigned(src[0]) | (unsigned(src[1]) << 8) |
+                    (unsigned(src[2]) << 16) | (unsigned(src[3]) << 24));
+        dst[i] = float(v) * int32Scale;
+        src += 4;
+    }
+}
+
+static void
+convertInt32BEPlain(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        int v = int((unsigned(src[0]) << 24) | (unsigned(src[1]) << 16) |
+                    (unsigned(src[2]) << 8) | unsigned(src[3]));
+        dst[i] = float(v) * int32Scale;
+        src += 4;
+    }
+}
+
+static void
+convertFloat32Plain(const unsigned char *src, bool bigEndian,
+                    float *dst, size_t n)
+{
+    // Floats are assumed to share the byte order of integers
+    for (size_t i = 0; i < n; ++i) {
+        unsigned v;
+        if (bigEndian) {
+            v = (unsigned(src[0]) << 24) | (unsigned(src[1]) << 16) |
+                (unsigned(src[2]) << 8) | unsigned(src[3]);
+        } else {
+            v = unsigned(src[0]) | (unsigned(src[1]) << 8) |
+                (unsigned(src[2]) << 16) | (unsigned(src[3]) << 24);
+        }
+        memcpy(dst + i, &v, sizeof(float));
+        src += 4;
+    }
+}
+
+
+#ifdef SV_SSE2
+
+static void
+convertInt16LESSE2(const unsigned char *src, float *dst, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(int16Scale);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        // sign-extend by placing each sample in the top half of a
+        // 32-bit word and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+
+    convertInt16LEPlain(src + i * 2, dst + i, n - i);
+}
+
+static void
+convertInt32LESSE2(const unsigned char *src, float *dst, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(int32Scale);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    convertInt32LEPlain(src + i * 4, dst + i, n - i);
+}
+
+#endif // SV_SSE2
+
+
+#ifdef SV_AVX2
+
+static AVX2_FUNCTION void
+convertInt16LEAVX2(const unsigned char *src, float *dst, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(int16Scale);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m256i w = _mm256_cvtepi16_epi32(v);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(w), scale));
+    }
+
+    convertInt16LEPlain(src + i * 2, dst + i, n - i);
+}
+
+static AVX2_FUNCTION void
+convertInt32LEAVX2(const unsigned char *src, float *dst, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(int32Scale);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    convertInt32LEPlain(src + i * 4, dst + i, n - i);
+}
+
+#endif // SV_AVX2
+
+
+typedef void (*ConvertFunction)(const unsigned char *, float *, size_t);
+
+struct ConvertFunctions {
+    ConvertFunction int16LE;
+    ConvertFunction int32LE;
+};
+
+static ConvertFunctions
+chooseConvertFunctions()
+{
+    ConvertFunctions f;
+    f.int16LE = convertInt16LEPlain;
+    f.int32LE = convertInt32LEPlain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) {
+        f.int16LE = convertInt16LESSE2;
+        f.int32LE = convertInt32LESSE2;
+    }
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) {
+        f.int16LE = convertInt16LEAVX2;
+        f.int32LE = convertInt32LEAVX2;
+    }
+#endif
+
+#ifdef DEBUG_SAMPLE_KERNELS
+    std::cerr << "SampleKernels: using "
+              << (f.int16LE == convertInt16LEPlain ? "plain" : "vector")
+              << " implementation" << std::endl;
+#endif
+
+    return f;
+}
+
+static const ConvertFunctions convertFunctions = chooseConvertFunctions();
+
+static bool
+isLittleEndian()
+{
+    unsigned int one = 1;
+    return *(const unsigned char *)&one == 1;
+}
+
+static const bool hostIsLittleEndian = isLittleEndian();
+
+size_t
+SampleKernels::getBytesPerSample(Format format)
+{
+    switch (format) {
+    case Int16: return 2;
+    case Int24: return 3;
+    case Int32: return 4;
+    case Float32: return 4;
+    }
+    return 0;
+}
+
+void
+SampleKernels::convert(const void *vsrc, Format format, bool bigEndian,
+                       float *dst, size_t n)
+{
+    const unsigned char *src = (const unsigned char *)vsrc;
+
+    switch (format) {
+
+    case Int16:
+        if (bigEndian) convertInt16BEPlain(src, dst, n);
+        else convertFunctions.int16LE(src, dst, n);
+        break;
+
+    case Int24:
+        convertInt24Plain(src, bigEndian, dst, n);
+        break;
+
+    case Int32:
+        if (bigEndian) convertInt32BEPlain(src, dst, n);
+        else convertFunctions.int32LE(src, dst, n);
+        break;
+
+    case Float32:
+        if (!bigEndian && hostIsLittleEndian) memcpy(dst, src, n * sizeof(float));
+        else convertFloat32Plain(src, bigEndian, dst, n);
+        break;
+    }
+}
@@ -0,0 +1,49 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _SAMPLE_KERNELS_H_
+#define _SAMPLE_KERNELS_H_
+
+#include <stddef.h>
+
+/**
+ * Functions used to convert samples stored in audio files to floats.
+ * Integer samples are scaled in the same way as libsndfile does by
+ * default, so that -1.0 corresponds to the most negative value.
+ * Only the conversions of little-endian 16 and 32-bit integers are
+ * vectorised.
+ */
+
+class SampleKernels
+{
+public:
+    enum Format {
+        Int16,
+        Int24,
+        Int32,
+        Float32
+    };
+
+    static size_t getBytesPerSample(Format format);
+
+    /**
+     * Convert n samples in the given format and byte order from src,
+     * which need not be aligned, to floats in dst.
+     */
+    static void convert(const void *src, Format format, bool bigEndian,
+                        float *dst, size_t n);
+};
+
+#endif
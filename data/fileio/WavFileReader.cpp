@@ -16,10 +16,23 @@
 #include "WavFileReader.h"
 
 #include <iostream>
+#include <cstring>
+#include <cstdio>
 
 #include <QMutexLocker>
 #include <QFileInfo>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+//#define DEBUG_WAV_FILE_READER 1
+
 WavFileReader::WavFileReader(FileSource source, bool fileUpdating) :
     m_file(0),
     m_source(source),
@@ -28,7 +41,13 @@ WavFileReader::WavFileReader(FileSource source, bool fileUpdating) :
     m_bufsiz(0),
     m_lastStart(0),
     m_lastCount(0),
-    m_updating(fileUpdating)
+    m_updating(fileUpdating),
+    m_mmap(0),
+    m_mmapSize(0),
+    m_sampleData(0),
+    m_sampleFormat(SampleKernels::Int16),
+    m_bigEndian(false),
+    m_bytesPerFrame(0)
 {
     m_frameCount = 0;
     m_channelCount = 0;
@@ -60,12 +79,185 @@ WavFileReader::WavFileReader(FileSource source, bool fileUpdating) :
 
 //    std::cerr << "WavFileReader: Frame count " << m_frameCount << ", channel count " << m_channelCount << ", sample rate " << m_sampleRate << std::endl;
 
+    if (!fileUpdating && m_channelCount > 0) map();
 }
 
 WavFileReader::~WavFileReader()
 {
     if (m_file) sf_close(m_file);
     delete[] m_buffer;
+
+#ifndef _WIN32
+    if (m_mmap) ::munmap(m_mmap, m_mmapSize);
+#endif
+}
+
+void
+WavFileReader::map()
+{
+#ifndef _WIN32
+    int major = (m_fileInfo.format & SF_FORMAT_TYPEMASK);
+    if (major != SF_FORMAT_WAV && major != SF_FORMAT_AIFF) return;
+
+    int fd = ::open(m_path.toLocal8Bit(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || st.st_size <= 0) {
+        ::close(fd);
+        return;
+    }
+
+    void *addr = ::mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        ::perror("WavFileReader::map: mmap failed, reading through libsndfile");
+        return;
+    }
+
+    m_mmap = (char *)addr;
+    m_mmapSize = st.st_size;
+
+    size_t offset = 0;
+    SampleKernels::Format format = SampleKernels::Int16;
+    bool bigEndian = false;
+
+    if (!findSampleData(offset, format, bigEndian)) {
+#ifdef DEBUG_WAV_FILE_READER
+        std::cerr << "WavFileReader::map: Format of " << m_path.toStdString()
+                  << " not supported for direct reading" << std::endl;
+#endif
+        ::munmap(m_mmap, m_mmapSize);
+        m_mmap = 0;
+        m_mmapSize = 0;
+        return;
+    }
+
+    m_sampleData = m_mmap + offset;
+    m_sampleFormat = format;
+    m_bigEndian = bigEndian;
+    m_bytesPerFrame = SampleKernels::getBytesPerSample(format) * m_channelCount;
+
+#ifdef DEBUG_WAV_FILE_READER
+    std::cerr << "WavFileReader::map: Mapped " << m_path.toStdString()
+              << ", sample data at offset " << offset << std::endl;
+#endif
+#endif
+}
+
+static inline unsigned int
+getLE32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (unsigned(p[3]) << 24);
+}
+
+static inline unsigned int
+getBE32(const unsigned char *p)
+{
+    return (unsigned(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline unsigned int
+getLE16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int
+getBE16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+bool
+WavFileReader::findSampleData(size_t &offset, SampleKernels::Format &format,
+                              bool &bigEndian) const
+{
+    // Find the sample data chunk of a RIFF WAVE or (uncompressed)
+    // AIFF file, and check that its format is one we can convert and
+    // agrees with what libsndfile told us.  Anything unexpected and
+    // we leave it to libsndfile.
+
+    const unsigned char *file = (const unsigned char *)m_mmap;
+    size_t size = m_mmapSize;
+
+    if (size < 12) return false;
+
+    bool riff = (!memcmp(file, "RIFF", 4) && !memcmp(file + 8, "WAVE", 4));
+    bool aiff = (!memcmp(file, "FORM", 4) && !memcmp(file + 8, "AIFF", 4));
+    if (!riff && !aiff) return false;
+
+    bigEndian = aiff;
+
+    int bits = 0;
+    bool isFloat = false;
+    size_t channels = 0;
+    size_t dataOffset = 0;
+
+    size_t pos = 12;
+
+    while (pos + 8 <= size) {
+
+        const unsigned char *chunk = file + pos;
+        size_t chunkSize = (riff ? getLE32(chunk + 4) : getBE32(chunk + 4));
+        const unsigned char *body = chunk + 8;
+        size_t bodySize = size - pos - 8;
+
+        if (riff && !memcmp(chunk, "fmt ", 4)) {
+            if (bodySize < 16) return false;
+            unsigned int tag = getLE16(body);
+            channels = getLE16(body + 2);
+            unsigned int blockAlign = getLE16(body + 12);
+            bits = getLE16(body + 14);
+            if (tag == 0xfffe) { // WAVE_FORMAT_EXTENSIBLE
+                if (bodySize < 26) return false;
+                tag = getLE16(body + 24); // start of subformat GUID
+            }
+            if (tag == 3) isFloat = true;
+            else if (tag != 1) return false;
+            if (channels == 0 || blockAlign != channels * (bits / 8)) {
+                return false;
+            }
+        } else if (riff && !memcmp(chunk, "data", 4)) {
+            dataOffset = pos + 8;
+            break;
+        } else if (aiff && !memcmp(chunk, "COMM", 4)) {
+            if (bodySize < 18) return false;
+            channels = getBE16(body);
+            bits = getBE16(body + 6);
+        } else if (aiff && !memcmp(chunk, "SSND", 4)) {
+            if (bodySize < 8) return false;
+            dataOffset = pos + 16 + getBE32(body);
+            break;
+        }
+
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    if (dataOffset == 0 || channels != m_channelCount) return false;
+
+    int subtype = (m_fileInfo.format & SF_FORMAT_SUBMASK);
+
+    if (isFloat) {
+        if (bits != 32 || subtype != SF_FORMAT_FLOAT) return false;
+        format = SampleKernels::Float32;
+    } else if (bits == 16 && subtype == SF_FORMAT_PCM_16) {
+        format = SampleKernels::Int16;
+    } else if (bits == 24 && subtype == SF_FORMAT_PCM_24) {
+        format = SampleKernels::Int24;
+    } else if (bits == 32 && subtype == SF_FORMAT_PCM_32) {
+        format = SampleKernels::Int32;
+    } else {
+        return false;
+    }
+
+    size_t bytes = m_frameCount * channels *
+        SampleKernels::getBytesPerSample(format);
+    if (dataOffset + bytes > size) return false;
+
+    offset = dataOffset;
+    return true;
 }
 
 void
@@ -112,6 +304,21 @@ WavFileReader::getInterleavedFrames(size_t start, size_t count,
 {
     if (count == 0) return;
     results.clear();
+
+    if (m_sampleData) {
+
+        // Mapped: the file is not changing, so no locking needed
+
+        if (start >= m_frameCount) return;
+        if (count > m_frameCount - start) count = m_frameCount - start;
+
+        results.resize(count * m_channelCount);
+        SampleKernels::convert(m_sampleData + start * m_bytesPerFrame,
+                               m_sampleFormat, m_bigEndian,
+                               &results[0], count * m_channelCount);
+        return;
+    }
+
     results.reserve(count * m_fileInfo.channels);
 
     QMutexLocker locker(&m_mutex);
@@ -17,6 +17,7 @@
 #define _WAV_FILE_READER_H_
 
 #include "AudioFileReader.h"
+#include "SampleKernels.h"
 
 #include <sndfile.h>
 #include <QMutex>
@@ -66,6 +67,21 @@ protected:
     mutable size_t m_lastCount;
 
     bool m_updating;
+
+    // For uncompressed WAV and AIFF files that are not being written,
+    // the whole file is mapped and samples are converted directly
+    // from the mapping, so that any number of threads can read at
+    // once without locking.  Other files are read through libsndfile.
+    char *m_mmap;
+    size_t m_mmapSize;
+    const char *m_sampleData;
+    SampleKernels::Format m_sampleFormat;
+    bool m_bigEndian;
+    size_t m_bytesPerFrame;
+
+    void map();
+    bool findSampleData(size_t &offset, SampleKernels::Format &format,
+                        bool &bigEndian) const;
 };
 
 #endif
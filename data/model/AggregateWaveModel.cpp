@@ -14,16 +14,38 @@
 */
 
 #include "AggregateWaveModel.h"
+#include "RangeSummariser.h"
+
+#include "base/StorageAdviser.h"
+#include "base/Exceptions.h"
+#include "base/Profiler.h"
 
 #include <iostream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 
 #include <QTextStream>
+#include <QTimer>
+
+//#define DEBUG_AGGREGATE_WAVE_MODEL 1
 
 PowerOfSqrtTwoZoomConstraint
 AggregateWaveModel::m_zoomConstraint;
 
 AggregateWaveModel::AggregateWaveModel(ChannelSpecList channelSpecs) :
-    m_components(channelSpecs)
+    m_components(channelSpecs),
+    m_samplesCached(false),
+    m_fillThread(0),
+    m_updateTimer(0),
+    m_invalidStart(0),
+    m_invalidEnd(0),
+    m_rebuildFrame(0),
+    m_rebuildEnd(0),
+    m_builtExtent(0),
+    m_changedStart(0),
+    m_changedEnd(0),
+    m_exiting(false)
 {
     for (ChannelSpecList::const_iterator i = channelSpecs.begin();
          i != channelSpecs.end(); ++i) {
@@ -33,10 +55,71 @@ AggregateWaveModel::AggregateWaveModel(ChannelSpecList channelSpecs) :
             break;
         }
     }
+
+    for (ChannelSpecList::const_iterator i = channelSpecs.begin();
+         i != channelSpecs.end(); ++i) {
+        connect(i->model, SIGNAL(modelChanged()),
+                this, SLOT(componentModelChanged()));
+        connect(i->model, SIGNAL(modelChanged(size_t, size_t)),
+                this, SLOT(componentModelChanged(size_t, size_t)));
+        connect(i->model, SIGNAL(completionChanged()),
+                this, SLOT(componentModelCompletionChanged()));
+    }
+
+    for (int ct = 0; ct < 2; ++ct) {
+        m_cache[ct].push_back(RangeBlock());
+    }
+
+    m_updateTimer = new QTimer(this);
+    connect(m_updateTimer, SIGNAL(timeout()), this, SLOT(cacheUpdateTimedOut()));
+
+    if (m_components.empty()) return;
+
+    // Decide now whether there is room to keep the samples as well as
+    // the summaries.  Components that are still loading may grow, in
+    // which case the sample cache grows with them.
+
+    size_t frames = getFrameCount();
+    int kb = int((double(frames) * m_components.size() * sizeof(float))
+                 / 1024.0);
+
+    try {
+        StorageAdviser::Recommendation recommendation =
+            StorageAdviser::recommend
+            (StorageAdviser::Criteria(StorageAdviser::SpeedCritical |
+                                      StorageAdviser::FrequentLookupLikely),
+             kb, kb);
+        if ((recommendation & StorageAdviser::UseMemory) ||
+            (recommendation & StorageAdviser::PreferMemory)) {
+            m_samplesCached = true;
+            m_samples.resize(m_components.size());
+        }
+    } catch (InsufficientDiscSpace) {
+        // leave it to the summaries alone
+    }
+
+#ifdef DEBUG_AGGREGATE_WAVE_MODEL
+    std::cerr << "AggregateWaveModel: " << m_components.size()
+              << " components, " << frames << " frames, samples "
+              << (m_samplesCached ? "" : "not ") << "cached" << std::endl;
+#endif
+
+    m_fillThread = new CacheFillThread(*this);
+    m_fillThread->start();
+
+    invalidate(0, frames);
 }
 
 AggregateWaveModel::~AggregateWaveModel()
 {
+    if (m_fillThread) {
+        m_mutex.lock();
+        m_exiting = true;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+        m_fillThread->wait();
+        delete m_fillThread;
+    }
 }
 
 bool
@@ -62,6 +145,19 @@ AggregateWaveModel::isReady(int *completion) const
             *completion = completionHere;
         }
     }
+
+    QMutexLocker locker(&m_mutex);
+
+    if (m_invalidStart < m_invalidEnd || m_rebuildFrame < m_rebuildEnd) {
+        ready = false;
+        size_t frames = getFrameCount();
+        if (completion && frames > 0) {
+            int built = int((100.0 * double(m_builtExtent)) / frames);
+            if (built > 99) built = 99;
+            if (built < *completion) *completion = built;
+        }
+    }
+
     return ready;
 }
 
@@ -102,6 +198,8 @@ size_t
 AggregateWaveModel::getData(int channel, size_t start, size_t count,
                             float *buffer) const
 {
+    if (readFromCache(channel, start, count, buffer)) return count;
+
     int ch0 = channel, ch1 = channel;
     bool mixing = false;
     if (channel == -1) {
@@ -141,6 +239,16 @@ size_t
 AggregateWaveModel::getData(int channel, size_t start, size_t count,
                             double *buffer) const
 {
+    if (m_samplesCached && count > 0) {
+        float *fbuf = new float[count];
+        bool cached = readFromCache(channel, start, count, fbuf);
+        if (cached) {
+            for (size_t i = 0; i < count; ++i) buffer[i] = fbuf[i];
+        }
+        delete[] fbuf;
+        if (cached) return count;
+    }
+
     int ch0 = channel, ch1 = channel;
     bool mixing = false;
     if (channel == -1) {
@@ -191,25 +299,211 @@ AggregateWaveModel::getData(size_t fromchannel, size_t tochannel,
     return min;
 }
 
+bool
+AggregateWaveModel::readFromCache(int channel, size_t start, size_t count,
+                                  float *buffer) const
+{
+    if (!m_samplesCached || count == 0) return false;
+
+    QMutexLocker locker(&m_mutex);
+
+    // Only use samples that have been read since the region they are
+    // in was last reported to have changed
+
+    size_t end = start + count;
+    if (end > m_builtExtent) return false;
+    if (start < m_invalidEnd && end > m_invalidStart) return false;
+    if (start < m_rebuildEnd && end > m_rebuildFrame) return false;
+
+    if (channel >= 0) {
+        if (size_t(channel) >= m_samples.size()) return false;
+        memcpy(buffer, &m_samples[channel][start], count * sizeof(float));
+        return true;
+    }
+
+    for (size_t i = 0; i < count; ++i) buffer[i] = 0.f;
+    for (size_t c = 0; c < m_samples.size(); ++c) {
+        const float *src = &m_samples[c][start];
+        for (size_t i = 0; i < count; ++i) buffer[i] += src[i];
+    }
+    return true;
+}
+
+size_t
+AggregateWaveModel::getCacheBlockSize(int cacheType) const
+{
+    if (cacheType == 0) {
+        return (1 << m_zoomConstraint.getMinCachePower());
+    } else {
+        return ((unsigned int)((1 << m_zoomConstraint.getMinCachePower()) *
+                               sqrt(2.) + 0.01));
+    }
+}
+
 size_t
 AggregateWaveModel::getSummaryBlockSize(size_t desired) const
 {
-    //!!! complete
-    return desired;
+    int cacheType = 0;
+    int power = m_zoomConstraint.getMinCachePower();
+    size_t roundedBlockSize = m_zoomConstraint.getNearestBlockSize
+        (desired, cacheType, power, ZoomConstraint::RoundDown);
+    if (cacheType != 0 && cacheType != 1) {
+        // We will be reading directly from the components, so can
+        // satisfy any blocksize requirement
+        return desired;
+    } else {
+        return roundedBlockSize;
+    }
 }
         
 void
 AggregateWaveModel::getSummaries(size_t channel, size_t start, size_t count,
                                  RangeBlock &ranges, size_t &blockSize) const
 {
-    //!!! complete
+    ranges.clear();
+    if (!isOK() || channel >= getChannelCount() || blockSize == 0) return;
+    ranges.reserve((count / blockSize) + 1);
+
+    int cacheType = 0;
+    int power = m_zoomConstraint.getMinCachePower();
+    size_t roundedBlockSize = m_zoomConstraint.getNearestBlockSize
+        (blockSize, cacheType, power, ZoomConstraint::RoundDown);
+
+    if (cacheType != 0 && cacheType != 1) {
+
+        // Smaller than our cache blocks: summarise the samples
+        // directly, which will come from the sample cache if we have
+        // one.  The request should be small.
+
+        float *buffer = new float[count];
+        size_t got = getData(channel, start, count, buffer);
+
+        float max = 0.0, min = 0.0, total = 0.0;
+        size_t n = 0;
+
+        for (size_t i = 0; i < got; ++i) {
+            float sample = buffer[i];
+            if (sample > max || n == 0) max = sample;
+            if (sample < min || n == 0) min = sample;
+            total += fabsf(sample);
+            if (++n == blockSize) {
+                ranges.push_back(Range(min, max, total / n));
+                min = max = total = 0.0f;
+                n = 0;
+            }
+        }
+
+        if (n > 0) ranges.push_back(Range(min, max, total / n));
+
+        delete[] buffer;
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    const RangeBlockLevels &levels = m_cache[cacheType];
+    if (levels.empty()) return;
+
+    blockSize = roundedBlockSize;
+
+    size_t cacheBlock = getCacheBlockSize(cacheType);
+    size_t channels = getChannelCount();
+
+    // The lookup is the same as in WaveFileModel::getSummaries: use
+    // the level whose blocks are the size requested, or the coarsest
+    // level that fits where the request is not aligned to it
+
+    size_t level = power - m_zoomConstraint.getMinCachePower();
+    size_t div = (size_t(1) << level);
+    if (level >= levels.size()) level = levels.size() - 1;
+
+    size_t startIndex = start / cacheBlock;
+    size_t endIndex = (start + count) / cacheBlock;
+
+    float max = 0.0, min = 0.0, total = 0.0;
+    size_t i = startIndex, got = 0, weight = 0;
+    size_t baseBlocks = levels[0].size() / channels;
+
+    while (i <= endIndex) {
+
+        size_t l = level;
+        while (l > 0) {
+            size_t w = (size_t(1) << l);
+            if (i % w == 0 && got + w <= div && i + w <= endIndex + 1 &&
+                (i >> l) * channels + channel < levels[l].size()) break;
+            --l;
+        }
+
+        size_t index = (i >> l) * channels + channel;
+        if (index >= levels[l].size()) break;
+
+        size_t w = (size_t(1) << l);
+            
+        const Range &range = levels[l][index];
+        if (range.max() > max || got == 0) max = range.max();
+        if (range.min() < min || got == 0) min = range.min();
+        size_t covered = std::min(w, baseBlocks - i);
+        total += range.absmean() * covered;
+        weight += covered;
+            
+        i += w;
+        got += w;
+
+        if (got == div) {
+            ranges.push_back(Range(min, max, total / weight));
+            min = max = total = 0.0f;
+            got = weight = 0;
+        }
+    }
+		
+    if (got > 0) {
+        ranges.push_back(Range(min, max, total / weight));
+    }
 }
 
 AggregateWaveModel::Range
 AggregateWaveModel::getSummary(size_t channel, size_t start, size_t count) const
 {
-    //!!! complete
-    return Range();
+    Range range;
+    if (!isOK()) return range;
+
+    size_t blockSize;
+    for (blockSize = 1; blockSize <= count; blockSize *= 2);
+    if (blockSize > 1) blockSize /= 2;
+
+    bool first = true;
+
+    size_t blockStart = (start / blockSize) * blockSize;
+    size_t blockEnd = ((start + count) / blockSize) * blockSize;
+
+    if (blockStart < start) blockStart += blockSize;
+        
+    if (blockEnd > blockStart) {
+        RangeBlock ranges;
+        getSummaries(channel, blockStart, blockEnd - blockStart, ranges, blockSize);
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            if (first || ranges[i].min() < range.min()) range.setMin(ranges[i].min());
+            if (first || ranges[i].max() > range.max()) range.setMax(ranges[i].max());
+            if (first || ranges[i].absmean() < range.absmean()) range.setAbsmean(ranges[i].absmean());
+            first = false;
+        }
+    }
+
+    if (blockStart > start) {
+        Range startRange = getSummary(channel, start, blockStart - start);
+        range.setMin(std::min(range.min(), startRange.min()));
+        range.setMax(std::max(range.max(), startRange.max()));
+        range.setAbsmean(std::min(range.absmean(), startRange.absmean()));
+    }
+
+    if (blockEnd < start + count) {
+        Range endRange = getSummary(channel, blockEnd, start + count - blockEnd);
+        range.setMin(std::min(range.min(), endRange.min()));
+        range.setMax(std::max(range.max(), endRange.max()));
+        range.setAbsmean(std::min(range.absmean(), endRange.absmean()));
+    }
+
+    return range;
 }
         
 size_t
@@ -227,13 +521,78 @@ AggregateWaveModel::getComponent(size_t c) const
 void
 AggregateWaveModel::componentModelChanged()
 {
-    emit modelChanged();
+    // Components report the regions that change as they change; this
+    // signal generally follows at the end of loading.  Anything the
+    // caches don't yet cover still needs building, but there is no
+    // need to rebuild the rest.
+
+    size_t built;
+    {
+        QMutexLocker locker(&m_mutex);
+        built = m_builtExtent;
+    }
+
+    size_t frames = getFrameCount();
+    if (frames > built) invalidate(built, frames);
+    else emit modelChanged();
 }
 
 void
 AggregateWaveModel::componentModelChanged(size_t start, size_t end)
 {
-    emit modelChanged(start, end);
+    invalidate(start, end);
+}
+
+void
+AggregateWaveModel::invalidate(size_t start, size_t end)
+{
+    if (!m_fillThread) {
+        emit modelChanged(start, end);
+        return;
+    }
+
+    if (end <= start) return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (m_invalidStart < m_invalidEnd) {
+            m_invalidStart = std::min(m_invalidStart, start);
+            m_invalidEnd = std::max(m_invalidEnd, end);
+        } else {
+            m_invalidStart = start;
+            m_invalidEnd = end;
+        }
+
+        m_condition.wakeAll();
+    }
+
+    if (!m_updateTimer->isActive()) m_updateTimer->start(100);
+}
+
+void
+AggregateWaveModel::cacheUpdateTimedOut()
+{
+    size_t start = 0, end = 0;
+    bool idle = false;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        start = m_changedStart;
+        end = m_changedEnd;
+        m_changedStart = m_changedEnd = 0;
+        idle = (m_invalidStart >= m_invalidEnd &&
+                m_rebuildFrame >= m_rebuildEnd);
+    }
+
+    if (end > start) emit modelChanged(start, end);
+
+    if (idle) {
+        m_updateTimer->stop();
+        emit modelChanged();
+        emit completionChanged();
+        emit ready();
+    }
 }
 
 void
@@ -242,6 +601,235 @@ AggregateWaveModel::componentModelCompletionChanged()
     emit completionChanged();
 }
 
+void
+AggregateWaveModel::storeBaseRanges(int cacheType, size_t index,
+                                    const RangeBlock &ranges)
+{
+    RangeBlock &base = m_cache[cacheType][0];
+
+    size_t end = index * m_components.size() + ranges.size();
+    if (base.size() < end) base.resize(end);
+
+    std::copy(ranges.begin(), ranges.end(),
+              base.begin() + index * m_components.size());
+}
+
+void
+AggregateWaveModel::updateLevels(int cacheType, size_t index0, size_t index1)
+{
+    // Recalculate the blocks of every level above the base that
+    // summarise base blocks index0 to index1-1.  Unlike in
+    // WaveFileModel, where the levels are only ever appended to, any
+    // region may be rebuilt here, so each block is recalculated from
+    // whichever of its two blocks in the level below exist.
+
+    size_t channels = m_components.size();
+    if (channels == 0) return;
+
+    RangeBlockLevels &levels = m_cache[cacheType];
+    size_t baseBlocks = levels[0].size() / channels;
+
+    for (size_t level = 0; index1 > index0; ++level) {
+
+        size_t n = levels[level].size() / channels;
+        if (n <= 1) break;
+
+        if (levels.size() <= level + 1) levels.push_back(RangeBlock());
+
+        size_t p0 = index0 / 2;
+        size_t p1 = (index1 + 1) / 2;
+        size_t pn = (n + 1) / 2;
+        if (p1 > pn) p1 = pn;
+
+        const RangeBlock &from = levels[level];
+        RangeBlock &to = levels[level + 1];
+        if (to.size() < pn * channels) to.resize(pn * channels);
+
+        // The last block of a level may cover fewer base blocks than
+        // the others, so the means are weighted by coverage
+        size_t w = (size_t(1) << level);
+
+        for (size_t p = p0; p < p1; ++p) {
+            for (size_t ch = 0; ch < channels; ++ch) {
+                const Range &r0 = from[(p * 2) * channels + ch];
+                if (p * 2 + 1 < n) {
+                    const Range &r1 = from[(p * 2 + 1) * channels + ch];
+                    size_t w1 = std::min(w, baseBlocks - (p * 2 + 1) * w);
+                    to[p * channels + ch] =
+                        Range(std::min(r0.min(), r1.min()),
+                              std::max(r0.max(), r1.max()),
+                              (r0.absmean() * w + r1.absmean() * w1) /
+                              (w + w1));
+                } else {
+                    to[p * channels + ch] = r0;
+                }
+            }
+        }
+
+        index0 = p0;
+        index1 = p1;
+    }
+}
+
+void
+AggregateWaveModel::storeSamples(size_t start, size_t count,
+                                 const float *interleaved)
+{
+    if (!m_samplesCached) return;
+
+    size_t channels = m_components.size();
+
+    for (size_t c = 0; c < channels; ++c) {
+        std::vector<float> &samples = m_samples[c];
+        if (samples.size() < start + count) samples.resize(start + count);
+        float *dst = &samples[start];
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = interleaved[i * channels + c];
+        }
+    }
+}
+
+void
+AggregateWaveModel::CacheFillThread::run()
+{
+    m_model.m_mutex.lock();
+
+    while (!m_model.m_exiting) {
+
+        if (m_model.m_invalidStart >= m_model.m_invalidEnd) {
+            m_model.m_condition.wait(&m_model.m_mutex);
+            continue;
+        }
+
+        size_t start = m_model.m_invalidStart;
+        size_t end = m_model.m_invalidEnd;
+        m_model.m_invalidStart = m_model.m_invalidEnd = 0;
+
+        m_model.m_mutex.unlock();
+        rebuild(start, end);
+        m_model.m_mutex.lock();
+    }
+
+    m_model.m_mutex.unlock();
+}
+
+void
+AggregateWaveModel::CacheFillThread::rebuild(size_t start, size_t end)
+{
+    Profiler profiler("AggregateWaveModel::CacheFillThread::rebuild", true);
+
+    size_t cacheBlockSize[2];
+    for (int ct = 0; ct < 2; ++ct) {
+        cacheBlockSize[ct] = m_model.getCacheBlockSize(ct);
+    }
+
+    // Start at a frame where blocks of both cache types begin, so as
+    // to rebuild whole blocks, and finish at a similar frame or at
+    // the end of the model
+
+    size_t align = cacheBlockSize[0];
+    while (align % cacheBlockSize[1] != 0) align += cacheBlockSize[0];
+
+    size_t frames = m_model.getFrameCount();
+    start = (start / align) * align;
+    end = ((end + align - 1) / align) * align;
+    if (end > frames) end = frames;
+    if (start >= end) return;
+
+#ifdef DEBUG_AGGREGATE_WAVE_MODEL
+    std::cerr << "AggregateWaveModel::CacheFillThread::rebuild: "
+              << start << " -> " << end << std::endl;
+#endif
+
+    size_t channels = m_model.m_components.size();
+
+    size_t readBlockSize = 16384;
+    if (readBlockSize * channels < 262144) {
+        readBlockSize = 262144 / channels;
+    }
+
+    float *readbuf = new float[readBlockSize];
+    float *interleaved = new float[readBlockSize * channels];
+
+    RangeSummariser summariser(channels, cacheBlockSize);
+    RangeBlock ranges[2];
+
+    size_t index[2];
+    for (int ct = 0; ct < 2; ++ct) index[ct] = start / cacheBlockSize[ct];
+
+    {
+        QMutexLocker locker(&m_model.m_mutex);
+        m_model.m_rebuildFrame = start;
+        m_model.m_rebuildEnd = end;
+    }
+
+    size_t frame = start;
+
+    while (frame < end && !m_model.m_exiting) {
+
+        size_t count = std::min(readBlockSize, end - frame);
+
+        // Read the same block of every component before moving on,
+        // so that each is read once, sequentially, for both caches
+
+        for (size_t c = 0; c < channels; ++c) {
+            const ModelChannelSpec &spec = m_model.m_components[c];
+            size_t got = spec.model->getData(spec.channel, frame, count,
+                                             readbuf);
+            for (size_t i = got; i < count; ++i) readbuf[i] = 0.f;
+            for (size_t i = 0; i < count; ++i) {
+                interleaved[i * channels + c] = readbuf[i];
+            }
+        }
+
+        summariser.summarise(interleaved, count, ranges);
+        if (frame + count == frames) {
+            RangeBlock tail[2];
+            summariser.finish(tail);
+            for (int ct = 0; ct < 2; ++ct) {
+                ranges[ct].insert(ranges[ct].end(),
+                                  tail[ct].begin(), tail[ct].end());
+            }
+        }
+
+        QMutexLocker locker(&m_model.m_mutex);
+
+        for (int ct = 0; ct < 2; ++ct) {
+            size_t n = ranges[ct].size() / channels;
+            if (n == 0) continue;
+            m_model.storeBaseRanges(ct, index[ct], ranges[ct]);
+            m_model.updateLevels(ct, index[ct], index[ct] + n);
+            index[ct] += n;
+        }
+
+        m_model.storeSamples(frame, count, interleaved);
+
+        if (frame <= m_model.m_builtExtent &&
+            frame + count > m_model.m_builtExtent) {
+            m_model.m_builtExtent = frame + count;
+        }
+
+        if (m_model.m_changedEnd > m_model.m_changedStart) {
+            m_model.m_changedStart = std::min(m_model.m_changedStart, frame);
+            m_model.m_changedEnd = std::max(m_model.m_changedEnd, frame + count);
+        } else {
+            m_model.m_changedStart = frame;
+            m_model.m_changedEnd = frame + count;
+        }
+
+        frame += count;
+        m_model.m_rebuildFrame = frame;
+    }
+
+    {
+        QMutexLocker locker(&m_model.m_mutex);
+        m_model.m_rebuildFrame = m_model.m_rebuildEnd = 0;
+    }
+
+    delete[] interleaved;
+    delete[] readbuf;
+}
+
 void
 AggregateWaveModel::toXml(QTextStream &out,
                           QString indent,
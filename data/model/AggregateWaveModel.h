@@ -19,8 +19,29 @@
 #include "RangeSummarisableTimeValueModel.h"
 #include "PowerOfSqrtTwoZoomConstraint.h"
 
+#include "base/Thread.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
 #include <vector>
 
+class QTimer;
+
+/**
+ * A model whose channels are drawn from channels (or mixdowns) of
+ * other models.
+ *
+ * The aggregate keeps its own range summaries, in the same form as
+ * those of WaveFileModel, and, where memory allows, a copy of the
+ * samples of each of its channels, so that views and analysis of
+ * an aggregate cost no more than those of a single file instead of
+ * reading and mixing every component each time.  Both caches are
+ * built by a background thread that reads all of the components
+ * together a block at a time.  When a component reports that a
+ * region of it has changed, just that region is rebuilt.
+ */
+
 class AggregateWaveModel : public RangeSummarisableTimeValueModel
 {
     Q_OBJECT
@@ -92,10 +113,54 @@ protected slots:
     void componentModelChanged();
     void componentModelChanged(size_t, size_t);
     void componentModelCompletionChanged();
+    void cacheUpdateTimedOut();
 
 protected:
     ChannelSpecList m_components;
     static PowerOfSqrtTwoZoomConstraint m_zoomConstraint;
+
+    class CacheFillThread : public Thread
+    {
+    public:
+        CacheFillThread(AggregateWaveModel &model) : m_model(model) { }
+        virtual void run();
+
+    protected:
+        void rebuild(size_t start, size_t end);
+        AggregateWaveModel &m_model;
+    };
+
+    /// As in WaveFileModel: a pyramid of summaries for each cache type
+    typedef std::vector<RangeBlock> RangeBlockLevels;
+
+    void invalidate(size_t start, size_t end);
+    size_t getCacheBlockSize(int cacheType) const;
+    bool readFromCache(int channel, size_t start, size_t count,
+                       float *buffer) const;
+
+    // These must be called with m_mutex held
+    void storeBaseRanges(int cacheType, size_t index,
+                         const RangeBlock &ranges);
+    void updateLevels(int cacheType, size_t index0, size_t index1);
+    void storeSamples(size_t start, size_t count, const float *interleaved);
+
+    RangeBlockLevels m_cache[2];
+    std::vector<std::vector<float> > m_samples; // per channel, if cached
+    bool m_samplesCached;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    CacheFillThread *m_fillThread;
+    QTimer *m_updateTimer;
+
+    size_t m_invalidStart;   // region awaiting rebuild, empty if start == end
+    size_t m_invalidEnd;
+    size_t m_rebuildFrame;   // region being rebuilt but not yet read
+    size_t m_rebuildEnd;
+    size_t m_builtExtent;    // frames from zero that have been built
+    size_t m_changedStart;   // region rebuilt since we last said so
+    size_t m_changedEnd;
+    bool m_exiting;
 };
 
 #endif
@@ -78,6 +78,7 @@ void
 Dense3DModelPeakCache::sourceModelChanged()
 {
     if (!m_source) return;
+    QWriteLocker locker(&m_coverageLock);
     if (m_coverage.size() > 0) {
         // The last peak may have come from an incomplete read, which
         // may since have been filled, so reset it
@@ -95,6 +96,7 @@ Dense3DModelPeakCache::sourceModelAboutToBeDeleted()
 bool
 Dense3DModelPeakCache::haveColumn(size_t column) const
 {
+    QReadLocker locker(&m_coverageLock);
     return column < m_coverage.size() && m_coverage.get(column);
 }
 
@@ -103,12 +105,6 @@ Dense3DModelPeakCache::fillColumn(size_t column) const
 {
     Profiler profiler("Dense3DModelPeakCache::fillColumn");
 
-    if (column >= m_coverage.size()) {
-        // see note in sourceModelChanged
-        if (m_coverage.size() > 0) m_coverage.reset(m_coverage.size()-1);
-        m_coverage.resize(column + 1);
-    }
-
     Column peak;
     for (int i = 0; i < m_resolution; ++i) {
         Column here = m_source->getColumn(column * m_resolution + i);
@@ -122,6 +118,16 @@ Dense3DModelPeakCache::fillColumn(size_t column) const
     }
 
     m_cache->setColumn(column, peak);
+
+    // Two threads may occasionally fill the same column; that is
+    // wasteful but harmless, as they will calculate the same peak
+
+    QWriteLocker locker(&m_coverageLock);
+    if (column >= m_coverage.size()) {
+        // see note in sourceModelChanged
+        if (m_coverage.size() > 0) m_coverage.reset(m_coverage.size()-1);
+        m_coverage.resize(column + 1);
+    }
     m_coverage.set(column);
 }
 
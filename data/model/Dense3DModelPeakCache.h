@@ -20,6 +20,8 @@
 #include "EditableDenseThreeDimensionalModel.h"
 #include "base/ResizeableBitset.h"
 
+#include <QReadWriteLock>
+
 class Dense3DModelPeakCache : public DenseThreeDimensionalModel
 {
     Q_OBJECT
@@ -97,6 +99,7 @@ private:
     DenseThreeDimensionalModel *m_source;
     mutable EditableDenseThreeDimensionalModel *m_cache;
     mutable ResizeableBitset m_coverage;
+    mutable QReadWriteLock m_coverageLock; // columns may be filled from several threads
     size_t m_resolution;
 
     bool haveColumn(size_t column) const;
@@ -336,6 +336,39 @@ EditableDenseThreeDimensionalModel::setColumn(size_t index,
         m_trunc.push_back(0);
     }
 
+    bool allChange = storeColumn(index, values);
+
+    notifyColumnsChanged(index, index, allChange);
+}
+
+void
+EditableDenseThreeDimensionalModel::setColumns(size_t index,
+                                               const std::vector<Column> &columns)
+{
+    if (columns.empty()) return;
+
+    QWriteLocker locker(&m_lock);
+
+    size_t end = index + columns.size();
+
+    if (end > m_data.size()) {
+        m_data.resize(end);
+        m_trunc.resize(end, 0);
+    }
+
+    bool allChange = false;
+
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (storeColumn(index + i, columns[i])) allChange = true;
+    }
+
+    notifyColumnsChanged(index, end - 1, allChange);
+}
+
+bool
+EditableDenseThreeDimensionalModel::storeColumn(size_t index,
+                                                const Column &values)
+{
     bool allChange = false;
 
 //    if (values.size() > m_yBinCount) m_yBinCount = values.size();
@@ -360,14 +393,25 @@ EditableDenseThreeDimensionalModel::setColumn(size_t index,
 
 //    assert(values == expandAndRetrieve(index));
 
-    long windowStart = index;
+    return allChange;
+}
+
+void
+EditableDenseThreeDimensionalModel::notifyColumnsChanged(size_t first,
+                                                         size_t last,
+                                                         bool allChange)
+{
+    long windowStart = first;
     windowStart *= m_resolution;
 
+    long windowEnd = last;
+    windowEnd *= m_resolution;
+
     if (m_notifyOnAdd) {
 	if (allChange) {
 	    emit modelChanged();
 	} else {
-	    emit modelChanged(windowStart, windowStart + m_resolution);
+	    emit modelChanged(windowStart, windowEnd + m_resolution);
 	}
     } else {
 	if (allChange) {
@@ -380,8 +424,8 @@ EditableDenseThreeDimensionalModel::setColumn(size_t index,
 		m_sinceLastNotifyMin = windowStart;
 	    }
 	    if (m_sinceLastNotifyMax == -1 ||
-		windowStart > m_sinceLastNotifyMax) {
-		m_sinceLastNotifyMax = windowStart;
+		windowEnd > m_sinceLastNotifyMax) {
+		m_sinceLastNotifyMax = windowEnd;
 	    }
 	}
     }
@@ -127,6 +127,14 @@ public:
      */
     virtual void setColumn(size_t x, const Column &values);
 
+    /**
+     * Set the bin values of a run of consecutive columns starting at
+     * x, taking the lock and notifying of the change only once for
+     * the whole run.  This is much quicker than setting the columns
+     * individually when there are many of them.
+     */
+    virtual void setColumns(size_t x, const std::vector<Column> &columns);
+
     virtual QString getBinName(size_t n) const;
     virtual void setBinName(size_t n, QString);
     virtual void setBinNames(std::vector<QString> names);
@@ -158,6 +166,8 @@ protected:
     // stored.
     std::vector<signed char> m_trunc;
     void truncateAndStore(size_t index, const Column & values);
+    bool storeColumn(size_t index, const Column &values); // true if extents changed
+    void notifyColumnsChanged(size_t first, size_t last, bool allChange);
     Column expandAndRetrieve(size_t index) const;
 
     std::vector<QString> m_binNames;
@@ -85,7 +85,10 @@ FFTModel::FFTModel(const DenseTimeValueModel *model,
 
 FFTModel::~FFTModel()
 {
-    if (m_server) FFTDataServer::releaseInstance(m_server);
+    if (m_server) {
+        m_server->clearVisibleColumns(this);
+        FFTDataServer::releaseInstance(m_server);
+    }
 }
 
 void
@@ -94,6 +97,7 @@ FFTModel::sourceModelAboutToBeDeleted()
     if (m_sourceModel) {
         std::cerr << "FFTModel[" << this << "]::sourceModelAboutToBeDeleted(" << m_sourceModel << ")" << std::endl;
         if (m_server) {
+            m_server->clearVisibleColumns(this);
             FFTDataServer::releaseInstance(m_server);
             m_server = 0;
         }
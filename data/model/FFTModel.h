@@ -100,6 +100,19 @@ public:
 
     inline size_t getFillExtent() const { return m_server->getFillExtent(); }
 
+    /**
+     * Tell the FFT data server that columns x0 to x1-1 of this model
+     * are currently visible, so that they should be calculated before
+     * any others.  Each FFTModel has its own visible range, which
+     * replaces any previously set for it and is cleared when the
+     * model is destroyed.
+     */
+    inline void setVisibleColumns(size_t x0, size_t x1) {
+        if (m_server) {
+            m_server->setVisibleColumns(this, x0 << m_xshift, x1 << m_xshift);
+        }
+    }
+
     // DenseThreeDimensionalModel and Model methods:
     //
     inline virtual size_t getWidth() const {
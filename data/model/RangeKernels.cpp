@@ -0,0 +1,192 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RangeKernels.h"
+
+#include "system/System.h"
+#include "system/SIMD.h"
+
+#include <cmath>
+#include <iostream>
+
+//#define DEBUG_RANGE_KERNELS 1
+
+
+// Plain implementation
+
+static void
+getRangePlain(const float *src, size_t n,
+              float &min, float &max, float &absSum)
+{
+    min = max = absSum = 0.f;
+    if (n == 0) return;
+    min = max = src[0];
+    for (size_t i = 0; i < n; ++i) {
+        float sample = src[i];
+        if (sample > max) max = sample;
+        if (sample < min) min = sample;
+        absSum += fabsf(sample);
+    }
+}
+
+// Combine the results for a vector part with those for its tail
+
+static inline void
+mergeTail(const float *src, size_t n,
+          float &min, float &max, float &absSum)
+{
+    if (n == 0) return;
+    float tmin, tmax, tsum;
+    getRangePlain(src, n, tmin, tmax, tsum);
+    if (tmin < min) min = tmin;
+    if (tmax > max) max = tmax;
+    absSum += tsum;
+}
+
+
+#ifdef SV_SSE2
+
+static void
+getRangeSSE2(const float *src, size_t n,
+             float &min, float &max, float &absSum)
+{
+    if (n < 4) {
+        getRangePlain(src, n, min, max, absSum);
+        return;
+    }
+
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+    __m128 vmin = _mm_loadu_ps(src);
+    __m128 vmax = vmin;
+    __m128 vsum = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        vmin = _mm_min_ps(vmin, v);
+        vmax = _mm_max_ps(vmax, v);
+        vsum = _mm_add_ps(vsum, _mm_andnot_ps(signMask, v));
+    }
+
+    float fmin[4], fmax[4], fsum[4];
+    _mm_storeu_ps(fmin, vmin);
+    _mm_storeu_ps(fmax, vmax);
+    _mm_storeu_ps(fsum, vsum);
+
+    min = fmin[0];
+    max = fmax[0];
+    absSum = fsum[0];
+    for (int j = 1; j < 4; ++j) {
+        if (fmin[j] < min) min = fmin[j];
+        if (fmax[j] > max) max = fmax[j];
+        absSum += fsum[j];
+    }
+
+    mergeTail(src + i, n - i, min, max, absSum);
+}
+
+#endif // SV_SSE2
+
+
+#ifdef SV_AVX2
+
+static AVX2_FUNCTION void
+getRangeAVX2(const float *src, size_t n,
+             float &min, float &max, float &absSum)
+{
+    if (n < 8) {
+        getRangePlain(src, n, min, max, absSum);
+        return;
+    }
+
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+
+    __m256 vmin = _mm256_loadu_ps(src);
+    __m256 vmax = vmin;
+    __m256 vsum = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        vmin = _mm256_min_ps(vmin, v);
+        vmax = _mm256_max_ps(vmax, v);
+        vsum = _mm256_add_ps(vsum, _mm256_andnot_ps(signMask, v));
+    }
+
+    float fmin[8], fmax[8], fsum[8];
+    _mm256_storeu_ps(fmin, vmin);
+    _mm256_storeu_ps(fmax, vmax);
+    _mm256_storeu_ps(fsum, vsum);
+
+    min = fmin[0];
+    max = fmax[0];
+    absSum = fsum[0];
+    for (int j = 1; j < 8; ++j) {
+        if (fmin[j] < min) min = fmin[j];
+        if (fmax[j] > max) max = fmax[j];
+        absSum += fsum[j];
+    }
+
+    mergeTail(src + i, n - i, min, max, absSum);
+}
+
+#endif // SV_AVX2
+
+
+typedef void (*GetRangeFunction)(const float *, size_t,
+                                 float &, float &, float &);
+
+static GetRangeFunction
+chooseGetRange()
+{
+    GetRangeFunction f = getRangePlain;
+
+#ifdef SV_SSE2
+    if (ProcessorHasSSE2()) f = getRangeSSE2;
+#endif
+
+#ifdef SV_AVX2
+    if (ProcessorHasAVX2()) f = getRangeAVX2;
+#endif
+
+#ifdef DEBUG_RANGE_KERNELS
+    std::cerr << "RangeKernels: using "
+              << (f == getRangePlain ? "plain" : "vector")
+              << " implementation" << std::endl;
+#endif
+
+    return f;
+}
+
+static const GetRangeFunction getRangeFunction = chooseGetRange();
+
+void
+RangeKernels::getRange(const float *src, size_t n,
+                       float &min, float &max, float &absSum)
+{
+    getRangeFunction(src, n, min, max, absSum);
+}
+
+void
+RangeKernels::deinterleave(const float *src, size_t channels,
+                           size_t channel, float *dst, size_t n)
+{
+    src += channel;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = *src;
+        src += channels;
+    }
+}
@@ -0,0 +1,47 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _RANGE_KERNELS_H_
+#define _RANGE_KERNELS_H_
+
+#include <stddef.h>
+
+/**
+ * Functions used when summarising audio into min/max/mean ranges
+ * for waveform display.  The vector implementations give the same
+ * minima and maxima as the plain one; sums may differ in rounding,
+ * as they add in a different order.
+ */
+
+class RangeKernels
+{
+public:
+    /**
+     * Find the minimum and maximum of the n samples in src, and the
+     * sum of their absolute values.  If n is zero, all three are
+     * returned as zero.
+     */
+    static void getRange(const float *src, size_t n,
+                         float &min, float &max, float &absSum);
+
+    /**
+     * Copy n samples of the given channel from interleaved data with
+     * the given number of channels into a contiguous buffer.
+     */
+    static void deinterleave(const float *src, size_t channels,
+                             size_t channel, float *dst, size_t n);
+};
+
+#endif
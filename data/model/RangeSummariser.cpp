@@ -0,0 +1,226 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RangeSummariser.h"
+#include "RangeKernels.h"
+
+#include "base/Profiler.h"
+
+#include <algorithm>
+
+#ifndef __GNUC__
+#include <alloca.h>
+#endif
+
+RangeSummariser::RangeSummariser(size_t channels,
+                                 const size_t *cacheBlockSize) :
+    m_channels(channels),
+    m_min(channels * 2, 0.f),
+    m_max(channels * 2, 0.f),
+    m_sum(channels * 2, 0.f),
+    m_data(0),
+    m_out(0),
+    m_pool(ThreadPool::getInstance())
+{
+    for (int ct = 0; ct < 2; ++ct) {
+        m_blockSize[ct] = cacheBlockSize[ct];
+        m_count[ct] = 0;
+    }
+}
+
+RangeSummariser::~RangeSummariser()
+{
+}
+
+void
+RangeSummariser::summarise(const float *data, size_t frames, RangeBlock *out)
+{
+    Profiler profiler("RangeSummariser::summarise");
+
+    m_data = data;
+    m_out = out;
+    m_tasks.clear();
+
+    bool parallel = (m_pool->getThreadCount() > 1 &&
+                     frames * m_channels >= ParallelThreshold);
+
+    size_t tailOffset[2], tail[2];
+
+    for (int ct = 0; ct < 2; ++ct) {
+
+        size_t bs = m_blockSize[ct];
+
+        // Frames needed to complete the block left part-filled by
+        // the previous call
+        size_t head = 0;
+        if (m_count[ct] > 0) {
+            head = std::min(bs - m_count[ct], frames);
+        }
+        bool headCompletes = (head > 0 && m_count[ct] + head == bs);
+
+        size_t whole = (frames - head) / bs;
+        size_t outIndex = (headCompletes ? 1 : 0);
+
+        out[ct].clear();
+        out[ct].resize((outIndex + whole) * m_channels);
+
+        if (head > 0) {
+            accumulate(ct, data, head);
+            if (headCompletes) complete(ct, out[ct], 0);
+        }
+
+        size_t segments = 1;
+        if (parallel) segments = m_pool->getThreadCount() * 2;
+        if (segments > whole) segments = whole;
+
+        for (size_t s = 0; s < segments; ++s) {
+            size_t b0 = (whole * s) / segments;
+            size_t b1 = (whole * (s + 1)) / segments;
+            Task task;
+            task.cacheType = ct;
+            task.offset = head + b0 * bs;
+            task.blocks = b1 - b0;
+            task.outIndex = outIndex + b0;
+            m_tasks.push_back(task);
+        }
+
+        tailOffset[ct] = head + whole * bs;
+        tail[ct] = frames - tailOffset[ct];
+    }
+
+    runTasks(parallel);
+
+    for (int ct = 0; ct < 2; ++ct) {
+        if (tail[ct] > 0) {
+            accumulate(ct, data + tailOffset[ct] * m_channels, tail[ct]);
+        }
+    }
+}
+
+void
+RangeSummariser::finish(RangeBlock *out)
+{
+    for (int ct = 0; ct < 2; ++ct) {
+        out[ct].clear();
+        if (m_count[ct] > 0) {
+            out[ct].resize(m_channels);
+            complete(ct, out[ct], 0);
+        }
+    }
+}
+
+void
+RangeSummariser::reset()
+{
+    for (int ct = 0; ct < 2; ++ct) {
+        m_count[ct] = 0;
+    }
+}
+
+void
+RangeSummariser::accumulate(int ct, const float *data, size_t frames)
+{
+    // frames is always less than a cache block
+#ifdef __GNUC__
+    float buffer[frames];
+#else
+    float *buffer = (float *)alloca(frames * sizeof(float));
+#endif
+
+    for (size_t ch = 0; ch < m_channels; ++ch) {
+
+        const float *src = data;
+        if (m_channels > 1) {
+            RangeKernels::deinterleave(data, m_channels, ch, buffer, frames);
+            src = buffer;
+        }
+
+        float min, max, sum;
+        RangeKernels::getRange(src, frames, min, max, sum);
+
+        size_t index = ch * 2 + ct;
+        if (m_count[ct] == 0 || min < m_min[index]) m_min[index] = min;
+        if (m_count[ct] == 0 || max > m_max[index]) m_max[index] = max;
+        if (m_count[ct] == 0) m_sum[index] = 0.f;
+        m_sum[index] += sum;
+    }
+
+    m_count[ct] += frames;
+}
+
+void
+RangeSummariser::complete(int ct, RangeBlock &out, size_t outIndex)
+{
+    for (size_t ch = 0; ch < m_channels; ++ch) {
+        size_t index = ch * 2 + ct;
+        out[outIndex * m_channels + ch] =
+            Range(m_min[index], m_max[index], m_sum[index] / m_count[ct]);
+    }
+    m_count[ct] = 0;
+}
+
+void
+RangeSummariser::runTasks(bool parallel)
+{
+    if (!parallel) {
+        for (size_t i = 0; i < m_tasks.size(); ++i) {
+            performTask(m_tasks[i]);
+        }
+        return;
+    }
+
+    m_pool->run(this, int(m_tasks.size()));
+}
+
+void
+RangeSummariser::perform(int n)
+{
+    performTask(m_tasks[n]);
+}
+
+void
+RangeSummariser::performTask(const Task &task)
+{
+    size_t bs = m_blockSize[task.cacheType];
+    RangeBlock &out = m_out[task.cacheType];
+
+    // One cache block of all channels is small enough to stay in
+    // cache while we pick the channels out of it one at a time
+
+#ifdef __GNUC__
+    float buffer[bs];
+#else
+    float *buffer = (float *)alloca(bs * sizeof(float));
+#endif
+
+    for (size_t b = 0; b < task.blocks; ++b) {
+
+        const float *data = m_data + (task.offset + b * bs) * m_channels;
+        size_t outBase = (task.outIndex + b) * m_channels;
+
+        for (size_t ch = 0; ch < m_channels; ++ch) {
+
+            const float *src = data;
+            if (m_channels > 1) {
+                RangeKernels::deinterleave(data, m_channels, ch, buffer, bs);
+                src = buffer;
+            }
+
+            float min, max, sum;
+            RangeKernels::getRange(src, bs, min, max, sum);
+            out[outBase + ch] = Range(min, max, sum / bs);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _RANGE_SUMMARISER_H_
+#define _RANGE_SUMMARISER_H_
+
+#include "RangeSummarisableTimeValueModel.h"
+
+#include "base/ThreadPool.h"
+
+#include <vector>
+
+/**
+ * Calculates the base-level ranges for both range caches of a
+ * WaveFileModel or AggregateWaveModel from the blocks of interleaved
+ * audio read by its cache fill thread.  The whole cache blocks within
+ * each read block are divided into segments that are summarised in
+ * parallel, for all channels at once, by the shared thread pool
+ * together with the calling thread.  The partial cache blocks at
+ * either end of each read block are merged with those of its
+ * neighbours by the calling thread.
+ */
+class RangeSummariser : public ThreadPool::Job
+{
+public:
+    typedef RangeSummarisableTimeValueModel::Range Range;
+    typedef RangeSummarisableTimeValueModel::RangeBlock RangeBlock;
+
+    RangeSummariser(size_t channels, const size_t *cacheBlockSize);
+    ~RangeSummariser();
+
+    /**
+     * Summarise the given number of frames of interleaved audio,
+     * which follow on from those passed to the previous call.  The
+     * ranges of the cache blocks completed are returned in out[0]
+     * and out[1] for the two cache types, interleaved by channel.
+     */
+    void summarise(const float *data, size_t frames, RangeBlock *out);
+
+    /**
+     * Return in out the ranges of any partial cache blocks left at
+     * the end of the audio.
+     */
+    void finish(RangeBlock *out);
+
+    /**
+     * Discard any partial cache blocks, so that the next call to
+     * summarise() starts at the beginning of a block.
+     */
+    void reset();
+
+private:
+    struct Task {
+        int cacheType;
+        size_t offset;   // frame offset of the first block within the data
+        size_t blocks;
+        size_t outIndex; // index of the first block within the output
+    };
+
+    void accumulate(int cacheType, const float *data, size_t frames);
+    void complete(int cacheType, RangeBlock &out, size_t outIndex);
+    void runTasks(bool parallel);
+    void performTask(const Task &task);
+
+    virtual void perform(int n); // ThreadPool::Job
+
+    size_t m_channels;
+    size_t m_blockSize[2];
+
+    // The part-filled block for each channel and cache type, indexed
+    // by channel * 2 + cache type
+    std::vector<float> m_min;
+    std::vector<float> m_max;
+    std::vector<float> m_sum;
+    size_t m_count[2];
+
+    const float *m_data;
+    RangeBlock *m_out;
+    std::vector<Task> m_tasks;
+
+    ThreadPool *m_pool;
+
+    // Below this many samples in a read block it is quicker to
+    // summarise in the calling thread alone
+    static const size_t ParallelThreshold = 65536;
+};
+
+#endif
@@ -208,6 +208,17 @@ public:
         if (point.value != 0.f) m_haveDistinctValues = true;
         IntervalModel<RegionRec>::addPoint(point);
     }
+
+    virtual void addPoints(const std::vector<Point> &points)
+    {
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (points[i].value != 0.f) {
+                m_haveDistinctValues = true;
+                break;
+            }
+        }
+        IntervalModel<RegionRec>::addPoints(points);
+    }
     
 protected:
     float m_valueQuantization;
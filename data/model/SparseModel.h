@@ -121,6 +121,15 @@ public:
      */
     virtual void addPoint(const PointType &point);
 
+    /**
+     * Add a batch of points at once, taking the lock and notifying of
+     * the change only once for the whole batch.  This is much quicker
+     * than adding the points individually when there are many of
+     * them.  The points should be sorted by frame, and are quickest
+     * to add if they also follow any points already in the model.
+     */
+    virtual void addPoints(const std::vector<PointType> &points);
+
     /** 
      * Remove a point.  Points are not necessarily unique, so this
      * function will remove the first point that compares equal to the
@@ -708,6 +717,48 @@ SparseModel<PointType>::addPoint(const PointType &point)
     }
 }
 
+template <typename PointType>
+void
+SparseModel<PointType>::addPoints(const std::vector<PointType> &points)
+{
+    if (points.empty()) return;
+
+    long minFrame = points[0].frame, maxFrame = points[0].frame;
+
+    {
+	QMutexLocker locker(&m_mutex);
+
+        // With sorted input, each point belongs just before the one
+        // following its predecessor, so that is the hint we give
+        PointListIterator hint = m_points.upper_bound(points[0]);
+
+        for (size_t i = 0; i < points.size(); ++i) {
+            const PointType &point = points[i];
+            hint = m_points.insert(hint, point);
+            ++hint;
+            if (point.frame < minFrame) minFrame = point.frame;
+            if (point.frame > maxFrame) maxFrame = point.frame;
+            if (point.getLabel() != "") m_hasTextLabels = true;
+        }
+
+        m_pointCount += points.size();
+    }
+
+    if (m_notifyOnAdd) {
+        m_rows.clear(); //!!! inefficient
+	emit modelChanged(minFrame, maxFrame + m_resolution);
+    } else {
+	if (m_sinceLastNotifyMin == -1 ||
+	    minFrame < m_sinceLastNotifyMin) {
+	    m_sinceLastNotifyMin = minFrame;
+	}
+	if (m_sinceLastNotifyMax == -1 ||
+	    maxFrame > m_sinceLastNotifyMax) {
+	    m_sinceLastNotifyMax = maxFrame;
+	}
+    }
+}
+
 template <typename PointType>
 void
 SparseModel<PointType>::deletePoint(const PointType &point)
@@ -84,6 +84,26 @@ public:
 	if (allChange) emit modelChanged();
     }
 
+    virtual void addPoints(const std::vector<PointType> &points)
+    {
+	bool allChange = false;
+
+        for (size_t i = 0; i < points.size(); ++i) {
+            float value = points[i].value;
+            if (ISNAN(value) || ISINF(value)) continue;
+            if (!m_haveExtents || value < m_valueMinimum) {
+                m_valueMinimum = value; allChange = true;
+            }
+            if (!m_haveExtents || value > m_valueMaximum) {
+                m_valueMaximum = value; allChange = true;
+            }
+            m_haveExtents = true;
+        }
+
+	SparseModel<PointType>::addPoints(points);
+	if (allChange) emit modelChanged();
+    }
+
     virtual void deletePoint(const PointType &point)
     {
 	SparseModel<PointType>::deletePoint(point);
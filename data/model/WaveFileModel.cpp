@@ -14,12 +14,15 @@
 */
 
 #include "WaveFileModel.h"
+#include "RangeSummariser.h"
 
 #include "fileio/AudioFileReader.h"
 #include "fileio/AudioFileReaderFactory.h"
 
 #include "system/System.h"
 
+#include "base/Profiler.h"
+
 #include <QFileInfo>
 #include <QTextStream>
 
@@ -29,6 +32,7 @@
 #include <sndfile.h>
 
 #include <cassert>
+#include <algorithm>
 
 //#define DEBUG_WAVE_FILE_MODEL 1
 
@@ -491,52 +495,82 @@ WaveFileModel::getSummaries(size_t channel, size_t start, size_t count,
 
 	QMutexLocker locker(&m_mutex);
     
-	const RangeBlock &cache = m_cache[cacheType];
+	const RangeBlockLevels &levels = m_cache[cacheType];
+        if (levels.empty()) return;
 
         blockSize = roundedBlockSize;
 
-	size_t cacheBlock, div;
+	size_t cacheBlock;
         
 	if (cacheType == 0) {
 	    cacheBlock = (1 << m_zoomConstraint.getMinCachePower());
-            div = (1 << power) / cacheBlock;
 	} else {
 	    cacheBlock = ((unsigned int)((1 << m_zoomConstraint.getMinCachePower()) * sqrt(2.) + 0.01));
-            div = ((unsigned int)((1 << power) * sqrt(2.) + 0.01)) / cacheBlock;
 	}
 
+        // The level whose blocks are the size requested, and the
+        // number of base-level blocks in each of them
+
+        size_t level = power - m_zoomConstraint.getMinCachePower();
+	size_t div = (size_t(1) << level);
+        if (level >= levels.size()) level = levels.size() - 1;
+
 	size_t startIndex = start / cacheBlock;
 	size_t endIndex = (start + count) / cacheBlock;
 
+        // The last range of a level may cover fewer than its full
+        // number of base-level blocks, so the means are weighted by
+        // the base blocks each range actually covers
+        size_t baseBlocks = levels[0].size() / channels;
+
 	float max = 0.0, min = 0.0, total = 0.0;
-	size_t i = 0, got = 0;
+	size_t i = startIndex, got = 0, weight = 0;
 
 #ifdef DEBUG_WAVE_FILE_MODEL
-	cerr << "blockSize is " << blockSize << ", cacheBlock " << cacheBlock << ", start " << start << ", count " << count << " (frame count " << getFrameCount() << "), power is " << power << ", div is " << div << ", startIndex " << startIndex << ", endIndex " << endIndex << endl;
+	cerr << "blockSize is " << blockSize << ", cacheBlock " << cacheBlock << ", start " << start << ", count " << count << " (frame count " << getFrameCount() << "), power is " << power << ", div is " << div << ", level " << level << " of " << levels.size() << ", startIndex " << startIndex << ", endIndex " << endIndex << endl;
 #endif
 
-	for (i = 0; i <= endIndex - startIndex; ) {
-        
-	    size_t index = (i + startIndex) * channels + channel;
-	    if (index >= cache.size()) break;
+        // Normally start is aligned to the requested block size and
+        // every range comes straight from the matching level.  If it
+        // isn't, or if that level has not been filled as far as the
+        // base level yet, we use the coarsest level whose ranges
+        // fit within the range we are building and the request.
+
+	while (i <= endIndex) {
+
+            size_t l = level;
+            while (l > 0) {
+                size_t w = (size_t(1) << l);
+                if (i % w == 0 && got + w <= div && i + w <= endIndex + 1 &&
+                    (i >> l) * channels + channel < levels[l].size()) break;
+                --l;
+            }
+
+	    size_t index = (i >> l) * channels + channel;
+	    if (index >= levels[l].size()) break;
+
+            size_t w = (size_t(1) << l);
+            size_t covered = std::min(w, baseBlocks - i);
             
-            const Range &range = cache[index];
+            const Range &range = levels[l][index];
             if (range.max() > max || got == 0) max = range.max();
             if (range.min() < min || got == 0) min = range.min();
-            total += range.absmean();
+            total += range.absmean() * covered;
             
-	    ++i;
-            ++got;
+	    i += w;
+            got += w;
+            weight += covered;
             
 	    if (got == div) {
-		ranges.push_back(Range(min, max, total / got));
+		ranges.push_back(Range(min, max, total / weight));
                 min = max = total = 0.0f;
                 got = 0;
+                weight = 0;
 	    }
 	}
 		
 	if (got > 0) {
-            ranges.push_back(Range(min, max, total / got));
+            ranges.push_back(Range(min, max, total / weight));
 	}
     }
 
@@ -603,6 +637,11 @@ WaveFileModel::fillCache()
 {
     m_mutex.lock();
 
+    for (int ct = 0; ct < 2; ++ct) {
+        m_cache[ct].clear();
+        m_cache[ct].push_back(RangeBlock());
+    }
+
     m_updateTimer = new QTimer(this);
     connect(m_updateTimer, SIGNAL(timeout()), this, SLOT(fillTimerTimedOut()));
     m_updateTimer->start(100);
@@ -666,7 +705,6 @@ WaveFileModel::RangeCacheFillThread::run()
                                         sqrt(2.) + 0.01));
     
     size_t frame = 0;
-    int readBlockSize = 16384;
     SampleBlock block;
 
     if (!m_model.isOK()) return;
@@ -682,14 +720,18 @@ WaveFileModel::RangeCacheFillThread::run()
         }
     }
 
-    Range *range = new Range[2 * channels];
-    float *means = new float[2 * channels];
-    size_t count[2];
-    count[0] = count[1] = 0;
-    for (int i = 0; i < 2 * channels; ++i) {
-        means[i] = 0.f;
+    if (channels == 0) return;
+
+    // Read enough frames at a time to give the summariser's threads
+    // a worthwhile amount of work, however few channels there are
+    size_t readBlockSize = 16384;
+    if (readBlockSize * channels < 262144) {
+        readBlockSize = 262144 / channels;
     }
 
+    RangeSummariser summariser(channels, cacheBlockSize);
+    RangeBlock ranges[2];
+
     bool first = true;
 
     while (first || updating) {
@@ -697,63 +739,39 @@ WaveFileModel::RangeCacheFillThread::run()
         updating = m_model.m_reader->isUpdating();
         m_frameCount = m_model.getFrameCount();
 
+        // Keep within what has been decoded, rather than having
+        // the reader decode regions on demand for us
+        size_t available = m_frameCount;
+        if (updating) {
+            available = m_model.m_reader->getDecodedFrameCount();
+        }
+
 //        std::cerr << "WaveFileModel::fill: frame = " << frame << ", count = " << m_frameCount << std::endl;
 
         while (frame < m_frameCount) {
 
 //            std::cerr << "WaveFileModel::fill inner loop: frame = " << frame << ", count = " << m_frameCount << ", blocksize " << readBlockSize << std::endl;
 
-            if (updating && (frame + readBlockSize > m_frameCount)) break;
+            if (updating && (frame + readBlockSize > available)) break;
 
             m_model.m_reader->getInterleavedFrames(frame, readBlockSize, block);
 
 //            std::cerr << "block is " << block.size() << std::endl;
 
-            for (int i = 0; i < readBlockSize; ++i) {
-		
-                if (channels * i + channels > block.size()) break;
-
-                for (int ch = 0; ch < channels; ++ch) {
-
-                    int index = channels * i + ch;
-                    float sample = block[index];
-                    
-                    for (int ct = 0; ct < 2; ++ct) { // cache type
-                        
-                        int rangeIndex = ch * 2 + ct;
-                        
-                        if (sample > range[rangeIndex].max() || count[ct] == 0) {
-                            range[rangeIndex].setMax(sample);
-                        }
-                        if (sample < range[rangeIndex].min() || count[ct] == 0) {
-                            range[rangeIndex].setMin(sample);
-                        }
-
-                        means[rangeIndex] += fabsf(sample);
-                    }
-                }
-                
-                QMutexLocker locker(&m_model.m_mutex);
+            size_t got = block.size() / channels;
+            if (got > readBlockSize) got = readBlockSize;
+            if (got == 0) break;
 
-                for (size_t ct = 0; ct < 2; ++ct) {
-
-                    if (++count[ct] == cacheBlockSize[ct]) {
-                        
-                        for (size_t ch = 0; ch < size_t(channels); ++ch) {
-                            size_t rangeIndex = ch * 2 + ct;
-                            means[rangeIndex] /= count[ct];
-                            range[rangeIndex].setAbsmean(means[rangeIndex]);
-                            m_model.m_cache[ct].push_back(range[rangeIndex]);
-                            range[rangeIndex] = Range();
-                            means[rangeIndex] = 0.f;
-                        }
-
-                        count[ct] = 0;
-                    }
+            summariser.summarise(&block[0], got, ranges);
+
+            {
+                QMutexLocker locker(&m_model.m_mutex);
+                for (int ct = 0; ct < 2; ++ct) {
+                    m_model.addBaseRanges(ct, ranges[ct], channels);
                 }
-                
-                ++frame;
             }
+
+            frame += got;
             
             if (m_model.m_exiting) break;
             
@@ -772,41 +790,115 @@ WaveFileModel::RangeCacheFillThread::run()
 
     if (!m_model.m_exiting) {
 
-        QMutexLocker locker(&m_model.m_mutex);
+        summariser.finish(ranges);
 
-        for (size_t ct = 0; ct < 2; ++ct) {
+        QMutexLocker locker(&m_model.m_mutex);
 
-            if (count[ct] > 0) {
+        for (int ct = 0; ct < 2; ++ct) {
 
-                for (size_t ch = 0; ch < size_t(channels); ++ch) {
-                    size_t rangeIndex = ch * 2 + ct;
-                    means[rangeIndex] /= count[ct];
-                    range[rangeIndex].setAbsmean(means[rangeIndex]);
-                    m_model.m_cache[ct].push_back(range[rangeIndex]);
-                    range[rangeIndex] = Range();
-                    means[rangeIndex] = 0.f;
-                }
+            m_model.addBaseRanges(ct, ranges[ct], channels);
+            m_model.finishLevels(ct, channels);
 
-                count[ct] = 0;
+            for (size_t level = 0; level < m_model.m_cache[ct].size(); ++level) {
+                const RangeBlock &rb = m_model.m_cache[ct][level];
+                if (rb.empty()) continue;
+                MUNLOCK(&rb[0], rb.capacity() * sizeof(Range));
             }
-            
-            const Range &rr = *m_model.m_cache[ct].begin();
-            MUNLOCK(&rr, m_model.m_cache[ct].capacity() * sizeof(Range));
         }
     }
-    
-    delete[] means;
-    delete[] range;
 
     m_fillExtent = m_frameCount;
 
 #ifdef DEBUG_WAVE_FILE_MODEL        
     for (size_t ct = 0; ct < 2; ++ct) {
-        cerr << "Cache type " << ct << " now contains " << m_model.m_cache[ct].size() << " ranges" << endl;
+        cerr << "Cache type " << ct << " now contains " << m_model.m_cache[ct].size() << " levels, with " << m_model.m_cache[ct][0].size() << " ranges at base level" << endl;
     }
 #endif
 }
 
+void
+WaveFileModel::addBaseRanges(int cacheType, const RangeBlock &ranges,
+                             size_t channels)
+{
+    RangeBlock &base = m_cache[cacheType][0];
+
+    for (size_t i = 0; i + channels <= ranges.size(); i += channels) {
+        base.insert(base.end(), ranges.begin() + i,
+                    ranges.begin() + i + channels);
+        summariseLevel(cacheType, 0, channels);
+    }
+}
+
+void
+WaveFileModel::summariseLevel(int cacheType, size_t level, size_t channels)
+{
+    // Called each time a complete set of per-channel ranges has been
+    // appended to the given level.  If that completes a pair, merge
+    // the pair into the level above, and so on up the pyramid.
+
+    if (channels == 0) return;
+
+    RangeBlockLevels &levels = m_cache[cacheType];
+
+    while (1) {
+
+        size_t n = levels[level].size() / channels;
+        if (n == 0 || n % 2 != 0) return;
+
+        if (levels.size() <= level + 1) levels.push_back(RangeBlock());
+
+        const RangeBlock &from = levels[level];
+        RangeBlock &to = levels[level + 1];
+
+        // The second of the pair may be a block carried up alone by
+        // finishLevels, covering fewer base-level blocks than the
+        // first; weight the means by the base blocks covered
+
+        size_t w = (size_t(1) << level);
+        size_t w1 = std::min(w, levels[0].size() / channels - (n - 1) * w);
+
+        for (size_t ch = 0; ch < channels; ++ch) {
+            const Range &r0 = from[(n - 2) * channels + ch];
+            const Range &r1 = from[(n - 1) * channels + ch];
+            to.push_back(Range(std::min(r0.min(), r1.min()),
+                               std::max(r0.max(), r1.max()),
+                               (r0.absmean() * w + r1.absmean() * w1) /
+                               (w + w1)));
+        }
+
+        ++level;
+    }
+}
+
+void
+WaveFileModel::finishLevels(int cacheType, size_t channels)
+{
+    // Called once the base level is complete.  A level with an odd
+    // number of blocks has a last block that has not been summarised
+    // in the level above, because it has no partner: carry it up
+    // alone, so that every level covers the whole file.
+
+    if (channels == 0) return;
+
+    RangeBlockLevels &levels = m_cache[cacheType];
+
+    for (size_t level = 0; level < levels.size(); ++level) {
+
+        size_t n = levels[level].size() / channels;
+        if (n <= 1) break;
+        if (n % 2 == 0) continue;
+
+        if (levels.size() <= level + 1) levels.push_back(RangeBlock());
+
+        for (size_t ch = 0; ch < channels; ++ch) {
+            Range r = levels[level][(n - 1) * channels + ch];
+            levels[level + 1].push_back(r);
+        }
+
+        summariseLevel(cacheType, level + 1, channels);
+    }
+}
+
 void
 WaveFileModel::toXml(QTextStream &out,
                      QString indent,
@@ -117,6 +117,24 @@ protected:
          
     void fillCache();
 
+    /**
+     * Each of the two caches is a pyramid of summaries: level 0
+     * holds one range per channel for every block at the cache's
+     * base resolution (64 or 90 frames), and each level above it
+     * one range per pair of blocks in the level below, so every
+     * block size offered by the zoom constraint corresponds to
+     * exactly one level.  The whole pyramid takes about twice the
+     * memory of its base level.  Ranges are interleaved by channel
+     * at every level.
+     */
+    typedef std::vector<RangeBlock> RangeBlockLevels;
+
+    // These must be called with m_mutex held
+    void addBaseRanges(int cacheType, const RangeBlock &ranges,
+                       size_t channels);
+    void summariseLevel(int cacheType, size_t level, size_t channels);
+    void finishLevels(int cacheType, size_t channels);
+
     FileSource m_source;
     QString m_path;
     AudioFileReader *m_reader;
@@ -124,7 +142,7 @@ protected:
 
     size_t m_startFrame;
 
-    RangeBlock m_cache[2]; // interleaved at two base resolutions
+    RangeBlockLevels m_cache[2]; // pyramids at two base resolutions
     mutable QMutex m_mutex;
     RangeCacheFillThread *m_fillThread;
     QTimer *m_updateTimer;
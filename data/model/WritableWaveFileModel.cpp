@@ -20,6 +20,7 @@
 
 #include "fileio/WavFileWriter.h"
 #include "fileio/WavFileReader.h"
+#include "fileio/ChunkedAudioStore.h"
 
 #include <QDir>
 #include <QTextStream>
@@ -34,7 +35,8 @@ WritableWaveFileModel::WritableWaveFileModel(size_t sampleRate,
 					     QString path) :
     m_model(0),
     m_writer(0),
-    m_reader(0),
+    m_store(0),
+    m_backing(0),
     m_sampleRate(sampleRate),
     m_channels(channels),
     m_frameCount(0),
@@ -62,21 +64,32 @@ WritableWaveFileModel::WritableWaveFileModel(size_t sampleRate,
 
     FileSource source(m_writer->getPath());
 
-    m_reader = new WavFileReader(source, true);
-    if (!m_reader->getError().isEmpty()) {
-        std::cerr << "WritableWaveFileModel: Error in creating wave file reader" << std::endl;
-        delete m_reader;
-        m_reader = 0;
-        return;
+    // The model reads recent audio back from memory rather than from
+    // the file we are writing, so that it need not wait for the
+    // file's header to be updated and does not contend with the
+    // writer for the disc.  Older audio is read from the file, so
+    // that a long recording doesn't have to fit in memory
+
+    m_store = new ChunkedAudioStore(sampleRate, channels, m_writer->getPath());
+
+    m_backing = new WavFileReader(source, true);
+    if (m_backing->getError().isEmpty()) {
+        m_store->setBackingReader(m_backing, MaxResidentBytes);
+    } else {
+        std::cerr << "WritableWaveFileModel: Failed to open written file for reading, keeping all recorded audio in memory" << std::endl;
+        delete m_backing;
+        m_backing = 0;
     }
     
-    m_model = new WaveFileModel(source, m_reader);
+    m_model = new WaveFileModel(source, m_store);
     if (!m_model->isOK()) {
         std::cerr << "WritableWaveFileModel: Error in creating wave file model" << std::endl;
         delete m_model;
         m_model = 0;
-        delete m_reader;
-        m_reader = 0;
+        delete m_store;
+        m_store = 0;
+        delete m_backing;
+        m_backing = 0;
         return;
     }
     m_model->setStartFrame(m_startFrame);
@@ -90,7 +103,8 @@ WritableWaveFileModel::~WritableWaveFileModel()
 {
     delete m_model;
     delete m_writer;
-    delete m_reader;
+    delete m_store;
+    delete m_backing;
 }
 
 void
@@ -116,20 +130,7 @@ WritableWaveFileModel::addSamples(float **samples, size_t count)
 
     m_frameCount += count;
 
-    static int updateCounter = 0;
-
-    if (m_reader && m_reader->getChannelCount() == 0) {
-#ifdef DEBUG_WRITABLE_WAVE_FILE_MODEL
-        std::cerr << "WritableWaveFileModel::addSamples(" << count << "): calling updateFrameCount (initial)" << std::endl;
-#endif
-        m_reader->updateFrameCount();
-    } else if (++updateCounter == 100) {
-#ifdef DEBUG_WRITABLE_WAVE_FILE_MODEL
-        std::cerr << "WritableWaveFileModel::addSamples(" << count << "): calling updateFrameCount (periodic)" << std::endl;
-#endif
-        if (m_reader) m_reader->updateFrameCount();
-        updateCounter = 0;
-    }
+    if (m_store) m_store->addFrames(samples, count);
 
     return true;
 }
@@ -154,7 +155,7 @@ WritableWaveFileModel::setCompletion(int completion)
 {
     m_completion = completion;
     if (completion == 100) {
-        if (m_reader) m_reader->updateDone();
+        if (m_store) m_store->finish();
     }
 }
 
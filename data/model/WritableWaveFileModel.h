@@ -20,6 +20,7 @@
 
 class WavFileWriter;
 class WavFileReader;
+class ChunkedAudioStore;
 
 class WritableWaveFileModel : public RangeSummarisableTimeValueModel
 {
@@ -88,12 +89,17 @@ public:
 protected:
     WaveFileModel *m_model;
     WavFileWriter *m_writer;
-    WavFileReader *m_reader;
+    ChunkedAudioStore *m_store;
+    WavFileReader *m_backing; // for audio the store no longer holds
     size_t m_sampleRate;
     size_t m_channels;
     size_t m_frameCount;
     size_t m_startFrame;
     int m_completion;
+
+    // Recorded audio held in memory, beyond which it is read back
+    // from the file
+    static const size_t MaxResidentBytes = 256 * 1024 * 1024;
 };
 
 #endif
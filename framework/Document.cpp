@@ -205,57 +205,93 @@ Document::createDerivedLayer(LayerFactory::LayerType type,
 Layer *
 Document::createDerivedLayer(const Transform &transform,
                              const ModelTransformer::Input &input)
+{
+    Transforms transforms;
+    transforms.push_back(transform);
+    std::vector<Layer *> layers = createDerivedLayers(transforms, input);
+    if (layers.empty()) return 0;
+    else return layers[0];
+}
+
+std::vector<Layer *>
+Document::createDerivedLayers(const Transforms &transforms,
+                              const ModelTransformer::Input &input)
 {
     QString message;
-    Model *newModel = addDerivedModel(transform, input, message);
-    if (!newModel) {
-        emit modelGenerationFailed(transform.getIdentifier(), message);
-        return 0;
-    } else if (message != "") {
-        emit modelGenerationWarning(transform.getIdentifier(), message);
-    }
+    std::vector<Model *> newModels = addDerivedModels(transforms, input, message);
 
-    LayerFactory::LayerTypeSet types =
-	LayerFactory::getInstance()->getValidLayerTypes(newModel);
+    std::vector<Layer *> layers;
+    bool warned = false;
 
-    if (types.empty()) {
-	std::cerr << "WARNING: Document::createLayerForTransformer: no valid display layer for output of transform " << transform.getIdentifier().toStdString() << std::endl;
-        newModel->aboutToDelete();
-        emit modelAboutToBeDeleted(newModel);
-        m_models.erase(newModel);
-	delete newModel;
-	return 0;
-    }
+    // Similar transforms may share one output model, so a model that
+    // has been deleted below may turn up again at a later index
+    std::set<Model *> deleted;
 
-    //!!! for now, just use the first suitable layer type
+    for (size_t j = 0; j < transforms.size(); ++j) {
 
-    Layer *newLayer = createLayer(*types.begin());
-    setModel(newLayer, newModel);
+        const Transform &transform = transforms[j];
+        Model *newModel = newModels[j];
 
-    //!!! We need to clone the model when adding the layer, so that it
-    //can be edited without affecting other layers that are based on
-    //the same model.  Unfortunately we can't just clone it now,
-    //because it probably hasn't been completed yet -- the transform
-    //runs in the background.  Maybe the transform has to handle
-    //cloning and cacheing models itself.
-    //
-    // Once we do clone models here, of course, we'll have to avoid
-    // leaking them too.
-    //
-    // We want the user to be able to add a model to a second layer
-    // _while it's still being calculated in the first_ and have it
-    // work quickly.  That means we need to put the same physical
-    // model pointer in both layers, so they can't actually be cloned.
+        if (newModel && deleted.find(newModel) != deleted.end()) {
+            layers.push_back(0);
+            continue;
+        }
+
+        if (!newModel) {
+            emit modelGenerationFailed(transform.getIdentifier(), message);
+            layers.push_back(0);
+            continue;
+        } else if (message != "" && !warned) {
+            emit modelGenerationWarning(transform.getIdentifier(), message);
+            warned = true;
+        }
+
+        LayerFactory::LayerTypeSet types =
+            LayerFactory::getInstance()->getValidLayerTypes(newModel);
+
+        if (types.empty()) {
+            std::cerr << "WARNING: Document::createLayerForTransformer: no valid display layer for output of transform " << transform.getIdentifier().toStdString() << std::endl;
+            newModel->aboutToDelete();
+            emit modelAboutToBeDeleted(newModel);
+            m_models.erase(newModel);
+            deleted.insert(newModel);
+            delete newModel;
+            layers.push_back(0);
+            continue;
+        }
+
+        //!!! for now, just use the first suitable layer type
+
+        Layer *newLayer = createLayer(*types.begin());
+        setModel(newLayer, newModel);
+
+        //!!! We need to clone the model when adding the layer, so that it
+        //can be edited without affecting other layers that are based on
+        //the same model.  Unfortunately we can't just clone it now,
+        //because it probably hasn't been completed yet -- the transform
+        //runs in the background.  Maybe the transform has to handle
+        //cloning and cacheing models itself.
+        //
+        // Once we do clone models here, of course, we'll have to avoid
+        // leaking them too.
+        //
+        // We want the user to be able to add a model to a second layer
+        // _while it's still being calculated in the first_ and have it
+        // work quickly.  That means we need to put the same physical
+        // model pointer in both layers, so they can't actually be cloned.
     
-    if (newLayer) {
-	newLayer->setObjectName(getUniqueLayerName
-                                (TransformFactory::getInstance()->
-                                 getTransformFriendlyName
-                                 (transform.getIdentifier())));
+        if (newLayer) {
+            newLayer->setObjectName(getUniqueLayerName
+                                    (TransformFactory::getInstance()->
+                                     getTransformFriendlyName
+                                     (transform.getIdentifier())));
+        }
+
+        emit layerAdded(newLayer);
+        layers.push_back(newLayer);
     }
 
-    emit layerAdded(newLayer);
-    return newLayer;
+    return layers;
 }
 
 void
@@ -273,6 +309,7 @@ Document::setMainModel(WaveFileModel *model)
 
     std::vector<Layer *> obsoleteLayers;
     std::set<QString> failedTransformers;
+    std::map<int, std::vector<Layer *> > regenerating; // by input channel
 
     // We need to ensure that no layer is left using oldMainModel or
     // any of the old derived models as its model.  Either replace the
@@ -332,21 +369,38 @@ Document::setMainModel(WaveFileModel *model)
             std::cerr << "... it uses a model derived from the old main model, regenerating" << std::endl;
 #endif
 
-	    // This model was derived from the previous main
-	    // model: regenerate it.
-	    
-	    const Transform &transform = m_models[model].transform;
-            QString transformId = transform.getIdentifier();
-	    
-            //!!! We have a problem here if the number of channels in
-            //the main model has changed.
-
-            QString message;
-	    Model *replacementModel =
-                addDerivedModel(transform,
-                                ModelTransformer::Input
-                                (m_mainModel, m_models[model].channel),
-                                message);
+	    // This model was derived from the previous main model:
+	    // regenerate it.  We collect all of these first, so that
+	    // transforms that can share a plugin run are run together.
+
+            regenerating[m_models[model].channel].push_back(layer);
+	}	    
+    }
+
+    for (std::map<int, std::vector<Layer *> >::iterator ri =
+             regenerating.begin(); ri != regenerating.end(); ++ri) {
+
+        const std::vector<Layer *> &layers = ri->second;
+
+        Transforms transforms;
+        for (size_t j = 0; j < layers.size(); ++j) {
+            transforms.push_back(m_models[layers[j]->getModel()].transform);
+        }
+
+        //!!! We have a problem here if the number of channels in
+        //the main model has changed.
+
+        QString message;
+        std::vector<Model *> replacementModels =
+            addDerivedModels(transforms,
+                             ModelTransformer::Input(m_mainModel, ri->first),
+                             message);
+
+        for (size_t j = 0; j < layers.size(); ++j) {
+
+            Layer *layer = layers[j];
+            QString transformId = transforms[j].getIdentifier();
+            Model *replacementModel = replacementModels[j];
 	    
 	    if (!replacementModel) {
 		std::cerr << "WARNING: Document::setMainModel: Failed to regenerate model for transform \""
@@ -366,6 +420,7 @@ Document::setMainModel(WaveFileModel *model)
                                                   message);
                 }
 #ifdef DEBUG_DOCUMENT
+                Model *model = layer->getModel();
                 std::cerr << "Replacing model " << model << " (type "
                           << typeid(*model).name() << ") with model "
                           << replacementModel << " (type "
@@ -384,7 +439,7 @@ Document::setMainModel(WaveFileModel *model)
 #endif
 		setModel(layer, replacementModel);
 	    }
-	}	    
+	}
     }
 
     for (size_t k = 0; k < obsoleteLayers.size(); ++k) {
@@ -497,40 +552,84 @@ Document::addDerivedModel(const Transform &transform,
                           const ModelTransformer::Input &input,
                           QString &message)
 {
-    Model *model = 0;
+    Transforms transforms;
+    transforms.push_back(transform);
+    std::vector<Model *> models = addDerivedModels(transforms, input, message);
+    if (models.empty()) return 0;
+    else return models[0];
+}
 
-    for (ModelMap::iterator i = m_models.begin(); i != m_models.end(); ++i) {
-	if (i->second.transform == transform &&
-	    i->second.source == input.getModel() && 
-            i->second.channel == input.getChannel()) {
-	    return i->first;
-	}
+std::vector<Model *>
+Document::addDerivedModels(const Transforms &transforms,
+                           const ModelTransformer::Input &input,
+                           QString &message)
+{
+    std::vector<Model *> models(transforms.size(), (Model *)0);
+
+    // Reuse any model we already have for one of these transforms,
+    // and hand the rest to the transformer factory together, so that
+    // it can share plugin runs between them where possible
+
+    Transforms toRun;
+    std::vector<size_t> runIndex(transforms.size(), 0);
+
+    for (size_t j = 0; j < transforms.size(); ++j) {
+
+        for (ModelMap::iterator i = m_models.begin(); i != m_models.end(); ++i) {
+            if (i->second.transform == transforms[j] &&
+                i->second.source == input.getModel() && 
+                i->second.channel == input.getChannel()) {
+                models[j] = i->first;
+                break;
+            }
+        }
+
+        if (models[j]) continue;
+
+        size_t k = 0;
+        while (k < toRun.size() && !(toRun[k] == transforms[j])) ++k;
+        if (k == toRun.size()) toRun.push_back(transforms[j]);
+        runIndex[j] = k;
     }
 
-    model = ModelTransformerFactory::getInstance()->transform
-        (transform, input, message);
+    if (toRun.empty()) return models;
 
-    // The transform we actually used was presumably identical to the
-    // one asked for, except that the version of the plugin may
-    // differ.  It's possible that the returned message contains a
-    // warning about this; that doesn't concern us here, but we do
-    // need to ensure that the transform we remember is correct for
-    // what was actually applied, with the current plugin version.
+    ModelTransformer::Models newModels =
+        ModelTransformerFactory::getInstance()->transformMultiple
+        (toRun, input, message);
 
-    Transform applied = transform;
-    applied.setPluginVersion
-        (TransformFactory::getInstance()->
-         getDefaultTransformFor(transform.getIdentifier(),
-                                lrintf(transform.getSampleRate()))
-         .getPluginVersion());
+    for (size_t k = 0; k < toRun.size(); ++k) {
 
-    if (!model) {
-	std::cerr << "WARNING: Document::addDerivedModel: no output model for transform " << transform.getIdentifier().toStdString() << std::endl;
-    } else {
-	addDerivedModel(applied, input, model);
+        const Transform &transform = toRun[k];
+        Model *model = (k < newModels.size() ? newModels[k] : 0);
+
+        // The transform we actually used was presumably identical to
+        // the one asked for, except that the version of the plugin may
+        // differ.  It's possible that the returned message contains a
+        // warning about this; that doesn't concern us here, but we do
+        // need to ensure that the transform we remember is correct for
+        // what was actually applied, with the current plugin version.
+
+        Transform applied = transform;
+        applied.setPluginVersion
+            (TransformFactory::getInstance()->
+             getDefaultTransformFor(transform.getIdentifier(),
+                                    lrintf(transform.getSampleRate()))
+             .getPluginVersion());
+
+        if (!model) {
+            std::cerr << "WARNING: Document::addDerivedModels: no output model for transform " << transform.getIdentifier().toStdString() << std::endl;
+            continue;
+        }
+
+        addDerivedModel(applied, input, model);
+
+        for (size_t j = 0; j < transforms.size(); ++j) {
+            if (!models[j] && runIndex[j] == k) models[j] = model;
+        }
     }
 
-    return model;
+    return models;
 }
 
 void
@@ -116,6 +116,17 @@ public:
     Layer *createDerivedLayer(const Transform &,
                               const ModelTransformer::Input &);
 
+    /**
+     * Create and return suitable layers for the given transforms,
+     * which must all have the same input, in the same order.  An
+     * entry is 0 if its transform could not be run.  Transforms that
+     * differ only in which output of a plugin they use are run
+     * together, so this is more efficient than calling
+     * createDerivedLayer for each of them.
+     */
+    std::vector<Layer *> createDerivedLayers(const Transforms &,
+                                             const ModelTransformer::Input &);
+
     /**
      * Delete the given layer, and also its associated model if no
      * longer used by any other layer.  In general, this should be the
@@ -153,6 +164,17 @@ public:
                            const ModelTransformer::Input &input,
                            QString &returnedMessage);
 
+    /**
+     * Add derived models associated with the given transforms, which
+     * must all have the same input, running the transforms (together
+     * where they can share a plugin run) and returning the resulting
+     * models in the same order.  An entry is 0 if its transform
+     * failed.
+     */
+    std::vector<Model *> addDerivedModels(const Transforms &transforms,
+                                          const ModelTransformer::Input &input,
+                                          QString &returnedMessage);
+
     /**
      * Add a derived model associated with the given transform.  This
      * is necessary to register any derived model that was not created
@@ -2673,6 +2673,11 @@ MainWindowBase::playbackFrameChanged(unsigned long frame)
     m_myStatusMessage = tr("Playing: %1 of %2 (%3 remaining)")
         .arg(nowStr).arg(thenStr).arg(remainingStr);
 
+    int xruns = m_playSource->getXrunCount();
+    if (xruns > 0) {
+        m_myStatusMessage += tr(" - %1 audio dropout(s)").arg(xruns);
+    }
+
     statusBar()->showMessage(m_myStatusMessage);
 }
 
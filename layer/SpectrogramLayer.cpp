@@ -23,6 +23,7 @@
 #include "base/Preferences.h"
 #include "base/RangeMapper.h"
 #include "base/LogRange.h"
+#include "base/ThreadPool.h"
 #include "widgets/CommandHistory.h"
 #include "ColourMapper.h"
 #include "ImageRegionFinder.h"
@@ -1827,6 +1828,17 @@ SpectrogramLayer::paint(View *v, QPainter &paint, QRect rect) const
     const_cast<SpectrogramLayer *>(this)->Layer::setLayerDormant(v, false);
 
     size_t fftSize = getFFTSize(v);
+
+    // Ask for the columns visible in this view to be calculated
+    // first, with the rest of the fill working outward from them
+
+    FFTModel *visibleFFT = getFFTModel(v);
+    if (visibleFFT) {
+        size_t resolution = visibleFFT->getResolution();
+        size_t visibleStart = (startFrame < 0 ? 0 : startFrame);
+        visibleFFT->setVisibleColumns(visibleStart / resolution,
+                                      v->getEndFrame() / resolution + 1);
+    }
 /*
     FFTModel *fft = getFFTModel(v);
     if (!fft) {
@@ -2484,6 +2496,57 @@ validArea.x() << ", " << cache.validArea.y() << ", " << cache.validArea.width()
 //!!!    if (fftSuspended) fft->resume();
 }
 
+struct SpectrogramLayer::DrawBufferParameters
+{
+    View *v;
+    int w;
+    int h;
+    const int *binforx;
+    const float *binfory;
+    int minbin;
+    int maxbin;
+    int divisor;
+    DenseThreeDimensionalModel *sourceModel;
+    FFTModel *fft;
+    bool interpolate;
+    bool peakFrequencies;
+    float displayMinFreq;
+    float displayMaxFreq;
+    bool logarithmic;
+    std::vector<unsigned char *> lines; // scan lines of m_drawBuffer
+};
+
+/**
+ * The painting of a draw buffer's tiles, as a job for the shared
+ * ThreadPool.  The pool's threads persist for the life of the
+ * program, which matters here because the FFT data server keeps a
+ * disc cache reader for each thread that reads from it, and a new
+ * set of threads for every paint would mean a new set of readers as
+ * well.
+ */
+class SpectrogramLayer::DrawBufferJob : public ThreadPool::Job
+{
+public:
+    DrawBufferJob(const SpectrogramLayer *layer,
+                  const DrawBufferParameters &params,
+                  DrawBufferTileList &tiles) :
+        m_layer(layer), m_params(params), m_tiles(tiles) { }
+
+    virtual void perform(int n) {
+        DrawBufferTile &tile = m_tiles[n];
+        if (m_params.peakFrequencies) {
+            m_layer->paintDrawBufferPeakFrequenciesTile(m_params, tile);
+        } else {
+            m_layer->paintDrawBufferTile(m_params, tile);
+        }
+    }
+
+private:
+    const SpectrogramLayer *m_layer;
+    const DrawBufferParameters &m_params;
+    DrawBufferTileList &m_tiles;
+};
+
 bool
 SpectrogramLayer::paintDrawBufferPeakFrequencies(View *v,
                                                  int w,
@@ -2508,6 +2571,40 @@ SpectrogramLayer::paintDrawBufferPeakFrequencies(View *v,
     FFTModel *fft = getFFTModel(v);
     if (!fft) return false;
 
+    DrawBufferParameters params;
+    params.v = v;
+    params.w = w;
+    params.h = h;
+    params.binforx = binforx;
+    params.binfory = 0;
+    params.minbin = minbin;
+    params.maxbin = maxbin;
+    params.divisor = 1;
+    params.sourceModel = fft;
+    params.fft = fft;
+    params.interpolate = false;
+    params.peakFrequencies = true;
+    params.displayMinFreq = displayMinFreq;
+    params.displayMaxFreq = displayMaxFreq;
+    params.logarithmic = logarithmic;
+
+    return renderDrawBuffer(params, overallMag, overallMagChanged);
+}
+
+void
+SpectrogramLayer::paintDrawBufferPeakFrequenciesTile(const DrawBufferParameters &params,
+                                                     DrawBufferTile &tile) const
+{
+    Profiler profiler("SpectrogramLayer::paintDrawBufferPeakFrequenciesTile");
+
+    View *v = params.v;
+    FFTModel *fft = params.fft;
+    const int *binforx = params.binforx;
+    int w = params.w;
+    int h = params.h;
+    int minbin = params.minbin;
+    int maxbin = params.maxbin;
+
     FFTModel::PeakSet peakfreqs;
 
     int px = -1, psx = -1;
@@ -2518,12 +2615,10 @@ SpectrogramLayer::paintDrawBufferPeakFrequencies(View *v,
     float *values = (float *)alloca((maxbin - minbin + 1) * sizeof(float));
 #endif
 
-    for (int x = 0; x < w; ++x) {
+    for (int x = tile.x0; x < tile.x1; ++x) {
         
         if (binforx[x] < 0) continue;
 
-        float columnMax = 0.f;
-
         int sx0 = binforx[x];
         int sx1 = sx0;
         if (x+1 < w) sx1 = binforx[x+1];
@@ -2541,7 +2636,8 @@ SpectrogramLayer::paintDrawBufferPeakFrequencies(View *v,
 #ifdef DEBUG_SPECTROGRAM_REPAINT
                     std::cerr << "Met unavailable column at col " << sx << std::endl;
 #endif
-                    return false;
+                    tile.complete = false;
+                    return;
                 }
             }
 
@@ -2580,31 +2676,21 @@ SpectrogramLayer::paintDrawBufferPeakFrequencies(View *v,
                 }
 
                 float y = v->getYForFrequency
-                    (freq, displayMinFreq, displayMaxFreq, logarithmic);
+                    (freq, params.displayMinFreq, params.displayMaxFreq,
+                     params.logarithmic);
 
                 int iy = int(y + 0.5);
                 if (iy < 0 || iy >= h) continue;
 
-                m_drawBuffer.setPixel(x, iy, getDisplayValue(v, value));
+                params.lines[iy][x] = getDisplayValue(v, value);
             }
 
             if (mag.isSet()) {
-                if (sx >= int(m_columnMags.size())) {
-#ifdef DEBUG_SPECTROGRAM
-                    std::cerr << "INTERNAL ERROR: " << sx << " >= "
-                              << m_columnMags.size()
-                              << " at SpectrogramLayer.cpp::paintDrawBuffer"
-                              << std::endl;
-#endif
-                } else {
-                    m_columnMags[sx].sample(mag);
-                    if (overallMag.sample(mag)) overallMagChanged = true;
-                }
+                tile.columnMags.push_back
+                    (std::pair<int, MagnitudeRange>(sx, mag));
             }
         }
     }
-
-    return true;
 }
 
 bool
@@ -2656,6 +2742,44 @@ SpectrogramLayer::paintDrawBuffer(View *v,
         }
     }
 
+    DrawBufferParameters params;
+    params.v = v;
+    params.w = w;
+    params.h = h;
+    params.binforx = binforx;
+    params.binfory = binfory;
+    params.minbin = minbin;
+    params.maxbin = maxbin;
+    params.divisor = divisor;
+    params.sourceModel = sourceModel;
+    params.fft = fft;
+    params.interpolate = interpolate;
+    params.peakFrequencies = false;
+    params.displayMinFreq = 0.f;
+    params.displayMaxFreq = 0.f;
+    params.logarithmic = false;
+
+    return renderDrawBuffer(params, overallMag, overallMagChanged);
+}
+
+void
+SpectrogramLayer::paintDrawBufferTile(const DrawBufferParameters &params,
+                                      DrawBufferTile &tile) const
+{
+    Profiler profiler("SpectrogramLayer::paintDrawBufferTile");
+
+    View *v = params.v;
+    DenseThreeDimensionalModel *sourceModel = params.sourceModel;
+    FFTModel *fft = params.fft;
+    const int *binforx = params.binforx;
+    const float *binfory = params.binfory;
+    int w = params.w;
+    int h = params.h;
+    int minbin = params.minbin;
+    int maxbin = params.maxbin;
+    int divisor = params.divisor;
+    bool interpolate = params.interpolate;
+
     int psx = -1;
 
 #ifdef __GNUC__
@@ -2669,7 +2793,7 @@ SpectrogramLayer::paintDrawBuffer(View *v,
     const float *values = autoarray;
     DenseThreeDimensionalModel::Column c;
 
-    for (int x = 0; x < w; ++x) {
+    for (int x = tile.x0; x < tile.x1; ++x) {
         
         if (binforx[x] < 0) continue;
 
@@ -2698,7 +2822,8 @@ SpectrogramLayer::paintDrawBuffer(View *v,
 #ifdef DEBUG_SPECTROGRAM_REPAINT
                     std::cerr << "Met unavailable column at col " << sx << std::endl;
 #endif
-                    return false;
+                    tile.complete = false;
+                    return;
                 }
             }
 
@@ -2802,17 +2927,8 @@ SpectrogramLayer::paintDrawBuffer(View *v,
             }
 
             if (mag.isSet()) {
-                if (sx >= int(m_columnMags.size())) {
-#ifdef DEBUG_SPECTROGRAM
-                    std::cerr << "INTERNAL ERROR: " << sx << " >= "
-                              << m_columnMags.size()
-                              << " at SpectrogramLayer.cpp::paintDrawBuffer"
-                              << std::endl;
-#endif
-                } else {
-                    m_columnMags[sx].sample(mag);
-                    if (overallMag.sample(mag)) overallMagChanged = true;
-                }
+                tile.columnMags.push_back
+                    (std::pair<int, MagnitudeRange>(sx, mag));
             }
         }
 
@@ -2826,13 +2942,99 @@ SpectrogramLayer::paintDrawBuffer(View *v,
                 peak /= columnMax;
             }
             
-            unsigned char peakpix = getDisplayValue(v, peak);
+            params.lines[h-y-1][x] = getDisplayValue(v, peak);
+        }
+    }
+}
+
+bool
+SpectrogramLayer::renderDrawBuffer(const DrawBufferParameters &constParams,
+                                   MagnitudeRange &overallMag,
+                                   bool &overallMagChanged) const
+{
+    Profiler profiler("SpectrogramLayer::renderDrawBuffer");
+
+    DrawBufferParameters params(constParams);
 
-            m_drawBuffer.setPixel(x, h-y-1, peakpix);
+    // Take the scan line pointers here, rather than using setPixel
+    // from the tiles, as the first scanLine call may detach the
+    // image and that must not happen concurrently
+    params.lines.resize(params.h);
+    for (int y = 0; y < params.h; ++y) {
+        params.lines[y] = m_drawBuffer.scanLine(y);
+    }
+
+    // Tiles call getDisplayValue, which looks up m_viewMags[v]: the
+    // view already has an entry there (paint looked it up before
+    // calling us) so that lookup will not modify the map.  When
+    // m_synchronous is set the FFT model may have to calculate
+    // missing columns on demand, which it cannot do from more than
+    // one thread at once, so in that case we paint in one tile.
+
+    int threads = 1;
+    if (!m_synchronous && params.w >= MinimumDrawBufferTileWidth * 2) {
+        threads = ThreadPool::getInstance()->getThreadCount();
+    }
+
+    int tileCount = 1;
+    if (threads > 1) {
+        // several tiles per thread, so that threads that finish
+        // early can help with the rest
+        tileCount = threads * 4;
+        if (tileCount > params.w / MinimumDrawBufferTileWidth) {
+            tileCount = params.w / MinimumDrawBufferTileWidth;
         }
     }
 
-    return true;
+    DrawBufferTileList tiles(tileCount);
+    for (int i = 0; i < tileCount; ++i) {
+        tiles[i].x0 = (params.w * i) / tileCount;
+        tiles[i].x1 = (params.w * (i + 1)) / tileCount;
+        tiles[i].complete = true;
+    }
+
+#ifdef DEBUG_SPECTROGRAM_REPAINT
+    cerr << "SpectrogramLayer::renderDrawBuffer: " << tileCount
+         << " tile(s) across " << threads << " thread(s)" << endl;
+#endif
+
+    if (tileCount == 1) {
+        if (params.peakFrequencies) {
+            paintDrawBufferPeakFrequenciesTile(params, tiles[0]);
+        } else {
+            paintDrawBufferTile(params, tiles[0]);
+        }
+    } else {
+        DrawBufferJob job(this, params, tiles);
+        ThreadPool::getInstance()->run(&job, tileCount);
+    }
+
+    bool complete = true;
+
+    for (int i = 0; i < tileCount; ++i) {
+
+        if (!tiles[i].complete) complete = false;
+
+        const std::vector<std::pair<int, MagnitudeRange> > &mags =
+            tiles[i].columnMags;
+
+        for (size_t j = 0; j < mags.size(); ++j) {
+            int sx = mags[j].first;
+            if (sx >= int(m_columnMags.size())) {
+#ifdef DEBUG_SPECTROGRAM
+                std::cerr << "INTERNAL ERROR: " << sx << " >= "
+                          << m_columnMags.size()
+                          << " at SpectrogramLayer.cpp::renderDrawBuffer"
+                          << std::endl;
+#endif
+            } else {
+                m_columnMags[sx].sample(mags[j].second);
+                if (overallMag.sample(mags[j].second)) overallMagChanged = true;
+            }
+        }
+    }
+
+    return complete;
 }
 
 void
@@ -439,6 +439,34 @@ protected:
                                         MagnitudeRange &overallMag,
                                         bool &overallMagChanged) const;
 
+    /**
+     * The draw buffer is rendered in vertical tiles, which may be
+     * painted concurrently by the threads of the shared ThreadPool.
+     * Each tile writes only to its own columns of the draw buffer
+     * and records the magnitude ranges it finds in its own list;
+     * these are merged into m_columnMags and the view's range once
+     * all tiles are done, from the painting thread.
+     */
+    struct DrawBufferParameters;
+    struct DrawBufferTile {
+        int x0;
+        int x1;
+        bool complete;
+        std::vector<std::pair<int, MagnitudeRange> > columnMags;
+    };
+    typedef std::vector<DrawBufferTile> DrawBufferTileList;
+    static const int MinimumDrawBufferTileWidth = 32;
+    class DrawBufferJob;
+    friend class DrawBufferJob;
+
+    bool renderDrawBuffer(const DrawBufferParameters &params,
+                          MagnitudeRange &overallMag,
+                          bool &overallMagChanged) const;
+    void paintDrawBufferTile(const DrawBufferParameters &params,
+                             DrawBufferTile &tile) const;
+    void paintDrawBufferPeakFrequenciesTile(const DrawBufferParameters &params,
+                                            DrawBufferTile &tile) const;
+
     virtual void updateMeasureRectYCoords(View *v, const MeasureRect &r) const;
     virtual void setMeasureRectYCoord(View *v, MeasureRect &r, bool start, int y) const;
 };
@@ -181,6 +181,33 @@ PreferencesDialog::PreferencesDialog(QWidget *parent, Qt::WFlags flags) :
             this, SLOT(tempDirButtonClicked()));
     tempDirButton->setFixedSize(QSize(24, 24));
 
+    QCheckBox *persistentFFTCache = new QCheckBox;
+    m_persistentFFTCache = prefs->getPersistentFFTCache();
+    persistentFFTCache->setCheckState(m_persistentFFTCache ? Qt::Checked :
+                                      Qt::Unchecked);
+    connect(persistentFFTCache, SIGNAL(stateChanged(int)),
+            this, SLOT(persistentFFTCacheChanged(int)));
+
+    QSpinBox *persistentFFTCacheSize = new QSpinBox;
+    int pcs = prefs->getPropertyRangeAndValue("Persistent FFT Cache Size",
+                                              &min, &max, &deflt);
+    m_persistentFFTCacheSize = pcs;
+    persistentFFTCacheSize->setMinimum(min);
+    persistentFFTCacheSize->setMaximum(max);
+    persistentFFTCacheSize->setSuffix(" MB");
+    persistentFFTCacheSize->setSingleStep(256);
+    persistentFFTCacheSize->setValue(pcs);
+
+    connect(persistentFFTCacheSize, SIGNAL(valueChanged(int)),
+            this, SLOT(persistentFFTCacheSizeChanged(int)));
+
+    QCheckBox *parallelFeatureExtraction = new QCheckBox;
+    m_parallelFeatureExtraction = prefs->getParallelFeatureExtraction();
+    parallelFeatureExtraction->setCheckState(m_parallelFeatureExtraction ?
+                                             Qt::Checked : Qt::Unchecked);
+    connect(parallelFeatureExtraction, SIGNAL(stateChanged(int)),
+            this, SLOT(parallelFeatureExtractionChanged(int)));
+
     QCheckBox *showSplash = new QCheckBox;
     m_showSplash = prefs->getShowSplash();
     showSplash->setCheckState(m_showSplash ? Qt::Checked : Qt::Unchecked);
@@ -242,6 +269,21 @@ PreferencesDialog::PreferencesDialog(QWidget *parent, Qt::WFlags flags) :
     subgrid->addWidget(tempDirButton, row, 2, 1, 1);
     row++;
 
+    subgrid->addWidget(new QLabel(tr("%1:").arg(prefs->getPropertyLabel
+                                                ("Persistent FFT Cache"))),
+                       row, 0);
+    subgrid->addWidget(persistentFFTCache, row++, 1, 1, 1);
+
+    subgrid->addWidget(new QLabel(tr("%1:").arg(prefs->getPropertyLabel
+                                                ("Persistent FFT Cache Size"))),
+                       row, 0);
+    subgrid->addWidget(persistentFFTCacheSize, row++, 1, 1, 2);
+
+    subgrid->addWidget(new QLabel(tr("%1:").arg(prefs->getPropertyLabel
+                                                ("Parallel Feature Extraction"))),
+                       row, 0);
+    subgrid->addWidget(parallelFeatureExtraction, row++, 1, 1, 1);
+
     subgrid->addWidget(new QLabel(tr("%1:").arg(prefs->getPropertyLabel
                                                 ("Resample On Load"))),
                        row, 0);
@@ -416,6 +458,27 @@ PreferencesDialog::showSplashChanged(int state)
     m_changesOnRestart = true;
 }
 
+void
+PreferencesDialog::persistentFFTCacheChanged(int state)
+{
+    m_persistentFFTCache = (state == Qt::Checked);
+    m_applyButton->setEnabled(true);
+}
+
+void
+PreferencesDialog::persistentFFTCacheSizeChanged(int mb)
+{
+    m_persistentFFTCacheSize = mb;
+    m_applyButton->setEnabled(true);
+}
+
+void
+PreferencesDialog::parallelFeatureExtractionChanged(int state)
+{
+    m_parallelFeatureExtraction = (state == Qt::Checked);
+    m_applyButton->setEnabled(true);
+}
+
 void
 PreferencesDialog::tempDirRootChanged(QString r)
 {
@@ -479,6 +542,9 @@ PreferencesDialog::applyClicked()
     prefs->setResampleQuality(m_resampleQuality);
     prefs->setResampleOnLoad(m_resampleOnLoad);
     prefs->setShowSplash(m_showSplash);
+    prefs->setPersistentFFTCache(m_persistentFFTCache);
+    prefs->setPersistentFFTCacheSize(m_persistentFFTCacheSize);
+    prefs->setParallelFeatureExtraction(m_parallelFeatureExtraction);
     prefs->setTemporaryDirectoryRoot(m_tempDirRoot);
     prefs->setBackgroundMode(Preferences::BackgroundMode(m_backgroundMode));
     prefs->setTimeToTextMode(Preferences::TimeToTextMode(m_timeToTextMode));
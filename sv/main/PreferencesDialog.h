@@ -49,6 +49,9 @@ protected slots:
     void timeToTextModeChanged(int mode);
     void viewFontSizeChanged(int sz);
     void showSplashChanged(int state);
+    void persistentFFTCacheChanged(int state);
+    void persistentFFTCacheSizeChanged(int mb);
+    void parallelFeatureExtractionChanged(int state);
 
     void tempDirButtonClicked();
 
@@ -75,6 +78,9 @@ protected:
     int m_timeToTextMode;
     int m_viewFontSize;
     bool m_showSplash;
+    bool m_persistentFFTCache;
+    int m_persistentFFTCacheSize;
+    bool m_parallelFeatureExtraction;
 
     bool m_changesOnRestart;
 };
@@ -0,0 +1,49 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _SV_SIMD_H_
+#define _SV_SIMD_H_
+
+// Which vector instruction sets this compiler can build code for.
+//
+// SV_SSE2 is defined, and the SSE2 intrinsics included, if SSE2 can
+// be used.  SSE2 code still needs a ProcessorHasSSE2() check before
+// it is run, except on 64-bit x86 where it is always present.
+//
+// SV_AVX2 is defined, and the AVX2 intrinsics included, if the
+// compiler can build individual functions for AVX2 without the rest
+// of the program requiring it.  Such functions must be declared with
+// AVX2_FUNCTION, and called only if ProcessorHasAVX2() returns true.
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SV_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(SV_SSE2) && \
+    (defined(_MSC_VER) || defined(__clang__) || \
+     (defined(__GNUC__) && \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define SV_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+#endif
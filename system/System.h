@@ -136,6 +136,11 @@ extern int GetDiscSpaceMBAvailable(const char *path);
 extern void StoreStartupLocale();
 extern void RestoreStartupLocale();
 
+// Return true if the processor we are running on supports the given
+// SIMD instruction set extension.  Always false on non-x86 platforms.
+extern bool ProcessorHasSSE2();
+extern bool ProcessorHasAVX2();
+
 #include <cmath>
 
 extern double mod(double x, double y);
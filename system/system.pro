@@ -13,5 +13,5 @@ DEPENDPATH += .
 INCLUDEPATH += .
 
 # Input
-HEADERS += Init.h System.h
+HEADERS += Init.h SIMD.h System.h
 SOURCES += Init.cpp System.cpp
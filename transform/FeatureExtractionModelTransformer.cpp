@@ -22,6 +22,8 @@
 #include "data/model/Model.h"
 #include "base/Window.h"
 #include "base/Exceptions.h"
+#include "base/Profiler.h"
+#include "base/Preferences.h"
 #include "data/model/SparseOneDimensionalModel.h"
 #include "data/model/SparseTimeValueModel.h"
 #include "data/model/EditableDenseThreeDimensionalModel.h"
@@ -30,48 +32,150 @@
 #include "data/model/RegionModel.h"
 #include "data/model/FFTModel.h"
 #include "data/model/WaveFileModel.h"
+#include "data/fft/FFTDataServer.h"
+#include "data/fft/FFTapi.h"
 #include "rdf/PluginRDFDescription.h"
 
 #include "TransformFactory.h"
+#include "SharedAudioReader.h"
+
+#include <QMutexLocker>
 
 #include <iostream>
 
+//#define DEBUG_FEATURE_EXTRACTION_SEGMENTS 1
+
+struct FeatureExtractionModelTransformer::BlockInput
+{
+    size_t channelCount;
+    size_t blockSize;
+    bool inlineFFT;
+
+    // The plugin input buffers double as FFT output buffers in the
+    // inline FFT case, so they must be allocated suitably for that
+    float **buffers;
+
+    float **fftInput;
+    std::vector<fftf_plan> fftPlans;
+    Window<float> *windower;
+
+    SharedAudioReader *reader;
+    int readerClient;
+};
+
+struct FeatureExtractionModelTransformer::PendingFeatures
+{
+    std::vector<SparseOneDimensionalModel::Point> instants;
+    std::vector<SparseTimeValueModel::Point> values;
+    std::vector<NoteModel::Point> notes;
+    std::vector<RegionModel::Point> regions;
+
+    // consecutive columns starting at firstColumn
+    size_t firstColumn;
+    std::vector<DenseThreeDimensionalModel::Column> columns;
+
+    size_t size() const {
+        return instants.size() + values.size() + notes.size() +
+            regions.size() + columns.size();
+    }
+};
+
+struct FeatureExtractionModelTransformer::SegmentedRun
+{
+    struct Segment {
+        long start; // first block frame whose features are kept
+        long end;   // block frame at which processing stops
+        bool last;
+        bool done;
+        // (block frame, features) for each block that had any
+        std::vector<std::pair<long, Vamp::Plugin::FeatureSet> > features;
+    };
+
+    std::vector<Segment> segments;
+    QAtomicInt nextSegment;
+    int merged;     // number of segments already passed to the models
+    int maxPending; // how far ahead of merging the workers may get
+
+    long contextStart;
+    long startFrame;
+    size_t stepSize;
+    size_t sampleRate;
+
+    QMutex mutex;
+    QWaitCondition condition;
+};
+
 FeatureExtractionModelTransformer::FeatureExtractionModelTransformer(Input in,
                                                                      const Transform &transform) :
     ModelTransformer(in, transform),
-    m_plugin(0),
-    m_descriptor(0),
-    m_outputFeatureNo(0)
+    m_plugin(0)
+{
+//    std::cerr << "FeatureExtractionModelTransformer::FeatureExtractionModelTransformer: plugin " << pluginId.toStdString() << ", outputName " << m_transforms[0].getOutput().toStdString() << std::endl;
+
+    initialise();
+}
+
+FeatureExtractionModelTransformer::FeatureExtractionModelTransformer(Input in,
+                                                                     const Transforms &transforms) :
+    ModelTransformer(in, transforms),
+    m_plugin(0)
 {
-//    std::cerr << "FeatureExtractionModelTransformer::FeatureExtractionModelTransformer: plugin " << pluginId.toStdString() << ", outputName " << m_transform.getOutput().toStdString() << std::endl;
+    initialise();
+}
 
-    QString pluginId = transform.getPluginIdentifier();
+bool
+FeatureExtractionModelTransformer::areTransformsSimilar(const Transform &t1,
+                                                        const Transform &t2)
+{
+    Transform t2o(t2);
+    t2o.setOutput(t1.getOutput());
+    return t1 == t2o;
+}
+
+bool
+FeatureExtractionModelTransformer::initialise()
+{
+    if (m_transforms.empty()) return false;
+
+    for (size_t j = 1; j < m_transforms.size(); ++j) {
+        if (!areTransformsSimilar(m_transforms[0], m_transforms[j])) {
+            m_message = tr("Transforms supplied to a single feature extraction transformer must differ only in plugin output");
+            return false;
+        }
+    }
+
+    // The first transform stands for all of them while the plugin is
+    // configured; the others are brought into line with it afterwards
+
+    Transform &primary = m_transforms[0];
+
+    QString pluginId = primary.getPluginIdentifier();
 
     FeatureExtractionPluginFactory *factory =
 	FeatureExtractionPluginFactory::instanceFor(pluginId);
 
     if (!factory) {
         m_message = tr("No factory available for feature extraction plugin id \"%1\" (unknown plugin type, or internal error?)").arg(pluginId);
-	return;
+	return false;
     }
 
     DenseTimeValueModel *input = getConformingInput();
     if (!input) {
         m_message = tr("Input model for feature extraction plugin \"%1\" is of wrong type (internal error?)").arg(pluginId);
-        return;
+        return false;
     }
 
     m_plugin = factory->instantiatePlugin(pluginId, input->getSampleRate());
     if (!m_plugin) {
         m_message = tr("Failed to instantiate plugin \"%1\"").arg(pluginId);
-	return;
+	return false;
     }
 
     TransformFactory::getInstance()->makeContextConsistentWithPlugin
-        (m_transform, m_plugin);
+        (primary, m_plugin);
 
     TransformFactory::getInstance()->setPluginParameters
-        (m_transform, m_plugin);
+        (primary, m_plugin);
 
     size_t channelCount = input->getChannelCount();
     if (m_plugin->getMaxChannelCount() < channelCount) {
@@ -83,34 +187,34 @@ FeatureExtractionModelTransformer::FeatureExtractionModelTransformer(Input in,
             .arg(m_plugin->getMinChannelCount())
             .arg(m_plugin->getMaxChannelCount())
             .arg(input->getChannelCount());
-	return;
+	return false;
     }
 
     std::cerr << "Initialising feature extraction plugin with channels = "
-              << channelCount << ", step = " << m_transform.getStepSize()
-              << ", block = " << m_transform.getBlockSize() << std::endl;
+              << channelCount << ", step = " << primary.getStepSize()
+              << ", block = " << primary.getBlockSize() << std::endl;
 
     if (!m_plugin->initialise(channelCount,
-                              m_transform.getStepSize(),
-                              m_transform.getBlockSize())) {
+                              primary.getStepSize(),
+                              primary.getBlockSize())) {
 
-        size_t pstep = m_transform.getStepSize();
-        size_t pblock = m_transform.getBlockSize();
+        size_t pstep = primary.getStepSize();
+        size_t pblock = primary.getBlockSize();
 
-        m_transform.setStepSize(0);
-        m_transform.setBlockSize(0);
+        primary.setStepSize(0);
+        primary.setBlockSize(0);
         TransformFactory::getInstance()->makeContextConsistentWithPlugin
-            (m_transform, m_plugin);
+            (primary, m_plugin);
 
-        if (m_transform.getStepSize() != pstep ||
-            m_transform.getBlockSize() != pblock) {
+        if (primary.getStepSize() != pstep ||
+            primary.getBlockSize() != pblock) {
             
             if (!m_plugin->initialise(channelCount,
-                                      m_transform.getStepSize(),
-                                      m_transform.getBlockSize())) {
+                                      primary.getStepSize(),
+                                      primary.getBlockSize())) {
 
                 m_message = tr("Failed to initialise feature extraction plugin \"%1\"").arg(pluginId);
-                return;
+                return false;
 
             } else {
 
@@ -118,22 +222,22 @@ FeatureExtractionModelTransformer::FeatureExtractionModelTransformer(Input in,
                     .arg(pluginId)
                     .arg(pstep)
                     .arg(pblock)
-                    .arg(m_transform.getStepSize())
-                    .arg(m_transform.getBlockSize());
+                    .arg(primary.getStepSize())
+                    .arg(primary.getBlockSize());
             }
 
         } else {
 
             m_message = tr("Failed to initialise feature extraction plugin \"%1\"").arg(pluginId);
-            return;
+            return false;
         }
     }
 
-    if (m_transform.getPluginVersion() != "") {
+    if (primary.getPluginVersion() != "") {
         QString pv = QString("%1").arg(m_plugin->getPluginVersion());
-        if (pv != m_transform.getPluginVersion()) {
+        if (pv != primary.getPluginVersion()) {
             QString vm = tr("Transform was configured for version %1 of plugin \"%2\", but the plugin being used is version %3")
-                .arg(m_transform.getPluginVersion())
+                .arg(primary.getPluginVersion())
                 .arg(pluginId)
                 .arg(pv);
             if (m_message != "") {
@@ -148,70 +252,99 @@ FeatureExtractionModelTransformer::FeatureExtractionModelTransformer(Input in,
 
     if (outputs.empty()) {
         m_message = tr("Plugin \"%1\" has no outputs").arg(pluginId);
-	return;
+	return false;
     }
     
-    for (size_t i = 0; i < outputs.size(); ++i) {
-//        std::cerr << "comparing output " << i << " name \"" << outputs[i].identifier << "\" with expected \"" << m_transform.getOutput().toStdString() << "\"" << std::endl;
-	if (m_transform.getOutput() == "" ||
-            outputs[i].identifier == m_transform.getOutput().toStdString()) {
-	    m_outputFeatureNo = i;
-	    m_descriptor = new Vamp::Plugin::OutputDescriptor(outputs[i]);
-	    break;
-	}
+    QStringList missing;
+
+    for (size_t j = 0; j < m_transforms.size(); ++j) {
+
+        if (j > 0) {
+            QString output = m_transforms[j].getOutput();
+            m_transforms[j] = primary;
+            m_transforms[j].setOutput(output);
+        }
+
+        Vamp::Plugin::OutputDescriptor *descriptor = 0;
+        int outputNo = 0;
+
+        for (size_t i = 0; i < outputs.size(); ++i) {
+//            std::cerr << "comparing output " << i << " name \"" << outputs[i].identifier << "\" with expected \"" << m_transforms[j].getOutput().toStdString() << "\"" << std::endl;
+            if (m_transforms[j].getOutput() == "" ||
+                outputs[i].identifier == m_transforms[j].getOutput().toStdString()) {
+                outputNo = i;
+                descriptor = new Vamp::Plugin::OutputDescriptor(outputs[i]);
+                break;
+            }
+        }
+
+        if (!descriptor) missing.push_back(m_transforms[j].getOutput());
+
+        m_descriptors.push_back(descriptor);
+        m_outputNos.push_back(outputNo);
     }
 
-    if (!m_descriptor) {
-        m_message = tr("Plugin \"%1\" has no output named \"%2\"")
+    if (!missing.empty()) {
+        QString mm = tr("Plugin \"%1\" has no output named \"%2\"")
             .arg(pluginId)
-            .arg(m_transform.getOutput());
-	return;
+            .arg(missing.join("\", \""));
+        if (m_message != "") {
+            m_message = QString("%1; %2").arg(mm).arg(m_message);
+        } else {
+            m_message = mm;
+        }
+    }
+
+    for (size_t j = 0; j < m_transforms.size(); ++j) {
+        m_outputs.push_back(0);
+        m_pending.push_back(new PendingFeatures);
+        if (m_descriptors[j]) createOutputModel(j);
     }
 
-    createOutputModel();
+    return true;
 }
 
 void
-FeatureExtractionModelTransformer::createOutputModel()
+FeatureExtractionModelTransformer::createOutputModel(int n)
 {
     DenseTimeValueModel *input = getConformingInput();
 
 //    std::cerr << "FeatureExtractionModelTransformer: output sample type "
-//	      << m_descriptor->sampleType << std::endl;
+//	      << m_descriptors[n]->sampleType << std::endl;
 
-    PluginRDFDescription description(m_transform.getPluginIdentifier());
-    QString outputId = m_transform.getOutput();
+    PluginRDFDescription description(m_transforms[n].getPluginIdentifier());
+    QString outputId = m_transforms[n].getOutput();
 
     int binCount = 1;
     float minValue = 0.0, maxValue = 0.0;
     bool haveExtents = false;
     
-    if (m_descriptor->hasFixedBinCount) {
-	binCount = m_descriptor->binCount;
+    if (m_descriptors[n]->hasFixedBinCount) {
+	binCount = m_descriptors[n]->binCount;
     }
 
 //    std::cerr << "FeatureExtractionModelTransformer: output bin count "
 //	      << binCount << std::endl;
 
-    if (binCount > 0 && m_descriptor->hasKnownExtents) {
-	minValue = m_descriptor->minValue;
-	maxValue = m_descriptor->maxValue;
+    if (binCount > 0 && m_descriptors[n]->hasKnownExtents) {
+	minValue = m_descriptors[n]->minValue;
+	maxValue = m_descriptors[n]->maxValue;
         haveExtents = true;
     }
 
     size_t modelRate = input->getSampleRate();
     size_t modelResolution = 1;
     
-    switch (m_descriptor->sampleType) {
+    switch (m_descriptors[n]->sampleType) {
 
     case Vamp::Plugin::OutputDescriptor::VariableSampleRate:
-	if (m_descriptor->sampleRate != 0.0) {
-	    modelResolution = size_t(modelRate / m_descriptor->sampleRate + 0.001);
+	if (m_descriptors[n]->sampleRate != 0.0) {
+	    modelResolution = size_t(modelRate / m_descriptors[n]->sampleRate + 0.001);
 	}
 	break;
 
     case Vamp::Plugin::OutputDescriptor::OneSamplePerStep:
-	modelResolution = m_transform.getStepSize();
+	modelResolution = m_transforms[n].getStepSize();
 	break;
 
     case Vamp::Plugin::OutputDescriptor::FixedSampleRate:
@@ -220,12 +353,12 @@ FeatureExtractionModelTransformer::createOutputModel()
         //!!! the model rate to be the input model's rate, and adjust
         //!!! the resolution appropriately.  We can't properly display
         //!!! data with a higher resolution than the base model at all
-//	modelRate = size_t(m_descriptor->sampleRate + 0.001);
-        if (m_descriptor->sampleRate > input->getSampleRate()) {
+//	modelRate = size_t(m_descriptors[n]->sampleRate + 0.001);
+        if (m_descriptors[n]->sampleRate > input->getSampleRate()) {
             modelResolution = 1;
         } else {
             modelResolution = size_t(input->getSampleRate() /
-                                     m_descriptor->sampleRate);
+                                     m_descriptors[n]->sampleRate);
         }
 	break;
     }
@@ -233,20 +366,20 @@ FeatureExtractionModelTransformer::createOutputModel()
     bool preDurationPlugin = (m_plugin->getVampApiVersion() < 2);
 
     if (binCount == 0 &&
-        (preDurationPlugin || !m_descriptor->hasDuration)) {
+        (preDurationPlugin || !m_descriptors[n]->hasDuration)) {
 
         // Anything with no value and no duration is an instant
 
-	m_output = new SparseOneDimensionalModel(modelRate, modelResolution,
+	m_outputs[n] = new SparseOneDimensionalModel(modelRate, modelResolution,
 						 false);
 
         QString outputEventTypeURI = description.getOutputEventTypeURI(outputId);
-        m_output->setRDFTypeURI(outputEventTypeURI);
+        m_outputs[n]->setRDFTypeURI(outputEventTypeURI);
 
     } else if ((preDurationPlugin && binCount > 1 &&
-                (m_descriptor->sampleType ==
+                (m_descriptors[n]->sampleType ==
                  Vamp::Plugin::OutputDescriptor::VariableSampleRate)) ||
-               (!preDurationPlugin && m_descriptor->hasDuration)) {
+               (!preDurationPlugin && m_descriptors[n]->hasDuration)) {
 
         // For plugins using the old v1 API without explicit duration,
         // we treat anything that has multiple bins (i.e. that has the
@@ -277,9 +410,9 @@ FeatureExtractionModelTransformer::createOutputModel()
 
         // Regions do not have units of Hz or MIDI things (a sweeping
         // assumption!)
-        if (m_descriptor->unit == "Hz" ||
-            m_descriptor->unit.find("MIDI") != std::string::npos ||
-            m_descriptor->unit.find("midi") != std::string::npos) {
+        if (m_descriptors[n]->unit == "Hz" ||
+            m_descriptors[n]->unit.find("MIDI") != std::string::npos ||
+            m_descriptors[n]->unit.find("midi") != std::string::npos) {
             isNoteModel = true;
         }
 
@@ -297,8 +430,8 @@ FeatureExtractionModelTransformer::createOutputModel()
                 model = new NoteModel
                     (modelRate, modelResolution, false);
             }
-            model->setScaleUnits(m_descriptor->unit.c_str());
-            m_output = model;
+            model->setScaleUnits(m_descriptors[n]->unit.c_str());
+            m_outputs[n] = model;
 
         } else {
 
@@ -310,15 +443,15 @@ FeatureExtractionModelTransformer::createOutputModel()
                 model = new RegionModel
                     (modelRate, modelResolution, false);
             }
-            model->setScaleUnits(m_descriptor->unit.c_str());
-            m_output = model;
+            model->setScaleUnits(m_descriptors[n]->unit.c_str());
+            m_outputs[n] = model;
         }
 
         QString outputEventTypeURI = description.getOutputEventTypeURI(outputId);
-        m_output->setRDFTypeURI(outputEventTypeURI);
+        m_outputs[n]->setRDFTypeURI(outputEventTypeURI);
 
     } else if (binCount == 1 ||
-               (m_descriptor->sampleType == 
+               (m_descriptors[n]->sampleType == 
                 Vamp::Plugin::OutputDescriptor::VariableSampleRate)) {
 
         // Anything that is not a 1D, note, or interval model and that
@@ -340,12 +473,12 @@ FeatureExtractionModelTransformer::createOutputModel()
         }
 
         Vamp::Plugin::OutputList outputs = m_plugin->getOutputDescriptors();
-        model->setScaleUnits(outputs[m_outputFeatureNo].unit.c_str());
+        model->setScaleUnits(outputs[m_outputNos[n]].unit.c_str());
 
-        m_output = model;
+        m_outputs[n] = model;
 
         QString outputEventTypeURI = description.getOutputEventTypeURI(outputId);
-        m_output->setRDFTypeURI(outputEventTypeURI);
+        m_outputs[n]->setRDFTypeURI(outputEventTypeURI);
 
     } else {
 
@@ -359,28 +492,33 @@ FeatureExtractionModelTransformer::createOutputModel()
              EditableDenseThreeDimensionalModel::BasicMultirateCompression,
              false);
 
-	if (!m_descriptor->binNames.empty()) {
+	if (!m_descriptors[n]->binNames.empty()) {
 	    std::vector<QString> names;
-	    for (size_t i = 0; i < m_descriptor->binNames.size(); ++i) {
-		names.push_back(m_descriptor->binNames[i].c_str());
+	    for (size_t i = 0; i < m_descriptors[n]->binNames.size(); ++i) {
+		names.push_back(m_descriptors[n]->binNames[i].c_str());
 	    }
 	    model->setBinNames(names);
 	}
         
-        m_output = model;
+        m_outputs[n] = model;
 
         QString outputSignalTypeURI = description.getOutputSignalTypeURI(outputId);
-        m_output->setRDFTypeURI(outputSignalTypeURI);
+        m_outputs[n]->setRDFTypeURI(outputSignalTypeURI);
     }
 
-    if (m_output) m_output->setSourceModel(input);
+    if (m_outputs[n]) m_outputs[n]->setSourceModel(input);
 }
 
 FeatureExtractionModelTransformer::~FeatureExtractionModelTransformer()
 {
 //    std::cerr << "FeatureExtractionModelTransformer::~FeatureExtractionModelTransformer()" << std::endl;
     delete m_plugin;
-    delete m_descriptor;
+    for (size_t j = 0; j < m_descriptors.size(); ++j) {
+        delete m_descriptors[j];
+    }
+    for (size_t j = 0; j < m_pending.size(); ++j) {
+        delete m_pending[j];
+    }
 }
 
 DenseTimeValueModel *
@@ -402,7 +540,11 @@ FeatureExtractionModelTransformer::run()
     DenseTimeValueModel *input = getConformingInput();
     if (!input) return;
 
-    if (!m_output) return;
+    bool haveOutput = false;
+    for (size_t j = 0; j < m_outputs.size(); ++j) {
+        if (m_outputs[j]) haveOutput = true;
+    }
+    if (!haveOutput) return;
 
     while (!input->isReady() && !m_abandoned) {
         std::cerr << "FeatureExtractionModelTransformer::run: Waiting for input model to be ready..." << std::endl;
@@ -417,45 +559,39 @@ FeatureExtractionModelTransformer::run()
 	channelCount = 1;
     }
 
-    float **buffers = new float*[channelCount];
-    for (size_t ch = 0; ch < channelCount; ++ch) {
-	buffers[ch] = new float[m_transform.getBlockSize() + 2];
-    }
-
-    size_t stepSize = m_transform.getStepSize();
-    size_t blockSize = m_transform.getBlockSize();
+    size_t stepSize = m_transforms[0].getStepSize();
+    size_t blockSize = m_transforms[0].getBlockSize();
 
     bool frequencyDomain = (m_plugin->getInputDomain() ==
                             Vamp::Plugin::FrequencyDomain);
     std::vector<FFTModel *> fftModels;
 
+    // Frequency-domain input is normally calculated here, a block at
+    // a time as we go, as that is much cheaper than going through an
+    // FFTModel for a single sequential pass.  But if an FFT server
+    // already exists for this input (for a spectrogram, say) then
+    // its data may already be calculated, so we use that instead.
+
+    bool inlineFFT = frequencyDomain;
+
     if (frequencyDomain) {
         for (size_t ch = 0; ch < channelCount; ++ch) {
-            FFTModel *model = new FFTModel
-                                  (getConformingInput(),
-                                   channelCount == 1 ? m_input.getChannel() : ch,
-                                   m_transform.getWindowType(),
-                                   blockSize,
-                                   stepSize,
-                                   blockSize,
-                                   false,
-                                   StorageAdviser::PrecisionCritical);
-            if (!model->isOK()) {
-                delete model;
-                setCompletion(100);
-                //!!! need a better way to handle this -- previously we were using a QMessageBox but that isn't an appropriate thing to do here either
-                throw AllocationFailed("Failed to create the FFT model for this feature extraction model transformer");
+            if (FFTDataServer::haveInstance
+                (input,
+                 channelCount == 1 ? m_input.getChannel() : ch,
+                 m_transforms[0].getWindowType(),
+                 blockSize, stepSize, blockSize)) {
+                inlineFFT = false;
+                break;
             }
-            model->resume();
-            fftModels.push_back(model);
         }
     }
 
     long startFrame = m_input.getModel()->getStartFrame();
     long   endFrame = m_input.getModel()->getEndFrame();
 
-    RealTime contextStartRT = m_transform.getStartTime();
-    RealTime contextDurationRT = m_transform.getDuration();
+    RealTime contextStartRT = m_transforms[0].getStartTime();
+    RealTime contextDurationRT = m_transforms[0].getDuration();
 
     long contextStart =
         RealTime::realTime2Frame(contextStartRT, sampleRate);
@@ -474,15 +610,72 @@ FeatureExtractionModelTransformer::run()
         contextDuration = endFrame - contextStart;
     }
 
+    setCompletion(0);
+
+    if ((!frequencyDomain || inlineFFT) && canRunInSegments()) {
+
+        // The number of blocks the sequential loop below would
+        // process, given its termination conditions
+
+        long blockCount = 0;
+        if (contextDuration > 0) {
+            if (frequencyDomain) {
+                blockCount = (contextDuration + long(blockSize)/2) /
+                    long(stepSize) + 1;
+            } else {
+                blockCount = (contextDuration + long(stepSize) - 1) /
+                    long(stepSize);
+            }
+        }
+
+        if (runInSegments(channelCount, stepSize, blockSize, inlineFFT,
+                          contextStart, blockCount)) {
+            setCompletion(100);
+            return;
+        }
+    }
+
+    // Share our reads with any other transformers running on the same
+    // input at the same time, unless we are reading from FFT models
+
+    BlockInput *blockInput = createBlockInput
+        (channelCount, blockSize, inlineFFT, !frequencyDomain || inlineFFT);
+
+    float **buffers = blockInput->buffers;
+
+    if (frequencyDomain && !inlineFFT) {
+        for (size_t ch = 0; ch < channelCount; ++ch) {
+            FFTModel *model = new FFTModel
+                                  (getConformingInput(),
+                                   channelCount == 1 ? m_input.getChannel() : ch,
+                                   m_transforms[0].getWindowType(),
+                                   blockSize,
+                                   stepSize,
+                                   blockSize,
+                                   false,
+                                   StorageAdviser::PrecisionCritical);
+            if (!model->isOK()) {
+                delete model;
+                for (size_t i = 0; i < fftModels.size(); ++i) {
+                    delete fftModels[i];
+                }
+                deleteBlockInput(blockInput);
+                setCompletion(100);
+                //!!! need a better way to handle this -- previously we were using a QMessageBox but that isn't an appropriate thing to do here either
+                throw AllocationFailed("Failed to create the FFT model for this feature extraction model transformer");
+            }
+            model->resume();
+            fftModels.push_back(model);
+        }
+    }
+
     long blockFrame = contextStart;
 
     long prevCompletion = 0;
 
-    setCompletion(0);
-
     float *reals = 0;
     float *imaginaries = 0;
-    if (frequencyDomain) {
+    if (frequencyDomain && !inlineFFT) {
         reals = new float[blockSize/2 + 1];
         imaginaries = new float[blockSize/2 + 1];
     }
@@ -493,7 +686,7 @@ FeatureExtractionModelTransformer::run()
             if (blockFrame - int(blockSize)/2 >
                 contextStart + contextDuration) break;
         } else {
-            if (blockFrame >= 
+            if (blockFrame >=
                 contextStart + contextDuration) break;
         }
 
@@ -507,7 +700,8 @@ FeatureExtractionModelTransformer::run()
 
 	// channelCount is either m_input.getModel()->channelCount or 1
 
-        if (frequencyDomain) {
+        if (frequencyDomain && !inlineFFT) {
+            Profiler profiler("FeatureExtractionModelTransformer::run: FFT model");
             for (size_t ch = 0; ch < channelCount; ++ch) {
                 int column = (blockFrame - startFrame) / stepSize;
                 fftModels[ch]->getValuesAt(column, reals, imaginaries);
@@ -517,7 +711,7 @@ FeatureExtractionModelTransformer::run()
                 }
             }
         } else {
-            getFrames(channelCount, blockFrame, blockSize, buffers);
+            readBlock(blockInput, blockFrame, startFrame, stepSize);
         }
 
         if (m_abandoned) break;
@@ -527,11 +721,7 @@ FeatureExtractionModelTransformer::run()
 
         if (m_abandoned) break;
 
-	for (size_t fi = 0; fi < features[m_outputFeatureNo].size(); ++fi) {
-	    Vamp::Plugin::Feature feature =
-		features[m_outputFeatureNo][fi];
-	    addFeature(blockFrame, feature);
-	}
+        addFeatures(blockFrame, features);
 
 	if (blockFrame == contextStart || completion > prevCompletion) {
 	    setCompletion(completion);
@@ -544,26 +734,424 @@ FeatureExtractionModelTransformer::run()
     if (!m_abandoned) {
         Vamp::Plugin::FeatureSet features = m_plugin->getRemainingFeatures();
 
-        for (size_t fi = 0; fi < features[m_outputFeatureNo].size(); ++fi) {
-            Vamp::Plugin::Feature feature =
-                features[m_outputFeatureNo][fi];
-            addFeature(blockFrame, feature);
-        }
+        addFeatures(blockFrame, features);
     }
 
     setCompletion(100);
 
-    if (frequencyDomain) {
+    if (frequencyDomain && !inlineFFT) {
         for (size_t ch = 0; ch < channelCount; ++ch) {
             delete fftModels[ch];
         }
         delete[] reals;
         delete[] imaginaries;
     }
+
+    deleteBlockInput(blockInput);
+}
+
+FeatureExtractionModelTransformer::BlockInput *
+FeatureExtractionModelTransformer::createBlockInput(size_t channelCount,
+                                                    size_t blockSize,
+                                                    bool inlineFFT,
+                                                    bool shareReads)
+{
+    BlockInput *bi = new BlockInput;
+
+    bi->channelCount = channelCount;
+    bi->blockSize = blockSize;
+    bi->inlineFFT = inlineFFT;
+    bi->fftInput = 0;
+    bi->windower = 0;
+    bi->reader = 0;
+    bi->readerClient = 0;
+
+    bi->buffers = new float*[channelCount];
+    for (size_t ch = 0; ch < channelCount; ++ch) {
+        if (inlineFFT) {
+            bi->buffers[ch] = (float *)fftf_malloc((blockSize + 2) * sizeof(float));
+        } else {
+            bi->buffers[ch] = new float[blockSize + 2];
+        }
+    }
+
+    if (inlineFFT) {
+        bi->fftInput = new float*[channelCount];
+        for (size_t ch = 0; ch < channelCount; ++ch) {
+            bi->fftInput[ch] = (float *)fftf_malloc(blockSize * sizeof(float));
+            bi->fftPlans.push_back(fftf_plan_dft_r2c_1d
+                                   (blockSize, bi->fftInput[ch],
+                                    (fftf_complex *)bi->buffers[ch],
+                                    FFTW_MEASURE));
+        }
+        bi->windower = new Window<float>(m_transforms[0].getWindowType(),
+                                         blockSize);
+    }
+
+    if (shareReads) {
+        bi->reader = SharedAudioReader::subscribe
+            (getConformingInput(), m_input.getChannel(), channelCount,
+             bi->readerClient);
+    }
+
+    return bi;
+}
+
+void
+FeatureExtractionModelTransformer::deleteBlockInput(BlockInput *bi)
+{
+    if (!bi) return;
+
+    if (bi->reader) {
+        SharedAudioReader::release(bi->reader, bi->readerClient);
+    }
+
+    if (bi->inlineFFT) {
+        for (size_t ch = 0; ch < bi->channelCount; ++ch) {
+            fftf_destroy_plan(bi->fftPlans[ch]);
+            fftf_free(bi->fftInput[ch]);
+            fftf_free(bi->buffers[ch]);
+        }
+        delete[] bi->fftInput;
+        delete bi->windower;
+    } else {
+        for (size_t ch = 0; ch < bi->channelCount; ++ch) {
+            delete[] bi->buffers[ch];
+        }
+    }
+    delete[] bi->buffers;
+
+    delete bi;
 }
 
 void
-FeatureExtractionModelTransformer::getFrames(int channelCount,
+FeatureExtractionModelTransformer::readBlock(BlockInput *bi,
+                                             long blockFrame,
+                                             long startFrame,
+                                             size_t stepSize)
+{
+    if (!bi->inlineFFT) {
+        getFrames(bi->reader, bi->readerClient, bi->channelCount,
+                  blockFrame, bi->blockSize, bi->buffers);
+        return;
+    }
+
+    Profiler profiler("FeatureExtractionModelTransformer::readBlock: inline FFT");
+
+    // Frame the block exactly as FFTDataServer would, centred on the
+    // start of its step
+
+    long blockSize = bi->blockSize;
+    long column = (blockFrame - startFrame) / long(stepSize);
+    long frame = column * long(stepSize) - blockSize/2;
+
+    // Any other transformer on the same input with the same window
+    // may already have calculated this spectrum
+
+    int windowType = int(m_transforms[0].getWindowType());
+
+    if (bi->reader &&
+        bi->reader->getSpectrum(bi->readerClient, windowType,
+                                bi->blockSize, frame, bi->buffers)) {
+        return;
+    }
+
+    getFrames(bi->reader, bi->readerClient, bi->channelCount,
+              frame, blockSize, bi->fftInput);
+
+    int hs = blockSize/2;
+    for (size_t ch = 0; ch < bi->channelCount; ++ch) {
+        float *in = bi->fftInput[ch];
+        bi->windower->cut(in);
+        for (int i = 0; i < hs; ++i) {
+            float temp = in[i];
+            in[i] = in[i + hs];
+            in[i + hs] = temp;
+        }
+        fftf_execute(bi->fftPlans[ch]);
+    }
+
+    if (bi->reader) {
+        bi->reader->putSpectrum(bi->readerClient, windowType,
+                                bi->blockSize, frame, bi->buffers);
+    }
+}
+
+bool
+FeatureExtractionModelTransformer::canRunInSegments() const
+{
+    // We can't tell whether a plugin keeps state for longer than the
+    // warm-up period, or returns features from getRemainingFeatures
+    // that depend on the whole input, in which case a segmented run
+    // gives different results from a sequential one -- so this is
+    // only done if the user has asked for it
+
+    if (!Preferences::getInstance()->getParallelFeatureExtraction()) {
+        return false;
+    }
+
+    if (QThread::idealThreadCount() < 2) return false;
+
+    // Features from outputs with any other sample type may depend on
+    // more than the block they are returned for, or be returned late,
+    // so they can't be split up safely
+
+    for (size_t j = 0; j < m_descriptors.size(); ++j) {
+        if (!m_descriptors[j]) continue;
+        if (m_descriptors[j]->sampleType !=
+            Vamp::Plugin::OutputDescriptor::OneSamplePerStep) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int
+FeatureExtractionModelTransformer::getSegmentCount(long blockCount,
+                                                   int threads) const
+{
+    long count = threads * SegmentsPerThread;
+
+    if (blockCount / count < MinSegmentBlocks) {
+        count = blockCount / MinSegmentBlocks;
+    }
+    if (count > 0 && blockCount / count > MaxSegmentBlocks) {
+        count = (blockCount + MaxSegmentBlocks - 1) / MaxSegmentBlocks;
+    }
+
+    return int(count);
+}
+
+bool
+FeatureExtractionModelTransformer::runInSegments(size_t channelCount,
+                                                 size_t stepSize,
+                                                 size_t blockSize,
+                                                 bool inlineFFT,
+                                                 long contextStart,
+                                                 long blockCount)
+{
+    int threads = QThread::idealThreadCount();
+    if (threads > MaxThreads) threads = MaxThreads;
+
+    int segmentCount = getSegmentCount(blockCount, threads);
+    if (segmentCount < 2) return false;
+    if (threads > segmentCount) threads = segmentCount;
+
+    DenseTimeValueModel *input = getConformingInput();
+    size_t sampleRate = input->getSampleRate();
+
+    // Our own plugin takes the first worker; the others need freshly
+    // configured instances of their own
+
+    QString pluginId = m_transforms[0].getPluginIdentifier();
+
+    FeatureExtractionPluginFactory *factory =
+	FeatureExtractionPluginFactory::instanceFor(pluginId);
+    if (!factory) return false;
+
+    std::vector<Vamp::Plugin *> plugins;
+    plugins.push_back(m_plugin);
+
+    while (int(plugins.size()) < threads) {
+        Vamp::Plugin *plugin = factory->instantiatePlugin(pluginId, sampleRate);
+        if (!plugin) break;
+        TransformFactory::getInstance()->setPluginParameters
+            (m_transforms[0], plugin);
+        if (!plugin->initialise(channelCount, stepSize, blockSize)) {
+            delete plugin;
+            break;
+        }
+        plugins.push_back(plugin);
+    }
+
+    if (plugins.size() < 2) return false;
+    threads = int(plugins.size());
+
+    SegmentedRun run;
+    run.nextSegment = 0;
+    run.merged = 0;
+    run.maxPending = threads * 2;
+    run.contextStart = contextStart;
+    run.startFrame = m_input.getModel()->getStartFrame();
+    run.stepSize = stepSize;
+    run.sampleRate = sampleRate;
+
+    for (int i = 0; i < segmentCount; ++i) {
+        SegmentedRun::Segment segment;
+        segment.start = contextStart +
+            ((blockCount * i) / segmentCount) * long(stepSize);
+        segment.end = contextStart +
+            ((blockCount * (i + 1)) / segmentCount) * long(stepSize);
+        segment.last = (i + 1 == segmentCount);
+        segment.done = false;
+        run.segments.push_back(segment);
+    }
+
+#ifdef DEBUG_FEATURE_EXTRACTION_SEGMENTS
+    std::cerr << "FeatureExtractionModelTransformer::runInSegments: "
+              << blockCount << " blocks in " << segmentCount
+              << " segments on " << threads << " threads" << std::endl;
+#endif
+
+    std::vector<SegmentWorker *> workers;
+    for (int i = 0; i < threads; ++i) {
+        BlockInput *bi = createBlockInput(channelCount, blockSize,
+                                          inlineFFT, true);
+        SegmentWorker *worker = new SegmentWorker(this, &run, plugins[i], bi);
+        workers.push_back(worker);
+        worker->start();
+    }
+
+    // Pass the features to the output models in order, as each
+    // segment becomes available
+
+    int prevCompletion = 0;
+
+    for (int i = 0; i < segmentCount; ++i) {
+
+        std::vector<std::pair<long, Vamp::Plugin::FeatureSet> > features;
+
+        run.mutex.lock();
+        while (!run.segments[i].done && !m_abandoned) {
+            run.condition.wait(&run.mutex, 200);
+        }
+        features.swap(run.segments[i].features);
+        run.merged = i + 1;
+        run.condition.wakeAll();
+        run.mutex.unlock();
+
+        if (m_abandoned) break;
+
+        for (size_t b = 0; b < features.size(); ++b) {
+            addFeatures(features[b].first, features[b].second);
+        }
+
+        int completion = int(((i + 1) * 99) / segmentCount);
+        if (completion > prevCompletion) {
+            setCompletion(completion);
+            prevCompletion = completion;
+        }
+    }
+
+    run.mutex.lock();
+    run.condition.wakeAll();
+    run.mutex.unlock();
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->wait();
+        deleteBlockInput(workers[i]->getInput());
+        delete workers[i];
+    }
+
+    for (size_t i = 1; i < plugins.size(); ++i) {
+        delete plugins[i];
+    }
+
+    return true;
+}
+
+void
+FeatureExtractionModelTransformer::SegmentWorker::run()
+{
+    m_transformer->processSegments(m_run, m_plugin, m_input);
+}
+
+void
+FeatureExtractionModelTransformer::processSegments(SegmentedRun *run,
+                                                   Vamp::Plugin *plugin,
+                                                   BlockInput *bi)
+{
+    int segmentCount = int(run->segments.size());
+    long stepSize = long(run->stepSize);
+
+    while (!m_abandoned) {
+
+        int i = run->nextSegment.fetchAndAddOrdered(1);
+        if (i >= segmentCount) break;
+
+        // Don't get too far ahead of the merge, or the features
+        // waiting for it could use a great deal of memory
+
+        run->mutex.lock();
+        while (i >= run->merged + run->maxPending && !m_abandoned) {
+            run->condition.wait(&run->mutex, 200);
+        }
+        run->mutex.unlock();
+
+        SegmentedRun::Segment &segment = run->segments[i];
+        std::vector<std::pair<long, Vamp::Plugin::FeatureSet> > features;
+
+        // The first segment starts from the plugin's initial state,
+        // the others after a few blocks' warm-up, as close as we can
+        // get to the state a sequential run would have reached
+
+        long blockFrame = segment.start;
+        if (i > 0) {
+            plugin->reset();
+            blockFrame -= WarmUpBlocks * stepSize;
+            if (blockFrame < run->contextStart) blockFrame = run->contextStart;
+        }
+
+        while (blockFrame < segment.end && !m_abandoned) {
+
+            readBlock(bi, blockFrame, run->startFrame, run->stepSize);
+
+            Vamp::Plugin::FeatureSet set = plugin->process
+                (bi->buffers,
+                 Vamp::RealTime::frame2RealTime(blockFrame, run->sampleRate));
+
+            if (blockFrame >= segment.start) {
+                Vamp::Plugin::FeatureSet kept;
+                keepFeatures(set, kept);
+                if (!kept.empty()) {
+                    features.push_back
+                        (std::pair<long, Vamp::Plugin::FeatureSet>
+                         (blockFrame, kept));
+                }
+            }
+
+            blockFrame += stepSize;
+        }
+
+        if (segment.last && !m_abandoned) {
+            Vamp::Plugin::FeatureSet kept;
+            keepFeatures(plugin->getRemainingFeatures(), kept);
+            if (!kept.empty()) {
+                features.push_back
+                    (std::pair<long, Vamp::Plugin::FeatureSet>
+                     (blockFrame, kept));
+            }
+        }
+
+        run->mutex.lock();
+        segment.features.swap(features);
+        segment.done = true;
+        run->condition.wakeAll();
+        run->mutex.unlock();
+    }
+}
+
+void
+FeatureExtractionModelTransformer::keepFeatures(const Vamp::Plugin::FeatureSet &features,
+                                                Vamp::Plugin::FeatureSet &kept) const
+{
+    // This is called from the worker threads, so it must not look at
+    // m_outputs, which may change under it
+    for (size_t j = 0; j < m_outputNos.size(); ++j) {
+        if (!m_descriptors[j]) continue;
+        Vamp::Plugin::FeatureSet::const_iterator i =
+            features.find(m_outputNos[j]);
+        if (i != features.end() && !i->second.empty()) {
+            kept[m_outputNos[j]] = i->second;
+        }
+    }
+}
+
+void
+FeatureExtractionModelTransformer::getFrames(SharedAudioReader *reader,
+                                             int readerClient,
+                                             int channelCount,
                                              long startFrame, long size,
                                              float **buffers)
 {
@@ -583,13 +1171,19 @@ FeatureExtractionModelTransformer::getFrames(int channelCount,
 
     DenseTimeValueModel *input = getConformingInput();
     if (!input) return;
-    
+
     long got = 0;
 
     if (channelCount == 1) {
 
-        got = input->getData(m_input.getChannel(), startFrame, size,
-                             buffers[0] + offset);
+        if (reader) {
+            float *writebuf = buffers[0] + offset;
+            got = reader->getFrames(readerClient, startFrame, size,
+                                    &writebuf);
+        } else {
+            got = input->getData(m_input.getChannel(), startFrame, size,
+                                 buffers[0] + offset);
+        }
 
         if (m_input.getChannel() == -1 && input->getChannelCount() > 1) {
             // use mean instead of sum, as plugin input
@@ -609,7 +1203,12 @@ FeatureExtractionModelTransformer::getFrames(int channelCount,
             }
         }
 
-        got = input->getData(0, channelCount-1, startFrame, size, writebuf);
+        if (reader) {
+            got = reader->getFrames(readerClient, startFrame, size,
+                                    writebuf);
+        } else {
+            got = input->getData(0, channelCount-1, startFrame, size, writebuf);
+        }
 
         if (writebuf != buffers) delete[] writebuf;
     }
@@ -623,7 +1222,43 @@ FeatureExtractionModelTransformer::getFrames(int channelCount,
 }
 
 void
-FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
+FeatureExtractionModelTransformer::addFeatures(long blockFrame,
+                                               Vamp::Plugin::FeatureSet &features)
+{
+    QMutexLocker locker(&m_outputMutex);
+
+    for (size_t j = 0; j < m_outputNos.size(); ++j) {
+        if (!m_outputs[j]) continue;
+        const Vamp::Plugin::FeatureList &list = features[m_outputNos[j]];
+        for (size_t fi = 0; fi < list.size(); ++fi) {
+            addFeature(j, blockFrame, list[fi]);
+        }
+    }
+}
+
+bool
+FeatureExtractionModelTransformer::removeOutputModel(Model *model)
+{
+    QMutexLocker locker(&m_outputMutex);
+
+    bool remaining = false;
+
+    for (size_t j = 0; j < m_outputs.size(); ++j) {
+        if (m_outputs[j] == model) {
+            m_outputs[j] = 0;
+            delete m_pending[j];
+            m_pending[j] = new PendingFeatures;
+        } else if (m_outputs[j]) {
+            remaining = true;
+        }
+    }
+
+    return remaining;
+}
+
+void
+FeatureExtractionModelTransformer::addFeature(int n,
+                                              size_t blockFrame,
 					     const Vamp::Plugin::Feature &feature)
 {
     size_t inputRate = m_input.getModel()->getSampleRate();
@@ -632,13 +1267,13 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
 //	      << blockFrame << ")" << std::endl;
 
     int binCount = 1;
-    if (m_descriptor->hasFixedBinCount) {
-	binCount = m_descriptor->binCount;
+    if (m_descriptors[n]->hasFixedBinCount) {
+	binCount = m_descriptors[n]->binCount;
     }
 
     size_t frame = blockFrame;
 
-    if (m_descriptor->sampleType ==
+    if (m_descriptors[n]->sampleType ==
 	Vamp::Plugin::OutputDescriptor::VariableSampleRate) {
 
 	if (!feature.hasTimestamp) {
@@ -651,39 +1286,36 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
 	    frame = Vamp::RealTime::realTime2Frame(feature.timestamp, inputRate);
 	}
 
-    } else if (m_descriptor->sampleType ==
+    } else if (m_descriptors[n]->sampleType ==
 	       Vamp::Plugin::OutputDescriptor::FixedSampleRate) {
 
 	if (feature.hasTimestamp) {
 	    //!!! warning: sampleRate may be non-integral
 	    frame = Vamp::RealTime::realTime2Frame(feature.timestamp,
 //!!! see comment above when setting up modelResolution and modelRate
-//                                                   lrintf(m_descriptor->sampleRate));
+//                                                   lrintf(m_descriptors[n]->sampleRate));
                                                    inputRate);
 	} else {
-	    frame = m_output->getEndFrame();
+            // the model must be up to date for its end frame to be
+            // meaningful
+            flushFeatures(n);
+	    frame = m_outputs[n]->getEndFrame();
 	}
     }
 	
+    PendingFeatures *pending = m_pending[n];
+
     // Rather than repeat the complicated tests from the constructor
     // to determine what sort of model we must be adding the features
     // to, we instead test what sort of model the constructor decided
     // to create.
 
-    if (isOutput<SparseOneDimensionalModel>()) {
-
-        SparseOneDimensionalModel *model =
-            getConformingOutput<SparseOneDimensionalModel>();
-	if (!model) return;
+    if (isOutput<SparseOneDimensionalModel>(n)) {
 
-        model->addPoint(SparseOneDimensionalModel::Point
-                       (frame, feature.label.c_str()));
+        pending->instants.push_back(SparseOneDimensionalModel::Point
+                                    (frame, feature.label.c_str()));
 	
-    } else if (isOutput<SparseTimeValueModel>()) {
-
-	SparseTimeValueModel *model =
-            getConformingOutput<SparseTimeValueModel>();
-	if (!model) return;
+    } else if (isOutput<SparseTimeValueModel>(n)) {
 
         for (int i = 0; i < feature.values.size(); ++i) {
 
@@ -694,10 +1326,11 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
                 label = QString("[%1] %2").arg(i+1).arg(label);
             }
 
-            model->addPoint(SparseTimeValueModel::Point(frame, value, label));
+            pending->values.push_back
+                (SparseTimeValueModel::Point(frame, value, label));
         }
 
-    } else if (isOutput<NoteModel>() || isOutput<RegionModel>()) {
+    } else if (isOutput<NoteModel>(n) || isOutput<RegionModel>(n)) {
 
         int index = 0;
 
@@ -715,7 +1348,7 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
             }
         }
         
-        if (isOutput<NoteModel>()) {
+        if (isOutput<NoteModel>(n)) {
 
             float velocity = 100;
             if (feature.values.size() > index) {
@@ -724,15 +1357,12 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
             if (velocity < 0) velocity = 127;
             if (velocity > 127) velocity = 127;
 
-            NoteModel *model = getConformingOutput<NoteModel>();
-            if (!model) return;
-            model->addPoint(NoteModel::Point(frame, value, // value is pitch
-                                             lrintf(duration),
-                                             velocity / 127.f,
-                                             feature.label.c_str()));
+            pending->notes.push_back
+                (NoteModel::Point(frame, value, // value is pitch
+                                  lrintf(duration),
+                                  velocity / 127.f,
+                                  feature.label.c_str()));
         } else {
-            RegionModel *model = getConformingOutput<RegionModel>();
-            if (!model) return;
 
             if (feature.hasDuration && !feature.values.empty()) {
 
@@ -745,75 +1375,144 @@ FeatureExtractionModelTransformer::addFeature(size_t blockFrame,
                         label = QString("[%1] %2").arg(i+1).arg(label);
                     }
 
-                    model->addPoint(RegionModel::Point(frame, value,
-                                                       lrintf(duration),
-                                                       label));
+                    pending->regions.push_back
+                        (RegionModel::Point(frame, value,
+                                            lrintf(duration),
+                                            label));
                 }
             } else {
             
-                model->addPoint(RegionModel::Point(frame, value,
-                                                   lrintf(duration),
-                                                   feature.label.c_str()));
+                pending->regions.push_back
+                    (RegionModel::Point(frame, value,
+                                        lrintf(duration),
+                                        feature.label.c_str()));
             }
         }
 	
-    } else if (isOutput<EditableDenseThreeDimensionalModel>()) {
+    } else if (isOutput<EditableDenseThreeDimensionalModel>(n)) {
 	
 	DenseThreeDimensionalModel::Column values =
             DenseThreeDimensionalModel::Column::fromStdVector(feature.values);
 	
 	EditableDenseThreeDimensionalModel *model =
-            getConformingOutput<EditableDenseThreeDimensionalModel>();
+            getConformingOutput<EditableDenseThreeDimensionalModel>(n);
 	if (!model) return;
 
-	model->setColumn(frame / model->getResolution(), values);
+        size_t column = frame / model->getResolution();
+
+        if (!pending->columns.empty() &&
+            column != pending->firstColumn + pending->columns.size()) {
+            flushFeatures(n);
+        }
+        if (pending->columns.empty()) pending->firstColumn = column;
+
+        pending->columns.push_back(values);
 
     } else {
         std::cerr << "FeatureExtractionModelTransformer::addFeature: Unknown output model type!" << std::endl;
     }
+
+    if (pending->size() >= MaxPendingFeatures) flushFeatures(n);
+}
+
+void
+FeatureExtractionModelTransformer::flushFeatures(int n)
+{
+    PendingFeatures *pending = m_pending[n];
+    if (pending->size() == 0) return;
+
+    Profiler profiler("FeatureExtractionModelTransformer::flushFeatures");
+
+    if (isOutput<SparseOneDimensionalModel>(n)) {
+
+        SparseOneDimensionalModel *model =
+            getConformingOutput<SparseOneDimensionalModel>(n);
+        if (model) model->addPoints(pending->instants);
+
+    } else if (isOutput<SparseTimeValueModel>(n)) {
+
+        SparseTimeValueModel *model =
+            getConformingOutput<SparseTimeValueModel>(n);
+        if (model) model->addPoints(pending->values);
+
+    } else if (isOutput<NoteModel>(n)) {
+
+        NoteModel *model = getConformingOutput<NoteModel>(n);
+        if (model) model->addPoints(pending->notes);
+
+    } else if (isOutput<RegionModel>(n)) {
+
+        RegionModel *model = getConformingOutput<RegionModel>(n);
+        if (model) model->addPoints(pending->regions);
+
+    } else if (isOutput<EditableDenseThreeDimensionalModel>(n)) {
+
+        EditableDenseThreeDimensionalModel *model =
+            getConformingOutput<EditableDenseThreeDimensionalModel>(n);
+        if (model) model->setColumns(pending->firstColumn, pending->columns);
+    }
+
+    pending->instants.clear();
+    pending->values.clear();
+    pending->notes.clear();
+    pending->regions.clear();
+    pending->columns.clear();
 }
 
 void
 FeatureExtractionModelTransformer::setCompletion(int completion)
+{
+    QMutexLocker locker(&m_outputMutex);
+
+    for (size_t j = 0; j < m_outputs.size(); ++j) {
+        if (m_outputs[j]) setCompletion(j, completion);
+    }
+}
+
+void
+FeatureExtractionModelTransformer::setCompletion(int n, int completion)
 {
     int binCount = 1;
-    if (m_descriptor->hasFixedBinCount) {
-	binCount = m_descriptor->binCount;
+    if (m_descriptors[n]->hasFixedBinCount) {
+	binCount = m_descriptors[n]->binCount;
     }
 
 //    std::cerr << "FeatureExtractionModelTransformer::setCompletion("
 //              << completion << ")" << std::endl;
 
-    if (isOutput<SparseOneDimensionalModel>()) {
+    // Bring the model up to date before it announces the change
+    flushFeatures(n);
+
+    if (isOutput<SparseOneDimensionalModel>(n)) {
 
 	SparseOneDimensionalModel *model =
-            getConformingOutput<SparseOneDimensionalModel>();
+            getConformingOutput<SparseOneDimensionalModel>(n);
 	if (!model) return;
 	model->setCompletion(completion, true);
 
-    } else if (isOutput<SparseTimeValueModel>()) {
+    } else if (isOutput<SparseTimeValueModel>(n)) {
 
 	SparseTimeValueModel *model =
-            getConformingOutput<SparseTimeValueModel>();
+            getConformingOutput<SparseTimeValueModel>(n);
 	if (!model) return;
 	model->setCompletion(completion, true);
 
-    } else if (isOutput<NoteModel>()) {
+    } else if (isOutput<NoteModel>(n)) {
 
-	NoteModel *model = getConformingOutput<NoteModel>();
+	NoteModel *model = getConformingOutput<NoteModel>(n);
 	if (!model) return;
 	model->setCompletion(completion, true);
 
-    } else if (isOutput<RegionModel>()) {
+    } else if (isOutput<RegionModel>(n)) {
 
-	RegionModel *model = getConformingOutput<RegionModel>();
+	RegionModel *model = getConformingOutput<RegionModel>(n);
 	if (!model) return;
 	model->setCompletion(completion, true);
 
-    } else if (isOutput<EditableDenseThreeDimensionalModel>()) {
+    } else if (isOutput<EditableDenseThreeDimensionalModel>(n)) {
 
 	EditableDenseThreeDimensionalModel *model =
-            getConformingOutput<EditableDenseThreeDimensionalModel>();
+            getConformingOutput<EditableDenseThreeDimensionalModel>(n);
 	if (!model) return;
 	model->setCompletion(completion, true); //!!!m_context.updates);
     }
@@ -18,13 +18,19 @@
 
 #include "ModelTransformer.h"
 
+#include "base/Thread.h"
+
 #include <QString>
+#include <QMutex>
+#include <QWaitCondition>
 
 #include <vamp-hostsdk/Plugin.h>
 
 #include <iostream>
+#include <vector>
 
 class DenseTimeValueModel;
+class SharedAudioReader;
 
 class FeatureExtractionModelTransformer : public ModelTransformer
 {
@@ -33,35 +39,129 @@ class FeatureExtractionModelTransformer : public ModelTransformer
 public:
     FeatureExtractionModelTransformer(Input input,
                                       const Transform &transform);
+
+    /**
+     * Obtain outputs for a set of transforms that all use the same
+     * plugin and input, but possibly different plugin outputs.  The
+     * plugin is run only once, and the features from each of its
+     * outputs are routed to the output model for the corresponding
+     * transform.  The transforms must all be similar in the sense of
+     * areTransformsSimilar.
+     */
+    FeatureExtractionModelTransformer(Input input,
+                                      const Transforms &transforms);
+
     virtual ~FeatureExtractionModelTransformer();
 
+    /**
+     * Return true if the two transforms differ at most in which of
+     * the plugin's outputs they use, so that both could be obtained
+     * from a single run of the plugin.
+     */
+    static bool areTransformsSimilar(const Transform &, const Transform &);
+
+    virtual bool removeOutputModel(Model *model);
+
 protected:
+    bool initialise();
+
     virtual void run();
 
     Vamp::Plugin *m_plugin;
-    Vamp::Plugin::OutputDescriptor *m_descriptor;
-    int m_outputFeatureNo;
 
-    void createOutputModel();
-
-    void addFeature(size_t blockFrame,
+    // One entry per transform, null for a transform whose plugin
+    // output could not be found
+    std::vector<Vamp::Plugin::OutputDescriptor *> m_descriptors;
+    std::vector<int> m_outputNos;
+
+    // Plugin input buffers, with the means of filling them, for a
+    // single processing thread.  Defined in the .cpp file
+    struct BlockInput;
+
+    BlockInput *createBlockInput(size_t channelCount, size_t blockSize,
+                                 bool inlineFFT, bool shareReads);
+    void deleteBlockInput(BlockInput *);
+    void readBlock(BlockInput *, long blockFrame, long startFrame,
+                   size_t stepSize);
+
+    // A run divided into segments that are processed in parallel by
+    // separate plugin instances, if the user has enabled that in the
+    // preferences.  Only outputs that return exactly one feature per
+    // process block and have no longer-term state give the same
+    // results as a sequential run: each segment begins a few blocks
+    // early, to let the plugin settle, and the features from those
+    // blocks are discarded.  Defined in the .cpp file
+    struct SegmentedRun;
+
+    class SegmentWorker : public Thread
+    {
+    public:
+        SegmentWorker(FeatureExtractionModelTransformer *transformer,
+                      SegmentedRun *run, Vamp::Plugin *plugin,
+                      BlockInput *input) :
+            m_transformer(transformer), m_run(run),
+            m_plugin(plugin), m_input(input) { }
+        BlockInput *getInput() { return m_input; }
+    protected:
+        virtual void run();
+        FeatureExtractionModelTransformer *m_transformer;
+        SegmentedRun *m_run;
+        Vamp::Plugin *m_plugin;
+        BlockInput *m_input;
+    };
+
+    bool canRunInSegments() const;
+    int getSegmentCount(long blockCount, int threads) const;
+    bool runInSegments(size_t channelCount, size_t stepSize,
+                       size_t blockSize, bool inlineFFT,
+                       long contextStart, long blockCount);
+    void processSegments(SegmentedRun *, Vamp::Plugin *, BlockInput *);
+    void keepFeatures(const Vamp::Plugin::FeatureSet &features,
+                      Vamp::Plugin::FeatureSet &kept) const;
+
+    static const int MaxThreads = 8;
+    static const int SegmentsPerThread = 4;
+    static const long WarmUpBlocks = 32;
+    static const long MinSegmentBlocks = 512;
+    static const long MaxSegmentBlocks = 8192;
+
+    // Features not yet passed to the output models, one entry per
+    // output.  They are handed over in batches, which is much cheaper
+    // than adding them one at a time.  Defined in the .cpp file
+    struct PendingFeatures;
+    std::vector<PendingFeatures *> m_pending;
+
+    static const size_t MaxPendingFeatures = 4096;
+
+    void createOutputModel(int n);
+
+    // Pass the features returned for one block to their output
+    // models, taking the output mutex
+    void addFeatures(long blockFrame, Vamp::Plugin::FeatureSet &features);
+
+    void addFeature(int n,
+                    size_t blockFrame,
 		    const Vamp::Plugin::Feature &feature);
 
-    void setCompletion(int);
+    void flushFeatures(int n);
+
+    void setCompletion(int n, int completion);
+    void setCompletion(int completion); // all outputs
 
-    void getFrames(int channelCount, long startFrame, long size,
+    void getFrames(SharedAudioReader *reader, int readerClient,
+                   int channelCount, long startFrame, long size,
                    float **buffer);
 
     // just casts
 
     DenseTimeValueModel *getConformingInput();
 
-    template <typename ModelClass> bool isOutput() {
-        return dynamic_cast<ModelClass *>(m_output) != 0;
+    template <typename ModelClass> bool isOutput(int n) {
+        return dynamic_cast<ModelClass *>(m_outputs[n]) != 0;
     }
 
-    template <typename ModelClass> ModelClass *getConformingOutput() {
-	ModelClass *mc = dynamic_cast<ModelClass *>(m_output);
+    template <typename ModelClass> ModelClass *getConformingOutput(int n) {
+	ModelClass *mc = dynamic_cast<ModelClass *>(m_outputs[n]);
 	if (!mc) {
 	    std::cerr << "FeatureExtractionModelTransformer::getOutput: Output model not conformable" << std::endl;
 	}
@@ -15,10 +15,19 @@
 
 #include "ModelTransformer.h"
 
+#include <QMutexLocker>
+
 ModelTransformer::ModelTransformer(Input input, const Transform &transform) :
-    m_transform(transform),
     m_input(input),
-    m_output(0),
+    m_detached(false),
+    m_abandoned(false)
+{
+    m_transforms.push_back(transform);
+}
+
+ModelTransformer::ModelTransformer(Input input, const Transforms &transforms) :
+    m_transforms(transforms),
+    m_input(input),
     m_detached(false),
     m_abandoned(false)
 {
@@ -28,6 +37,24 @@ ModelTransformer::~ModelTransformer()
 {
     m_abandoned = true;
     wait();
-    if (!m_detached) delete m_output;
+    if (!m_detached) {
+        for (size_t i = 0; i < m_outputs.size(); ++i) {
+            delete m_outputs[i];
+        }
+    }
 }
 
+bool
+ModelTransformer::removeOutputModel(Model *model)
+{
+    QMutexLocker locker(&m_outputMutex);
+
+    bool remaining = false;
+
+    for (size_t i = 0; i < m_outputs.size(); ++i) {
+        if (m_outputs[i] == model) m_outputs[i] = 0;
+        else if (m_outputs[i]) remaining = true;
+    }
+
+    return remaining;
+}
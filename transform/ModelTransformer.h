@@ -22,6 +22,10 @@
 
 #include "Transform.h"
 
+#include <QMutex>
+
+#include <vector>
+
 /**
  * A ModelTransformer turns one data model into another.
  *
@@ -75,19 +79,51 @@ public:
      */
     int getInputChannel() { return m_input.getChannel(); }
 
+    typedef std::vector<Model *> Models;
+
+    /**
+     * Return the set of output models created by the transform, one
+     * for each of the transforms it was constructed with and in the
+     * same order.  An entry is a null model if the transformer could
+     * not produce that output; if the transform could not be
+     * initialised at all, every entry is null and an error message
+     * may be available via getMessage().
+     */
+    Models getOutputModels() { return m_outputs; }
+
+    /**
+     * Return the set of output models, also detaching them from the
+     * transformer so that they will not be deleted when the
+     * transformer is.  The caller takes ownership of the models.
+     */
+    Models detachOutputModels() { m_detached = true; return m_outputs; }
+
+    /**
+     * Stop producing the given output model, which is about to be
+     * deleted, while carrying on with any others.  The model's entry
+     * in the output set becomes null.  Return true if any non-null
+     * outputs remain; if none do, the caller should abandon the
+     * transformer instead.  The model must have been detached.
+     */
+    virtual bool removeOutputModel(Model *model);
+
     /**
-     * Return the output model created by the transform.  Returns a
-     * null model if the transform could not be initialised; an error
-     * message may be available via getMessage() in this situation.
+     * Return the first (usually the only) output model created by the
+     * transform, or a null model if there is none.
      */
-    Model *getOutputModel() { return m_output; }
+    Model *getOutputModel() {
+        return m_outputs.empty() ? 0 : m_outputs[0];
+    }
 
     /**
-     * Return the output model, also detaching it from the transformer
-     * so that it will not be deleted when the transformer is.  The
-     * caller takes ownership of the model.
+     * Return the first output model, also detaching all outputs from
+     * the transformer.  Only appropriate for a transformer that was
+     * constructed with a single transform.
      */
-    Model *detachOutputModel() { m_detached = true; return m_output; }
+    Model *detachOutputModel() {
+        m_detached = true;
+        return getOutputModel();
+    }
 
     /**
      * Return a warning or error message.  If getOutputModel returned
@@ -99,11 +135,13 @@ public:
 
 protected:
     ModelTransformer(Input input, const Transform &transform);
+    ModelTransformer(Input input, const Transforms &transforms);
 
-    Transform m_transform;
+    Transforms m_transforms;
     Input m_input; // I don't own the model in this
-    Model *m_output; // I own this, unless...
+    Models m_outputs; // I own these, unless...
     bool m_detached; // ... this is true.
+    QMutex m_outputMutex; // held by the processing thread while writing outputs
     bool m_abandoned;
     QString m_message;
 };
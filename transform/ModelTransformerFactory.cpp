@@ -316,30 +316,32 @@ ModelTransformerFactory::getConfigurationForTransform(Transform &transform,
 }
 
 ModelTransformer *
-ModelTransformerFactory::createTransformer(const Transform &transform,
+ModelTransformerFactory::createTransformer(const Transforms &transforms,
                                            const ModelTransformer::Input &input)
 {
     ModelTransformer *transformer = 0;
 
-    QString id = transform.getPluginIdentifier();
+    if (transforms.empty()) return transformer;
+
+    QString id = transforms[0].getPluginIdentifier();
 
     if (FeatureExtractionPluginFactory::instanceFor(id)) {
 
         transformer =
-            new FeatureExtractionModelTransformer(input, transform);
+            new FeatureExtractionModelTransformer(input, transforms);
 
     } else if (RealTimePluginFactory::instanceFor(id)) {
 
         transformer =
-            new RealTimeEffectModelTransformer(input, transform);
+            new RealTimeEffectModelTransformer(input, transforms[0]);
 
     } else {
         std::cerr << "ModelTransformerFactory::createTransformer: Unknown transform \""
-                  << transform.getIdentifier().toStdString() << "\"" << std::endl;
+                  << transforms[0].getIdentifier().toStdString() << "\"" << std::endl;
         return transformer;
     }
 
-    if (transformer) transformer->setObjectName(transform.getIdentifier());
+    if (transformer) transformer->setObjectName(transforms[0].getIdentifier());
     return transformer;
 }
 
@@ -348,39 +350,101 @@ ModelTransformerFactory::transform(const Transform &transform,
                                    const ModelTransformer::Input &input,
                                    QString &message)
 {
-    std::cerr << "ModelTransformerFactory::transform: Constructing transformer with input model " << input.getModel() << std::endl;
+    Transforms transforms;
+    transforms.push_back(transform);
 
-    ModelTransformer *t = createTransformer(transform, input);
-    if (!t) return 0;
+    ModelTransformer::Models models =
+        transformMultiple(transforms, input, message);
 
-    connect(t, SIGNAL(finished()), this, SLOT(transformerFinished()));
+    if (models.empty()) return 0;
+    return models[0];
+}
 
-    m_runningTransformers.insert(t);
+ModelTransformer::Models
+ModelTransformerFactory::transformMultiple(const Transforms &transforms,
+                                           const ModelTransformer::Input &input,
+                                           QString &message)
+{
+    std::cerr << "ModelTransformerFactory::transformMultiple: Constructing transformers for " << transforms.size() << " transform(s) with input model " << input.getModel() << std::endl;
 
-    t->start();
-    Model *model = t->detachOutputModel();
+    ModelTransformer::Models models(transforms.size(), (Model *)0);
+    std::vector<bool> assigned(transforms.size(), false);
 
-    if (model) {
-        QString imn = input.getModel()->objectName();
-        QString trn =
-            TransformFactory::getInstance()->getTransformFriendlyName
-            (transform.getIdentifier());
-        if (imn != "") {
-            if (trn != "") {
-                model->setObjectName(tr("%1: %2").arg(imn).arg(trn));
-            } else {
-                model->setObjectName(imn);
+    for (size_t i = 0; i < transforms.size(); ++i) {
+
+        if (assigned[i]) continue;
+
+        // Feature extraction transforms that differ only in plugin
+        // output can all be obtained from one run of the plugin, so
+        // gather them up and hand them to a single transformer
+
+        Transforms group;
+        std::vector<size_t> indices;
+
+        group.push_back(transforms[i]);
+        indices.push_back(i);
+        assigned[i] = true;
+
+        if (FeatureExtractionPluginFactory::instanceFor
+            (transforms[i].getPluginIdentifier())) {
+            for (size_t j = i + 1; j < transforms.size(); ++j) {
+                if (assigned[j]) continue;
+                if (FeatureExtractionModelTransformer::areTransformsSimilar
+                    (transforms[i], transforms[j])) {
+                    group.push_back(transforms[j]);
+                    indices.push_back(j);
+                    assigned[j] = true;
+                }
             }
-        } else if (trn != "") {
-            model->setObjectName(trn);
         }
-    } else {
-        t->wait();
-    }
 
-    message = t->getMessage();
+        ModelTransformer *t = createTransformer(group, input);
+        if (!t) continue;
+
+        connect(t, SIGNAL(finished()), this, SLOT(transformerFinished()));
+
+        m_runningTransformers.insert(t);
+
+        t->start();
+        ModelTransformer::Models outputs = t->detachOutputModels();
+
+        bool haveOutput = false;
 
-    return model;
+        for (size_t k = 0; k < indices.size(); ++k) {
+
+            Model *model = (k < outputs.size() ? outputs[k] : 0);
+            models[indices[k]] = model;
+            if (!model) continue;
+
+            haveOutput = true;
+
+            QString imn = input.getModel()->objectName();
+            QString trn =
+                TransformFactory::getInstance()->getTransformFriendlyName
+                (transforms[indices[k]].getIdentifier());
+            if (imn != "") {
+                if (trn != "") {
+                    model->setObjectName(tr("%1: %2").arg(imn).arg(trn));
+                } else {
+                    model->setObjectName(imn);
+                }
+            } else if (trn != "") {
+                model->setObjectName(trn);
+            }
+        }
+
+        if (!haveOutput) {
+            t->wait();
+        }
+
+        QString tm = t->getMessage();
+        if (tm != "") {
+            if (message != "") message = QString("%1; %2").arg(message).arg(tm);
+            else message = tm;
+        }
+    }
+
+    return models;
 }
 
 void
@@ -419,8 +483,20 @@ ModelTransformerFactory::modelAboutToBeDeleted(Model *m)
 
         ModelTransformer *t = *i;
 
-        if (t->getInputModel() == m || t->getOutputModel() == m) {
+        if (t->getInputModel() == m) {
             affected.insert(t);
+            continue;
+        }
+
+        // A transformer with several outputs carries on producing the
+        // others; it is only abandoned once it has none left
+
+        ModelTransformer::Models outputs = t->getOutputModels();
+        for (size_t j = 0; j < outputs.size(); ++j) {
+            if (outputs[j] == m) {
+                if (!t->removeOutputModel(m)) affected.insert(t);
+                break;
+            }
         }
     }
 
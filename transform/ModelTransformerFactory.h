@@ -70,13 +70,32 @@ public:
                      const ModelTransformer::Input &input,
                      QString &message);
 
+    /**
+     * Return the output models resulting from applying the given
+     * transforms to the given input model, one for each transform in
+     * the same order.  An entry is 0 if its transform failed.
+     *
+     * Feature extraction transforms that differ only in which output
+     * of the plugin they use are obtained from a single run of the
+     * plugin, so it is much cheaper to request several outputs of one
+     * plugin together than to call transform() for each in turn.
+     *
+     * As with transform(), the models are returned immediately and
+     * may still be in the process of being filled.  Any errors or
+     * warnings are concatenated in message.  The returned models are
+     * owned by the caller.
+     */
+    ModelTransformer::Models transformMultiple(const Transforms &transforms,
+                                               const ModelTransformer::Input &input,
+                                               QString &message);
+
 protected slots:
     void transformerFinished();
 
     void modelAboutToBeDeleted(Model *);
 
 protected:
-    ModelTransformer *createTransformer(const Transform &transform,
+    ModelTransformer *createTransformer(const Transforms &transforms,
                                         const ModelTransformer::Input &input);
 
     typedef std::map<TransformId, QString> TransformerConfigurationMap;
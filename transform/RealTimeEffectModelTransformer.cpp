@@ -41,7 +41,7 @@ RealTimeEffectModelTransformer::RealTimeEffectModelTransformer(Input in,
 
     QString pluginId = transform.getPluginIdentifier();
 
-    if (!m_transform.getBlockSize()) m_transform.setBlockSize(1024);
+    if (!m_transforms[0].getBlockSize()) m_transforms[0].setBlockSize(1024);
 
 //    std::cerr << "RealTimeEffectModelTransformer::RealTimeEffectModelTransformer: plugin " << pluginId.toStdString() << ", output " << output << std::endl;
 
@@ -59,7 +59,7 @@ RealTimeEffectModelTransformer::RealTimeEffectModelTransformer(Input in,
 
     m_plugin = factory->instantiatePlugin(pluginId, 0, 0,
                                           input->getSampleRate(),
-                                          m_transform.getBlockSize(),
+                                          m_transforms[0].getBlockSize(),
                                           input->getChannelCount());
 
     if (!m_plugin) {
@@ -68,7 +68,7 @@ RealTimeEffectModelTransformer::RealTimeEffectModelTransformer(Input in,
 	return;
     }
 
-    TransformFactory::getInstance()->setPluginParameters(m_transform, m_plugin);
+    TransformFactory::getInstance()->setPluginParameters(m_transforms[0], m_plugin);
 
     if (m_outputNo >= 0 &&
         m_outputNo >= int(m_plugin->getControlOutputCount())) {
@@ -86,16 +86,16 @@ RealTimeEffectModelTransformer::RealTimeEffectModelTransformer(Input in,
         WritableWaveFileModel *model = new WritableWaveFileModel
             (input->getSampleRate(), outputChannels);
 
-        m_output = model;
+        m_outputs.push_back(model);
 
     } else {
 	
         SparseTimeValueModel *model = new SparseTimeValueModel
-            (input->getSampleRate(), m_transform.getBlockSize(), 0.0, 0.0, false);
+            (input->getSampleRate(), m_transforms[0].getBlockSize(), 0.0, 0.0, false);
 
         if (m_units != "") model->setScaleUnits(m_units);
 
-        m_output = model;
+        m_outputs.push_back(model);
     }
 }
 
@@ -127,8 +127,8 @@ RealTimeEffectModelTransformer::run()
     }
     if (m_abandoned) return;
 
-    SparseTimeValueModel *stvm = dynamic_cast<SparseTimeValueModel *>(m_output);
-    WritableWaveFileModel *wwfm = dynamic_cast<WritableWaveFileModel *>(m_output);
+    SparseTimeValueModel *stvm = dynamic_cast<SparseTimeValueModel *>(getOutputModel());
+    WritableWaveFileModel *wwfm = dynamic_cast<WritableWaveFileModel *>(getOutputModel());
     if (!stvm && !wwfm) return;
 
     if (stvm && (m_outputNo >= int(m_plugin->getControlOutputCount()))) return;
@@ -144,8 +144,8 @@ RealTimeEffectModelTransformer::run()
     long startFrame = m_input.getModel()->getStartFrame();
     long   endFrame = m_input.getModel()->getEndFrame();
     
-    RealTime contextStartRT = m_transform.getStartTime();
-    RealTime contextDurationRT = m_transform.getDuration();
+    RealTime contextStartRT = m_transforms[0].getStartTime();
+    RealTime contextDurationRT = m_transforms[0].getDuration();
 
     long contextStart =
         RealTime::realTime2Frame(contextStartRT, sampleRate);
@@ -0,0 +1,402 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "SharedAudioReader.h"
+
+#include "data/model/DenseTimeValueModel.h"
+
+#include "base/Profiler.h"
+
+#include <QMutexLocker>
+
+#include <iostream>
+#include <cstring>
+
+//#define DEBUG_SHARED_AUDIO_READER 1
+
+SharedAudioReader::ReaderMap
+SharedAudioReader::m_readers;
+
+QMutex
+SharedAudioReader::m_readersMutex;
+
+SharedAudioReader *
+SharedAudioReader::subscribe(const DenseTimeValueModel *model,
+                             int channel, size_t channelCount,
+                             int &client)
+{
+    QMutexLocker locker(&m_readersMutex);
+
+    Key key;
+    key.model = model;
+    key.channel = (channelCount == 1 ? channel : -1);
+    key.channelCount = channelCount;
+
+    SharedAudioReader *reader = 0;
+
+    ReaderMap::iterator i = m_readers.find(key);
+    if (i != m_readers.end()) {
+        reader = i->second;
+    } else {
+        reader = new SharedAudioReader(model, key.channel, channelCount);
+        m_readers[key] = reader;
+    }
+
+    ++reader->m_refcount;
+
+    QMutexLocker rlocker(&reader->m_mutex);
+    client = reader->m_nextClient++;
+    reader->m_clients[client] = 0;
+
+#ifdef DEBUG_SHARED_AUDIO_READER
+    std::cerr << "SharedAudioReader::subscribe: model " << model
+              << ", channel " << key.channel << ", channel count "
+              << channelCount << ": client " << client << " of "
+              << reader->m_refcount << std::endl;
+#endif
+
+    return reader;
+}
+
+void
+SharedAudioReader::release(SharedAudioReader *reader, int client)
+{
+    QMutexLocker locker(&m_readersMutex);
+
+    {
+        QMutexLocker rlocker(&reader->m_mutex);
+        reader->m_clients.erase(client);
+        reader->discardBlocks();
+        reader->discardSpectra();
+    }
+
+    if (--reader->m_refcount > 0) return;
+
+    for (ReaderMap::iterator i = m_readers.begin(); i != m_readers.end(); ++i) {
+        if (i->second == reader) {
+            m_readers.erase(i);
+            break;
+        }
+    }
+
+    delete reader;
+}
+
+SharedAudioReader::SharedAudioReader(const DenseTimeValueModel *model,
+                                     int channel, size_t channelCount) :
+    m_model(model),
+    m_channel(channel),
+    m_channelCount(channelCount),
+    m_nextClient(0),
+    m_refcount(0)
+{
+}
+
+SharedAudioReader::~SharedAudioReader()
+{
+    for (BlockMap::iterator i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+        deleteBlock(i->second);
+    }
+    for (SpectrumMap::iterator i = m_spectra.begin(); i != m_spectra.end(); ++i) {
+        deleteSpectrum(i->second);
+    }
+}
+
+size_t
+SharedAudioReader::readFromModel(size_t start, size_t count, float **buffers)
+{
+    if (m_channelCount == 1) {
+        return m_model->getData(m_channel, start, count, buffers[0]);
+    } else {
+        return m_model->getData(0, m_channelCount - 1, start, count, buffers);
+    }
+}
+
+size_t
+SharedAudioReader::getFrames(int client, size_t start, size_t count,
+                             float **buffers)
+{
+    Profiler profiler("SharedAudioReader::getFrames");
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_clients[client] = start;
+        discardBlocks();
+    }
+
+    size_t got = 0;
+
+    while (got < count) {
+
+        size_t frame = start + got;
+        Block *block = acquireBlock(frame / BlockFrames);
+
+        if (!block) {
+            // No room to cache it; go straight to the model for the
+            // rest of this request
+            float **bufs = new float *[m_channelCount];
+            for (size_t c = 0; c < m_channelCount; ++c) {
+                bufs[c] = buffers[c] + got;
+            }
+            got += readFromModel(frame, count - got, bufs);
+            delete[] bufs;
+            break;
+        }
+
+        size_t offset = frame - block->start;
+        size_t n = 0;
+        if (offset < block->count) {
+            n = block->count - offset;
+            if (n > count - got) n = count - got;
+            for (size_t c = 0; c < m_channelCount; ++c) {
+                memcpy(buffers[c] + got, block->data[c] + offset,
+                       n * sizeof(float));
+            }
+        }
+
+        bool atEnd = (block->count < BlockFrames);
+        releaseBlock(block);
+
+        got += n;
+        if (n == 0 || atEnd) break;
+    }
+
+    return got;
+}
+
+bool
+SharedAudioReader::getSpectrum(int client, int windowType, size_t blockSize,
+                               long frame, float **buffers)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_clients[client] = (frame > 0 ? size_t(frame) : 0);
+    discardSpectra();
+
+    SpectrumKey key;
+    key.windowType = windowType;
+    key.blockSize = blockSize;
+    key.frame = frame;
+
+    SpectrumMap::iterator i = m_spectra.find(key);
+
+    if (i != m_spectra.end()) {
+        Spectrum *spectrum = i->second;
+        ++spectrum->users;
+        while (!spectrum->ready) {
+            m_condition.wait(&m_mutex);
+        }
+        for (size_t c = 0; c < m_channelCount; ++c) {
+            memcpy(buffers[c], spectrum->data[c],
+                   (blockSize + 2) * sizeof(float));
+        }
+        --spectrum->users;
+        return true;
+    }
+
+    if (m_spectra.size() >= MaxSpectra) {
+
+        // As with blocks, drop the earliest one that is not being
+        // calculated, rather than let a slow client hold them all
+
+        SpectrumMap::iterator victim = m_spectra.end();
+        for (i = m_spectra.begin(); i != m_spectra.end(); ++i) {
+            if (i->second->ready && i->second->users == 0) {
+                victim = i;
+                break;
+            }
+        }
+        if (victim == m_spectra.end()) return false;
+
+        deleteSpectrum(victim->second);
+        m_spectra.erase(victim);
+    }
+
+    // Reserve it for the caller to calculate
+
+    Spectrum *spectrum = new Spectrum;
+    spectrum->data = new float *[m_channelCount];
+    for (size_t c = 0; c < m_channelCount; ++c) {
+        spectrum->data[c] = new float[blockSize + 2];
+    }
+    spectrum->ready = false;
+    spectrum->users = 0;
+    m_spectra[key] = spectrum;
+
+    return false;
+}
+
+void
+SharedAudioReader::putSpectrum(int, int windowType, size_t blockSize,
+                               long frame, float **buffers)
+{
+    QMutexLocker locker(&m_mutex);
+
+    SpectrumKey key;
+    key.windowType = windowType;
+    key.blockSize = blockSize;
+    key.frame = frame;
+
+    SpectrumMap::iterator i = m_spectra.find(key);
+    if (i == m_spectra.end()) return; // there was no room to cache it
+
+    Spectrum *spectrum = i->second;
+    if (spectrum->ready) return;
+
+    for (size_t c = 0; c < m_channelCount; ++c) {
+        memcpy(spectrum->data[c], buffers[c],
+               (blockSize + 2) * sizeof(float));
+    }
+    spectrum->ready = true;
+    m_condition.wakeAll();
+}
+
+SharedAudioReader::Block *
+SharedAudioReader::acquireBlock(size_t index)
+{
+    QMutexLocker locker(&m_mutex);
+
+    BlockMap::iterator i = m_blocks.find(index);
+
+    if (i != m_blocks.end()) {
+        Block *block = i->second;
+        ++block->users;
+        while (!block->ready) {
+            m_condition.wait(&m_mutex);
+        }
+        return block;
+    }
+
+    if (m_blocks.size() >= MaxBlocks) {
+
+        // Drop the earliest block nobody is reading from at the
+        // moment.  Some client may still want it, but we can't let
+        // one slow client hold the whole file in memory.
+
+        BlockMap::iterator victim = m_blocks.end();
+        for (i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+            if (i->second->users == 0 && i->second->ready) {
+                victim = i;
+                break;
+            }
+        }
+        if (victim == m_blocks.end()) return 0;
+
+        Block *block = victim->second;
+        deleteBlock(block);
+        m_blocks.erase(victim);
+    }
+
+    Block *block = new Block;
+    block->start = index * BlockFrames;
+    block->count = 0;
+    block->data = new float *[m_channelCount];
+    for (size_t c = 0; c < m_channelCount; ++c) {
+        block->data[c] = new float[BlockFrames];
+    }
+    block->ready = false;
+    block->users = 1;
+    m_blocks[index] = block;
+
+    // Read without the lock held, so that clients using other blocks
+    // can carry on; anyone else wanting this one waits for us
+
+    locker.unlock();
+    size_t count = readFromModel(block->start, BlockFrames, block->data);
+    locker.relock();
+
+#ifdef DEBUG_SHARED_AUDIO_READER
+    std::cerr << "SharedAudioReader: read block " << index << " ("
+              << count << " frames) for " << m_clients.size()
+              << " client(s)" << std::endl;
+#endif
+
+    block->count = count;
+    block->ready = true;
+    m_condition.wakeAll();
+
+    return block;
+}
+
+void
+SharedAudioReader::releaseBlock(Block *block)
+{
+    QMutexLocker locker(&m_mutex);
+    --block->users;
+}
+
+void
+SharedAudioReader::deleteBlock(Block *block)
+{
+    for (size_t c = 0; c < m_channelCount; ++c) {
+        delete[] block->data[c];
+    }
+    delete[] block->data;
+    delete block;
+}
+
+void
+SharedAudioReader::deleteSpectrum(Spectrum *spectrum)
+{
+    for (size_t c = 0; c < m_channelCount; ++c) {
+        delete[] spectrum->data[c];
+    }
+    delete[] spectrum->data;
+    delete spectrum;
+}
+
+size_t
+SharedAudioReader::getLowestClientFrame() const
+{
+    size_t lowest = m_clients.begin()->second;
+    for (ClientMap::const_iterator i = m_clients.begin();
+         i != m_clients.end(); ++i) {
+        if (i->second < lowest) lowest = i->second;
+    }
+    return lowest;
+}
+
+void
+SharedAudioReader::discardBlocks()
+{
+    if (m_clients.empty()) return;
+
+    size_t lowest = getLowestClientFrame();
+
+    while (!m_blocks.empty()) {
+        BlockMap::iterator i = m_blocks.begin();
+        Block *block = i->second;
+        if (block->start + BlockFrames > lowest) break;
+        if (block->users > 0 || !block->ready) break;
+        deleteBlock(block);
+        m_blocks.erase(i);
+    }
+}
+
+void
+SharedAudioReader::discardSpectra()
+{
+    if (m_clients.empty()) return;
+
+    long lowest = long(getLowestClientFrame());
+
+    while (!m_spectra.empty()) {
+        SpectrumMap::iterator i = m_spectra.begin();
+        if (i->first.frame + long(i->first.blockSize) > lowest) break;
+        if (!i->second->ready || i->second->users > 0) break;
+        deleteSpectrum(i->second);
+        m_spectra.erase(i);
+    }
+}
@@ -0,0 +1,175 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Sonic Visualiser
+    An audio file viewer and annotation editor.
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2010 QMUL.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef _SHARED_AUDIO_READER_H_
+#define _SHARED_AUDIO_READER_H_
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <map>
+
+class DenseTimeValueModel;
+
+/**
+ * Reads audio from a DenseTimeValueModel on behalf of several
+ * transformers that are working through the same model at the same
+ * time, so that each stretch of audio is retrieved from the model
+ * only once however many transformers are using it.
+ *
+ * Audio is read ahead in large blocks, which are kept until every
+ * client has moved past them (or until the cache is full, in which
+ * case the oldest unused block is dropped and a client that still
+ * wants it will cause it to be read again).  Clients are expected to
+ * read more or less sequentially, as feature extraction does.
+ *
+ * Frequency-domain transformers that calculate their own FFTs also
+ * share them through the reader.  The first client to want the
+ * spectrum of a given window calculates it and hands it back, and
+ * any other client wanting the same window (of the same shape and
+ * size) receives a copy instead of calculating it again.  Spectra
+ * are discarded in the same way as audio blocks.
+ *
+ * This class is thread safe.
+ */
+
+class SharedAudioReader
+{
+public:
+    /**
+     * Return the shared reader for the given model and channels,
+     * creating it if necessary, and register as a new client of it,
+     * returning the client id in client.  If channelCount is 1,
+     * channel is the channel to read, or -1 for the sum of all
+     * channels; otherwise channels 0 to channelCount-1 are read.
+     * Each call must be matched by a call to release().
+     */
+    static SharedAudioReader *subscribe(const DenseTimeValueModel *model,
+                                        int channel, size_t channelCount,
+                                        int &client);
+
+    /**
+     * Unregister the given client.  The reader is deleted when its
+     * last client is released.
+     */
+    static void release(SharedAudioReader *reader, int client);
+
+    /**
+     * Read count frames from start into the given buffers (one per
+     * channel), returning the number of frames obtained, as
+     * DenseTimeValueModel::getData would.  Also tell the reader that
+     * this client will not need any audio before start again.
+     */
+    size_t getFrames(int client, size_t start, size_t count,
+                     float **buffers);
+
+    /**
+     * Look for the spectrum of the window of the given type and size
+     * starting at frame, as blockSize/2+1 interleaved real and
+     * imaginary values per channel.  If another client has already
+     * calculated it, copy it into the given buffers and return true,
+     * waiting for it if the other client is still calculating it.
+     * Otherwise return false; the caller must then calculate the
+     * spectrum into buffers itself and pass it to putSpectrum.
+     */
+    bool getSpectrum(int client, int windowType, size_t blockSize,
+                     long frame, float **buffers);
+
+    /**
+     * Provide a spectrum calculated following a call to getSpectrum
+     * that returned false, for other clients to share.
+     */
+    void putSpectrum(int client, int windowType, size_t blockSize,
+                     long frame, float **buffers);
+
+protected:
+    SharedAudioReader(const DenseTimeValueModel *model,
+                      int channel, size_t channelCount);
+    virtual ~SharedAudioReader();
+
+    struct Block {
+        size_t start;
+        size_t count;
+        float **data;
+        bool ready;
+        int users;
+    };
+
+    struct SpectrumKey {
+        int windowType;
+        size_t blockSize;
+        long frame;
+        bool operator<(const SpectrumKey &k) const {
+            if (frame != k.frame) return frame < k.frame;
+            if (windowType != k.windowType) return windowType < k.windowType;
+            return blockSize < k.blockSize;
+        }
+    };
+
+    struct Spectrum {
+        float **data;
+        bool ready;
+        int users; // waiting to copy it
+    };
+
+    Block *acquireBlock(size_t index);
+    void releaseBlock(Block *block);
+    void deleteBlock(Block *block);
+    void deleteSpectrum(Spectrum *spectrum);
+    void discardBlocks(); // call with m_mutex held
+    void discardSpectra(); // call with m_mutex held
+    size_t getLowestClientFrame() const; // call with m_mutex held
+    size_t readFromModel(size_t start, size_t count, float **buffers);
+
+    const DenseTimeValueModel *m_model;
+    int m_channel;
+    size_t m_channelCount;
+
+    typedef std::map<size_t, Block *> BlockMap; // by block index
+    BlockMap m_blocks;
+
+    // ordered by frame, so the earliest are first
+    typedef std::map<SpectrumKey, Spectrum *> SpectrumMap;
+    SpectrumMap m_spectra;
+
+    typedef std::map<int, size_t> ClientMap; // client -> lowest frame
+    ClientMap m_clients;
+    int m_nextClient;
+    int m_refcount;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+
+    struct Key {
+        const DenseTimeValueModel *model;
+        int channel;
+        size_t channelCount;
+        bool operator<(const Key &k) const {
+            if (model != k.model) return model < k.model;
+            if (channel != k.channel) return channel < k.channel;
+            return channelCount < k.channelCount;
+        }
+    };
+
+    typedef std::map<Key, SharedAudioReader *> ReaderMap;
+    static ReaderMap m_readers;
+    static QMutex m_readersMutex;
+
+    static const size_t BlockFrames = 65536;
+    static const size_t MaxBlocks = 16;
+    static const size_t MaxSpectra = 1024;
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include <QString>
 
 #include <map>
+#include <vector>
 
 typedef QString TransformId;
 
@@ -196,5 +197,7 @@ protected:
     float m_sampleRate;
 };
 
+typedef std::vector<Transform> Transforms;
+
 #endif
 
@@ -1,6 +1,6 @@
 TEMPLATE = lib
 
-SV_UNIT_PACKAGES = vamp vamp-hostsdk
+SV_UNIT_PACKAGES = vamp vamp-hostsdk fftw3f
 load(../prf/sv.prf)
 
 CONFIG += sv staticlib qt thread warn_on stl rtti exceptions
@@ -19,6 +19,7 @@ HEADERS += CSVFeatureWriter.h \
            FeatureWriter.h \
            FileFeatureWriter.h \
            RealTimeEffectModelTransformer.h \
+           SharedAudioReader.h \
            Transform.h \
            TransformDescription.h \
            TransformFactory.h \
@@ -28,6 +29,7 @@ SOURCES += CSVFeatureWriter.cpp \
            FeatureExtractionModelTransformer.cpp \
            FileFeatureWriter.cpp \
            RealTimeEffectModelTransformer.cpp \
+           SharedAudioReader.cpp \
            Transform.cpp \
            TransformFactory.cpp \
            ModelTransformer.cpp \